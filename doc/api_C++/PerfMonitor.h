@@ -309,6 +309,17 @@ namespace pm_lib {
     void mergeThreads(int id);
 
 
+    ///  全測定区間のスレッド測定情報を一括してマスタースレッドに集約する。
+    ///
+    ///   @note 並列領域内で測定した区間がある場合は、parallel regionの内側から
+    ///		全スレッドが一回だけ呼び出す。区間別のバリアは不要で、全区間を
+    ///		一回のバリアで集約する。そうでない場合は逐次領域から呼び出す。
+    ///   @note  
+    ///  通常このAPIはPMlib内部で自動的に実行され、利用者が呼び出す必要はない。
+    ///
+    void mergeAllThreads(void);
+
+
     /// PMlibレポートの出力をコントロールする汎用ルーチン
     ///   @brief
     /// - [1] stop the Root section
@@ -411,7 +422,7 @@ namespace pm_lib {
     void printGroup(FILE* fp, MPI_Group p_group, MPI_Comm p_comm, int* pp_ranks, int group=0, int legend=0, int op_sort=0);
 
 
-    /// MPI communicatorから自動グループ化したMPIランク別詳細レポート、HWPC詳細レポートを出力
+    /// MPI communicatorから自動グループ化したグループ別の統計レポート、HWPC集計値を出力
     ///
     ///   @param[in] fp 出力ファイルポインタ
     ///   @param[in] p_comm   MPI_Comm型 MPI_Comm_split()で対応つけられたcommunicator
@@ -420,9 +431,32 @@ namespace pm_lib {
     ///   @param[in] legend int型 (省略可)HWPC記号説明の表示(0:なし、1:表示する)
     ///   @param[in] op_sort int型 (省略可)測定区間の表示順 (0:経過時間順、1:登録順)
     ///
+    ///   @note 全プロセスから呼び出す集団操作。グループはPMlibのcommunicatorを
+    ///   icolor, keyで分割して作り、グループ内のリダクションで集計する。
+    ///   ランク別の値が必要な場合はprintGroup()を用いる。
+    ///
     void printComm (FILE* fp, MPI_Comm p_comm, int icolor, int key, int legend=0, int op_sort=0);
 
 
+    /// 測定区間の前回呼び出し以降の時間を全プロセスまたは隣接プロセスと交換する
+    ///
+    ///   @param[in]  label  測定区間のラベル
+    ///   @param[in]  comm   交換するMPI communicator。
+    ///                      グラフ・直交トポロジを持つ場合は隣接プロセスのみと交換する
+    ///   @param[out] out    各プロセスの時間(秒)。commのプロセス数、
+    ///                      トポロジを持つ場合は入力側の隣接プロセス数の要素を用意する
+    ///
+    ///   @return  outに格納した値の数
+    ///
+    ///   @note commの全プロセスから呼び出す集団操作。一回のMPI_Allgatherまたは
+    ///   MPI_Neighbor_allgatherで交換する。値はこの区間の前回の呼び出しから
+    ///   今回までに測定された時間の増分で、測定途中の動的負荷分散に利用できる。
+    ///   この区間を定義していないプロセスの値は0となる。
+    ///   outの並びはcommのランク順、隣接交換の場合はMPIが定める入力側の隣接順。
+    ///
+    int exchangeSectionCost (const std::string& label, MPI_Comm comm, double* out);
+
+
     /// ポスト処理用traceファイルの出力
     ///
     /// @note プログラム実行中一回のみポスト処理用traceファイルを出力できる
@@ -515,6 +515,34 @@ void C_pm_printcomm (char* fc, MPI_Comm new_comm, int icolor, int key, int legen
 }
 
 
+/// PMlib C interface
+/// 測定区間の前回呼び出し以降の時間を全プロセスまたは隣接プロセスと交換する
+///
+///   @param[in] char*	fc	測定区間のラベル(character文字列)
+///   @param[in] MPI_Comm型 comm   交換するcommunicator
+///   @param[out] double*	out	各プロセスの時間(秒)
+///
+///   @return  outに格納した値の数
+///
+///   @note commがグラフ・直交トポロジを持つ場合は隣接プロセスの値のみを受け取る
+///
+int C_pm_exchangecost (char* fc, MPI_Comm comm, double* out)
+{
+	std::string s;
+	s=fc;
+#ifdef DEBUG_PRINT_MONITOR
+	//	fprintf(stderr, "<C_pm_exchangecost> fc=%s\n", s.c_str());
+#endif
+
+	if (s == "" ) {
+		fprintf(stderr, "<C_pm_exchangecost> argument fc is empty\n");
+		return 0;
+	}
+
+	return PM.exchangeSectionCost (s, comm, out);
+}
+
+
 /// PMlib C interface
 /// output OTF1 trace file for post processing
 ///
@@ -686,6 +714,20 @@ void C_pm_mergethreads (int id)
 }
 
 
+/// PMlib C interface
+///  全測定区間のスレッド情報を一括してマスタースレッドに集約する。
+///
+///		@note  通常このAPIはPMlib内部で自動的に実行され、利用者が呼び出す必要はない。
+///		@note 並列領域内で測定した区間がある場合は、parallel regionの内側から
+///			全スレッドが一回だけ呼び出す。
+///
+void C_pm_mergeallthreads (void)
+{
+	PM.mergeAllThreads();
+	return;
+}
+
+
 /// PMlib C interface
 /// @brief Power knob interface - Read the current value for the given power control knob
 ///
@@ -195,6 +195,16 @@ subroutine f_pm_mergethreads (id)
 end subroutine
 
 
+!> PMlib Fortran 全測定区間のスレッド情報を一括してマスタースレッドに集約する。
+!!
+!!  @note 通常このAPIはPMlib内部で自動的に実行され、利用者が呼び出す必要はない。
+!!  @note 並列領域内で測定した区間がある場合は、parallel regionの内側から
+!!  全スレッドが一回だけ呼び出す。測定区間ごとの並列領域やバリアは不要。
+!!
+subroutine f_pm_mergeallthreads ()
+end subroutine
+
+
 !> PMlib Fortran 測定結果のレポート出力をコントロール
 !!
 !!   @param[in] character*(*) fc	出力ファイル名(character文字列)
@@ -287,6 +297,20 @@ subroutine f_pm_printcomm (fc, new_comm, icolor, key, legend, psort)
 end subroutine
 
 
+!> PMlib Fortran 測定区間の前回呼び出し以降の時間を全プロセスまたは隣接プロセスと交換する
+!!
+!!   @param[in] character*(*)	fc	測定区間のラベル(character文字列)
+!!   @param[in] integer		comm   交換するMPI communicator
+!!   @param[out] real(kind=8)	out(*)	各プロセスの時間(秒)
+!!   @param[out] integer		nout	outに格納した値の数
+!!
+!!   @note  commの全プロセスから呼び出す集団操作
+!!   @note  commがグラフ・直交トポロジを持つ場合は隣接プロセスの値のみを受け取る
+!!
+subroutine f_pm_exchangecost (fc, comm, out, nout)
+end subroutine
+
+
 !> PMlib Fortran 測定途中経過レポートを出力（排他測定区間を対象とする）
 !!
 !!   @param[in] character*(*) fc	出力ファイル名(character文字列)
@@ -0,0 +1,63 @@
+//
+//	Benchmark of the report time versus the number of sections.
+//
+//	PerfMonitor::gather() exchanges the values of all sections with
+//	a single collective call. This program measures the elapsed time of
+//	gather() and report() for the given number of sections.
+//
+//	usage : mpirun -np <nprocs> ./a.out [number of sections] [repeat]
+//	        e.g. for n in 10 100 1000 10000 ; do mpirun -np 64 ./a.out $n ; done
+//
+#include <mpi.h>
+#include <PerfMonitor.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+pm_lib::PerfMonitor PM;
+
+int main (int argc, char *argv[])
+{
+	int my_id, npes;
+	int n_sections = 100;
+	int n_repeat = 10;
+	double t0, t_gather, t_report;
+
+	MPI_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_id);
+	MPI_Comm_size(MPI_COMM_WORLD, &npes);
+
+	if (argc > 1) n_sections = atoi(argv[1]);
+	if (argc > 2) n_repeat = atoi(argv[2]);
+
+	PM.initialize(n_sections+1);
+
+	for (int i=0; i<n_sections; i++) {
+		char label[32];
+		sprintf(label, "Section-%06d", i);
+		PM.start(label);
+		PM.stop (label, (double)i, 1);
+	}
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	t0 = MPI_Wtime();
+	for (int k=0; k<n_repeat; k++) {
+		PM.gather();
+	}
+	t_gather = (MPI_Wtime() - t0) / (double)n_repeat;
+
+	FILE *fp = fopen("/dev/null", "w");
+	MPI_Barrier(MPI_COMM_WORLD);
+	t0 = MPI_Wtime();
+	PM.report(fp);
+	t_report = MPI_Wtime() - t0;
+	fclose(fp);
+
+	if (my_id == 0) {
+		printf("processes=%d sections=%d  gather=%10.3e [sec]  report=%10.3e [sec]\n",
+			npes, n_sections, t_gather, t_report);
+	}
+
+	MPI_Finalize();
+	return 0;
+}
@@ -0,0 +1,82 @@
+//
+//	Sample of the interim statistics during the time step loop.
+//
+//	PerfMonitor::gatherStart() takes a snapshot of the local values and
+//	starts the non-blocking collectives, which overlap with the following
+//	time steps. The next print() reports the statistics of the snapshot
+//	without another chain of blocking collectives.
+//	This program compares the time spent in PMlib for the blocking mode
+//	(print() only) and the non-blocking mode (print() + gatherStart()).
+//
+//	usage : mpirun -np <nprocs> ./a.out [number of steps] [interval] [number of sections]
+//
+#include <mpi.h>
+#include <PerfMonitor.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+pm_lib::PerfMonitor PM;
+
+static double a[100000];
+
+static void compute (int n)
+{
+	for (int k=0; k<n; k++) {
+		for (int i=1; i<100000; i++) {
+			a[i] = 0.5 * (a[i-1] + a[i]) + 1.0e-6;
+		}
+	}
+}
+
+int main (int argc, char *argv[])
+{
+	int my_id, npes;
+	int n_steps = 1000;
+	int n_interval = 100;
+	int n_sections = 20;
+	double t0, t_pmlib[2];
+
+	MPI_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_id);
+	MPI_Comm_size(MPI_COMM_WORLD, &npes);
+
+	if (argc > 1) n_steps = atoi(argv[1]);
+	if (argc > 2) n_interval = atoi(argv[2]);
+	if (argc > 3) n_sections = atoi(argv[3]);
+
+	PM.initialize(n_sections+1);
+	FILE *fp = fopen("/dev/null", "w");
+
+	for (int mode=0; mode<2; mode++) {
+		t_pmlib[mode] = 0.0;
+		for (int step=1; step<=n_steps; step++) {
+			for (int i=0; i<n_sections; i++) {
+				char label[32];
+				sprintf(label, "Section-%03d", i);
+				PM.start(label);
+				compute(1 + my_id%2);
+				PM.stop (label, 1.0e5, 1);
+			}
+			(void) PM.gatherTest();	// progress the pending exchange, if any
+
+			if (step % n_interval == 0) {
+				t0 = MPI_Wtime();
+				PM.print(fp, "", "interim");
+				if (mode == 1) PM.gatherStart();
+				t_pmlib[mode] += MPI_Wtime() - t0;
+			}
+		}
+	}
+
+	if (my_id == 0) {
+		printf("processes=%d sections=%d steps=%d interval=%d\n", npes, n_sections, n_steps, n_interval);
+		printf("  time in PMlib reports : blocking %10.3e [sec]  non-blocking %10.3e [sec]\n",
+			t_pmlib[0], t_pmlib[1]);
+	}
+
+	PM.print(stdout, "", "final");
+	fclose(fp);
+	MPI_Finalize();
+	return 0;
+}
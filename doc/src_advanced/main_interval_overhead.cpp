@@ -0,0 +1,88 @@
+//
+//	Check that the interim record of PMLIB_INTERVAL is not counted in the
+//	time of the measured sections.
+//
+//	An empty section is started and stopped many times, first without and
+//	then with PMLIB_INTERVAL. The interval is set so short that the record
+//	is written at every start() and stop(). The time of the empty section
+//	is taken with exchangeSectionCost() on MPI_COMM_SELF, and the minimum
+//	of a few repetitions is used to damp the noise. The check fails
+//	if the time with PMLIB_INTERVAL exceeds the given ratio of the time
+//	without it, e.g. when the file output lands inside the section.
+//
+//	usage : mpirun -np <nprocs> ./a.out [number of calls] [ratio limit]
+//	        e.g. mpirun -np 2 ./a.out 20000 2.0
+//	@note  the interim records are written to pmlib_interval_check.*.csv
+//	       in the current directory, and are removed at the end.
+//	@note  registered as TEST_7 in example/CMakeLists.txt
+//
+#include <mpi.h>
+#include <PerfMonitor.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+//	time of the empty section measured by a new PerfMonitor instance
+static double measure_empty (int n_calls)
+{
+	double t_section = 0.0;
+	pm_lib::PerfMonitor* pm = new pm_lib::PerfMonitor;
+
+	pm->initialize(10);
+	for (int i=0; i<n_calls; i++) {
+		pm->start("Empty-section");
+		pm->stop ("Empty-section");
+	}
+	(void) pm->exchangeSectionCost("Empty-section", MPI_COMM_SELF, &t_section);
+
+	FILE *fp = fopen("/dev/null", "w");
+	pm->report(fp);
+	fclose(fp);
+	delete pm;
+	return t_section;
+}
+
+int main (int argc, char *argv[])
+{
+	int my_id, npes;
+	int n_calls = 20000;
+	double ratio_limit = 2.0;
+	const int n_repeat = 5;
+	double t_base = 0.0;
+	double t_interval = 0.0;
+	char filename[64];
+
+	MPI_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_id);
+	MPI_Comm_size(MPI_COMM_WORLD, &npes);
+
+	if (argc > 1) n_calls = atoi(argv[1]);
+	if (argc > 2) ratio_limit = atof(argv[2]);
+
+	setenv("PMLIB_INTERVAL_FILE", "pmlib_interval_check", 1);
+	for (int k=0; k<n_repeat; k++) {
+		unsetenv("PMLIB_INTERVAL");
+		double t = measure_empty(n_calls);
+		if (k == 0 || t < t_base) t_base = t;
+
+		setenv("PMLIB_INTERVAL", "1.0e-9", 1);
+		t = measure_empty(n_calls);
+		if (k == 0 || t < t_interval) t_interval = t;
+	}
+	unsetenv("PMLIB_INTERVAL");
+
+	snprintf(filename, sizeof(filename), "pmlib_interval_check.%06d.csv", my_id);
+	remove(filename);
+
+	double ratio = (t_base > 0.0) ? t_interval / t_base : 0.0;
+	int n_fail = (ratio > ratio_limit) ? 1 : 0;
+	MPI_Allreduce(MPI_IN_PLACE, &n_fail, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+
+	if (my_id == 0) {
+		printf("processes=%d calls=%d  empty section without=%10.3e  with PMLIB_INTERVAL=%10.3e [sec]  ratio=%6.2f\n",
+			npes, n_calls, t_base, t_interval, ratio);
+		printf("interim record is %s the measured time\n", (n_fail == 0)?"excluded from":"INCLUDED in");
+	}
+
+	MPI_Finalize();
+	return (n_fail == 0) ? 0 : 1;
+}
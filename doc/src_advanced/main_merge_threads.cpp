@@ -0,0 +1,98 @@
+//
+//	Benchmark of the thread merge time versus sections x threads.
+//
+//	All threads measure the given number of sections inside of a parallel
+//	region, and the thread values are merged into the master thread by
+//	  per-section : one parallel region and PerfMonitor::mergeThreads(id)
+//	                for each section, i.e. the former report() driver
+//	  single pass : one parallel region and PerfMonitor::mergeAllThreads()
+//	                for all sections
+//
+//	usage : mpirun -np <nprocs> ./a.out [number of sections] [repeat]
+//	        e.g. for n in 10 100 1000 ; do
+//	             for t in 1 2 4 8 ; do OMP_NUM_THREADS=$t ./a.out $n ; done ; done
+//
+#include <mpi.h>
+#include <PerfMonitor.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+// threadprivate declaration before the definition is a work around for g++
+// https://gcc.gnu.org/bugzilla/show_bug.cgi?id=27557
+extern pm_lib::PerfMonitor PM;
+#pragma omp threadprivate(PM)
+pm_lib::PerfMonitor PM;
+
+void measure_sections (int n_sections)
+{
+	#pragma omp parallel
+	{
+	for (int i=0; i<n_sections; i++) {
+		char label[32];
+		sprintf(label, "Section-%06d", i);
+		PM.start(label);
+		PM.stop (label, (double)i, 1);
+	}
+	}
+}
+
+int main (int argc, char *argv[])
+{
+	int my_id, npes, num_threads;
+	int n_sections = 100;
+	int n_repeat = 10;
+	int n_shared;
+	double t0, t_section, t_single;
+
+	MPI_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_id);
+	MPI_Comm_size(MPI_COMM_WORLD, &npes);
+
+	if (argc > 1) n_sections = atoi(argv[1]);
+	if (argc > 2) n_repeat = atoi(argv[2]);
+#ifdef _OPENMP
+	num_threads = omp_get_max_threads();
+#else
+	num_threads = 1;
+#endif
+
+	#pragma omp parallel
+	PM.initialize(n_sections+1);
+
+	t_section = 0.0;
+	t_single = 0.0;
+	for (int k=0; k<n_repeat; k++) {
+
+		// per-section merge
+		measure_sections (n_sections);
+		PM.countSections (n_shared);
+		t0 = MPI_Wtime();
+		for (int id=0; id<n_shared; id++) {
+			#pragma omp parallel
+			PM.mergeThreads (id);
+		}
+		t_section += MPI_Wtime() - t0;
+
+		// single pass merge
+		measure_sections (n_sections);
+		PM.countSections (n_shared);
+		t0 = MPI_Wtime();
+		#pragma omp parallel
+		PM.mergeAllThreads ();
+		t_single += MPI_Wtime() - t0;
+	}
+	t_section /= (double)n_repeat;
+	t_single /= (double)n_repeat;
+
+	if (my_id == 0) {
+		printf("threads=%d sections=%d  per-section=%10.3e [sec]  single pass=%10.3e [sec]  speedup=%6.1f\n",
+			num_threads, n_sections, t_section, t_single, t_section/t_single);
+	}
+
+	MPI_Finalize();
+	return 0;
+}
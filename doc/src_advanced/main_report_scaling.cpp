@@ -0,0 +1,78 @@
+//
+//	Check that the report time grows near-linearly with the number of sections.
+//
+//	The number of sections is increased by 10 times from 1000 up to the
+//	given maximum. For each case a new PerfMonitor instance defines the
+//	sections, measures them once, and writes the report to /dev/null.
+//	The time per section of each case is compared with that of the first
+//	case. The check fails if the ratio exceeds the given limit, e.g.
+//	when some report path scales quadratically with the number of sections.
+//
+//	usage : mpirun -np <nprocs> ./a.out [max number of sections] [ratio limit]
+//	        e.g. mpirun -np 4 ./a.out 100000 4.0
+//	@note  each section takes about 20 KB per process
+//	@note  registered as TEST_6 in example/CMakeLists.txt with 10000 sections and the limit 4.0
+//
+#include <mpi.h>
+#include <PerfMonitor.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+int main (int argc, char *argv[])
+{
+	int my_id, npes;
+	int max_sections = 100000;
+	double ratio_limit = 4.0;
+	double t0, t_define, t_report, t_base = 0.0;
+	int n_fail = 0;
+
+	MPI_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_id);
+	MPI_Comm_size(MPI_COMM_WORLD, &npes);
+
+	if (argc > 1) max_sections = atoi(argv[1]);
+	if (argc > 2) ratio_limit = atof(argv[2]);
+
+	// The labels of the smaller case are reused by the larger case,
+	// so that the shared section map is common to all the cases.
+	for (int n_sections=1000; n_sections<=max_sections; n_sections*=10) {
+		pm_lib::PerfMonitor* pm = new pm_lib::PerfMonitor;
+
+		MPI_Barrier(MPI_COMM_WORLD);
+		t0 = MPI_Wtime();
+		pm->initialize(10);
+		for (int i=0; i<n_sections; i++) {
+			char label[32];
+			sprintf(label, "Section-%06d", i);
+			pm->start(label);
+			pm->stop (label, (double)i, 1);
+		}
+		t_define = MPI_Wtime() - t0;
+
+		FILE *fp = fopen("/dev/null", "w");
+		MPI_Barrier(MPI_COMM_WORLD);
+		t0 = MPI_Wtime();
+		pm->report(fp);
+		t_report = MPI_Wtime() - t0;
+		fclose(fp);
+		delete pm;
+
+		double t_per_section = (t_define + t_report) / (double)n_sections;
+		if (t_base == 0.0) t_base = t_per_section;
+		double ratio = t_per_section / t_base;
+		if (ratio > ratio_limit) n_fail++;
+
+		if (my_id == 0) {
+			printf("processes=%d sections=%7d  define=%10.3e  report=%10.3e [sec]  per section ratio=%6.2f  %s\n",
+				npes, n_sections, t_define, t_report, ratio, (ratio > ratio_limit)?"NG":"OK");
+		}
+	}
+
+	if (my_id == 0) {
+		printf("report time is %s\n", (n_fail == 0)?"near-linear":"NOT near-linear");
+	}
+
+	MPI_Finalize();
+	return (n_fail == 0) ? 0 : 1;
+}
@@ -24,6 +24,7 @@
 #include <cstdlib>
 #include <map>
 #include <list>
+#include <vector>
 
 #ifdef DISABLE_MPI
 #include "mpi_stubs.h"
@@ -36,6 +37,22 @@
 
 namespace pm_lib {
 
+  /// ノード別集計で保持するホスト名の長さ (PMLIB_GATHER=NODE)
+  const int Max_node_hostname = 64;
+
+  /// 1つのモニターのスレッド間で共有する区間の表
+  /// @note threadprivate のモニターを並列領域内で初期化した場合、
+  ///	チームの全スレッドのインスタンスが同じ表を参照する。
+  ///	別のモニターは別の表を持つ。
+  struct pmlib_shared_sections {
+	std::map<std::string, int > map_sections;	// section label and shared section ID
+	std::vector<std::string> section_labels;	// label of each shared section ID
+	std::vector<struct pmlib_thread_slots> thread_slots;	// reduction buffer of the thread merge
+	std::vector<int> slot_index;	// index of thread_slots for each shared section ID, or -1
+	int flight_slot;	// slot of the flight recorder rings (PMLIB_FLIGHT_RECORDER), or -1
+	int n_users;		// number of the monitors referring to this table. The last one deletes it
+  };
+
   /**
    * PerfMonitor クラス 計算性能測定を行うクラス関数と変数
    */
@@ -92,6 +109,7 @@ namespace pm_lib {
     bool is_PAPI_enabled;      ///< PMlibの対応動作可能フラグ:PAPI
     bool is_POWER_enabled;     ///< PMlibの対応動作可能フラグ:Power API
     bool is_OTF_enabled;       ///< PMlibの対応動作可能フラグ:OTF tracing 出力
+    bool is_clock_aligned;     ///< トレースの時刻をランク0にそろえるフラグ (PMLIB_TRACE, PMLIB_FLIGHT_RECORDER)
     bool is_Root_active;       ///< 背景区間(Root区間)の動作フラグ
     bool is_exclusive_construct; ///< 測定区間の重なり状態検出フラグ
 
@@ -100,21 +118,86 @@ namespace pm_lib {
     std::string env_str_hwpc;  /*!< 環境変数 HWPC_CHOOSERの値
       // {FLOPS| BANDWIDTH| VECTOR| CACHE| CYCLE| LOADSTORE| USER} */
     std::string env_str_report;  /*!< 環境変数 PMLIB_REPORTの値
-      // {BASIC| DETAIL| FULL} */
+      // {BASIC| DETAIL| FULL| TOPK} */
+    std::string env_str_report_format;  /*!< 環境変数 PMLIB_REPORT_FORMATの値
+      // {TEXT| JSON| CSV} */
+    std::string env_str_detail_file;  /*!< 環境変数 PMLIB_DETAIL_FILEの値
+      // 指定された場合、DETAIL/FULLレポートのランク別の表をMPI-IOでこのファイルに出力する */
+    std::string env_str_dump;  /*!< 環境変数 PMLIB_DUMPの値
+      // 指定された場合、report()は集団通信を行わずに各プロセスの測定値をバイナリファイルに出力する */
+    int m_topk;                /*!< 環境変数 PMLIB_TOPKの値
+      // PMLIB_REPORT=TOPKで区間毎に表示する最も遅い/速いプロセスの数 */
+    std::string env_str_gather;  /*!< 環境変数 PMLIB_GATHERの値
+      // {ALL| ROOT| NODE} */
+
+    MPI_Comm m_comm;           /*!< 測定対象のプロセス群のcommunicator
+      // @note 集約・統計・OTF出力の集団通信は全てこのcommunicator上で行う */
+
+    bool is_node_comm_ready;   ///< ノード内/ノード代表communicatorの作成済みフラグ
+    MPI_Comm m_comm_node;      ///< 同一ノード内のプロセスのcommunicator (PMLIB_GATHER=NODE)
+    MPI_Comm m_comm_leader;    ///< 各ノードの代表プロセス間のcommunicator (PMLIB_GATHER=NODE)
+    int num_nodes;             ///< ノード数
+    int num_process_on_node;   ///< 自ノードのプロセス数
+    int my_rank_on_node;       ///< 自ノード内のランク番号 (0:ノード代表プロセス)
+    char* m_node_hosts;        ///< ノード別ホスト名 [num_nodes][Max_node_hostname] (rank 0のみ)
+    double* m_node_stats;      /*!< ノード別集計値 (rank 0のみ)
+      // [num_nodes][m_nWatch][4] : プロセス数, 平均時間, 最大時間, 最大時間のランク */
 
     PerfWatch* m_watchArray;   /*!< 測定区間の配列
       // @note PerfWatchのインスタンスは全部で m_nWatch 生成される。<br>
       // m_watchArray[0] :PMlibが定義するRoot区間、<br>
       // m_watchArray[1 .. m_nWatch] :ユーザーが定義する各区間 */
 
+    struct pmlib_shared_sections* m_shared;  ///< スレッド間で共有する区間の表
+
     unsigned* m_order;         ///< 測定区間ソート用のリスト m_order[m_nWatch]
 
+    int* m_global_order;       /*!< 全プロセス共通の測定区間の並び m_global_order[m_nWatch]
+      // @note 全プロセス共通の区間番号 g に対応する自プロセスの区間番号。<br>
+      // 測定区間の登録順や有無がプロセス毎に異なる場合でも、
+      // reconcile_sections() により全プロセスで同じ区間の並びとなる。 */
+    int m_nGlobal;             ///< m_global_order[] の要素数
+
+    int m_interim_state;       ///< gatherStart()による途中集約の状態 (0:なし, 1:通信中)
+    bool is_interim_dirty;     ///< 途中集約の後で区間表の照合が必要なフラグ
+    bool is_interim_fresh;     ///< 完了した途中集約の結果が次のgather()で未使用のフラグ
+    bool is_interim_comm_ready;  ///< 途中集約用communicatorの作成済みフラグ
+    bool is_interim_persistent;  ///< 途中集約用の永続通信requestの作成済みフラグ
+    MPI_Comm m_comm_interim;   ///< 途中集約用communicator (m_commの複製)
+    MPI_Request m_interim_req[3];  /*!< 途中集約の通信request
+      // [0]:区間表の変更フラグ, [1]:測定値の集約, [2]:統計量のリダクション */
+    int m_interim_flag[2];     ///< 区間表の変更フラグ [0]:自プロセス, [1]:全プロセスの最大値
+    int m_interim_nsec;        ///< 途中集約の測定区間数
+    int m_interim_stride;      ///< 途中集約の1測定区間あたりの要素数
+    double* m_interim_sendbuf; ///< 途中集約の送信バッファ (スナップショット)
+    double* m_interim_recvbuf; ///< 途中集約の受信バッファ
+    pmlib_section_stats* m_interim_stats;  ///< 途中集約の統計量 [0..n-1]:送信, [n..2n-1]:受信
+
+    double m_interval;         ///< 環境変数 PMLIB_INTERVALの値 (秒)。0の場合は途中記録を出力しない
+    double m_interval_base;    ///< 途中記録の経過時間の起点 (initialize()の時刻)
+    double m_interval_next;    ///< 次に途中記録を出力する時刻
+    std::string env_str_interval_file;  ///< 環境変数 PMLIB_INTERVAL_FILEの値 (途中記録ファイル名の接頭辞)
+    FILE* m_interval_fp;       ///< 途中記録ファイル
+    std::vector<double> m_interval_last;  ///< 区間毎に前回の途中記録に出力した時間
+
+    struct pmlib_shm_header* m_shm;  ///< 共有メモリセグメントの先頭 (PMLIB_SHM)。NULLの場合は公開しない
+    std::string m_shm_name;    ///< 共有メモリセグメントのファイル名
+
+    double m_prom_interval;    ///< 環境変数 PMLIB_PROMETHEUS_INTERVALの値 (秒)。0の場合は出力しない
+    double m_prom_next;        ///< 次にPrometheus形式のファイルを出力する時刻
+    std::string env_str_prom_dir;  ///< 環境変数 PMLIB_PROMETHEUS_DIRの値 (出力ディレクトリ)
+
+    bool is_signal_dump;       ///< 環境変数 PMLIB_SIGNAL_DUMP によりシグナルでスナップショットを出力するか
+    int m_signal_seen;         ///< 出力済みのシグナルの受信回数
+    int m_signal_nfile;        ///< 出力したスナップショットファイルの数
+    std::string env_str_signal_file;  ///< 環境変数 PMLIB_SIGNAL_FILEの値 (スナップショットファイル名の接頭辞)
+
     std::map<std::string, int > m_map_sections; /// map of section name and ID
 
 
   public:
     /// コンストラクタ.
-    PerfMonitor() : my_rank(-1), m_watchArray(0) {
+    PerfMonitor() : my_rank(-1), m_watchArray(0), m_shared(NULL) {
 		#ifdef DEBUG_PRINT_MONITOR
 		//	if (my_rank == 0) {
 		fprintf(stderr, "<PerfMonitor> constructor \n");
@@ -135,6 +218,12 @@ namespace pm_lib {
 	}
  ***/
 
+    /// デストラクタ.
+    ///
+    /// @note スレッド間で共有する区間の表は、それを参照する最後のインスタンスが解放する。
+    ///
+    ~PerfMonitor();
+
 
     /// PMlibの内部初期化
     ///
@@ -150,6 +239,32 @@ namespace pm_lib {
     void initialize (int init_nWatch=100);
 
 
+    /// PMlibの内部初期化 (communicatorを指定する)
+    ///
+    /// 測定対象のプロセス群をcommunicator commに限定して初期化する。
+    /// 以降のランク番号、集約、統計、HWPC・電力情報の集計とOTF出力は
+    /// 全てcomm上で行われ、comm外のプロセスとは同期しない。
+    ///
+    /// @param[in] comm        測定対象のプロセス群のMPI communicator
+    /// @param[in] init_nWatch 最初に確保する測定区間数
+    ///
+    /// @note
+    /// 連成計算の各コンポーネントやアンサンブル計算の各メンバーが、
+    /// それぞれのcommunicator上で独立したタイミングでレポートを出力できる。
+    /// PerfMonitorのインスタンスをcommunicator毎に生成すること。
+    /// initialize(init_nWatch) は initialize(MPI_COMM_WORLD, init_nWatch) と同じ。
+    /// commはPMlibの使用中に解放しないこと。
+    ///
+    /// @code
+    ///   MPI_Comm_split(MPI_COMM_WORLD, member, my_id, &comm_member);
+    ///   PM.initialize(comm_member, 100);
+    ///   ...
+    ///   PM.report(fp);    // comm_memberの全プロセスで呼ぶ
+    /// @endcode
+    ///
+    void initialize (MPI_Comm comm, int init_nWatch);
+
+
     /// 測定区間とそのプロパティを設定.
     ///
     ///   @param[in] label 測定区間に与える名前の文字列
@@ -273,6 +388,38 @@ namespace pm_lib {
     void gather(void);
 
 
+    /// 全プロセスの測定途中経過の集約を開始する (non-blocking)
+    ///
+    /// @note  自プロセスの全測定区間の測定値のスナップショットを作成し、
+    ///       非同期の集団通信(MPI_Iallgather等, MPI-4では永続通信)を開始して直ちに戻る。
+    ///       集約はアプリの計算と並行して進み、gatherTest() または次の gather()
+    ///       (print()等のレポート出力を含む) で完了する。
+    ///       gatherStart() の後の最初の gather() は、新たな集約を行わずに
+    ///       この集約結果 (スナップショット作成時の測定値) を用いる。
+    /// @note  全プロセスが同じ順で呼び出す必要がある (集団的呼び出し)。
+    ///       スナップショット以降に作成された測定区間は、次回の集約から含まれる。
+    ///
+    /// @verbatim
+    ///   for (step=1; step<=nsteps; step++) {
+    ///     ...
+    ///     if (step % 1000 == 0) {
+    ///       PM.print(stdout, "", "");	// the values at the previous gatherStart()
+    ///       PM.gatherStart();
+    ///     }
+    ///   }
+    /// @endverbatim
+    ///
+    void gatherStart(void);
+
+
+    /// gatherStart() で開始した集約の進行を確認する
+    ///
+    /// @return  true : 集約が完了して統計値が更新された、または集約中ではない
+    ///          false : 集約は進行中
+    ///
+    bool gatherTest(void);
+
+
     /// Root区間をstop
     ///	@note
     ///		Stop the Root section, which means the end of PMlib stats recording
@@ -309,6 +456,18 @@ namespace pm_lib {
     void mergeThreads(int id);
 
 
+    ///  全測定区間のスレッド測定情報を一括してマスタースレッドに集約する。
+    ///
+    ///   @note 並列領域内で測定した区間がある場合は、parallel regionの内側から
+    ///		全スレッドが一回だけ呼び出す。区間別のバリアは不要で、全区間を
+    ///		一回のバリアで集約する。そうでない場合は逐次領域から呼び出す。
+    ///   @note countSections()の後で呼び出すこと。
+    ///   @note  
+    ///  通常このAPIはPMlib内部で自動的に実行され、利用者が呼び出す必要はない。
+    ///
+    void mergeAllThreads(void);
+
+
     /// PMlibレポートの出力をコントロールする汎用ルーチン
     ///   @brief
     /// - [1] stop the Root section
@@ -364,6 +523,7 @@ namespace pm_lib {
 	///   PMLIB_REPORT=DETAIL: MPIランク別に経過時間、頻度、HWPC統計情報の詳細レポートを出力する。
 	///   PMLIB_REPORT=FULL： BASICとDETAILのレポートに加えて、
 	///		各MPIランクが生成した各並列スレッド毎にHWPC統計情報の詳細レポートを出力する。
+	///   PMLIB_REPORT=TOPK： BASICレポートに加えて、区間毎に最も遅い/速いプロセスを出力する。
     ///   @note  
     ///  通常このAPIはPMlib内部で自動的に実行され、利用者が呼び出す必要はない。
     ///
@@ -400,6 +560,59 @@ namespace pm_lib {
     void printDetail(FILE* fp, int legend=0, int op_sort=0);
 
 
+    /// 区間毎に最も遅いk個と最も速いk個のプロセスのレポートを出力。
+    ///
+    ///   @param[in] fp       出力ファイルポインタ
+    ///   @param[in] k        表示するプロセスの数 (0の場合は環境変数PMLIB_TOPKの値、省略時5)
+    ///   @param[in] op_sort  測定区間の表示順 (0:経過時間順、1:登録順)
+    ///
+    ///   @note 全プロセスで呼び出すこと。
+    ///   各区間の(時間, ランク番号, ホスト名)の上位k個と下位k個をカスタムMPI_Opの
+    ///   MPI_Reduce 1回で求めるので、通信量と出力量はプロセス数に依存しない。
+    ///   printDetail()の全ランクの表の代わりに、遅いランクの特定に用いる。
+    ///
+    void printTopK(FILE* fp, int k=0, int op_sort=0);
+
+
+    /// MPIランク別(とスレッド別)の詳細な測定値を MPI-IO で一つのファイルに出力。
+    ///
+    ///   @param[in] filename      出力ファイル名
+    ///   @param[in] with_threads  スレッド別の行も出力する (FULLレポート相当)
+    ///
+    ///   @note 全プロセスで呼び出すこと。各プロセスは自分の行を固定長の
+    ///   テキストに整形し、ランク0が書く索引ヘッダーの後ろの自分の位置に
+    ///   MPI_File_write_at_all 1回で書き込む。ランク0を経由しないので、
+    ///   出力時間と必要メモリはプロセス数に比例せず、並列ファイルシステムの
+    ///   帯域で決まる。ファイルの形式はヘッダーに記述される。
+    ///   行の位置 = header_bytes + (rank * rows_per_rank + row) * row_bytes
+    ///
+    void printDetailFile(const std::string filename, bool with_threads=false);
+
+
+    /// 測定結果を機械可読な形式(JSON, CSV)で出力。
+    ///
+    ///   @param[in] fp       出力ファイルポインタ
+    ///   @param[in] format   出力形式 "JSON" または "CSV"
+    ///
+    ///   @note 全プロセスで呼び出すこと。PMLIB_REPORT_FORMAT=json|csv の場合に
+    ///   テキストのレポートの代わりに出力される。内容はPMLIB_REPORTの指定に従い、
+    ///   区間別の統計量、ランク別の値、スレッド別の値、HWPCと電力の値、
+    ///   タイマーと実行環境の情報を含む。文書全体を保持せずに一回の走査で書き出す。
+    ///
+    void printStructured(FILE* fp, const std::string format);
+
+
+    /// 自プロセスの全測定区間の測定値をバイナリファイルに出力。
+    ///
+    ///   @param[in] prefix   出力ファイル名の接頭辞。ファイル名は prefix.RRRRRR.pmd
+    ///
+    ///   @note MPI通信を一切行わないので、各プロセスが独立に呼び出せる。
+    ///   スレッド別のHWPC値と電力値を含む区間の集計値を pmlib_dump.h の形式で出力する。
+    ///   BASIC/DETAIL/FULLレポートはツール pmlib-merge で全プロセスのファイルから作成する。
+    ///
+    void writeDump(const std::string prefix);
+
+
     /// 指定プロセスに対してスレッド別詳細レポートを出力。
     ///
     ///   @param[in] fp	       出力ファイルポインタ
@@ -435,7 +648,7 @@ namespace pm_lib {
     void printGroup(FILE* fp, MPI_Group p_group, MPI_Comm p_comm, int* pp_ranks, int group=0, int legend=0, int op_sort=0);
 
 
-    /// MPI communicatorから自動グループ化したMPIランク別詳細レポート、HWPC詳細レポートを出力
+    /// MPI communicatorから自動グループ化したグループ別の統計レポート、HWPC集計値を出力
     ///
     ///   @param[in] fp 出力ファイルポインタ
     ///   @param[in] p_comm   MPI_Comm型 MPI_Comm_split()で対応つけられたcommunicator
@@ -444,9 +657,33 @@ namespace pm_lib {
     ///   @param[in] legend int型 (省略可)HWPC記号説明の表示(0:なし、1:表示する)
     ///   @param[in] op_sort int型 (省略可)測定区間の表示順 (0:経過時間順、1:登録順)
     ///
+    ///   @note 全プロセスから呼び出す集団操作。グループはPMlibのcommunicatorを
+    ///   icolor, keyで分割して作り、グループ内のリダクションで集計する。
+    ///   ランク別の値が必要な場合はprintGroup()を用いる。
+    ///
     void printComm (FILE* fp, MPI_Comm p_comm, int icolor, int key, int legend=0, int op_sort=0);
 
 
+    /// 測定区間の前回呼び出し以降の時間を全プロセスまたは隣接プロセスと交換する
+    ///
+    ///   @param[in]  label  測定区間のラベル
+    ///   @param[in]  comm   交換するMPI communicator。
+    ///                      グラフ・直交トポロジを持つ場合は隣接プロセスのみと交換する
+    ///   @param[out] out    各プロセスの時間(秒)。commのプロセス数、
+    ///                      トポロジを持つ場合は入力側の隣接プロセス数の要素を用意する
+    ///
+    ///   @return  outに格納した値の数
+    ///
+    ///   @note commの全プロセスから呼び出す集団操作。一回のMPI_Allgatherまたは
+    ///   MPI_Neighbor_allgatherで交換する。値はこの区間の前回の呼び出しから
+    ///   今回までに測定された時間の増分で、測定途中の動的負荷分散に利用できる。
+    ///   この区間を定義していないプロセスの値は0となる。
+    ///   直交トポロジの境界でMPI_PROC_NULLとなる隣接プロセスの値も0となる。
+    ///   outの並びはcommのランク順、隣接交換の場合はMPIが定める入力側の隣接順。
+    ///
+    int exchangeSectionCost (const std::string& label, MPI_Comm comm, double* out);
+
+
     /// ポスト処理用traceファイルの出力
     ///
     /// @note プログラム実行中一回のみポスト処理用traceファイルを出力できる
@@ -542,6 +779,97 @@ namespace pm_lib {
     ///    各測定区間のHWPCイベントの統計値を取得する。
     void gather_and_stats(void);
 
+    /// 全プロセスの測定区間の表を照合し、共通の区間番号を作成する
+    ///
+    ///   @note  測定区間ラベルのハッシュ値を全プロセスで照合する。
+    ///    他のプロセスだけが持つ測定区間は、測定値ゼロの区間として自プロセスに追加される。
+    ///    全プロセスの区間の並びが既に一致している場合はMPI_Allreduce 1回だけで終了する。
+    ///
+    void reconcile_sections(void);
+
+    /// gatherStart() で開始した集約の完了を待つ
+    ///
+    void gatherWait(void);
+
+    /// 完了した途中集約の結果から各測定区間の統計値を作成する
+    ///
+    void interim_apply(void);
+
+    /// 途中集約のバッファと永続通信requestを解放する
+    ///
+    void interim_free(void);
+
+    /// PMLIB_INTERVALの間隔で自プロセスの測定値の途中記録を出力する
+    ///
+    ///   @param[in] is_final  間隔によらず出力し、ファイルを閉じる (report()から呼ぶ)
+    ///
+    ///   @note  start()/stop()から呼ばれ、前回の出力から間隔が経過していれば
+    ///    測定区間を止めずに現在の測定値を記録する。集団通信は行わない。
+    ///
+    void writeInterval(bool is_final=false);
+
+    /// シグナル受信後に自プロセスの測定値のスナップショットを出力する (PMLIB_SIGNAL_DUMP)
+    ///
+    void writeSignalDump(void);
+
+    /// 自プロセスの測定値をPrometheusのテキスト形式で出力する (PMLIB_PROMETHEUS_DIR)
+    ///
+    ///   @param[in] is_final  間隔によらず出力し、以後は出力しない (report()から呼ぶ)
+    ///
+    void writePrometheus(bool is_final=false);
+
+    /// PMLIB_SIGNAL_DUMP のシグナルハンドラを登録する
+    ///
+    ///   @param[in] signum  シグナル番号
+    ///
+    ///   @return  登録できた場合true
+    ///
+    bool installSignalDump(int signum);
+
+    /// PMLIB_SIGNAL_DUMP のシグナルハンドラの登録を解除する
+    ///
+    void restoreSignalDump(void);
+
+    /// 実行中の測定値を公開する共有メモリセグメントを作成する (PMLIB_SHM)
+    ///
+    ///   @note  /dev/shm/pmlib.PID.N を作成してマップする。作成できない場合は公開しない
+    ///
+    void openShm(void);
+
+    /// 測定区間の現在の測定値を共有メモリセグメントに書き込む
+    ///
+    ///   @param[in] id  測定区間の番号
+    ///
+    void publishShm(int id);
+
+    /// 共有メモリセグメントを削除する
+    ///
+    void closeShm(void);
+
+    /// ノード内communicatorとノード代表プロセス間communicatorを作成する
+    ///
+    ///   @note  PMLIB_GATHER=NODE の場合に最初のgather_and_stats()から1回だけ呼ばれる。
+    ///
+    void setupNodeComm(void);
+
+    /// スレッド間で共有する区間の表の参照をやめ、最後の利用者であれば解放する
+    ///
+    void releaseShared(void);
+
+    /// setupNodeComm()で作成したcommunicatorとノード別の表を解放する
+    ///
+    ///   @note  selectReport()の終わりに呼ばれる。次のgather_and_stats()で再び作成される。
+    ///
+    void freeNodeComm(void);
+
+    /// ノード内共有メモリとノード代表プロセス間リダクションによる2段階の集約
+    ///
+    ///   @param[in] sendbuf  自プロセスの全測定区間の測定値 [row_len]
+    ///   @param[in] row_len  1プロセスあたりの要素数
+    ///   @param[in] stride   1測定区間あたりの要素数
+    ///
+    void gatherNodeStats(double* sendbuf, int row_len, int stride);
+
     /// 経過時間でソートした測定区間のリストm_order[m_nWatch] を作成する。
     ///
     void sort_m_order(void);
@@ -616,6 +944,38 @@ namespace pm_lib {
 	void printBasicPower(FILE* fp, int maxLabelLen, int op_sort=0);
 
 
+	/// Report the distribution of the section time across the processes
+	///
+	///   @param[in] fp         report file pointer
+	///   @param[in] maxLabelLen    maximum label field string length
+    ///   @param[in] op_sort     sorting option (0:sorted by seconds, 1:listed order)
+	///
+	///		@note	min, median, p90, p99, max and the rank of max are taken from
+	///				the merged summary PerfWatch::m_stats
+	///
+	void printBasicDistribution(FILE* fp, int maxLabelLen, int op_sort=0);
+
+
+	/// Report the per node aggregates of the Root section
+	///
+	///   @param[in] fp         report file pointer
+	///   @param[in] maxLabelLen    maximum label field string length
+	///
+	///		@note	only for PMLIB_GATHER=NODE
+	///
+	void printBasicNodes(FILE* fp, int maxLabelLen);
+
+
+	/// Report the per node aggregates of all sections
+	///
+	///   @param[in] fp         report file pointer
+    ///   @param[in] op_sort     sorting option (0:sorted by seconds, 1:listed order)
+	///
+	///		@note	only for PMLIB_GATHER=NODE
+	///
+	void printDetailNodes(FILE* fp, int op_sort=0);
+
+
     /// PerfMonitorクラス用エラーメッセージ出力
     ///
     ///   @param[in] func  関数名
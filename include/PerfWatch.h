@@ -37,6 +37,10 @@
 #include "pmlib_papi.h"
 #include "pmlib_power.h"
 #include "pmlib_otf.h"
+#include "pmlib_stats.h"
+#include "pmlib_shm.h"
+#include "pmlib_flight.h"
+#include "pmlib_trace.h"
 
 #ifndef _WIN32
 #include <sys/time.h>
@@ -53,6 +57,42 @@ namespace pm_lib {
 //	((void)printf("exit at %s:%u\n", __FILE__, __LINE__), exit((x)))
 
 
+  /// 全PerfMonitorインスタンスが共有するハードウェア情報のコンテキスト
+  ///
+  /// @note HWPC(PAPI)のイベント表、CPUクロック、Power APIのcontextは
+  ///	プロセス内で一つだけ存在する。各PerfMonitorのRoot区間は初期化時に
+  ///	このコンテキストに接続し、最初の接続でPAPIとPower APIの初期化を行い、
+  ///	最後の切断で解放する。複数のPerfMonitorが独立した測定区間と
+  ///	レポートを持ちながら、PAPIの初期化は重複しない。
+  ///
+  struct pmlib_hw_context {
+	int ref_count;				// number of the attached PerfMonitor instances
+	bool is_hwpc_ready;			// HWPC interface has been initialized
+	bool is_power_ready;		// Power API contexts have been initialized
+	int num_power;				// number of the initialized power objects
+	struct pmlib_papi_chooser papi;
+	struct hwpc_group_chooser hwpc_group;
+	double cpu_clock_freq;		// processor clock frequency, i.e. Hz
+	double second_per_cycle;	// real time to take each cycle
+	struct pmlib_power_chooser power;
+  };
+
+  extern struct pmlib_hw_context hw_context;
+
+
+  /// スレッド集約用の測定区間別リダクションバッファ
+  ///
+  /// @note 並列領域内で測定した区間のスレッド別の値を、各スレッドが自分の行に
+  ///	書き込み、マスタースレッドがまとめて読み出す。行ごとに書き手が異なるため
+  ///	全測定区間を一回のバリアで集約できる。
+  ///
+  struct pmlib_thread_slots {
+	bool written[Max_nthreads];		// the row has been written by the thread
+	long long th_accumu[Max_nthreads][Max_chooser_events];
+	double th_v_sorted[Max_nthreads][Max_chooser_events];
+  };
+
+
 
   /**
    * 計算性能「測定時計」クラス.
@@ -76,6 +116,7 @@ namespace pm_lib {
     double m_time;         ///< 時間(秒)
     double m_flop;         ///< 浮動小数点演算量or通信量(バイト)
     double m_percentage;   ///< Percentage of vectorization or cache hit
+    double m_time_exchanged;  ///< exchangeSectionCost()で前回交換した時点の時間(秒)
 
     // 統計量(全プロセスに関する統計量でランク0のみが保持する)
     long m_count_sum;    ///< 測定回数 (全プロセスの合計値)
@@ -85,10 +126,15 @@ namespace pm_lib {
     double m_flop_av;    ///< 浮動小数点演算量or通信量の平均値
     double m_flop_sd;    ///< 浮動小数点演算量or通信量の標準偏差
     double m_time_comm;  ///< 通信部分の最大値
+    struct pmlib_section_stats m_stats;  ///< 全プロセスの統計量のサマリ (min/max, quantile)
 
     int level_POWER;	///< 電力情報レベル 0(no), 1(NODE), 2(NUMA), 3(PARTS)
     double m_power_av;    ///< average value of power consumption meter reading
     int level_OTF;	     ///< OTF tracing 出力レベル 0(no), 1(yes), 2(full)
+    bool m_gather_root;  ///< ランク0のみに集約するモード (PMLIB_GATHER=ROOT|NODE)
+    MPI_Comm m_comm;     ///< 集約・統計・OTF出力に用いるcommunicator (PerfMonitor::m_comm)
+    int m_flight_slot;   ///< フライトレコーダのリングのスロット。setProperties()の前に設定する
+    int m_otf_id;        ///< OTFイベントの区間番号。モニターのスレッド間で共有する区間番号
     std::string otf_filename;    ///< OTF filename headings
                         //	master 		: otf_filename + .otf
                         //	definition	: otf_filename + .mdID + .def
@@ -107,6 +153,9 @@ namespace pm_lib {
     // 測定時の補助変数
     double m_startTime;  ///< 測定区間の測定開始時刻
     double m_stopTime;   ///< 測定区間の測定終了時刻
+    struct pmlib_flight_ring* m_flight;  ///< フライトレコーダのリング。NULLの場合は記録しない
+    struct pmlib_trace_buffer* m_trace;  ///< バイナリトレースのバッファ。NULLの場合は記録しない
+    bool m_otf_sampled;  ///< 今回の測定のOTFカウンター値を出力するか (OTF_COUNTER_INTERVAL)
 
     // 測定値集計時の補助変数
     double* m_timeArray;         ///< 「時間」集計用配列
@@ -129,7 +178,13 @@ namespace pm_lib {
     PerfWatch() : m_time(0.0), m_flop(0.0), m_count(0), m_started(false),
       my_rank(-1), m_timeArray(0), m_flopArray(0), m_countArray(0),
       m_sortedArrayHWPC(0), m_is_set(false), m_is_healthy(true),
-      m_in_parallel(false) {
+      m_in_parallel(false), m_gather_root(false), m_comm(MPI_COMM_WORLD) {
+	m_time_exchanged = 0.0;
+	m_flight = NULL;
+	m_flight_slot = -1;
+	m_otf_id = 0;
+	m_trace = NULL;
+	m_otf_sampled = false;
 	#ifdef DEBUG_PRINT_WATCH
 		int i_thread_constractor;
 		#ifdef _OPENMP
@@ -188,6 +243,29 @@ namespace pm_lib {
     ///
     void initializeOTF(void);
 
+    /// 基準ランク(ランク0)の時刻とのずれをMPI ping-pongで推定する
+    ///
+    ///   @param[out] offset  ずれ(秒)。基準ランクの時刻 = 自ランクの時刻 + offset
+    ///
+    ///   @return 推定誤差の上限(秒)。最小往復時間の1/2
+    ///
+    double estimateClockOffset(double& offset);
+
+    /// トレースの時刻を全ランク共通の時刻系にそろえる
+    ///
+    ///   @param[in] phase  0: 初期化時にずれを推定する。
+    ///                     1: 終了時に再推定し、2点間のドリフトを求めて残差を出力する
+    ///
+    void alignClock(int phase);
+
+    /// 自ランクの時刻を基準ランクの時刻系に変換する
+    ///
+    ///   @param[in] t  getTime()の時刻値(秒)
+    ///
+    ///   @return 基準ランクの時刻系での時刻値(秒)
+    ///
+    static double alignedTime(double t);
+
     /// 測定スタート.
     ///
     void start();
@@ -221,6 +299,80 @@ namespace pm_lib {
     ///
     void gatherThreadHWPC(void);
 
+    /// 選択したスレッドのHWPCイベントカウンター測定値を並べ替える (プロセス内)
+    ///
+    void selectThreadHWPC(void);
+
+    /// HWPCイベントの測定値を集約前に較正し、集約する値の数を返す
+    ///
+    ///   @return 集約対象となるHWPC値の数 (HWPC測定値が無い場合は0)
+    ///
+    int calibrateHWPC(void);
+
+    /// 全測定区間を一括集約する送信バッファに自プロセスの測定値を詰める
+    ///
+    ///   @param[out] buf     この測定区間の書き込み先 (3+n_hwpc 個のdouble)
+    ///   @param[in]  n_hwpc  1区間あたりに確保されたHWPC値の数
+    ///
+    ///   @note 詰める順序は time, flop, count, HWPC値(v_sorted)
+    ///
+    void packGather(double* buf, int n_hwpc);
+
+    /// 測定区間を止めずに、現在までの測定値を取得する
+    ///
+    ///   @param[in]  now   現在の時刻 (getTime()の値)
+    ///   @param[out] buf   time, flop, count の3個のdouble
+    ///
+    ///   @note 測定中(start済み)の区間の時間は、開始から現在までを含める
+    ///
+    void packSnapshot(double now, double* buf);
+
+    /// 測定中の区間の開始からの経過時間を取得する
+    ///
+    ///   @param[in]  now   現在の時刻 (getTime()の値)
+    ///
+    ///   @return  経過時間(秒)。start済みでない場合は負の値
+    ///
+    double runningTime(double now);
+
+    /// 全スレッドのHWPCイベントの積算値を取得する
+    ///
+    ///   @param[out] events  イベント毎の積算値 (max_events個のdouble)
+    ///   @param[in]  max_events  取得するイベント数の上限
+    ///
+    ///   @return  取得したイベント数。HWPCを使わない場合は0
+    ///
+    int sumEvents(double* events, int max_events);
+
+    /// 共有メモリセグメントのレコードにこの区間の測定値を書き込む
+    ///
+    ///   @param[in,out] rec  この区間のレコード (PMLIB_SHM)
+    ///
+    ///   @note レコードのシーケンスロックを取って更新する。読み出し側を待たない
+    ///
+    void publishShm(struct pmlib_shm_section* rec);
+
+    /// 指定スレッドの測定値をpackGather()と同じ並びでバッファに詰める
+    ///
+    ///   @param[out] buf     この測定区間の書き込み先 (3+n_hwpc 個のdouble)
+    ///   @param[in]  n_hwpc  1区間あたりに確保されたHWPC値の数
+    ///   @param[in]  i_thread スレッド番号
+    ///
+    ///   @note プロセス内の処理のみで集団通信は行わない。
+    ///   プロセスの測定値は呼び出し前の状態に戻される。
+    ///
+    void packThread(double* buf, int n_hwpc, int i_thread);
+
+    /// 一括集約された受信バッファから全プロセスの測定値を取り出す
+    ///
+    ///   @param[in] recvbuf  全プロセス分の受信バッファ
+    ///   @param[in] offset   1プロセス分のバッファ内でのこの区間の開始位置
+    ///   @param[in] row_len  1プロセス分のバッファ長
+    ///
+    ///   @note gather() と gatherHWPC() が作成する配列と同じ内容を作成する
+    ///
+    void unpackGather(const double* recvbuf, int offset, int row_len);
+
 	/// start measuring the power of the section
 	///
 	///   @param[in] PWR_Cntxt pacntxt
@@ -247,10 +399,35 @@ namespace pm_lib {
     ///
     void gatherPOWER(void);
 
+    /// gather the estimated power consumption of all nodes
+    ///
+    ///   @param[in] comm_leader  communicator of the node leader processes
+    ///   @param[in] is_leader    true if this process is the node leader
+    ///   @param[in] n_nodes      number of nodes
+    ///
+    ///   @note only the node leaders take part, since the power is measured per node
+    ///
+    void gatherPOWER(MPI_Comm comm_leader, bool is_leader, int n_nodes);
+
     /// 測定結果の平均値・標準偏差などの基礎的な統計計算
     ///
     void statsAverage(void);
 
+    /// 統計計算用のリダクションバッファに自プロセスの測定値を詰める
+    ///
+    ///   @param[out] s   この測定区間の自プロセスのサマリ
+    ///
+    void packStats(pmlib_section_stats* s);
+
+    /// 全プロセスのサマリから平均値・標準偏差などを計算する
+    ///
+    ///   @param[in] s   全プロセスをマージしたサマリ
+    ///
+    ///   @note PMLIB_GATHER=ROOT の場合に全ランクが呼び出す。
+    ///         プロセス別の配列を必要としない。
+    ///
+    void statsReduction(const pmlib_section_stats* s);
+
     /// 計算量の選択を行う
     ///
     /// @return  戻り値とその意味合い \n
@@ -288,7 +465,10 @@ namespace pm_lib {
 
     /// OTF 出力処理を終了する
     ///
-    void finalizeOTF(void);
+    ///   @param[in] otf_region  共有区間番号に対応する全プロセス共通の区間番号
+    ///   @param[in] n_region    otf_region[] の要素数
+    ///
+    void finalizeOTF(const int* otf_region, int n_region);
 
     /// MPIランク別測定結果を出力. 非排他測定区間も出力
     ///
@@ -379,17 +559,14 @@ namespace pm_lib {
     ///
     void read_cpu_clock_freq();
 
-    ///	copy in HWPC values from master thread to shared "papi" struct
-    ///
-    void mergeMasterThread(void);
-
-    ///	merge private HWPC values from the parallel threads to the master
+    ///	write private HWPC values of the parallel thread into the reduction buffer
     ///
-    void mergeParallelThread(void);
+    void writeThreadSlot(struct pmlib_thread_slots& slot);
 
+    ///	merge the reduction buffer into the master thread and
     ///	re-calculate the aggregate HWPC values from all threads
     ///
-    void updateMergedThread(void);
+    void mergeThreadSlots(struct pmlib_thread_slots* slot);
 
     ///
     void selectPerfSingleThread(int i_thread);
@@ -410,6 +587,7 @@ namespace pm_lib {
     void stopSectionParallel(double flopPerTask, unsigned iterationCount);
 
 	/// HWPC related internal functions
+	int numSortedHWPC (void);
 	void identifyARMplatform (void);
 	void createPapiCounterList (void);
 	void sortPapiCounterList (void);
@@ -40,8 +40,10 @@ namespace pm_lib {
   typedef int MPI_Datatype;
   typedef int MPI_Op;
   typedef int MPI_Group;
+  typedef int MPI_Request;
 
 #define MPI_SUCCESS true
+#define MPI_MAX (MPI_Op)(0x58000001)
 #define MPI_SUM (MPI_Op)(0x58000003)
 
 
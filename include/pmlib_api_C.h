@@ -21,9 +21,11 @@ extern void C_pm_sections (int *nSections);
 extern void C_pm_serial_parallel (int id, int *mid, int *inside);
 extern void C_pm_stop_Root (void);
 extern void C_pm_mergethreads (int id);
+extern void C_pm_mergeallthreads (void);
 extern void C_pm_getpowerknob (int knob, int* value);
 extern void C_pm_setpowerknob (int knob, int value);
 #if defined  (MORE_MPI_MEMBERS)
 extern void C_pm_printgroup (char* fc, MPI_Group p_group, MPI_Comm p_comm, int* pp_ranks, int group, int legend, int fp_sort);
 extern void C_pm_printcomm (char* fc, MPI_Comm new_comm, int icolor, int key, int legend, int fp_sort);
+extern int C_pm_exchangecost (char* fc, MPI_Comm comm, double* out);
 #endif
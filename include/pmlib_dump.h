@@ -0,0 +1,110 @@
+#ifndef _PM_DUMP_H_
+#define _PM_DUMP_H_
+
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+/// PMlib プロセス別バイナリダンプファイルの形式
+/// included in PerfMonitor.cpp and src_tools/pmlib_merge.cpp
+///
+/// @file pmlib_dump.h
+/// @brief Header block for the per process binary dump (PMLIB_DUMP)
+///
+/// @note
+///	With PMLIB_DUMP=prefix, each process writes its raw section values to its own
+///	file "prefix.RRRRRR.pmd" (RRRRRR is the rank number) at report() without any
+///	MPI communication. The files are merged offline by the pmlib-merge tool.
+///	The file consists of
+///	- struct pmlib_dump_header
+///	- for each section, struct pmlib_dump_section followed by
+///	  - the label (label_len bytes, not terminated)
+///	  - the sorted HWPC values of the process (num_sorted doubles)
+///	  - the power consumption of the parts (num_power doubles, Joule)
+///	  - for each thread, struct pmlib_dump_thread followed by
+///	    the sorted HWPC values of the thread (num_sorted doubles) and
+///	    the raw HWPC counters of the thread (num_events long long)
+///	All values are written in the native byte order of the process.
+///
+
+namespace pm_lib {
+
+/// magic string at the top of the file
+const char Dump_magic[8] = {'P','M','L','I','B','D','M','P'};
+
+/// version of the file layout
+const int Dump_version = 1;
+
+/// marker to detect the byte order mismatch
+const int Dump_byte_order = 0x01020304;
+
+/// maximum length of the event, part and host names
+const int Max_dump_name = 32;
+
+/// maximum number of HWPC events. same as Max_chooser_events
+const int Max_dump_events = 12;
+
+/// maximum number of power parts. same as Max_power_stats
+const int Max_dump_power = 20;
+
+/// file header
+struct pmlib_dump_header {
+	char magic[8];
+	int version;
+	int byte_order;
+	int rank;			// rank number of the process in the PMlib communicator
+	int num_process;	// number of processes, i.e. number of the files
+	int num_threads;	// number of threads per process
+	int num_sections;	// number of the section records in this file
+	int num_events;		// number of the raw HWPC events per thread
+	int num_sorted;		// max number of the sorted HWPC values per section
+	int num_power;		// number of the power parts per section
+	int is_unit;		// PerfWatch::statsSwitch() of the Root section
+	char pm_version[Max_dump_name];
+	char parallel_mode[Max_dump_name];	// Serial, OpenMP, FlatMPI, Hybrid
+	char hwpc_chooser[Max_dump_name];	// HWPC_CHOOSER value
+	char hostname[Max_dump_name*2];
+	char event_name[Max_dump_events][Max_dump_name];	// raw event names
+	char sorted_name[Max_dump_events][Max_dump_name];	// sorted value names
+	char power_name[Max_dump_power][Max_dump_name];	// power part names
+};
+
+/// section record. The variable length fields follow.
+struct pmlib_dump_section {
+	int id;				// section ID in the process. 0 is the Root section
+	int type_calc;		// 0:COMM, 1:CALC
+	int exclusive;		// 1:exclusive, 0:inclusive
+	int in_parallel;	// 1:defined inside of parallel region
+	int is_unit;		// PerfWatch::statsSwitch()
+	int num_sorted;		// number of the sorted HWPC values of this section
+	int label_len;		// length of the label
+	int reserved;
+	long count;			// process values after the thread merge
+	double time;
+	double flop;
+	double percentage;
+};
+
+/// thread record. The variable length fields follow.
+struct pmlib_dump_thread {
+	long count;
+	double time;
+	double flop;
+};
+
+} /* namespace pm_lib */
+
+#endif // _PM_DUMP_H_
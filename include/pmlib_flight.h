@@ -0,0 +1,140 @@
+#ifndef _PM_FLIGHT_H_
+#define _PM_FLIGHT_H_
+
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+/// PMlib 最近の区間イベントを記録するフライトレコーダ
+/// included in PerfWatch.h
+///
+/// @file pmlib_flight.h
+/// @brief Header block for the crash-safe flight recorder (PMLIB_FLIGHT_RECORDER)
+///
+/// @note
+///	Each thread owns a fixed-size ring of the recent start/stop events and
+///	the stack of its open sections. Only the owner thread writes them, so
+///	an event costs a few stores without any lock.
+///	On SIGSEGV, SIGBUS, SIGABRT and SIGTERM, the handler writes the rings of
+///	all threads to the per rank file with the async-signal-safe write(2),
+///	then lets the signal take its previous action.
+///	The section labels are copied into the ring of the thread when the
+///	section is defined, so that the handler does not touch the std::string.
+///	Each PerfMonitor instance has its own slot of the rings, so that the
+///	section IDs and labels of the different monitors do not collide.
+///	Each thread installs its own alternate signal stack with its first ring,
+///	so that a stack overflow of any thread can be reported.
+///	The events keep the raw getTime() values. The dump converts all of them
+///	to the clock of rank 0 with the latest coefficients of flight_set_clock().
+///
+
+namespace pm_lib {
+
+/// maximum depth of the open section stack per thread
+const int Max_flight_depth = 64;
+
+/// maximum number of the PerfMonitor instances with the rings
+const int Max_flight_monitors = 8;
+
+/// maximum number of the labels per thread
+const int Max_flight_labels = 256;
+
+/// maximum length of the label including the terminating null
+const int Max_flight_label = 48;
+
+/// event record
+struct pmlib_flight_event {
+	int id;			// section ID
+	int kind;		// 0: start, 1: stop
+	double time;	// time stamp [sec] (getTime())
+	double duration;	// time of the call [sec] for stop. 0 for start
+};
+
+/// ring of one thread
+struct pmlib_flight_ring {
+	unsigned long head;		// number of the recorded events
+	unsigned long mask;		// size of events[] - 1. the size is a power of 2
+	int depth;				// depth of the open section stack
+	int thread;				// thread number
+	int monitor;			// slot number of the PerfMonitor instance
+	int stack[Max_flight_depth];
+	char label[Max_flight_labels][Max_flight_label];
+	struct pmlib_flight_event* events;
+};
+
+/// フライトレコーダを初期化し、シグナルハンドラを登録する (プロセスで1度だけ)
+///
+///   @param[in] rank      ランク番号
+///   @param[in] n_events  スレッド毎のリングの大きさ (2のべき乗に切り上げる)
+///   @param[in] prefix    出力ファイル名の接頭辞
+///
+///   @return  登録できた場合true
+///
+bool flight_initialize (int rank, int n_events, const char* prefix);
+
+/// PerfMonitorのインスタンスにリングのスロットを割り当てる
+///
+///   @return  スロット番号。フライトレコーダが無効な場合、またはスロットが無い場合は-1
+///
+int flight_monitor_slot (void);
+
+/// 呼び出したスレッドのモニターのリングを取得する (無ければ作成する)
+///
+///   @param[in] monitor  flight_monitor_slot() で得たスロット番号
+///
+///   @return  リング。フライトレコーダが無効な場合はNULL
+///
+struct pmlib_flight_ring* flight_thread_ring (int monitor);
+
+/// 時刻を基準ランクの時刻系に変換する係数を設定する (PerfWatch::alignClock)
+///
+///   @param[in] offset  ずれ(秒)
+///   @param[in] drift   ドリフト(秒/秒)
+///   @param[in] t0      ずれを推定した時刻(秒)
+///
+void flight_set_clock (double offset, double drift, double t0);
+
+/// 区間のラベルをリングに登録する
+void flight_set_label (struct pmlib_flight_ring* r, int id, const char* label);
+
+/// 区間の開始を記録する
+inline void flight_start (struct pmlib_flight_ring* r, int id, double t)
+{
+	struct pmlib_flight_event* e = &r->events[r->head & r->mask];
+	e->id = id;
+	e->kind = 0;
+	e->time = t;
+	e->duration = 0.0;
+	r->head++;
+	if (r->depth < Max_flight_depth) r->stack[r->depth] = id;
+	r->depth++;
+}
+
+/// 区間の終了を記録する
+inline void flight_stop (struct pmlib_flight_ring* r, int id, double t, double duration)
+{
+	struct pmlib_flight_event* e = &r->events[r->head & r->mask];
+	e->id = id;
+	e->kind = 1;
+	e->time = t;
+	e->duration = duration;
+	r->head++;
+	if (r->depth > 0) r->depth--;
+}
+
+} /* namespace pm_lib */
+
+#endif // _PM_FLIGHT_H_
@@ -20,17 +20,26 @@
 
 /// PMlib private クラスからOTF へのインタフェイスC関数
 /// included in PerfWatch.h
+/// implemented by src_otf_ext/otf_ext.c (OTF) or src_otf2_ext/otf2_ext.c (OTF2)
+///
+/// The events are buffered per thread by PerfWatch, and passed to these
+/// functions at flush time with the thread number of the stream.
+/// The section number of the events and the labels is the global section ID
+/// of PerfMonitor::reconcile_sections(), which is common to all ranks.
+/// The last argument of my_otf_initialize() and my_otf_finalize() is the
+/// Fortran handle (MPI_Comm_c2f) of the communicator of the monitor, or 0 without MPI.
 ///
 /// @file pmlib_otf.h
 /// @brief Header block for PMlib - OTF interface class
 ///
 
 #ifdef USE_OTF
-extern "C" void my_otf_initialize  (int, int, const char*, double);
-extern "C" void my_otf_event_start (int, double, int, int);
-extern "C" void my_otf_event_stop  (int, double, int, int, double);
+extern "C" void my_otf_initialize  (int, int, int, const char*, double, int);
+extern "C" void my_otf_event_start (int, int, double, int);
+extern "C" void my_otf_event_stop  (int, int, double, int);
+extern "C" void my_otf_event_counter (int, int, double, int, double);
 extern "C" void my_otf_event_label (int, int, int, const char*, int, int);
-extern "C" void my_otf_finalize    (int, int, int, const char*, const char*, const char*, const char*);
+extern "C" void my_otf_finalize    (int, int, int, const char*, const char*, const char*, const char*, int);
 #endif
 
 //	struct otf_group_chooser {
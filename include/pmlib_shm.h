@@ -0,0 +1,122 @@
+#ifndef _PM_SHM_H_
+#define _PM_SHM_H_
+
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+/// PMlib 実行中の測定値を公開する共有メモリセグメントの形式
+/// included in PerfWatch.h and src_tools/pmlib_top.cpp
+///
+/// @file pmlib_shm.h
+/// @brief Layout of the live statistics segment (PMLIB_SHM)
+///
+/// @note
+///	With PMLIB_SHM=on, each process creates the file /dev/shm/pmlib.PID.N
+///	(N is the PerfMonitor instance number in the process), maps it, and updates
+///	the record of a section in place at each stop() of the master thread.
+///	The file consists of
+///	- struct pmlib_shm_header
+///	- struct pmlib_shm_section [max_sections]
+///	A record is protected by its own sequence lock. The writer makes seq odd,
+///	updates the values, and makes seq even again. It never waits for readers.
+///	A reader copies the record, and retries if seq was odd or has changed.
+///	num_sections is increased after the label of the new record is written.
+///
+
+#include <cstring>
+
+namespace pm_lib {
+
+/// magic string at the top of the segment
+const char Shm_magic[8] = {'P','M','L','I','B','S','H','M'};
+
+/// version of the segment layout
+const int Shm_version = 1;
+
+/// maximum number of the published sections per segment
+const int Max_shm_sections = 1024;
+
+/// maximum length of the label including the terminating null
+const int Max_shm_label = 64;
+
+/// maximum number of HWPC events. same as Max_chooser_events
+const int Max_shm_events = 12;
+
+/// maximum length of the event and host names
+const int Max_shm_name = 32;
+
+/// segment header
+struct pmlib_shm_header {
+	char magic[8];
+	int version;
+	int rank;			// rank number of the process in the PMlib communicator
+	int num_process;	// number of processes
+	int pid;			// process ID of the writer
+	int max_sections;	// number of the section records in this segment
+	int num_sections;	// number of the records in use. read with acquire
+	int num_events;		// number of the raw HWPC events
+	int reserved;
+	double start_time;	// wall clock time at initialize (sec since epoch)
+	char hostname[Max_shm_name*2];
+	char event_name[Max_shm_events][Max_shm_name];
+};
+
+/// section record
+struct pmlib_shm_section {
+	unsigned int seq;	// sequence lock. odd while the record is updated
+	int id;				// section ID in the process
+	char label[Max_shm_label];
+	long count;			// number of the calls
+	double time;		// accumulated time [sec]
+	double last;		// time of the last call [sec]
+	double flop;		// accumulated operations
+	double events[Max_shm_events];	// accumulated raw HWPC counts of all threads
+};
+
+/// 書き込み側: レコードの更新を開始する (seqを奇数にする)
+inline void shm_write_begin (struct pmlib_shm_section* s)
+{
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/// 書き込み側: レコードの更新を終了する (seqを偶数に戻す)
+inline void shm_write_end (struct pmlib_shm_section* s)
+{
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+/// 読み出し側: 一貫したレコードのコピーを得る
+///
+///   @return  コピーできた場合true。書き込みが続いて max_retry 回で得られない場合false
+///
+inline bool shm_read (const struct pmlib_shm_section* s, struct pmlib_shm_section* copy, int max_retry=1000)
+{
+	for (int k=0; k<max_retry; k++) {
+		unsigned int s1 = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if (s1 & 1) continue;
+		memcpy(copy, (const void*)s, sizeof(struct pmlib_shm_section));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		unsigned int s2 = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+		if (s1 == s2) return true;
+	}
+	return false;
+}
+
+} /* namespace pm_lib */
+
+#endif // _PM_SHM_H_
@@ -0,0 +1,131 @@
+#ifndef _PM_STATS_H_
+#define _PM_STATS_H_
+
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+/// PMlib 全プロセスの統計量をリダクションで求めるための集計構造体
+/// included in PerfWatch.h
+///
+/// @file pmlib_stats.h
+/// @brief Header block for the reduction based statistics among processes
+///
+/// @note
+///	The struct pmlib_section_stats holds the mergeable summary of one section.
+///	The summary of each process is merged with the custom MPI_Op, which is
+///	commutative and associative, so the stats of all processes are obtained
+///	in O(log P) time with O(1) memory per process.
+///	- Welford accumulators (count, mean, M2) of the time and the flop values
+///	- min/max of the time and the ranks which have them (argmin/argmax)
+///	- log-scale histogram sketch of the time, for the quantiles (median, p90, p99)
+///	The struct pmlib_topk_entry holds the k slowest and the k fastest processes
+///	of one section, and is merged in the same way with O(k) memory per section.
+///
+
+namespace pm_lib {
+
+/// number of bins of the quantile sketch
+const int Max_sketch_bins = 256;
+
+/// growth ratio of the neighbouring bins. The relative error is about 2%.
+const double Sketch_gamma = 1.04;
+
+/// Welford accumulator
+struct pmlib_welford {
+	double n;		// number of samples
+	double mean;	// mean value
+	double m2;		// sum of squared differences from the mean
+};
+
+/// mergeable log-scale histogram sketch
+///	bins[k] counts the values v with index(v) == i_top - (Max_sketch_bins-1) + k.
+///	The values below the window are collapsed into bins[0].
+struct pmlib_sketch {
+	int i_top;		// index of the highest bin. INT_MIN if the sketch is empty
+	unsigned int n_zero;	// number of values equal to zero
+	unsigned int bins[Max_sketch_bins];
+};
+
+/// mergeable summary of one section
+struct pmlib_section_stats {
+	struct pmlib_welford time;
+	struct pmlib_welford flop;
+	double count_sum;	// sum of the call counts
+	double time_min;
+	double time_max;
+	int rank_min;		// rank which has time_min
+	int rank_max;		// rank which has time_max
+	struct pmlib_sketch sketch;
+};
+
+/// maximum length of the host name kept in the top-k list
+const int Max_topk_hostname = 64;
+
+/// maximum number of the processes kept at each end of the top-k list
+const int Max_topk = 64;
+
+/// one entry of the top-k list of a section
+struct pmlib_topk_entry {
+	double time;	// measured time of the process
+	int rank;		// rank number of the process. -1 if the entry is empty
+	char host[Max_topk_hostname];	// host name of the process
+};
+
+/// initialize the summary as empty
+void stats_init (pmlib_section_stats* s);
+
+/// add the values of one process to the summary
+void stats_add (pmlib_section_stats* s, double time, double flop, long count, int rank);
+
+/// merge the summary "in" into "inout"
+void stats_merge (pmlib_section_stats* inout, const pmlib_section_stats* in);
+
+/// q-quantile (0.0 <= q <= 1.0) of the time values in the summary
+double stats_quantile (const pmlib_section_stats* s, double q);
+
+/// standard deviation computed from the Welford accumulator
+double stats_stddev (const pmlib_welford* w);
+
+/// MPI datatype and the custom MPI_Op for the array of the summaries,
+///	e.g. for the non-blocking or persistent reductions
+///	@note mpi.h or mpi_stubs.h must be included before this header
+int stats_mpi_type (MPI_Datatype* dtype, MPI_Op* op);
+
+/// merge the summaries of n sections across all processes of comm
+///	with a single MPI_Allreduce using the custom MPI_Op
+///	@note mpi.h or mpi_stubs.h must be included before this header
+int stats_allreduce (pmlib_section_stats* s, int n, MPI_Comm comm);
+
+/// initialize the top-k list of one section as empty
+///	the list has 2*k entries : [0,k) the slowest and [k,2k) the fastest processes
+///	k must not exceed Max_topk
+void topk_init (pmlib_topk_entry* t, int k);
+
+/// add the value of one process to the top-k list of one section
+void topk_add (pmlib_topk_entry* t, int k, double time, int rank, const char* host);
+
+/// merge the top-k list "in" into "inout"
+void topk_merge (pmlib_topk_entry* inout, const pmlib_topk_entry* in, int k);
+
+/// merge the top-k lists of n sections across all processes of comm
+///	to the root process with a single MPI_Reduce using the custom MPI_Op
+///	@note mpi.h or mpi_stubs.h must be included before this header
+int topk_reduce (pmlib_topk_entry* t, int n, int k, int root, MPI_Comm comm);
+
+} /* namespace pm_lib */
+
+#endif // _PM_STATS_H_
@@ -0,0 +1,213 @@
+#ifndef _PM_TRACE_H_
+#define _PM_TRACE_H_
+
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+/// PMlib 組み込みのスレッド毎バイナリトレース
+/// included in PerfWatch.h and src_tools/pmlib_trace2json.cpp
+///
+/// @file pmlib_trace.h
+/// @brief Format and recorder of the per thread binary trace (PMLIB_TRACE)
+///
+/// @note
+///	Each thread appends its events to its own buffer without any lock.
+///	When the buffer is full, the owner thread reserves a region of the per
+///	rank file with an atomic add of the file offset, and writes the buffer
+///	there as one chunk with pwrite(2). So the threads never wait for each
+///	other, and the chunks of the threads are interleaved in the file.
+///	There is no writer thread, and pwrite(2) runs synchronously in the owner
+///	thread. PerfWatch::start() makes room for the enter event before the
+///	start time is taken, so the write is never counted in the section being
+///	started. A write at stop() comes after the stop time is taken, and is
+///	counted only in the enclosing sections.
+///	The file prefix.RRRRRR.pmt consists of
+///	- struct pmlib_trace_file_header
+///	- chunks, each of struct pmlib_trace_chunk_header and its events
+///	A chunk is decoded by itself. Its events are
+///	- Trace_enter : kind, varint delta time [ns], varint section ID
+///	- Trace_leave : kind, varint delta time [ns], varint section ID
+///	- Trace_counter : kind, varint delta time [ns], varint section ID, double value
+///	- Trace_label : kind, varint section ID, varint length, label bytes
+///	- Trace_clock : kind, double offset, double drift, double t0
+///	The delta time is measured from the previous event of the chunk, and the
+///	first one from base_time of the chunk header.
+///	The time stamps are the raw getTime() values. The Trace_clock event is
+///	written in a chunk of thread Trace_clock_thread by each clock alignment,
+///	and the converter applies the last one to all the events of the file:
+///	time of rank 0 = t + offset + drift * (t - t0).
+///	The section ID is the one of the PerfMonitor instance of the thread.
+///
+
+#include <cstring>
+
+namespace pm_lib {
+
+/// magic string at the top of the file
+const char Trace_magic[8] = {'P','M','L','I','B','T','R','C'};
+
+/// version of the file format
+const int Trace_version = 2;
+
+/// magic number of a chunk header
+const unsigned int Trace_chunk_magic = 0x434d5450;	// "PTMC"
+
+/// event kinds
+const unsigned char Trace_enter = 0;
+const unsigned char Trace_leave = 1;
+const unsigned char Trace_counter = 2;
+const unsigned char Trace_label = 3;
+const unsigned char Trace_clock = 4;
+
+/// thread number of the chunk of a Trace_clock event
+const int Trace_clock_thread = -1;
+
+/// maximum size of one encoded event, except for the label
+const int Max_trace_event = 32;
+
+/// file header
+struct pmlib_trace_file_header {
+	char magic[8];
+	int version;
+	int rank;
+	int pid;
+	int reserved;
+};
+
+/// chunk header
+struct pmlib_trace_chunk_header {
+	unsigned int magic;
+	int thread;			// thread number
+	unsigned int bytes;	// size of the events following this header
+	unsigned int reserved;
+	double base_time;	// time stamp [sec] of the start of the chunk (getTime())
+};
+
+/// buffer of one thread
+struct pmlib_trace_buffer {
+	int thread;
+	unsigned int size;		// capacity of data[]
+	unsigned int used;		// bytes of the events in data[]
+	double base_time;		// base_time of the current chunk
+	double last_time;		// time stamp of the previous event
+	unsigned char* data;
+};
+
+/// トレースを初期化し、出力ファイルを作成する (プロセスで1度だけ)
+///
+///   @param[in] rank    ランク番号
+///   @param[in] kbytes  スレッド毎のバッファの大きさ (KB)
+///   @param[in] prefix  出力ファイル名の接頭辞
+///
+///   @return  作成できた場合true
+///
+bool trace_initialize (int rank, int kbytes, const char* prefix);
+
+/// 呼び出したスレッドのバッファを取得する (無ければ作成する)
+///
+///   @return  バッファ。トレースが無効な場合はNULL
+///
+struct pmlib_trace_buffer* trace_thread_buffer (void);
+
+/// バッファをチャンクとしてファイルに書き出し、空にする
+void trace_flush (struct pmlib_trace_buffer* b);
+
+/// 全スレッドのバッファを書き出す (並列領域の外から呼ぶ)
+void trace_flush_all (void);
+
+/// 基準ランクの時刻系への変換係数を記録する (PerfWatch::alignClock)
+void trace_clock (double offset, double drift, double t0);
+
+/// 区間のラベルを記録する
+void trace_label (struct pmlib_trace_buffer* b, int id, const char* label);
+
+/// バッファの空きがbytesに満たない場合は書き出して空にする
+///	PerfWatch::start() が開始時刻を取る前に呼ぶ
+inline void trace_reserve (struct pmlib_trace_buffer* b, unsigned int bytes)
+{
+	if (b->used + bytes > b->size) trace_flush(b);
+}
+
+/// 可変長整数 (LEB128) を書き込む
+inline unsigned char* trace_put_varint (unsigned char* p, unsigned long long v)
+{
+	while (v >= 0x80) {
+		*p++ = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (unsigned char)v;
+	return p;
+}
+
+/// 可変長整数 (LEB128) を読み出す
+inline const unsigned char* trace_get_varint (const unsigned char* p, const unsigned char* end, unsigned long long& v)
+{
+	v = 0;
+	int shift = 0;
+	while (p < end && shift < 64) {
+		unsigned char c = *p++;
+		v |= (unsigned long long)(c & 0x7f) << shift;
+		if ((c & 0x80) == 0) return p;
+		shift += 7;
+	}
+	return NULL;
+}
+
+/// イベントの種類・時刻差・区間番号を書き込む
+inline unsigned char* trace_put_event (struct pmlib_trace_buffer* b, unsigned char kind, int id, double t)
+{
+	trace_reserve(b, Max_trace_event);
+	if (b->used == 0) {
+		b->base_time = t;
+		b->last_time = t;
+	}
+	// last_time follows the decoded time, so that the rounding errors do not accumulate
+	double dt = (t - b->last_time) * 1.0e9;
+	unsigned long long ns = (dt > 0.0) ? (unsigned long long)(dt + 0.5) : 0;
+	b->last_time += (double)ns * 1.0e-9;
+	unsigned char* p = b->data + b->used;
+	*p++ = kind;
+	p = trace_put_varint(p, ns);
+	p = trace_put_varint(p, (unsigned long long)id);
+	return p;
+}
+
+/// 区間の開始を記録する
+inline void trace_enter (struct pmlib_trace_buffer* b, int id, double t)
+{
+	unsigned char* p = trace_put_event(b, Trace_enter, id, t);
+	b->used = (unsigned int)(p - b->data);
+}
+
+/// 区間の終了を記録する
+inline void trace_leave (struct pmlib_trace_buffer* b, int id, double t)
+{
+	unsigned char* p = trace_put_event(b, Trace_leave, id, t);
+	b->used = (unsigned int)(p - b->data);
+}
+
+/// 区間のカウンタ値を記録する
+inline void trace_counter (struct pmlib_trace_buffer* b, int id, double t, double value)
+{
+	unsigned char* p = trace_put_event(b, Trace_counter, id, t);
+	memcpy(p, &value, sizeof(double));
+	b->used = (unsigned int)(p + sizeof(double) - b->data);
+}
+
+} /* namespace pm_lib */
+
+#endif // _PM_TRACE_H_
@@ -35,8 +35,14 @@
 
 namespace pm_lib {
 
-  extern struct pmlib_papi_chooser papi;
-  extern struct hwpc_group_chooser hwpc_group;
+  extern struct pmlib_papi_chooser& papi;
+  extern struct hwpc_group_chooser& hwpc_group;
+
+#ifdef USE_PAPI
+  /// the PAPI event set of this thread has been added and started
+  static bool is_thread_bound = false;
+  #pragma omp threadprivate(is_thread_bound)
+#endif
 
 
   /// HWPC interface initialization
@@ -57,11 +63,17 @@ namespace pm_lib {
   ///	If a class member is called from inside parallel region,
   ///	the variables of the class are given different addresses.
   ///
+  /// @note
+  ///	The Root section of each PerfMonitor instance attaches to the shared
+  ///	hw_context. Only the first attach initializes PAPI and the event list,
+  ///	and each thread adds its PAPI event set only once.
+  ///
 void PerfWatch::initializeHWPC ()
 {
 
 	bool root_in_parallel;
 	int root_thread;
+	bool is_first_attach;
 
 	root_in_parallel = false;
 	root_thread = 0;
@@ -76,7 +88,40 @@ void PerfWatch::initializeHWPC ()
 	}
 	#endif
 
-	if (root_thread == 0)
+// Parse the Environment Variable HWPC_CHOOSER
+	std::string s_chooser;
+	std::string s_default = "USER";
+	char* cp_env = std::getenv("HWPC_CHOOSER");
+	if (cp_env == NULL) {
+		s_chooser = s_default;
+	} else {
+		s_chooser = cp_env;
+		if (s_chooser == "FLOPS" ||
+			s_chooser == "BANDWIDTH" ||
+			s_chooser == "VECTOR" ||
+			s_chooser == "CACHE" ||
+			s_chooser == "CYCLE" ||
+			s_chooser == "LOADSTORE" ||
+			s_chooser == "USER" ) {
+			;
+		} else {
+			s_chooser = s_default;
+		}
+	}
+
+	// The one-time setup is done by the first thread which arrives here,
+	// inside of the critical section. The other threads of the team enter
+	// the critical section after it, so they never call getTime() before
+	// second_per_cycle is set.
+	is_first_attach = false;
+	#ifdef _OPENMP
+	#pragma omp critical (pmlib_hw_context)
+	#endif
+	{
+	if (root_thread == 0) hw_context.ref_count++;
+	is_first_attach = !hw_context.is_hwpc_ready;
+
+	if (is_first_attach)
 	{
 	for (int i=0; i<Max_hwpc_output_group; i++) {
 		hwpc_group.number[i] = 0;
@@ -97,38 +142,14 @@ void PerfWatch::initializeHWPC ()
 			papi.th_v_sorted[j][i] = 0;
 		}
 		}
-	}
 
-// Parse the Environment Variable HWPC_CHOOSER
-	std::string s_chooser;
-	std::string s_default = "USER";
-	char* cp_env = std::getenv("HWPC_CHOOSER");
-	if (cp_env == NULL) {
-		s_chooser = s_default;
-	} else {
-		s_chooser = cp_env;
-		if (s_chooser == "FLOPS" ||
-			s_chooser == "BANDWIDTH" ||
-			s_chooser == "VECTOR" ||
-			s_chooser == "CACHE" ||
-			s_chooser == "CYCLE" ||
-			s_chooser == "LOADSTORE" ||
-			s_chooser == "USER" ) {
-			;
-		} else {
-			s_chooser = s_default;
-		}
-	}
 	hwpc_group.env_str_hwpc = s_chooser;
 
 	read_cpu_clock_freq(); /// API for reading processor clock frequency.
 
-	if (hwpc_group.env_str_hwpc == "USER" ) return;	// Is this a correct return? Yes!
-
 #ifdef USE_PAPI
+	if (s_chooser != "USER" ) {
 	int i_papi;
-	if (root_thread == 0)
-	{
 	i_papi = PAPI_library_init( PAPI_VER_CURRENT );
 	if (i_papi != PAPI_VER_CURRENT ) {
 		fprintf (stderr, "*** error. <PAPI_library_init> code: %d\n", i_papi);
@@ -147,19 +168,27 @@ void PerfWatch::initializeHWPC ()
 	createPapiCounterList ();
 
 	#ifdef DEBUG_PRINT_PAPI
-	if (my_rank == 0 && root_thread == 0) {
+	if (my_rank == 0) {
 		fprintf(stderr, "<initializeHWPC> created struct papi: papi.num_events=%d, address=%p\n",
 			papi.num_events, &papi.num_events );
 		fprintf(stderr, "\t\t memo: struct papi is shared across threads.\n");
 	}
 	#endif
 	}
+#endif // USE_PAPI
+	hw_context.is_hwpc_ready = true;
+	}
+	} // end of #pragma omp critical
+
+	if (s_chooser == "USER" ) return;	// Is this a correct return? Yes!
 
+#ifdef USE_PAPI
 	#pragma omp barrier
 	// In general the arguments to <my_papi_*> should be thread private.
 	// For APIs whose arguments do not change,  we use shared object.
 
 	if (root_in_parallel) {
+	if (!is_thread_bound) {
 	int t_papi;
 	t_papi = my_papi_add_events (papi.events, papi.num_events);
 	if ( t_papi != PAPI_OK ) {
@@ -173,10 +202,13 @@ void PerfWatch::initializeHWPC ()
 		fprintf(stderr, "*** error. <initializeHWPC> <my_papi_bind_start> code: %d\n", t_papi);
 		PM_Exit(0);
 		}
+	is_thread_bound = true;
+	}
 
 	} else {
 	#pragma omp parallel
 	{
+	if (!is_thread_bound) {
 	int t_papi;
 	t_papi = my_papi_add_events (papi.events, papi.num_events);
 	if ( t_papi != PAPI_OK ) {
@@ -190,6 +222,8 @@ void PerfWatch::initializeHWPC ()
 		fprintf(stderr, "*** error. <initializeHWPC> <my_papi_bind_start> code: %d\n", t_papi);
 		PM_Exit(0);
 		}
+	is_thread_bound = true;
+	}
 	} // end of #pragma omp parallel
 	} // end of if (root_in_parallel)
 
@@ -199,9 +233,26 @@ void PerfWatch::initializeHWPC ()
 
   /// cleanup and free HWPC memory space for papi HighLevelInfo struct
   /// @note  this routine is called by PerfMonitor::stopRoot()
+  ///	The Root section detaches from the shared hw_context. The PAPI
+  ///	resources are freed only when the last PerfMonitor instance detaches.
   ///
 void PerfWatch::cleanupHWPC ()
 {
+	int root_thread;
+	root_thread = 0;
+	#ifdef _OPENMP
+	root_thread = omp_get_thread_num();
+	#endif
+
+	#ifdef _OPENMP
+	#pragma omp critical (pmlib_hw_context)
+	#endif
+	{
+	if (root_thread == 0 && hw_context.ref_count > 0) {
+		hw_context.ref_count--;
+		if (hw_context.ref_count == 0) hw_context.is_hwpc_ready = false;
+	}
+	}
 
 #ifdef _OPENMP
 #ifdef USE_PAPI
@@ -209,15 +260,18 @@ void PerfWatch::cleanupHWPC ()
 	if (hwpc_group.env_str_hwpc == "USER" ) return;
 
 	#pragma omp barrier
+	if (hw_context.ref_count > 0) return;
 	root_in_parallel = omp_in_parallel();
 
 	if (root_in_parallel) {
-		my_papi_internal_free();
+		if (is_thread_bound) my_papi_internal_free();
+		is_thread_bound = false;
 
 	} else {
 	#pragma omp parallel
 		{
-		my_papi_internal_free();
+		if (is_thread_bound) my_papi_internal_free();
+		is_thread_bound = false;
 		} // end of #pragma omp parallel
 
 	} // end of if (root_in_parallel)
@@ -0,0 +1,379 @@
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+//! @file   PerfFlight.cpp
+//! @brief  crash-safe flight recorder of the recent section events
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "pmlib_papi.h"
+#include "pmlib_flight.h"
+
+namespace pm_lib {
+
+  /// number of the handled signals
+  static const int Num_flight_signals = 4;
+
+  /// handled signals
+  static const int flight_signals[Num_flight_signals] = {SIGSEGV, SIGBUS, SIGABRT, SIGTERM};
+
+  /// previous actions of the handled signals
+  static struct sigaction flight_old_actions[Num_flight_signals];
+
+  /// rings of all monitors and threads. written once by the owner thread
+  static struct pmlib_flight_ring* flight_rings[Max_flight_monitors][Max_nthreads];
+
+  /// number of the assigned monitor slots
+  static int flight_num_monitors = 0;
+
+  /// size of the ring of each thread. 0 if the recorder is disabled
+  static unsigned long flight_ring_size = 0;
+
+  /// output file name, formatted at flight_initialize()
+  static char flight_filename[512];
+
+  /// rank number
+  static int flight_rank = 0;
+
+  /// coefficients to the clock of rank 0. aligned time = t + offset + drift * (t - t0)
+  static double flight_clock_offset = 0.0;
+  static double flight_clock_drift = 0.0;
+  static double flight_clock_t0 = 0.0;
+
+  /// size of the alternate stack of the handler
+  static const size_t Flight_altstack_size = SIGSTKSZ + 16384;
+
+
+  /// async-signal-safe output buffer
+  struct flight_writer {
+    int fd;
+    int n;
+    char buf[4096];
+  };
+
+  static void fw_flush (struct flight_writer* w)
+  {
+    int k = 0;
+    while (k < w->n) {
+      ssize_t m = write(w->fd, w->buf + k, w->n - k);
+      if (m <= 0) break;
+      k += (int)m;
+    }
+    w->n = 0;
+  }
+
+  static void fw_char (struct flight_writer* w, char c)
+  {
+    if (w->n >= (int)sizeof(w->buf)) fw_flush(w);
+    w->buf[w->n++] = c;
+  }
+
+  static void fw_str (struct flight_writer* w, const char* s)
+  {
+    while (*s) fw_char(w, *s++);
+  }
+
+  static void fw_ulong (struct flight_writer* w, unsigned long v)
+  {
+    char d[24];
+    int k = 0;
+    do {
+      d[k++] = (char)('0' + v % 10);
+      v /= 10;
+    } while (v > 0);
+    while (k > 0) fw_char(w, d[--k]);
+  }
+
+  static void fw_int (struct flight_writer* w, int v)
+  {
+    if (v < 0) {
+      fw_char(w, '-');
+      fw_ulong(w, (unsigned long)(-(long)v));
+    } else {
+      fw_ulong(w, (unsigned long)v);
+    }
+  }
+
+  /// fixed point with 9 decimal digits (nano second)
+  static void fw_double (struct flight_writer* w, double v)
+  {
+    if (v < 0.0) {
+      fw_char(w, '-');
+      v = -v;
+    }
+    unsigned long i = (unsigned long)v;
+    unsigned long f = (unsigned long)((v - (double)i) * 1.0e9 + 0.5);
+    if (f >= 1000000000UL) {
+      i++;
+      f -= 1000000000UL;
+    }
+    fw_ulong(w, i);
+    fw_char(w, '.');
+    char d[9];
+    for (int k=8; k>=0; k--) {
+      d[k] = (char)('0' + f % 10);
+      f /= 10;
+    }
+    for (int k=0; k<9; k++) fw_char(w, d[k]);
+  }
+
+  static void fw_label (struct flight_writer* w, const struct pmlib_flight_ring* r, int id)
+  {
+    if (id >= 0 && id < Max_flight_labels && r->label[id][0] != '\0') {
+      fw_str(w, r->label[id]);
+    } else {
+      fw_str(w, "(id ");
+      fw_int(w, id);
+      fw_str(w, ")");
+    }
+  }
+
+
+  /// リングの内容をファイルに書き出す (async-signal-safe)
+  ///
+  static void flight_dump (int signum)
+  {
+    int fd = open(flight_filename, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0) return;
+    struct flight_writer w;
+    w.fd = fd;
+    w.n = 0;
+
+    fw_str(&w, "# PMlib flight recorder. rank ");
+    fw_int(&w, flight_rank);
+    fw_str(&w, ", pid ");
+    fw_int(&w, (int)getpid());
+    fw_str(&w, ", signal ");
+    fw_int(&w, signum);
+    fw_str(&w, "\n# the event times are aligned to the clock of rank 0\n");
+
+    for (int m=0; m<Max_flight_monitors; m++) {
+    for (int t=0; t<Max_nthreads; t++) {
+      const struct pmlib_flight_ring* r = flight_rings[m][t];
+      if (r == NULL) continue;
+      unsigned long head = r->head;
+      unsigned long n = (head < flight_ring_size) ? head : flight_ring_size;
+
+      fw_str(&w, "\n# monitor ");
+      fw_int(&w, m);
+      fw_str(&w, " thread ");
+      fw_int(&w, t);
+      fw_str(&w, ": open sections (outermost first)\n");
+      int depth = (r->depth < Max_flight_depth) ? r->depth : Max_flight_depth;
+      for (int k=0; k<depth; k++) {
+        fw_str(&w, "open ");
+        fw_label(&w, r, r->stack[k]);
+        fw_str(&w, "\n");
+      }
+      if (r->depth > Max_flight_depth) {
+        fw_str(&w, "# deeper sections are not recorded. depth ");
+        fw_int(&w, r->depth);
+        fw_str(&w, "\n");
+      }
+
+      fw_str(&w, "# monitor ");
+      fw_int(&w, m);
+      fw_str(&w, " thread ");
+      fw_int(&w, t);
+      fw_str(&w, ": last ");
+      fw_ulong(&w, n);
+      fw_str(&w, " of ");
+      fw_ulong(&w, head);
+      fw_str(&w, " events (event time[sec] duration[sec] label)\n");
+      for (unsigned long k=head-n; k<head; k++) {
+        const struct pmlib_flight_event* e = &r->events[k & r->mask];
+        fw_str(&w, (e->kind == 0) ? "start " : "stop  ");
+        fw_double(&w, e->time + flight_clock_offset + flight_clock_drift * (e->time - flight_clock_t0));
+        fw_char(&w, ' ');
+        fw_double(&w, e->duration);
+        fw_char(&w, ' ');
+        fw_label(&w, r, e->id);
+        fw_char(&w, '\n');
+      }
+    }
+    }
+    fw_flush(&w);
+    close(fd);
+  }
+
+
+  /// シグナルハンドラ: リングを書き出して、以前の動作でシグナルを再送する
+  ///
+  static void flight_handler (int signum)
+  {
+    flight_dump(signum);
+
+    for (int i=0; i<Num_flight_signals; i++) {
+      if (flight_signals[i] == signum) {
+        sigaction(signum, &flight_old_actions[i], NULL);
+        break;
+      }
+    }
+    raise(signum);
+  }
+
+
+  /// フライトレコーダを初期化し、シグナルハンドラを登録する (プロセスで1度だけ)
+  ///
+  ///   @param[in] rank      ランク番号
+  ///   @param[in] n_events  スレッド毎のリングの大きさ (2のべき乗に切り上げる)
+  ///   @param[in] prefix    出力ファイル名の接頭辞
+  ///
+  ///   @return  登録できた場合true
+  ///
+  bool flight_initialize (int rank, int n_events, const char* prefix)
+  {
+    bool is_ok = true;
+    #ifdef _OPENMP
+    #pragma omp critical (pmlib_flight)
+    #endif
+    {
+    if (flight_ring_size == 0) {
+      unsigned long size = 16;
+      while (size < (unsigned long)n_events) size *= 2;
+      flight_rank = rank;
+      snprintf(flight_filename, sizeof(flight_filename), "%s.%06d.txt", prefix, rank);
+      for (int m=0; m<Max_flight_monitors; m++) {
+        for (int t=0; t<Max_nthreads; t++) flight_rings[m][t] = NULL;
+      }
+      flight_num_monitors = 0;
+
+      struct sigaction sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = flight_handler;
+      sigfillset(&sa.sa_mask);
+      sa.sa_flags = SA_ONSTACK;
+      for (int i=0; i<Num_flight_signals; i++) {
+        if (sigaction(flight_signals[i], &sa, &flight_old_actions[i]) != 0) is_ok = false;
+      }
+      if (is_ok) flight_ring_size = size;
+    }
+    }
+    return is_ok;
+  }
+
+
+  /// 呼び出したスレッドに代替シグナルスタックが無ければ登録する
+  ///
+  ///   @note sigaltstack はスレッド毎の設定なので、リングを持つ各スレッドが呼ぶ
+  ///
+  static void flight_thread_altstack (void)
+  {
+    stack_t ss;
+    if (sigaltstack(NULL, &ss) != 0) return;
+    if (!(ss.ss_flags & SS_DISABLE)) return;	// already installed by this thread
+    char* p = (char*)malloc(Flight_altstack_size);
+    if (p == NULL) return;
+    ss.ss_sp = p;
+    ss.ss_size = Flight_altstack_size;
+    ss.ss_flags = 0;
+    if (sigaltstack(&ss, NULL) != 0) free(p);
+  }
+
+
+  /// PerfMonitorのインスタンスにリングのスロットを割り当てる
+  ///
+  ///   @return  スロット番号。フライトレコーダが無効な場合、またはスロットが
+  ///    Max_flight_monitors 個を使い切った場合は-1
+  ///
+  int flight_monitor_slot (void)
+  {
+    int m = -1;
+    if (flight_ring_size == 0) return m;
+    #ifdef _OPENMP
+    #pragma omp critical (pmlib_flight)
+    #endif
+    {
+    if (flight_num_monitors < Max_flight_monitors) m = flight_num_monitors++;
+    }
+    return m;
+  }
+
+
+  /// 呼び出したスレッドのモニターのリングを取得する (無ければ作成する)
+  ///
+  ///   @param[in] monitor  flight_monitor_slot() で得たスロット番号
+  ///
+  ///   @return  リング。フライトレコーダが無効な場合、スロット番号が無効な場合、
+  ///    またはスレッド番号が Max_nthreads 以上の場合はNULL
+  ///
+  struct pmlib_flight_ring* flight_thread_ring (int monitor)
+  {
+    if (flight_ring_size == 0) return NULL;
+    if (monitor < 0 || monitor >= Max_flight_monitors) return NULL;
+    int t = 0;
+#ifdef _OPENMP
+    t = omp_get_thread_num();
+#endif
+    if (t < 0 || t >= Max_nthreads) return NULL;
+    if (flight_rings[monitor][t] != NULL) return flight_rings[monitor][t];
+
+    flight_thread_altstack();
+
+    struct pmlib_flight_ring* r = (struct pmlib_flight_ring*)calloc(1, sizeof(struct pmlib_flight_ring));
+    if (r == NULL) return NULL;
+    r->events = (struct pmlib_flight_event*)calloc(flight_ring_size, sizeof(struct pmlib_flight_event));
+    if (r->events == NULL) {
+      free(r);
+      return NULL;
+    }
+    r->mask = flight_ring_size - 1;
+    r->thread = t;
+    r->monitor = monitor;
+    flight_rings[monitor][t] = r;
+    return r;
+  }
+
+
+  /// 時刻を基準ランクの時刻系に変換する係数を設定する (PerfWatch::alignClock)
+  ///
+  ///   @param[in] offset  ずれ(秒)
+  ///   @param[in] drift   ドリフト(秒/秒)
+  ///   @param[in] t0      ずれを推定した時刻(秒)
+  ///
+  void flight_set_clock (double offset, double drift, double t0)
+  {
+    flight_clock_offset = offset;
+    flight_clock_drift = drift;
+    flight_clock_t0 = t0;
+  }
+
+
+  /// 区間のラベルをリングに登録する
+  ///
+  ///   @param[in] r      リング
+  ///   @param[in] id     区間番号
+  ///   @param[in] label  ラベル
+  ///
+  void flight_set_label (struct pmlib_flight_ring* r, int id, const char* label)
+  {
+    if (id < 0 || id >= Max_flight_labels) return;
+    strncpy(r->label[id], label, Max_flight_label-1);
+    r->label[id][Max_flight_label-1] = '\0';
+  }
+
+} /* namespace pm_lib */
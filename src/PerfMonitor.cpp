@@ -23,13 +23,55 @@
 #include "PerfMonitor.h"
 #include <time.h>
 #include <unistd.h> // for gethostname() of FX10/K
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
 #include <cmath>
+#include <algorithm>
 #include "power_obj_menu.h"
+#include "pmlib_dump.h"
 
 namespace pm_lib {
 
-    /// shared map of section name and ID
-    std::map<std::string, int > shared_map_sections;
+    /// シグナルの受信回数 (PMLIB_SIGNAL_DUMP)。シグナルハンドラだけが更新する
+    static volatile sig_atomic_t signal_dump_count = 0;
+
+    /// 登録したシグナル番号と、登録前のアプリケーションのシグナル動作
+    static int signal_dump_signum = 0;
+    static int signal_dump_users = 0;
+    static struct sigaction signal_dump_old_action;
+
+    /// PMLIB_SIGNAL_DUMP のシグナルハンドラ
+    ///	@note  async-signal-safe であるように受信回数を増やすだけにし、
+    ///	スナップショットは次の start()/stop() で出力する。
+    ///	アプリケーションが登録していたハンドラがあれば、続けて呼び出す。
+    static void signal_dump_handler(int signum, siginfo_t* info, void* context)
+    {
+      signal_dump_count = signal_dump_count + 1;
+
+      if (signal_dump_old_action.sa_flags & SA_SIGINFO) {
+        if (signal_dump_old_action.sa_sigaction != NULL)
+          signal_dump_old_action.sa_sigaction(signum, info, context);
+      } else
+      if (signal_dump_old_action.sa_handler != SIG_DFL &&
+          signal_dump_old_action.sa_handler != SIG_IGN) {
+        signal_dump_old_action.sa_handler(signum);
+      }
+    }
+
+
+#ifdef _OPENMP
+    /// reduction buffer of the thread merge for the shared section ID
+    ///	@return NULL if the section has not been given its buffer
+    static struct pmlib_thread_slots* find_thread_slot (struct pmlib_shared_sections* sh, int id)
+    {
+      if (sh == NULL || id < 0 || id >= (int)sh->slot_index.size()) return NULL;
+      int k = sh->slot_index[id];
+      if (k < 0 || k >= (int)sh->thread_slots.size()) return NULL;
+      return &sh->thread_slots[k];
+    }
+#endif
 
 
 
@@ -42,6 +84,21 @@ namespace pm_lib {
   /// @note 測定区間数 m_nWatch は不足すると動的に増えていく
   ///
   void PerfMonitor::initialize (int inn)
+  {
+    PerfMonitor::initialize (MPI_COMM_WORLD, inn);
+  }
+
+
+  /// 初期化 (communicatorを指定).
+  /// 測定対象のプロセス群をcommに限定して初期化する。
+  /// @param[in] comm 測定対象のプロセス群のMPI communicator
+  /// @param[in] inn  最初に確保する測定区間数
+  ///
+  /// @note 集約・統計・OTF出力の集団通信は全てcomm上で行われる
+  /// @note 並列領域内で呼び出す場合は、チームの全スレッドが呼び出すこと
+  ///	(threadprivate のインスタンスが区間の表を共有するため)
+  ///
+  void PerfMonitor::initialize (MPI_Comm comm, int inn)
   {
     char* cp_env;
 	int iret;
@@ -59,12 +116,13 @@ namespace pm_lib {
     if (!is_PMlib_enabled) return;
     init_nWatch = inn;
 
-    iret = MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    m_comm = comm;
+    iret = MPI_Comm_rank(m_comm, &my_rank);
 	if (iret != 0) {
 		fprintf(stderr, "*** PMlib error. <initialize> MPI_Comm_rank failed. iret=%d \n", iret);
 		(void) MPI_Abort(MPI_COMM_WORLD, -999);
 	}
-    iret = MPI_Comm_size(MPI_COMM_WORLD, &num_process);
+    iret = MPI_Comm_size(m_comm, &num_process);
 	if (iret != 0) {
 		fprintf(stderr, "*** PMlib error. <initialize> MPI_Comm_size failed. iret=%d \n", iret);
 		(void) MPI_Abort(MPI_COMM_WORLD, -999);
@@ -153,6 +211,58 @@ namespace pm_lib {
 	}
 	env_str_hwpc = s_chooser;
 
+// Parse the Environment Variable PMLIB_FLIGHT_RECORDER and PMLIB_FLIGHT_FILE
+	// the ring of the recent section events dumped at a fatal signal.
+	// It must be set before the Root Section is defined.
+    cp_env = NULL;
+	cp_env = std::getenv("PMLIB_FLIGHT_RECORDER");
+	is_clock_aligned = false;
+	if (cp_env != NULL) {
+		s_chooser = cp_env;
+		std::transform(s_chooser.begin(), s_chooser.end(), s_chooser.begin(), toupper);
+		int n_events = 0;
+		if (s_chooser == "ON" || s_chooser == "YES") {
+			n_events = 1024;
+		} else if (atoi(cp_env) > 0) {
+			n_events = atoi(cp_env);
+		} else if (s_chooser != "OFF" && s_chooser != "NO") {
+			printDiag("initialize()",  "unknown PMLIB_FLIGHT_RECORDER value [%s]. the recorder is not used.\n", cp_env);
+		}
+		if (n_events > 0) {
+			cp_env = std::getenv("PMLIB_FLIGHT_FILE");
+			std::string prefix = (cp_env == NULL) ? "pmlib_flight" : cp_env;
+			if (!flight_initialize(my_rank, n_events, prefix.c_str())) {
+				printDiag("initialize()",  "can not handle the fatal signals. PMLIB_FLIGHT_RECORDER is disabled.\n");
+			} else {
+				is_clock_aligned = true;
+			}
+		}
+	}
+
+
+// Parse the Environment Variable PMLIB_TRACE, PMLIB_TRACE_BUFFER and PMLIB_TRACE_FILE
+	// the per thread binary trace. It must be set before the Root Section is defined.
+    cp_env = NULL;
+	cp_env = std::getenv("PMLIB_TRACE");
+	if (cp_env != NULL) {
+		s_chooser = cp_env;
+		std::transform(s_chooser.begin(), s_chooser.end(), s_chooser.begin(), toupper);
+		if (s_chooser == "ON" || s_chooser == "YES") {
+			int kbytes = 1024;
+			cp_env = std::getenv("PMLIB_TRACE_BUFFER");
+			if (cp_env != NULL && atoi(cp_env) > 0) kbytes = atoi(cp_env);
+			cp_env = std::getenv("PMLIB_TRACE_FILE");
+			std::string prefix = (cp_env == NULL) ? "pmlib_trace" : cp_env;
+			if (!trace_initialize(my_rank, kbytes, prefix.c_str())) {
+				printDiag("initialize()",  "can not create the trace file. PMLIB_TRACE is disabled.\n");
+			} else {
+				is_clock_aligned = true;
+			}
+		} else if (s_chooser != "OFF" && s_chooser != "NO") {
+			printDiag("initialize()",  "unknown PMLIB_TRACE value [%s]. the trace is not recorded.\n", cp_env);
+		}
+	}
+
 
 // Start m_watchArray[0] instance
     // m_watchArray[] は PerfWatch classである(PerfMonitorではない)ことに留意
@@ -163,10 +273,41 @@ namespace pm_lib {
     std::string label;
     label="Root Section";
 
+	// the section table shared by the threads of this monitor.
+	// If the threadprivate instances are initialized inside of parallel region,
+	// one thread creates the table and the other threads of the team refer to it.
+	// Each instance counts itself as a user of the table, and the last
+	// instance deletes it in the destructor.
+	releaseShared();
+	struct pmlib_shared_sections* p_shared = NULL;
+	#ifdef _OPENMP
+	#pragma omp single copyprivate(p_shared)
+	#endif
+	{
+	p_shared = new pmlib_shared_sections;
+	p_shared->flight_slot = flight_monitor_slot();
+	p_shared->n_users = 0;
+	}
+	__atomic_add_fetch(&p_shared->n_users, 1, __ATOMIC_ACQ_REL);
+	m_shared = p_shared;
+
 	// objects created by "new" operator can be accessed using pointer, not name.
     m_watchArray = new PerfWatch[init_nWatch];
     m_nWatch = 0 ;
     m_order = NULL;
+    m_global_order = NULL;
+    m_nGlobal = 0;
+
+    m_interim_state = 0;
+    is_interim_dirty = false;
+    is_interim_fresh = false;
+    is_interim_comm_ready = false;
+    is_interim_persistent = false;
+    m_interim_nsec = 0;
+    m_interim_stride = 0;
+    m_interim_sendbuf = NULL;
+    m_interim_recvbuf = NULL;
+    m_interim_stats = NULL;
 	reserved_nWatch = init_nWatch;
 
     m_watchArray[0].my_rank = my_rank;
@@ -198,9 +339,25 @@ namespace pm_lib {
 //	increment the shared sections as well
     int id_shared;
     id_shared = add_shared_section(label);
+    m_watchArray[0].m_otf_id = id_shared;
 
     m_nWatch++;
+    m_watchArray[0].m_flight_slot = m_shared->flight_slot;
     m_watchArray[0].setProperties(label, id, CALC, num_process, my_rank, num_threads, false);
+    m_watchArray[0].m_comm = m_comm;
+
+// align the time stamps of the traces to rank 0, once per process by the master thread.
+// OTF is aligned by initializeOTF() as well
+	// The flag depends on the local file creation, so that all ranks agree on it
+	// before the collective ping-pong of alignClock().
+    if (my_thread == 0) {
+		#ifndef DISABLE_MPI
+		int i_aligned = is_clock_aligned ? 1 : 0;
+		if (num_process > 1) (void) MPI_Allreduce(MPI_IN_PLACE, &i_aligned, 1, MPI_INT, MPI_MIN, m_comm);
+		is_clock_aligned = (i_aligned != 0);
+		#endif
+		if (is_clock_aligned) m_watchArray[0].alignClock(0);
+	}
 
 // initialize OTF manager
     m_watchArray[0].initializeOTF();
@@ -227,7 +384,8 @@ namespace pm_lib {
 		s_chooser = cp_env;
 		if (s_chooser == "BASIC" ||
 			s_chooser == "DETAIL" ||
-			s_chooser == "FULL" ) {
+			s_chooser == "FULL" ||
+			s_chooser == "TOPK" ) {
 			;
 		} else {
 			printDiag("initialize()",  "unknown PMLIB_REPORT value [%s]. the default value [%s] is set.\n", cp_env, s_default.c_str());
@@ -235,9 +393,205 @@ namespace pm_lib {
 		}
 	}
 	env_str_report = s_chooser;
+
+// Parse the Environment Variable PMLIB_REPORT_FORMAT
+	// If given, the value should be one of {TEXT| JSON| CSV}
+	s_default = "TEXT";
+
+    cp_env = NULL;
+	cp_env = std::getenv("PMLIB_REPORT_FORMAT");
+	if (cp_env == NULL) {
+		s_chooser = s_default;	// default setting
+	} else {
+		s_chooser = cp_env;
+		std::transform(s_chooser.begin(), s_chooser.end(), s_chooser.begin(), toupper);
+		if (s_chooser == "TEXT" ||
+			s_chooser == "JSON" ||
+			s_chooser == "CSV" ) {
+			;
+		} else {
+			printDiag("initialize()",  "unknown PMLIB_REPORT_FORMAT value [%s]. the default value [%s] is set.\n", cp_env, s_default.c_str());
+			s_chooser = s_default;
+		}
+	}
+	env_str_report_format = s_chooser;
+
+// Parse the Environment Variable PMLIB_DETAIL_FILE
+	// the file name of the per rank detail output via MPI-IO
+    cp_env = NULL;
+	cp_env = std::getenv("PMLIB_DETAIL_FILE");
+	if (cp_env == NULL) {
+		env_str_detail_file = "";
+	} else {
+		env_str_detail_file = cp_env;
+	}
+
+// Parse the Environment Variable PMLIB_DUMP
+	// the file name prefix of the per process binary dump written at report()
+    cp_env = NULL;
+	cp_env = std::getenv("PMLIB_DUMP");
+	if (cp_env == NULL) {
+		env_str_dump = "";
+	} else {
+		env_str_dump = cp_env;
+	}
+
+// Parse the Environment Variable PMLIB_INTERVAL and PMLIB_INTERVAL_FILE
+	// the interval [sec] of the interim record written by each process
+	m_interval = 0.0;
+	m_interval_fp = NULL;
+	m_interval_last.clear();
+    cp_env = NULL;
+	cp_env = std::getenv("PMLIB_INTERVAL");
+	if (cp_env != NULL) {
+		double t = atof(cp_env);
+		if (t > 0.0) {
+			m_interval = t;
+		} else {
+			printDiag("initialize()",  "invalid PMLIB_INTERVAL value [%s]. the interim record is not written.\n", cp_env);
+		}
+	}
+	cp_env = std::getenv("PMLIB_INTERVAL_FILE");
+	if (cp_env == NULL) {
+		env_str_interval_file = "pmlib_interval";
+	} else {
+		env_str_interval_file = cp_env;
+	}
+	m_interval_base = m_watchArray[0].getTime();
+	m_interval_next = m_interval_base + m_interval;
+
+// Parse the Environment Variable PMLIB_SHM
+	// publish the live section values in the shared memory segment
+	m_shm = NULL;
+    cp_env = NULL;
+	cp_env = std::getenv("PMLIB_SHM");
+	if (cp_env != NULL) {
+		s_chooser = cp_env;
+		std::transform(s_chooser.begin(), s_chooser.end(), s_chooser.begin(), toupper);
+		if (s_chooser == "ON" || s_chooser == "YES") {
+			if (my_thread == 0) openShm();
+		} else if (s_chooser != "OFF" && s_chooser != "NO") {
+			printDiag("initialize()",  "unknown PMLIB_SHM value [%s]. the segment is not created.\n", cp_env);
+		}
+	}
+
+// Parse the Environment Variable PMLIB_PROMETHEUS_DIR and PMLIB_PROMETHEUS_INTERVAL
+	// the directory of the node-exporter textfile collector and the update interval [sec]
+	m_prom_interval = 0.0;
+    cp_env = NULL;
+	cp_env = std::getenv("PMLIB_PROMETHEUS_DIR");
+	if (cp_env != NULL && cp_env[0] != '\0') {
+		env_str_prom_dir = cp_env;
+		m_prom_interval = 10.0;
+		cp_env = std::getenv("PMLIB_PROMETHEUS_INTERVAL");
+		if (cp_env != NULL) {
+			double t = atof(cp_env);
+			if (t > 0.0) {
+				m_prom_interval = t;
+			} else {
+				printDiag("initialize()",  "invalid PMLIB_PROMETHEUS_INTERVAL value [%s]. 10 seconds is used.\n", cp_env);
+			}
+		}
+	}
+	m_prom_next = m_interval_base + m_prom_interval;
+
+// Parse the Environment Variable PMLIB_SIGNAL_DUMP and PMLIB_SIGNAL_FILE
+	// write a snapshot of the local sections after receiving the signal
+	is_signal_dump = false;
+	m_signal_nfile = 0;
+    cp_env = NULL;
+	cp_env = std::getenv("PMLIB_SIGNAL_DUMP");
+	if (cp_env != NULL) {
+		s_chooser = cp_env;
+		std::transform(s_chooser.begin(), s_chooser.end(), s_chooser.begin(), toupper);
+		int signum = 0;
+		if (s_chooser == "ON" || s_chooser == "YES" || s_chooser == "USR1" || s_chooser == "SIGUSR1") {
+			signum = SIGUSR1;
+		} else if (s_chooser == "USR2" || s_chooser == "SIGUSR2") {
+			signum = SIGUSR2;
+		} else if (s_chooser != "OFF" && s_chooser != "NO") {
+			printDiag("initialize()",  "unknown PMLIB_SIGNAL_DUMP value [%s]. the signal is not handled.\n", cp_env);
+		}
+		if (signum != 0) is_signal_dump = installSignalDump(signum);
+	}
+	cp_env = std::getenv("PMLIB_SIGNAL_FILE");
+	if (cp_env == NULL) {
+		env_str_signal_file = "pmlib_signal";
+	} else {
+		env_str_signal_file = cp_env;
+	}
+	m_signal_seen = signal_dump_count;
+
+// Parse the Environment Variable PMLIB_TOPK
+	// the number of the slowest/fastest processes in PMLIB_REPORT=TOPK
+	m_topk = 5;
+    cp_env = NULL;
+	cp_env = std::getenv("PMLIB_TOPK");
+	if (cp_env != NULL) {
+		int k = atoi(cp_env);
+		if (k > Max_topk) {
+			printDiag("initialize()",  "PMLIB_TOPK value [%s] is too large. the maximum value [%d] is set.\n", cp_env, Max_topk);
+			m_topk = Max_topk;
+		} else
+		if (k > 0) {
+			m_topk = k;
+		} else {
+			printDiag("initialize()",  "invalid PMLIB_TOPK value [%s]. the default value [%d] is set.\n", cp_env, m_topk);
+		}
+	}
+
+// Parse the Environment Variable PMLIB_GATHER
+	// If given, the value should be one of {ALL | ROOT | NODE}
+	// NODE is the node-leader shared-window mode.
+	s_default = "ALL";
+
+    cp_env = NULL;
+	cp_env = std::getenv("PMLIB_GATHER");
+	if (cp_env == NULL) {
+		s_chooser = s_default;	// default setting
+	} else {
+		s_chooser = cp_env;
+		if (s_chooser == "ALL" ||
+			s_chooser == "ROOT" ||
+			s_chooser == "NODE" ) {
+			;
+		} else {
+			printDiag("initialize()",  "unknown PMLIB_GATHER value [%s]. the default value [%s] is set.\n", cp_env, s_default.c_str());
+			s_chooser = s_default;
+		}
+	}
+	env_str_gather = s_chooser;
+	m_watchArray[0].m_gather_root = (env_str_gather != "ALL");
+
+	is_node_comm_ready = false;
+	num_nodes = 1;
+	num_process_on_node = 1;
+	my_rank_on_node = 0;
+	m_node_hosts = NULL;
+	m_node_stats = NULL;
+  }
+
+
+
+  /// デストラクタ.
+  ///
+  PerfMonitor::~PerfMonitor()
+  {
+    releaseShared();
   }
 
 
+  /// スレッド間で共有する区間の表の参照をやめ、最後の利用者であれば解放する
+  ///
+  void PerfMonitor::releaseShared(void)
+  {
+    if (m_shared == NULL) return;
+    if (__atomic_sub_fetch(&m_shared->n_users, 1, __ATOMIC_ACQ_REL) == 0) {
+      delete m_shared;
+    }
+    m_shared = NULL;
+  }
+
 
   /// 測定区間にプロパティを設定.
   ///
@@ -266,9 +620,11 @@ namespace pm_lib {
 	#endif
 
     int id, id_shared;
+    bool is_new_section = false;
     id = find_section_object(label);
 	if (id < 0) {
     	id = add_section_object(label);
+    	is_new_section = true;
    		id_shared = add_shared_section(label);
 
     	#ifdef DEBUG_PRINT_MONITOR
@@ -286,7 +642,8 @@ namespace pm_lib {
 //
     if ((m_nWatch+1) >= reserved_nWatch) {
 
-      reserved_nWatch = m_nWatch + init_nWatch;
+      // grow geometrically so that the total copy cost stays linear in m_nWatch
+      reserved_nWatch = std::max(m_nWatch + init_nWatch, m_nWatch + m_nWatch/2);
       PerfWatch* watch_more = new PerfWatch[reserved_nWatch];
       if (watch_more == NULL) {
         printDiag("setProperties()", "memory allocation failed. [%s] is not added.\n", label.c_str());
@@ -309,8 +666,12 @@ namespace pm_lib {
     }
 
     is_exclusive_construct = exclusive;
-    m_nWatch++;
+    if (is_new_section) m_nWatch++;
+    m_watchArray[id].m_flight_slot = m_shared->flight_slot;
     m_watchArray[id].setProperties(label, id, type, num_process, my_rank, num_threads, exclusive);
+    m_watchArray[id].m_gather_root = (env_str_gather != "ALL");
+    m_watchArray[id].m_comm = m_comm;
+    if (is_new_section) m_watchArray[id].m_otf_id = id_shared;
 
   }
 
@@ -432,12 +793,17 @@ namespace pm_lib {
 
     is_exclusive_construct = true;
 
+    // the file output of the polls is done before the start time is taken,
+    // so that it is not counted in the time of this section.
+    if (m_interval > 0.0) writeInterval();
+    if (is_signal_dump && signal_dump_count != m_signal_seen) writeSignalDump();
+    if (m_prom_interval > 0.0) writePrometheus();
+
     m_watchArray[id].start();
 	#ifdef USE_POWER
 	if (level_POWER != 0)
     m_watchArray[id].power_start( pm_pacntxt, pm_extcntxt, pm_obj_array, pm_obj_ext);
 	#endif
-
   }
 
 
@@ -479,6 +845,11 @@ namespace pm_lib {
     }
     is_exclusive_construct = false;
 
+    // the polls come after the stop time of this section is taken.
+    if (m_shm != NULL) publishShm(id);
+    if (m_interval > 0.0) writeInterval();
+    if (is_signal_dump && signal_dump_count != m_signal_seen) writeSignalDump();
+    if (m_prom_interval > 0.0) writePrometheus();
   }
 
 
@@ -566,6 +937,11 @@ namespace pm_lib {
 
     	is_Root_active = false;
     }
+
+    // The final report always gathers the values again. The snapshot of
+    // gatherStart() is used only for the interim output before it.
+    if (m_interim_state != 0) gatherWait();
+    is_interim_fresh = false;
   }
 
   /// Count the number of shared measured sections
@@ -580,7 +956,9 @@ namespace pm_lib {
 	std::string p_label;
 	int id;
 
-	n_shared_sections = shared_map_sections.size();	// this is the shared value for all threads
+	n_shared_sections = 0;
+	if (m_shared == NULL) return;
+	n_shared_sections = m_shared->map_sections.size();	// this is the shared value for all threads
 
 	#ifdef DEBUG_PRINT_MONITOR
     //	if (my_rank == 0) {
@@ -590,12 +968,10 @@ namespace pm_lib {
 	//	}
 	#endif
 
-	if (n_shared_sections == m_nWatch) return; // The master thread contains all the shared sections
-
+	if (n_shared_sections != m_nWatch) {
 	// Add the missing section object instances in the master thread
-	std::map<std::string, int>::const_iterator it;
-	for(it = shared_map_sections.begin(); it != shared_map_sections.end(); ++it) {
-		p_label = it->first;
+	for (int i=0; i<n_shared_sections; i++) {
+		p_label = m_shared->section_labels[i];
 		if ( find_section_object(p_label) >= 0)  continue;
 		PerfMonitor::setProperties(p_label);
 		id = find_section_object(p_label);
@@ -607,6 +983,20 @@ namespace pm_lib {
 		//	}
 		#endif
 	}
+	}
+
+	// prepare the reduction buffer of the thread merge for the sections
+	// inside of parallel region. The other sections do not need it.
+	if ((int)m_shared->slot_index.size() < n_shared_sections) {
+		m_shared->slot_index.resize(n_shared_sections, -1);
+	}
+	for (int i=0; i<m_nWatch; i++) {
+		if ( !m_watchArray[i].m_in_parallel ) continue;
+		auto it = m_shared->map_sections.find(m_watchArray[i].m_label);
+		if (it == m_shared->map_sections.end() || m_shared->slot_index[it->second] >= 0) continue;
+		m_shared->slot_index[it->second] = m_shared->thread_slots.size();
+		m_shared->thread_slots.push_back(pmlib_thread_slots());
+	}
 
 	#ifdef DEBUG_PRINT_MONITOR
     //	if (my_rank == 0) {
@@ -633,7 +1023,7 @@ namespace pm_lib {
 
     if (!is_PMlib_enabled) return;
 
-	int n_shared_sections = shared_map_sections.size();
+	int n_shared_sections = m_shared->map_sections.size();
 
     if ((id<0) || (n_shared_sections<=id)) {
 		fprintf(stderr, "*** PMlib internal Error <SerialParallelRegion> section id=%d is out of range\n", id);
@@ -643,15 +1033,8 @@ namespace pm_lib {
 
 	std::string s;
 
-	mid=-1;
-	for (auto it=shared_map_sections.begin(); it != shared_map_sections.end(); ++it)
-	{
-    	if (it->second == id) {
-			s = it->first;
-			mid = find_section_object(s);
-			break;
-		}
-	}
+	s = m_shared->section_labels[id];
+	mid = find_section_object(s);
 	if ( (mid<0) || (mid>=n_shared_sections) ) {
 		// Well, this class instance does not contain the section labeled "s".
 		// So the id in the shared section map must have been defined by some other class instance
@@ -676,7 +1059,7 @@ namespace pm_lib {
 
 
 
-  ///  Merge the parallel thread data into the master thread in three steps. 
+  ///  Merge the parallel thread data of one section into the master thread.
   ///
   ///   @param[in] id    shared section number
   ///
@@ -696,16 +1079,13 @@ namespace pm_lib {
 	std::string s;
 
 	// identify the section label for id
-	for (auto it=shared_map_sections.begin(); it != shared_map_sections.end(); ++it)
-	{
-    	if (it->second == id) {
-			s = it->first;
-			// search for section id in local thread
-			// if found, mid returns the local section id. if not, mid=-1.
-			mid = find_section_object(s);
-			break;
-		}
+	// search for section id in local thread
+	// if found, mid returns the local section id. if not, mid=-1.
+	if (0 <= id && id < (int)m_shared->section_labels.size()) {
+		s = m_shared->section_labels[id];
+		mid = find_section_object(s);
 	}
+	struct pmlib_thread_slots* slot = find_thread_slot(m_shared, id);
 
 	#ifdef DEBUG_PRINT_MONITOR
     if (my_rank == 0) {
@@ -719,13 +1099,63 @@ namespace pm_lib {
 	#endif
 
 	#pragma omp barrier
-	if ( mid>=0 ) m_watchArray[mid].mergeMasterThread();
+	if ( mid>=0 && slot != NULL ) m_watchArray[mid].writeThreadSlot(*slot);
 	#pragma omp barrier
-	if ( mid>=0 ) m_watchArray[mid].mergeParallelThread();
+	if ( mid>=0 ) m_watchArray[mid].mergeThreadSlots(slot);
 	#pragma omp barrier
-	if ( mid>=0 ) m_watchArray[mid].updateMergedThread();
+
+#endif
+  }
+
+
+
+  ///  Merge the thread data of all the sections into the master thread at once.
+  ///
+  /// @note
+  /// Each thread writes the values of its parallel sections into the shared
+  /// reduction buffer, and after a single barrier the master thread merges
+  /// the buffer into its sections. Compared with mergeThreads(id), which
+  /// needs a parallel region and barriers per section, the cost of the
+  /// synchronization does not grow with the number of the sections.
+  /// If some sections have been measured inside of parallel region, this
+  /// routine must be called by all threads from one parallel region.
+  ///
+  void PerfMonitor::mergeAllThreads (void)
+  {
+    if (!is_PMlib_enabled) return;
+#ifdef _OPENMP
+	int i_thread = omp_get_thread_num();
+
+	// step 1. the parallel threads write their values into the buffer
+	if (i_thread != 0) {
+		for (int i=0; i<m_nWatch; i++) {
+			if ( !m_watchArray[i].m_in_parallel ) continue;
+			auto it = m_shared->map_sections.find(m_watchArray[i].m_label);
+			if (it == m_shared->map_sections.end()) continue;
+			struct pmlib_thread_slots* slot = find_thread_slot(m_shared, it->second);
+			if (slot != NULL) m_watchArray[i].writeThreadSlot(*slot);
+		}
+	}
+
 	#pragma omp barrier
 
+	// step 2. the master thread merges the buffer into its sections
+	if (i_thread == 0) {
+		for (int i=0; i<m_nWatch; i++) {
+			struct pmlib_thread_slots* slot = NULL;
+			if ( m_watchArray[i].m_in_parallel ) {
+				auto it = m_shared->map_sections.find(m_watchArray[i].m_label);
+				if (it != m_shared->map_sections.end()) slot = find_thread_slot(m_shared, it->second);
+			}
+			m_watchArray[i].mergeThreadSlots(slot);
+		}
+	}
+
+	#ifdef DEBUG_PRINT_MONITOR
+    if (my_rank == 0 && i_thread == 0) {
+		fprintf(stderr, "<mergeAllThreads> merged %d sections of %d threads \n" , m_nWatch, num_threads);
+	}
+	#endif
 #endif
   }
 
@@ -758,113 +1188,1215 @@ namespace pm_lib {
   }
 
 
-  /// 全プロセスの測定中経過情報を集約
+  /// 全プロセスの測定途中経過の集約を開始する (non-blocking)
   ///
-  ///   @note  以下の処理を行う。
-  ///    各測定区間の全プロセス途中経過状況を集約。
-  ///    測定結果の平均値・標準偏差などの基礎的な統計計算。
-  ///    各測定区間のHWPCイベントの統計値を取得する。
-  ///   @note  gather_and_stats() は複数回呼び出し可能。
+  ///   @note  gather_and_stats() と同じ形式のバッファに自プロセスの測定値を詰め、
+  ///    非同期の集団通信を開始する。集団通信はアプリの通信と順序が干渉しないように
+  ///    測定対象のcommunicator m_comm を複製したcommunicator上で行う。
+  ///    集約する区間数は前回の照合で全プロセスが合意した m_nGlobal なので、
+  ///    各プロセスの通信量は常に一致する。照合後に区間が追加された場合は
+  ///    変更フラグが同時にリダクションされ、次回の gatherStart() で照合し直す。
+  ///    MPI-4 では永続集団通信 (MPI_*_init) を作成し、バッファ長が変わらない限り再利用する。
   ///
-  void PerfMonitor::gather_and_stats(void)
+  void PerfMonitor::gatherStart(void)
   {
-
     if (!is_PMlib_enabled) return;
+    if (m_nWatch == 0) return;
 
-    if (m_nWatch == 0) return; // There is no section defined yet. This is basically an error case.
+    if (m_interim_state != 0) gatherWait();
+    is_interim_fresh = false;
 
-    // For each of the sections,
-	// allgather the HWPC event values of all processes in MPI_COMM_WORLD.
-	// Calibrate some numbers to represent the process value as the sum of thread values
+    if (num_process <= 1) {
+      gather_and_stats();
+      is_interim_fresh = true;
+      return;
+    }
 
-    for (int i=0; i<m_nWatch; i++) {
-      m_watchArray[i].gatherHWPC();
+#ifndef DISABLE_MPI
+    int iret;
+
+    // The section tables must agree before the non-blocking exchange.
+    if (m_global_order == NULL || is_interim_dirty) {
+      reconcile_sections();
+      is_interim_dirty = false;
     }
 
-	//   Allgather the process level basic statistics of m_time, m_flop, m_count
-    for (int i = 0; i < m_nWatch; i++) {
-        m_watchArray[i].gather();
+    int n_hwpc = 0;
+    for (int i=0; i<m_nWatch; i++) {
+      int n_sorted = m_watchArray[i].calibrateHWPC();
+      if (n_sorted > n_hwpc) n_hwpc = n_sorted;
+    }
+    int n_sec = m_nGlobal;
+    int stride = 3 + n_hwpc;
+    int row_len = n_sec * stride;
+    bool is_root_gather = (env_str_gather != "ALL");
+
+    // (re)allocate the buffers. The persistent requests are bound to them.
+    if ( n_sec != m_interim_nsec || stride != m_interim_stride ) {
+      interim_free();
+      m_interim_nsec = n_sec;
+      m_interim_stride = stride;
+      if ( !(m_interim_sendbuf = new double[row_len]) ) PM_Exit(0);
+      if ( !is_root_gather || my_rank == 0 ) {
+        if ( !(m_interim_recvbuf = new double[(size_t)row_len*num_process]) ) PM_Exit(0);
+      }
+      if ( is_root_gather ) {
+        if ( !(m_interim_stats = new pmlib_section_stats[2*n_sec]) ) PM_Exit(0);
+      }
+    }
+    // created after the (re)allocation, since interim_free() releases it
+    if (!is_interim_comm_ready) {
+      iret = MPI_Comm_dup(m_comm, &m_comm_interim);
+      if ( iret != MPI_SUCCESS ) {
+        fprintf(stderr, "*** PMlib error. <gatherStart> MPI_Comm_dup failed. iret=%d\n", iret);
+        PM_Exit(0);
+      }
+      is_interim_comm_ready = true;
     }
 
-    //	summary stats including the average, standard deviation, etc.
-    for (int i = 0; i < m_nWatch; i++) {
-      m_watchArray[i].statsAverage();
+    // snapshot of the local values in the agreed global order
+    for (int i = 0; i < n_sec; i++) {
+      m_watchArray[m_global_order[i]].packGather(&m_interim_sendbuf[i*stride], n_hwpc);
+      if ( is_root_gather ) {
+        m_watchArray[m_global_order[i]].packStats(&m_interim_stats[i]);
+      }
     }
+    m_interim_flag[0] = (m_nWatch > m_nGlobal) ? 1 : 0;
 
-	//  summary stats of the estimated power consumption. Only the Root section does this.
-	if (level_POWER != 0)
-    m_watchArray[0].gatherPOWER();
+    MPI_Datatype stats_type;
+    MPI_Op stats_op;
+    if ( is_root_gather ) {
+      if ( stats_mpi_type(&stats_type, &stats_op) != MPI_SUCCESS ) PM_Exit(0);
+    }
 
+#if MPI_VERSION >= 4
+    if ( !is_interim_persistent ) {
+      iret = MPI_Allreduce_init(&m_interim_flag[0], &m_interim_flag[1], 1, MPI_INT, MPI_MAX,
+                                m_comm_interim, MPI_INFO_NULL, &m_interim_req[0]);
+      if ( is_root_gather ) {
+        if ( iret == MPI_SUCCESS )
+        iret = MPI_Gather_init(m_interim_sendbuf, row_len, MPI_DOUBLE,
+                               m_interim_recvbuf, row_len, MPI_DOUBLE, 0,
+                               m_comm_interim, MPI_INFO_NULL, &m_interim_req[1]);
+        if ( iret == MPI_SUCCESS )
+        iret = MPI_Allreduce_init(&m_interim_stats[0], &m_interim_stats[n_sec], n_sec,
+                                  stats_type, stats_op, m_comm_interim, MPI_INFO_NULL, &m_interim_req[2]);
+      } else {
+        if ( iret == MPI_SUCCESS )
+        iret = MPI_Allgather_init(m_interim_sendbuf, row_len, MPI_DOUBLE,
+                                  m_interim_recvbuf, row_len, MPI_DOUBLE,
+                                  m_comm_interim, MPI_INFO_NULL, &m_interim_req[1]);
+        m_interim_req[2] = MPI_REQUEST_NULL;
+      }
+      if ( iret != MPI_SUCCESS ) {
+        fprintf(stderr, "*** PMlib error. <gatherStart> persistent collective init failed. iret=%d\n", iret);
+        PM_Exit(0);
+      }
+      is_interim_persistent = true;
+    }
+    iret = MPI_Startall(is_root_gather ? 3 : 2, m_interim_req);
+#else
+    iret = MPI_Iallreduce(&m_interim_flag[0], &m_interim_flag[1], 1, MPI_INT, MPI_MAX,
+                          m_comm_interim, &m_interim_req[0]);
+    if ( is_root_gather ) {
+      if ( iret == MPI_SUCCESS )
+      iret = MPI_Igather(m_interim_sendbuf, row_len, MPI_DOUBLE,
+                         m_interim_recvbuf, row_len, MPI_DOUBLE, 0,
+                         m_comm_interim, &m_interim_req[1]);
+      if ( iret == MPI_SUCCESS )
+      iret = MPI_Iallreduce(&m_interim_stats[0], &m_interim_stats[n_sec], n_sec,
+                            stats_type, stats_op, m_comm_interim, &m_interim_req[2]);
+    } else {
+      if ( iret == MPI_SUCCESS )
+      iret = MPI_Iallgather(m_interim_sendbuf, row_len, MPI_DOUBLE,
+                            m_interim_recvbuf, row_len, MPI_DOUBLE,
+                            m_comm_interim, &m_interim_req[1]);
+      m_interim_req[2] = MPI_REQUEST_NULL;
+    }
+#endif
+    if ( iret != MPI_SUCCESS ) {
+      fprintf(stderr, "*** PMlib error. <gatherStart> non-blocking collective failed. iret=%d\n", iret);
+      PM_Exit(0);
+    }
+    m_interim_state = 1;
+#endif
   }
 
 
-  /// 経過時間でソートした測定区間のリストm_order[m_nWatch] を作成する。
-  /// Remark.
-  /// 	Each process stores its own sorted list. Be careful when reporting from rank 0.
+  /// gatherStart() で開始した集約の進行を確認する
   ///
+  ///   @return  true : 集約が完了して統計値が更新された、または集約中ではない
+  ///            false : 集約は進行中
   ///
-  void PerfMonitor::sort_m_order(void)
+  ///   @note  通信を進めるために、計算の合間に適宜呼び出すとよい。
+  ///
+  bool PerfMonitor::gatherTest(void)
   {
-    if (!is_PMlib_enabled) return;
-    if (m_nWatch == 0) return;
+    if (!is_PMlib_enabled) return true;
+    if (m_interim_state == 0) return true;
+
+#ifndef DISABLE_MPI
+    int flag = 0;
+    int iret = MPI_Testall(3, m_interim_req, &flag, MPI_STATUSES_IGNORE);
+    if ( iret != MPI_SUCCESS ) {
+      fprintf(stderr, "*** PMlib error. <gatherTest> MPI_Testall failed. iret=%d\n", iret);
+      PM_Exit(0);
+    }
+    if (!flag) return false;
+    interim_apply();
+#endif
+    return true;
+  }
 
-	#ifdef DEBUG_PRINT_MONITOR
-    fprintf(stderr, "<sort_m_order> starts. my_rank=%d, num_process=%d \n\n", my_rank, num_process);
-	#endif
 
-    // 経過時間でソートした測定区間のリストm_order[m_nWatch] を作成する
-    // This delete/new may look redundant, but is needed if m_nWatch has
-    // increased since last call...
-    if ( m_order != NULL) { delete[] m_order; m_order = NULL; }
-    if ( !(m_order = new unsigned[m_nWatch]) ) PM_Exit(0);
+  /// gatherStart() で開始した集約の完了を待つ
+  ///
+  void PerfMonitor::gatherWait(void)
+  {
+    if (m_interim_state == 0) return;
 
-    for (int i=0; i<m_nWatch; i++) {
-      m_order[i] = i;
+#ifndef DISABLE_MPI
+    int iret = MPI_Waitall(3, m_interim_req, MPI_STATUSES_IGNORE);
+    if ( iret != MPI_SUCCESS ) {
+      fprintf(stderr, "*** PMlib error. <gatherWait> MPI_Waitall failed. iret=%d\n", iret);
+      PM_Exit(0);
     }
+    interim_apply();
+#endif
+  }
 
-    double *m_tcost = NULL;
-    if ( !(m_tcost = new double[m_nWatch]) ) PM_Exit(0);
-    for (int i = 0; i < m_nWatch; i++) {
-      PerfWatch& w = m_watchArray[i];
-      if ( w.m_count_sum > 0 ) {
-        m_tcost[i] = w.m_time_av;
-      } else {
-        m_tcost[i] = 0.0;
+
+  /// 完了した途中集約の結果から各測定区間の統計値を作成する
+  ///
+  ///   @note  gather_and_stats() と同じ配列と統計値が作成される。
+  ///    ただしノード別集計値 (PMLIB_GATHER=NODE) は作成されない。
+  ///
+  void PerfMonitor::interim_apply(void)
+  {
+    m_interim_state = 0;
+    is_interim_fresh = true;
+    if (m_interim_flag[1] != 0) is_interim_dirty = true;
+
+    int n_sec = m_interim_nsec;
+    int stride = m_interim_stride;
+    int row_len = n_sec * stride;
+    bool is_root_gather = (env_str_gather != "ALL");
+
+    if ( m_interim_recvbuf != NULL ) {
+      for (int i = 0; i < n_sec; i++) {
+        m_watchArray[m_global_order[i]].unpackGather(m_interim_recvbuf, i*stride, row_len);
       }
     }
-    // 降順ソート O(n^2) Brute force　
-    double tmp_d;
-    unsigned tmp_u;
-    for (int i=0; i<m_nWatch-1; i++) {
-      PerfWatch& w = m_watchArray[i];
-      if (w.m_label.empty()) continue;  //
-      for (int j=i+1; j<m_nWatch; j++) {
-        PerfWatch& q = m_watchArray[j];
-        if (q.m_label.empty()) continue;  //
-        if ( m_tcost[i] < m_tcost[j] ) {
-          tmp_d=m_tcost[i]; m_tcost[i]=m_tcost[j]; m_tcost[j]=tmp_d;
-          tmp_u=m_order[i]; m_order[i]=m_order[j]; m_order[j]=tmp_u;
-        }
+    if ( is_root_gather ) {
+      for (int i = 0; i < n_sec; i++) {
+        m_watchArray[m_global_order[i]].statsReduction(&m_interim_stats[n_sec+i]);
+      }
+      // the per node aggregates are not updated by the interim gather
+      if (m_node_stats != NULL) { delete[] m_node_stats; m_node_stats = NULL; }
+    } else {
+      for (int i = 0; i < n_sec; i++) {
+        m_watchArray[m_global_order[i]].statsAverage();
       }
     }
-    delete[] m_tcost; m_tcost = NULL;
+  }
 
-	#ifdef DEBUG_PRINT_MONITOR
-	(void) MPI_Barrier(MPI_COMM_WORLD);
-    	fprintf(stderr, "<sort_m_order> my_rank=%d, num_process=%d \n", my_rank, num_process);
-		for (int j=0; j<m_nWatch; j++) {
-		int k=m_order[j];
-		fprintf(stderr, "\t\t m_order[%d]=%d time_av=%10.2e [%s]\n",
-		j, k, m_watchArray[k].m_time_av, m_watchArray[k].m_label.c_str());
-		}
-		fprintf(stderr, "<sort_m_order> ends\n");
-	#endif
 
+  /// 途中集約のバッファと永続通信request、複製したcommunicatorを解放する
+  ///
+  ///   @note  通信中の途中集約が無い状態で呼ぶ
+  ///
+  void PerfMonitor::interim_free(void)
+  {
+#ifndef DISABLE_MPI
+#if MPI_VERSION >= 4
+    if ( is_interim_persistent ) {
+      for (int k = 0; k < 3; k++) {
+        if (m_interim_req[k] != MPI_REQUEST_NULL) MPI_Request_free(&m_interim_req[k]);
+      }
+      is_interim_persistent = false;
+    }
+#endif
+#endif
+    if ( m_interim_sendbuf != NULL ) { delete[] m_interim_sendbuf; m_interim_sendbuf = NULL; }
+    if ( m_interim_recvbuf != NULL ) { delete[] m_interim_recvbuf; m_interim_recvbuf = NULL; }
+    if ( m_interim_stats != NULL ) { delete[] m_interim_stats; m_interim_stats = NULL; }
+    m_interim_nsec = 0;
+    m_interim_stride = 0;
+#ifndef DISABLE_MPI
+    if ( is_interim_comm_ready ) {
+      MPI_Comm_free(&m_comm_interim);
+      is_interim_comm_ready = false;
+    }
+#endif
   }
-  
 
-  //> PMlib report controll routine for outside parallel regions
-  ///	@brief
+
+#ifndef DISABLE_MPI
+  /// 測定区間ラベルのハッシュ値 (FNV-1a 64bit)
+  ///
+  static unsigned long label_hash (const std::string& label)
+  {
+    unsigned long h = 14695981039346656037UL;
+    for (size_t k = 0; k < label.size(); k++) {
+      h ^= (unsigned char)label[k];
+      h *= 1099511628211UL;
+    }
+    return h;
+  }
+#endif
+
+
+  /// PMLIB_INTERVALの間隔で自プロセスの測定値の途中記録を出力する
+  ///
+  ///   @param[in] is_final  間隔によらず出力し、ファイルを閉じる (report()から呼ぶ)
+  ///
+  ///   @note  ジョブが report() に到達せずに終了しても測定値が残るように、
+  ///    各プロセスが自分のファイル prefix.RRRRRR.csv に追記し、その都度 flush する。
+  ///    測定区間は止めずに、測定中の区間は現在までの時間を含めて記録する。
+  ///    前回の記録から時間が変化した区間だけを1行ずつ出力する。
+  ///    区間のラベルは初めて記録する時に "#S id label" の行で出力する。
+  ///    スレッド毎のPerfMonitorを持つ場合はマスタースレッドだけが出力する。
+  ///
+  void PerfMonitor::writeInterval(bool is_final)
+  {
+    if (my_thread != 0) return;
+    double now = m_watchArray[0].getTime();
+    if (!is_final && now < m_interval_next) return;
+    m_interval_next = now + m_interval;
+
+    if (m_interval_fp == NULL) {
+      char filename[512];
+      snprintf(filename, sizeof(filename), "%s.%06d.csv", env_str_interval_file.c_str(), my_rank);
+      m_interval_fp = fopen(filename, "w");
+      if (m_interval_fp == NULL) {
+        printDiag("writeInterval()", "can not open the interim record file [%s]. PMLIB_INTERVAL is disabled.\n", filename);
+        m_interval = 0.0;
+        return;
+      }
+      fprintf(m_interval_fp, "# PMlib interim record. PMlib version %s\n", PM_VERSION);
+      fprintf(m_interval_fp, "# rank %d of %d processes, interval %.3f [sec]\n", my_rank, num_process, m_interval);
+      fprintf(m_interval_fp, "elapsed,section,calls,time,operations\n");
+    }
+
+    double elapsed = now - m_interval_base;
+    double v[3];
+    for (int i=0; i<m_nWatch; i++) {
+      if (i >= (int)m_interval_last.size()) {
+        fprintf(m_interval_fp, "#S %d %s\n", i, m_watchArray[i].m_label.c_str());
+        m_interval_last.push_back(-1.0);
+      }
+      m_watchArray[i].packSnapshot(now, v);
+      if (v[0] == m_interval_last[i]) continue;
+      m_interval_last[i] = v[0];
+      fprintf(m_interval_fp, "%.6e,%d,%ld,%.9e,%.9e\n", elapsed, i, (long)v[2], v[0], v[1]);
+    }
+    fflush(m_interval_fp);
+
+    if (is_final) {
+      fclose(m_interval_fp);
+      m_interval_fp = NULL;
+      m_interval = 0.0;
+    }
+  }
+
+
+  /// PMLIB_SIGNAL_DUMP のシグナルハンドラを登録する
+  ///
+  ///   @param[in] signum  シグナル番号 (SIGUSR1 または SIGUSR2)
+  ///
+  ///   @return  登録できた場合true
+  ///
+  ///   @note  プロセスで1度だけ登録し、複数のPerfMonitorインスタンスで共有する。
+  ///    登録前のシグナル動作は保存し、最後の利用者の restoreSignalDump() で戻す。
+  ///
+  bool PerfMonitor::installSignalDump(int signum)
+  {
+    bool is_ok = true;
+#ifdef _OPENMP
+    #pragma omp critical (pmlib_signal_dump)
+#endif
+    {
+    if (signal_dump_signum == 0) {
+      struct sigaction sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_sigaction = signal_dump_handler;
+      sigemptyset(&sa.sa_mask);
+      sa.sa_flags = SA_RESTART | SA_SIGINFO;
+      if (sigaction(signum, &sa, &signal_dump_old_action) == 0) {
+        signal_dump_signum = signum;
+      } else {
+        is_ok = false;
+      }
+    } else if (signal_dump_signum != signum) {
+      is_ok = false;
+    }
+    if (is_ok) signal_dump_users++;
+    }
+    if (!is_ok) {
+      printDiag("installSignalDump()", "can not handle the signal %d. PMLIB_SIGNAL_DUMP is disabled.\n", signum);
+    }
+    return is_ok;
+  }
+
+
+  /// PMLIB_SIGNAL_DUMP の登録を解除する
+  ///
+  ///   @note  最後の利用者が解除した時点で、登録前のアプリケーションの
+  ///    シグナル動作に戻す。
+  ///
+  void PerfMonitor::restoreSignalDump(void)
+  {
+#ifdef _OPENMP
+    #pragma omp critical (pmlib_signal_dump)
+#endif
+    {
+    if (signal_dump_users > 0 && --signal_dump_users == 0) {
+      (void) sigaction(signal_dump_signum, &signal_dump_old_action, NULL);
+      signal_dump_signum = 0;
+    }
+    }
+    is_signal_dump = false;
+  }
+
+
+  /// シグナル受信後に自プロセスの測定値のスナップショットを出力する (PMLIB_SIGNAL_DUMP)
+  ///
+  ///   @note  シグナルを受信した後の最初の start()/stop() から呼ばれる。
+  ///    集団通信は行わず、各プロセスが自分のファイル prefix.RRRRRR.NNN.txt に
+  ///    区間毎の測定値と、測定中の区間の経過時間を出力する。NNN はスナップショットの番号。
+  ///    測定区間は止めずに、測定中の区間は現在までの時間を含めて出力する。
+  ///    スレッド毎のPerfMonitorを持つ場合はマスタースレッドだけが出力する。
+  ///
+  void PerfMonitor::writeSignalDump(void)
+  {
+    if (my_thread != 0) return;
+    m_signal_seen = signal_dump_count;
+
+    char filename[512];
+    snprintf(filename, sizeof(filename), "%s.%06d.%03d.txt", env_str_signal_file.c_str(), my_rank, m_signal_nfile++);
+    FILE* fp = fopen(filename, "w");
+    if (fp == NULL) {
+      printDiag("writeSignalDump()", "can not open the snapshot file [%s].\n", filename);
+      return;
+    }
+
+    double now = m_watchArray[0].getTime();
+    char hostname[512];
+    if (gethostname(hostname, sizeof(hostname)) != 0) strcpy(hostname, "unknown");
+    fprintf(fp, "# PMlib snapshot. PMlib version %s\n", PM_VERSION);
+    fprintf(fp, "# rank %d of %d processes, host %s, pid %d\n", my_rank, num_process, hostname, (int)getpid());
+    fprintf(fp, "# elapsed %.6e [sec] since initialize()\n", now - m_interval_base);
+    fprintf(fp, "#\n");
+    fprintf(fp, "# %-30s %12s %16s %16s %16s\n", "Label", "calls", "time[sec]", "operations", "running[sec]");
+
+    double v[3];
+    int n_running = 0;
+    for (int i=0; i<m_nWatch; i++) {
+      m_watchArray[i].packSnapshot(now, v);
+      double t_run = m_watchArray[i].runningTime(now);
+      if (t_run >= 0.0) n_running++;
+      fprintf(fp, "  %-30s %12ld %16.9e %16.9e ", m_watchArray[i].m_label.c_str(), (long)v[2], v[0], v[1]);
+      if (t_run >= 0.0) {
+        fprintf(fp, "%16.9e\n", t_run);
+      } else {
+        fprintf(fp, "%16s\n", "-");
+      }
+    }
+    fprintf(fp, "# %d sections, %d running\n", m_nWatch, n_running);
+    fclose(fp);
+  }
+
+
+  /// Prometheusのラベル値のエスケープ (バックスラッシュ、ダブルクォート、改行)
+  static std::string prom_escape(const std::string& s)
+  {
+    std::string r;
+    for (size_t i=0; i<s.size(); i++) {
+      if (s[i] == '\\' || s[i] == '"') {
+        r += '\\';
+        r += s[i];
+      } else if (s[i] == '\n') {
+        r += "\\n";
+      } else {
+        r += s[i];
+      }
+    }
+    return r;
+  }
+
+
+  /// 自プロセスの測定値をPrometheusのテキスト形式で出力する (PMLIB_PROMETHEUS_DIR)
+  ///
+  ///   @param[in] is_final  間隔によらず出力し、以後は出力しない (report()から呼ぶ)
+  ///
+  ///   @note  node-exporter の textfile collector が読むディレクトリに、
+  ///    各プロセスが pmlib_RRRRRR.prom を PMLIB_PROMETHEUS_INTERVAL 秒毎に書く。
+  ///    一時ファイルに書いてから rename() するので、読み手が途中の内容を見ることはない。
+  ///    次の start()/stop() で間隔を判定し、ロックも集団通信も行わない。
+  ///    測定中の区間の時間は現在までを含める。HWPCは生のイベント数を counter として出力し、
+  ///    レートは Prometheus 側の rate() で求める。
+  ///    スレッド毎のPerfMonitorを持つ場合はマスタースレッドだけが出力する。
+  ///
+  void PerfMonitor::writePrometheus(bool is_final)
+  {
+    if (my_thread != 0) return;
+    double now = m_watchArray[0].getTime();
+    if (!is_final && now < m_prom_next) return;
+    m_prom_next = now + m_prom_interval;
+
+    char filename[512], tmpname[512];
+    snprintf(filename, sizeof(filename), "%s/pmlib_%06d.prom", env_str_prom_dir.c_str(), my_rank);
+    snprintf(tmpname, sizeof(tmpname), "%s/.pmlib_%06d.prom.%d", env_str_prom_dir.c_str(), my_rank, (int)getpid());
+    FILE* fp = fopen(tmpname, "w");
+    if (fp == NULL) {
+      printDiag("writePrometheus()", "can not open [%s]. PMLIB_PROMETHEUS_DIR is disabled.\n", tmpname);
+      m_prom_interval = 0.0;
+      return;
+    }
+
+    char hostname[512];
+    if (gethostname(hostname, sizeof(hostname)) != 0) strcpy(hostname, "unknown");
+    char common[600];
+    snprintf(common, sizeof(common), "rank=\"%d\",host=\"%s\"", my_rank, prom_escape(hostname).c_str());
+
+    std::vector<std::string> labels(m_nWatch);
+    std::vector<double> values(3*m_nWatch);
+    for (int i=0; i<m_nWatch; i++) {
+      labels[i] = prom_escape(m_watchArray[i].m_label);
+      m_watchArray[i].packSnapshot(now, &values[3*i]);
+    }
+
+    const char* name[3] = {"pmlib_section_seconds_total", "pmlib_section_flops_total", "pmlib_section_calls_total"};
+    const char* help[3] = {"Accumulated time of the section in seconds.",
+      "Accumulated operations (Flop or Byte) of the section given at stop().",
+      "Number of the calls of the section."};
+    int order[3] = {0, 2, 1};
+    for (int k=0; k<3; k++) {
+      int j = order[k];
+      fprintf(fp, "# HELP %s %s\n", name[j], help[j]);
+      fprintf(fp, "# TYPE %s counter\n", name[j]);
+      for (int i=0; i<m_nWatch; i++) {
+        fprintf(fp, "%s{section=\"%s\",%s} %.9e\n", name[j], labels[i].c_str(), common, values[3*i+j]);
+      }
+    }
+
+#ifdef USE_PAPI
+    double events[Max_chooser_events];
+    int n_events = m_watchArray[0].sumEvents(events, Max_chooser_events);
+    if (n_events > 0) {
+      fprintf(fp, "# HELP pmlib_section_hwpc_events_total Raw HWPC event counts of the section summed over the threads.\n");
+      fprintf(fp, "# TYPE pmlib_section_hwpc_events_total counter\n");
+      for (int i=0; i<m_nWatch; i++) {
+        n_events = m_watchArray[i].sumEvents(events, Max_chooser_events);
+        for (int n=0; n<n_events; n++) {
+          fprintf(fp, "pmlib_section_hwpc_events_total{section=\"%s\",event=\"%s\",%s} %.9e\n",
+            labels[i].c_str(), m_watchArray[i].my_papi.s_name[n].c_str(), common, events[n]);
+        }
+      }
+    }
+#endif
+    fprintf(fp, "# HELP pmlib_elapsed_seconds Elapsed time since the initialize() of PMlib.\n");
+    fprintf(fp, "# TYPE pmlib_elapsed_seconds gauge\n");
+    fprintf(fp, "pmlib_elapsed_seconds{%s} %.9e\n", common, now - m_interval_base);
+
+    bool is_ok = (fclose(fp) == 0);
+    if (!is_ok || rename(tmpname, filename) != 0) {
+      printDiag("writePrometheus()", "can not write [%s]. PMLIB_PROMETHEUS_DIR is disabled.\n", filename);
+      unlink(tmpname);
+      m_prom_interval = 0.0;
+      return;
+    }
+    if (is_final) m_prom_interval = 0.0;
+  }
+
+
+  /// PerfMonitorインスタンスの番号 (共有メモリセグメントのファイル名に用いる)
+  static int shm_instance_count = 0;
+
+
+  /// 実行中の測定値を公開する共有メモリセグメントを作成する (PMLIB_SHM)
+  ///
+  ///   @note  形式は pmlib_shm.h を参照。ノード上の pmlib-top から読み出す。
+  ///    /dev/shm が無い場合などで作成できない場合は公開しない。
+  ///
+  void PerfMonitor::openShm(void)
+  {
+    char filename[256];
+    snprintf(filename, sizeof(filename), "/dev/shm/pmlib.%d.%d", (int)getpid(), shm_instance_count++);
+    size_t bytes = sizeof(struct pmlib_shm_header) + sizeof(struct pmlib_shm_section) * Max_shm_sections;
+
+    int fd = open(filename, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+      printDiag("openShm()", "can not create the segment [%s]. PMLIB_SHM is disabled.\n", filename);
+      return;
+    }
+    if (ftruncate(fd, (off_t)bytes) != 0) {
+      printDiag("openShm()", "can not allocate the segment [%s]. PMLIB_SHM is disabled.\n", filename);
+      close(fd);
+      unlink(filename);
+      return;
+    }
+    void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+      printDiag("openShm()", "can not map the segment [%s]. PMLIB_SHM is disabled.\n", filename);
+      unlink(filename);
+      return;
+    }
+    m_shm_name = filename;
+
+    //	the pages are zero filled by ftruncate()
+    struct pmlib_shm_header* h = (struct pmlib_shm_header*)p;
+    h->version = Shm_version;
+    h->rank = my_rank;
+    h->num_process = num_process;
+    h->pid = (int)getpid();
+    h->max_sections = Max_shm_sections;
+    h->num_sections = 0;
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    h->start_time = (double)tv.tv_sec + (double)tv.tv_usec * 1.0e-6;
+    if (gethostname(h->hostname, sizeof(h->hostname)-1) != 0) strcpy(h->hostname, "unknown");
+#ifdef USE_PAPI
+    h->num_events = m_watchArray[0].my_papi.num_events;
+    if (h->num_events > Max_shm_events) h->num_events = Max_shm_events;
+    for (int n=0; n<h->num_events; n++) {
+      strncpy(h->event_name[n], m_watchArray[0].my_papi.s_name[n].c_str(), Max_shm_name-1);
+    }
+#endif
+    //	the magic string is written last, so that a reader does not see a partial header
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(h->magic, Shm_magic, sizeof(h->magic));
+    m_shm = h;
+  }
+
+
+  /// 測定区間の現在の測定値を共有メモリセグメントに書き込む
+  ///
+  ///   @param[in] id  測定区間の番号
+  ///
+  ///   @note  新しい区間はラベルを書いてから num_sections を増やす。
+  ///    Max_shm_sections を超えた区間は公開しない。
+  ///
+  void PerfMonitor::publishShm(int id)
+  {
+    if (my_thread != 0) return;
+    if (id >= Max_shm_sections) return;
+    struct pmlib_shm_section* rec = (struct pmlib_shm_section*)(m_shm + 1);
+
+    int n = m_shm->num_sections;
+    if (id >= n) {
+      for (int i=n; i<=id; i++) {
+        rec[i].id = i;
+        strncpy(rec[i].label, m_watchArray[i].m_label.c_str(), Max_shm_label-1);
+      }
+      __atomic_store_n(&m_shm->num_sections, id+1, __ATOMIC_RELEASE);
+    }
+    m_watchArray[id].publishShm(&rec[id]);
+  }
+
+
+  /// 共有メモリセグメントを削除する
+  ///
+  void PerfMonitor::closeShm(void)
+  {
+    size_t bytes = sizeof(struct pmlib_shm_header) + sizeof(struct pmlib_shm_section) * Max_shm_sections;
+    munmap((void*)m_shm, bytes);
+    unlink(m_shm_name.c_str());
+    m_shm = NULL;
+  }
+
+
+  /// 全プロセスの測定区間の表を照合し、共通の区間番号を作成する
+  ///
+  ///   @note  測定区間の番号は各プロセスで最初に呼ばれた順に付けられるので、
+  ///    プロセス毎に区間の登録順が異なる場合や、一部のプロセスだけが通過する
+  ///    区間がある場合は、区間番号では全プロセスの測定値を対応付けられない。
+  ///    ここでは以下の手順で全プロセス共通の区間の並び m_global_order[] を作成する。
+  ///    [1] 区間ラベルのハッシュ値の並びの指紋をMPI_Allreduceで比較する。
+  ///        全プロセスで一致すれば、前回の並びをそのまま使う。(通常はここで終了)
+  ///    [2] 一致しない場合は、ハッシュ値だけをMPI_Allgathervで交換し、
+  ///        前回の並び、rank 0 の区間、rank 1 で新しい区間、... の順に共通の表を作る。
+  ///    [3] 一部のプロセスにしか無い区間のラベルだけを、その区間を持つ最小ランクから配布する。
+  ///        自プロセスに無い区間は、測定値ゼロの区間として追加される。
+  ///
+  void PerfMonitor::reconcile_sections(void)
+  {
+    //	The previous global order covers the local sections 0 .. m_nGlobal-1.
+    //	The sections created since then are appended in the local order.
+    int *order = NULL;
+    if ( !(order = new int[m_nWatch]) ) PM_Exit(0);
+    for (int k = 0; k < m_nWatch; k++) {
+      order[k] = (m_global_order != NULL && k < m_nGlobal) ? m_global_order[k] : k;
+    }
+    if ( m_global_order != NULL ) { delete[] m_global_order; m_global_order = NULL; }
+    m_global_order = order;
+    m_nGlobal = m_nWatch;
+
+    if (num_process <= 1) return;
+
+#ifndef DISABLE_MPI
+    int iret;
+    int n_local = m_nWatch;
+    unsigned long *hash = NULL;
+    if ( !(hash = new unsigned long[n_local]) ) PM_Exit(0);
+    unsigned long fp = 14695981039346656037UL;
+    for (int k = 0; k < n_local; k++) {
+      hash[k] = label_hash(m_watchArray[order[k]].m_label);
+      fp = (fp ^ hash[k]) * 1099511628211UL;
+    }
+
+    //	[1] the max and the min of the number of sections and the fingerprint
+    unsigned long check[4], check_max[4];
+    check[0] = (unsigned long)n_local;
+    check[1] = fp;
+    check[2] = ~check[0];
+    check[3] = ~check[1];
+    iret = MPI_Allreduce(check, check_max, 4, MPI_UNSIGNED_LONG, MPI_MAX, m_comm);
+    if ( iret != MPI_SUCCESS ) {
+      fprintf(stderr, "*** PMlib error. <reconcile_sections> MPI_Allreduce failed. iret=%d\n", iret);
+      PM_Exit(0);
+    }
+    if ( (check_max[0] == ~check_max[2]) && (check_max[1] == ~check_max[3]) ) {
+      delete[] hash; hash = NULL;
+      return;
+    }
+
+    //	[2] exchange the hashes and create the global table
+    int *counts = NULL;
+    int *displs = NULL;
+    if ( !(counts = new int[num_process]) ) PM_Exit(0);
+    if ( !(displs = new int[num_process]) ) PM_Exit(0);
+    iret = MPI_Allgather(&n_local, 1, MPI_INT, counts, 1, MPI_INT, m_comm);
+    if ( iret != MPI_SUCCESS ) {
+      fprintf(stderr, "*** PMlib error. <reconcile_sections> MPI_Allgather failed. iret=%d\n", iret);
+      PM_Exit(0);
+    }
+    int n_total = 0;
+    for (int r = 0; r < num_process; r++) {
+      displs[r] = n_total;
+      n_total += counts[r];
+    }
+    unsigned long *all_hash = NULL;
+    if ( !(all_hash = new unsigned long[n_total]) ) PM_Exit(0);
+    iret = MPI_Allgatherv(hash, n_local, MPI_UNSIGNED_LONG,
+                          all_hash, counts, displs, MPI_UNSIGNED_LONG, m_comm);
+    if ( iret != MPI_SUCCESS ) {
+      fprintf(stderr, "*** PMlib error. <reconcile_sections> MPI_Allgatherv failed. iret=%d\n", iret);
+      PM_Exit(0);
+    }
+
+    std::map<unsigned long, int> g_map;	// hash -> global ID
+    int *g_owner = NULL;			// the lowest rank which has the section
+    int *g_nranks = NULL;			// number of ranks which have the section
+    unsigned long *g_hash = NULL;
+    if ( !(g_owner = new int[n_total]) ) PM_Exit(0);
+    if ( !(g_nranks = new int[n_total]) ) PM_Exit(0);
+    if ( !(g_hash = new unsigned long[n_total]) ) PM_Exit(0);
+    int n_global = 0;
+    for (int r = 0; r < num_process; r++) {
+      for (int k = 0; k < counts[r]; k++) {
+        unsigned long h = all_hash[displs[r]+k];
+        std::map<unsigned long, int>::iterator it = g_map.find(h);
+        if (it == g_map.end()) {
+          g_map.insert( std::make_pair(h, n_global) );
+          g_hash[n_global] = h;
+          g_owner[n_global] = r;
+          g_nranks[n_global] = 1;
+          n_global++;
+        } else {
+          g_nranks[it->second]++;
+        }
+      }
+    }
+
+    //	[3] the owners distribute the labels of the sections missing on some ranks
+    //	    record : type(0/1), exclusive(0/1), in_parallel(0/1), label, '\0'
+    std::string records;
+    for (int k = 0; k < n_local; k++) {
+      int g = g_map[hash[k]];
+      if (g_owner[g] != my_rank || g_nranks[g] == num_process) continue;
+      PerfWatch& w = m_watchArray[order[k]];
+      records += (w.get_typeCalc() == 0) ? '0' : '1';
+      records += w.m_exclusive ? '1' : '0';
+      records += w.m_in_parallel ? '1' : '0';
+      records += w.m_label;
+      records += '\0';
+    }
+    int n_chars = (int)records.size();
+    iret = MPI_Allgather(&n_chars, 1, MPI_INT, counts, 1, MPI_INT, m_comm);
+    if ( iret != MPI_SUCCESS ) {
+      fprintf(stderr, "*** PMlib error. <reconcile_sections> MPI_Allgather failed. iret=%d\n", iret);
+      PM_Exit(0);
+    }
+    n_total = 0;
+    for (int r = 0; r < num_process; r++) {
+      displs[r] = n_total;
+      n_total += counts[r];
+    }
+    char *all_records = NULL;
+    if ( !(all_records = new char[n_total+1]) ) PM_Exit(0);
+    iret = MPI_Allgatherv((void*)records.data(), n_chars, MPI_CHAR,
+                          all_records, counts, displs, MPI_CHAR, m_comm);
+    if ( iret != MPI_SUCCESS ) {
+      fprintf(stderr, "*** PMlib error. <reconcile_sections> MPI_Allgatherv failed. iret=%d\n", iret);
+      PM_Exit(0);
+    }
+
+    //	The records are in the global order. Add the missing sections in this order.
+    bool save_exclusive = is_exclusive_construct;
+    for (int c = 0; c < n_total; ) {
+      Type p_type = (all_records[c] == '0') ? COMM : CALC;
+      bool p_exclusive = (all_records[c+1] == '1');
+      bool p_in_parallel = (all_records[c+2] == '1');
+      std::string p_label = &all_records[c+3];
+      c += 3 + (int)p_label.size() + 1;
+      if ( find_section_object(p_label) >= 0 ) continue;
+      PerfMonitor::setProperties(p_label, p_type, p_exclusive);
+      int id = find_section_object(p_label);
+      if (id >= 0) m_watchArray[id].m_in_parallel = p_in_parallel;
+    }
+    is_exclusive_construct = save_exclusive;
+
+    //	the local section ID of each global ID
+    if (m_nWatch != n_global) {
+      printDiag("reconcile_sections()",  "the section tables do not match. %d sections on my_rank=%d, %d sections in total. Label hashes may collide.\n",
+        m_nWatch, my_rank, n_global);
+      PM_Exit(0);
+    }
+    if ( !(order = new int[n_global]) ) PM_Exit(0);
+    for (int i = 0; i < m_nWatch; i++) {
+      order[g_map[label_hash(m_watchArray[i].m_label)]] = i;
+    }
+    delete[] m_global_order;
+    m_global_order = order;
+    m_nGlobal = n_global;
+
+    delete[] all_records; all_records = NULL;
+    delete[] g_hash; g_hash = NULL;
+    delete[] g_nranks; g_nranks = NULL;
+    delete[] g_owner; g_owner = NULL;
+    delete[] all_hash; all_hash = NULL;
+    delete[] displs; displs = NULL;
+    delete[] counts; counts = NULL;
+    delete[] hash; hash = NULL;
+#endif
+  }
+
+
+  /// 全プロセスの測定中経過情報を集約
+  ///
+  ///   @note  以下の処理を行う。
+  ///    各測定区間の全プロセス途中経過状況を集約。
+  ///    測定結果の平均値・標準偏差などの基礎的な統計計算。
+  ///    各測定区間のHWPCイベントの統計値を取得する。
+  ///   @note  gather_and_stats() は複数回呼び出し可能。
+  ///   @note  全測定区間の測定値を1つのバッファに詰めて、1回のMPI_Allgatherで集約する。
+  ///
+  void PerfMonitor::gather_and_stats(void)
+  {
+
+    if (!is_PMlib_enabled) return;
+
+    if (m_nWatch == 0) return; // There is no section defined yet. This is basically an error case.
+
+    //	The first gather after gatherStart() uses the result of the interim gather.
+    if (m_interim_state != 0) gatherWait();
+    if (is_interim_fresh) {
+      is_interim_fresh = false;
+      return;
+    }
+
+    //	The values are exchanged in the global section order m_global_order[],
+    //	which is common to all ranks even if their section tables differ.
+    reconcile_sections();
+
+    // For each of the sections,
+	// calibrate some numbers to represent the process value as the sum of thread values
+    int n_hwpc = 0;
+    for (int i=0; i<m_nWatch; i++) {
+      int n_sorted = m_watchArray[i].calibrateHWPC();
+      if (n_sorted > n_hwpc) n_hwpc = n_sorted;
+    }
+
+	//	Pack m_time, m_flop, m_count and the HWPC event values of all sections
+	//	into one buffer, and allgather them with a single collective call
+	//	instead of 4 collective calls per section.
+	//	In the root gather mode (PMLIB_GATHER=ROOT), the buffer is gathered
+	//	only to rank 0, and the other ranks do not keep the per process arrays.
+	//	In the node gather mode (PMLIB_GATHER=NODE), the buffers are first
+	//	collected on the shared memory of each node. See gatherNodeStats().
+    bool is_root_gather = (env_str_gather == "ROOT") && (num_process > 1);
+    bool is_node_gather = (env_str_gather == "NODE") && (num_process > 1);
+    int stride = 3 + n_hwpc;
+    int row_len = m_nWatch * stride;
+    double *sendbuf = NULL;
+    double *recvbuf = NULL;
+    if ( !(sendbuf = new double[row_len]) ) PM_Exit(0);
+
+    for (int i = 0; i < m_nWatch; i++) {
+      m_watchArray[m_global_order[i]].packGather(&sendbuf[i*stride], n_hwpc);
+    }
+
+    if ( is_node_gather ) {
+      gatherNodeStats(sendbuf, row_len, stride);
+      delete[] sendbuf; sendbuf = NULL;
+
+      //  the power is measured per node. Only the node leaders are summed up.
+      if (level_POWER != 0)
+      m_watchArray[0].gatherPOWER(m_comm_leader, (my_rank_on_node == 0), num_nodes);
+      return;
+    }
+
+    if ( !is_root_gather || my_rank == 0 ) {
+      if ( !(recvbuf = new double[(size_t)row_len*num_process]) ) PM_Exit(0);
+    }
+
+    if ( is_root_gather ) {
+      int iret = MPI_Gather(sendbuf, row_len, MPI_DOUBLE,
+                            recvbuf, row_len, MPI_DOUBLE, 0, m_comm);
+      if ( iret != MPI_SUCCESS ) {
+        fprintf(stderr, "*** PMlib error. <gather_and_stats> MPI_Gather failed. iret=%d\n", iret);
+        PM_Exit(0);
+      }
+    } else if ( num_process > 1 ) {
+      int iret = MPI_Allgather(sendbuf, row_len, MPI_DOUBLE,
+                               recvbuf, row_len, MPI_DOUBLE, m_comm);
+      if ( iret != MPI_SUCCESS ) {
+        fprintf(stderr, "*** PMlib error. <gather_and_stats> MPI_Allgather failed. iret=%d\n", iret);
+        PM_Exit(0);
+      }
+    } else {
+      for (int j = 0; j < row_len; j++) recvbuf[j] = sendbuf[j];
+    }
+
+    if ( recvbuf != NULL ) {
+      for (int i = 0; i < m_nWatch; i++) {
+        m_watchArray[m_global_order[i]].unpackGather(recvbuf, i*stride, row_len);
+      }
+    }
+    delete[] sendbuf; sendbuf = NULL;
+    if ( recvbuf != NULL ) { delete[] recvbuf; recvbuf = NULL; }
+
+    //	summary stats including the average, standard deviation, etc.
+    if ( is_root_gather ) {
+      // All ranks obtain the stats through the reduction, not from the arrays
+      pmlib_section_stats *s_stats = NULL;
+      if ( !(s_stats = new pmlib_section_stats[m_nWatch]) ) PM_Exit(0);
+      for (int i = 0; i < m_nWatch; i++) {
+        m_watchArray[m_global_order[i]].packStats(&s_stats[i]);
+      }
+      if ( stats_allreduce(s_stats, m_nWatch, m_comm) != MPI_SUCCESS ) PM_Exit(0);
+      for (int i = 0; i < m_nWatch; i++) {
+        m_watchArray[m_global_order[i]].statsReduction(&s_stats[i]);
+      }
+      delete[] s_stats; s_stats = NULL;
+    } else {
+      for (int i = 0; i < m_nWatch; i++) {
+        m_watchArray[i].statsAverage();
+      }
+    }
+
+	//  summary stats of the estimated power consumption. Only the Root section does this.
+	if (level_POWER != 0)
+    m_watchArray[0].gatherPOWER();
+
+  }
+
+
+  /// ノード内communicatorとノード代表プロセス間communicatorを作成する
+  ///
+  ///   @note  MPI_Comm_split_type(MPI_COMM_TYPE_SHARED) により共有メモリを持つ
+  ///    プロセスのグループをノードとみなし、ノード内ランク0をノード代表プロセスとする。
+  ///    ノード代表プロセスのホスト名はrank 0に集約される。
+  ///
+  void PerfMonitor::setupNodeComm(void)
+  {
+#ifndef DISABLE_MPI
+    int iret;
+    iret = MPI_Comm_split_type(m_comm, MPI_COMM_TYPE_SHARED, my_rank,
+                               MPI_INFO_NULL, &m_comm_node);
+    if ( iret != MPI_SUCCESS ) {
+      fprintf(stderr, "*** PMlib error. <setupNodeComm> MPI_Comm_split_type failed. iret=%d\n", iret);
+      PM_Exit(0);
+    }
+    MPI_Comm_rank(m_comm_node, &my_rank_on_node);
+    MPI_Comm_size(m_comm_node, &num_process_on_node);
+
+    // The key my_rank makes the world rank 0 to be the rank 0 of the leaders
+    int color = (my_rank_on_node == 0) ? 0 : MPI_UNDEFINED;
+    iret = MPI_Comm_split(m_comm, color, my_rank, &m_comm_leader);
+    if ( iret != MPI_SUCCESS ) {
+      fprintf(stderr, "*** PMlib error. <setupNodeComm> MPI_Comm_split failed. iret=%d\n", iret);
+      PM_Exit(0);
+    }
+    if (my_rank_on_node == 0) {
+      MPI_Comm_size(m_comm_leader, &num_nodes);
+    }
+    MPI_Bcast(&num_nodes, 1, MPI_INT, 0, m_comm_node);
+
+    if (my_rank_on_node == 0) {
+      char hn[Max_node_hostname];
+      memset(hn, 0, sizeof(hn));
+      if (gethostname(hn, sizeof(hn)-1) != 0) {
+        strcpy(hn, "unknown");
+      }
+      if (my_rank == 0) {
+        if ( !(m_node_hosts = new char[(size_t)num_nodes*Max_node_hostname]) ) PM_Exit(0);
+      }
+      MPI_Gather(hn, Max_node_hostname, MPI_CHAR,
+                 m_node_hosts, Max_node_hostname, MPI_CHAR, 0, m_comm_leader);
+    }
+#endif
+    is_node_comm_ready = true;
+  }
+
+
+  /// setupNodeComm()で作成したcommunicatorとノード別の表を解放する
+  ///
+  void PerfMonitor::freeNodeComm(void)
+  {
+    if (m_node_hosts != NULL) { delete[] m_node_hosts; m_node_hosts = NULL; }
+    if (m_node_stats != NULL) { delete[] m_node_stats; m_node_stats = NULL; }
+    if (!is_node_comm_ready) return;
+#ifndef DISABLE_MPI
+    if (m_comm_leader != MPI_COMM_NULL) MPI_Comm_free(&m_comm_leader);
+    MPI_Comm_free(&m_comm_node);
+#endif
+    is_node_comm_ready = false;
+  }
+
+
+  /// ノード内共有メモリとノード代表プロセス間リダクションによる2段階の集約
+  ///
+  ///   @param[in] sendbuf  自プロセスの全測定区間の測定値 [row_len]
+  ///   @param[in] row_len  1プロセスあたりの要素数
+  ///   @param[in] stride   1測定区間あたりの要素数
+  ///
+  ///   @note  PMLIB_GATHER=NODE の場合に gather_and_stats() から呼ばれる。
+  ///    [1] 各プロセスは測定値をノード内の共有メモリwindowに直接書き込む。
+  ///    [2] ノード代表プロセスはノード内の集計値を作成し、
+  ///        代表プロセス間のstats_allreduce()で全プロセスの集計値を得る。
+  ///    [3] 全プロセスの集計値はノード内でMPI_Bcastされる。
+  ///    [4] プロセス別の測定値とノード別の集計値は代表プロセスからrank 0に集約される。
+  ///    ノード間の通信は代表プロセスだけが行うので、通信量はノード数に比例する。
+  ///
+  void PerfMonitor::gatherNodeStats(double* sendbuf, int row_len, int stride)
+  {
+#ifndef DISABLE_MPI
+    int iret;
+    if (!is_node_comm_ready) setupNodeComm();
+
+    bool is_leader = (my_rank_on_node == 0);
+    int row_size = row_len + 1;		// the last element holds the world rank
+    double *node_rows = NULL;		// rows of the node processes (leader only)
+
+    //	[1] node local stage on the shared memory window
+    double *my_row = NULL;
+    MPI_Win win;
+    iret = MPI_Win_allocate_shared((MPI_Aint)row_size*sizeof(double), sizeof(double),
+                                   MPI_INFO_NULL, m_comm_node, &my_row, &win);
+    if ( iret != MPI_SUCCESS ) {
+      fprintf(stderr, "*** PMlib error. <gatherNodeStats> MPI_Win_allocate_shared failed. iret=%d\n", iret);
+      PM_Exit(0);
+    }
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+    for (int j = 0; j < row_len; j++) my_row[j] = sendbuf[j];
+    my_row[row_len] = (double)my_rank;
+    MPI_Win_sync(win);
+    MPI_Barrier(m_comm_node);
+    MPI_Win_sync(win);
+
+    pmlib_section_stats *s_stats = NULL;
+    if ( !(s_stats = new pmlib_section_stats[m_nWatch]) ) PM_Exit(0);
+    for (int i = 0; i < m_nWatch; i++) {
+      stats_init(&s_stats[i]);
+    }
+
+    if (is_leader) {
+      MPI_Aint seg_size;
+      int disp_unit;
+      double *node_base = NULL;
+      // The segments of the node processes are contiguous in the rank order
+      MPI_Win_shared_query(win, 0, &seg_size, &disp_unit, &node_base);
+
+      if ( !(node_rows = new double[(size_t)row_size*num_process_on_node]) ) PM_Exit(0);
+      for (size_t j = 0; j < (size_t)row_size*num_process_on_node; j++) {
+        node_rows[j] = node_base[j];
+      }
+      for (int r = 0; r < num_process_on_node; r++) {
+        const double *row = &node_rows[(size_t)r*row_size];
+        int rank = (int)row[row_len];
+        for (int i = 0; i < m_nWatch; i++) {
+          const double *p = &row[i*stride];
+          stats_add(&s_stats[i], p[0], p[1], lround(p[2]), rank);
+        }
+      }
+    }
+    MPI_Win_unlock_all(win);
+    MPI_Win_free(&win);
+
+    //	[2] reduction among the node leaders
+    double *node_vals = NULL;		// per node aggregates of this node
+    if (is_leader) {
+      if ( !(node_vals = new double[(size_t)m_nWatch*4]) ) PM_Exit(0);
+      for (int i = 0; i < m_nWatch; i++) {
+        node_vals[i*4]   = s_stats[i].time.n;
+        node_vals[i*4+1] = s_stats[i].time.mean;
+        node_vals[i*4+2] = s_stats[i].time_max;
+        node_vals[i*4+3] = (double)s_stats[i].rank_max;
+      }
+      if ( stats_allreduce(s_stats, m_nWatch, m_comm_leader) != MPI_SUCCESS ) PM_Exit(0);
+    }
+
+    //	[3] the global summary is shared inside the node
+    iret = MPI_Bcast(s_stats, (int)(m_nWatch*sizeof(pmlib_section_stats)), MPI_BYTE, 0, m_comm_node);
+    if ( iret != MPI_SUCCESS ) {
+      fprintf(stderr, "*** PMlib error. <gatherNodeStats> MPI_Bcast failed. iret=%d\n", iret);
+      PM_Exit(0);
+    }
+
+    //	[4] the per process rows and the per node aggregates are gathered to rank 0
+    if (is_leader) {
+      int *counts = NULL;
+      int *displs = NULL;
+      double *rows = NULL;
+      int my_count = row_size*num_process_on_node;
+      if (my_rank == 0) {
+        if ( !(counts = new int[num_nodes]) ) PM_Exit(0);
+        if ( !(displs = new int[num_nodes]) ) PM_Exit(0);
+        if ( !(rows = new double[(size_t)row_size*num_process]) ) PM_Exit(0);
+        if (m_node_stats != NULL) { delete[] m_node_stats; m_node_stats = NULL; }
+        if ( !(m_node_stats = new double[(size_t)num_nodes*m_nWatch*4]) ) PM_Exit(0);
+      }
+      MPI_Gather(&my_count, 1, MPI_INT, counts, 1, MPI_INT, 0, m_comm_leader);
+      if (my_rank == 0) {
+        displs[0] = 0;
+        for (int n = 1; n < num_nodes; n++) displs[n] = displs[n-1] + counts[n-1];
+      }
+      iret = MPI_Gatherv(node_rows, my_count, MPI_DOUBLE,
+                         rows, counts, displs, MPI_DOUBLE, 0, m_comm_leader);
+      if ( iret != MPI_SUCCESS ) {
+        fprintf(stderr, "*** PMlib error. <gatherNodeStats> MPI_Gatherv failed. iret=%d\n", iret);
+        PM_Exit(0);
+      }
+      MPI_Gather(node_vals, m_nWatch*4, MPI_DOUBLE,
+                 m_node_stats, m_nWatch*4, MPI_DOUBLE, 0, m_comm_leader);
+
+      if (my_rank == 0) {
+        // reorder the rows by the world rank, and create the per process arrays
+        double *recvbuf = NULL;
+        if ( !(recvbuf = new double[(size_t)row_len*num_process]) ) PM_Exit(0);
+        for (int r = 0; r < num_process; r++) {
+          const double *row = &rows[(size_t)r*row_size];
+          int rank = (int)row[row_len];
+          for (int j = 0; j < row_len; j++) recvbuf[(size_t)rank*row_len+j] = row[j];
+        }
+        for (int i = 0; i < m_nWatch; i++) {
+          m_watchArray[m_global_order[i]].unpackGather(recvbuf, i*stride, row_len);
+        }
+        delete[] recvbuf; recvbuf = NULL;
+
+        // m_node_stats[] is kept in the local section order of rank 0
+        double *v = NULL;
+        if ( !(v = new double[(size_t)num_nodes*m_nWatch*4]) ) PM_Exit(0);
+        for (int n = 0; n < num_nodes; n++) {
+          for (int i = 0; i < m_nWatch; i++) {
+            for (int k = 0; k < 4; k++) {
+              v[((size_t)n*m_nWatch + m_global_order[i])*4+k] = m_node_stats[((size_t)n*m_nWatch + i)*4+k];
+            }
+          }
+        }
+        delete[] m_node_stats;
+        m_node_stats = v;
+        delete[] rows; rows = NULL;
+        delete[] counts; counts = NULL;
+        delete[] displs; displs = NULL;
+      }
+      delete[] node_vals; node_vals = NULL;
+      delete[] node_rows; node_rows = NULL;
+    }
+
+    for (int i = 0; i < m_nWatch; i++) {
+      m_watchArray[m_global_order[i]].statsReduction(&s_stats[i]);
+    }
+    delete[] s_stats; s_stats = NULL;
+#endif
+  }
+
+
+  /// 経過時間でソートした測定区間のリストm_order[m_nWatch] を作成する。
+  /// Remark.
+  /// 	Each process stores its own sorted list. Be careful when reporting from rank 0.
+  ///
+  ///
+  void PerfMonitor::sort_m_order(void)
+  {
+    if (!is_PMlib_enabled) return;
+    if (m_nWatch == 0) return;
+
+	#ifdef DEBUG_PRINT_MONITOR
+    fprintf(stderr, "<sort_m_order> starts. my_rank=%d, num_process=%d \n\n", my_rank, num_process);
+	#endif
+
+    // 経過時間でソートした測定区間のリストm_order[m_nWatch] を作成する
+    // This delete/new may look redundant, but is needed if m_nWatch has
+    // increased since last call...
+    if ( m_order != NULL) { delete[] m_order; m_order = NULL; }
+    if ( !(m_order = new unsigned[m_nWatch]) ) PM_Exit(0);
+
+    // Start from the global section order, so that all ranks obtain
+    // the same list for the same stats, even if their section IDs differ.
+    for (int i=0; i<m_nWatch; i++) {
+      m_order[i] = (m_global_order != NULL && i < m_nGlobal) ? m_global_order[i] : i;
+    }
+
+    double *m_tcost = NULL;
+    if ( !(m_tcost = new double[m_nWatch]) ) PM_Exit(0);
+    for (int i = 0; i < m_nWatch; i++) {
+      PerfWatch& w = m_watchArray[m_order[i]];
+      if ( w.m_count_sum > 0 ) {
+        m_tcost[i] = w.m_time_av;
+      } else {
+        m_tcost[i] = 0.0;
+      }
+    }
+    // 降順ソート O(n log n)
+    // The sections without label are left in place.
+    // The stable sort keeps the global order for the sections of the same cost.
+    std::vector<int> keys;
+    keys.reserve(m_nWatch);
+    for (int i=0; i<m_nWatch; i++) {
+      if (!m_watchArray[m_order[i]].m_label.empty()) keys.push_back(i);
+    }
+    std::vector<int> sorted_keys(keys);
+    std::stable_sort(sorted_keys.begin(), sorted_keys.end(),
+      [m_tcost](int a, int b) { return m_tcost[a] > m_tcost[b]; });
+    std::vector<unsigned> sorted_order(keys.size());
+    for (size_t k=0; k<keys.size(); k++) {
+      sorted_order[k] = m_order[sorted_keys[k]];
+    }
+    for (size_t k=0; k<keys.size(); k++) {
+      m_order[keys[k]] = sorted_order[k];
+    }
+    delete[] m_tcost; m_tcost = NULL;
+
+	#ifdef DEBUG_PRINT_MONITOR
+	(void) MPI_Barrier(m_comm);
+    	fprintf(stderr, "<sort_m_order> my_rank=%d, num_process=%d \n", my_rank, num_process);
+		for (int j=0; j<m_nWatch; j++) {
+		int k=m_order[j];
+		fprintf(stderr, "\t\t m_order[%d]=%d time_av=%10.2e [%s]\n",
+		j, k, m_watchArray[k].m_time_av, m_watchArray[k].m_label.c_str());
+		}
+		fprintf(stderr, "<sort_m_order> ends\n");
+	#endif
+
+  }
+  
+
+  //> PMlib report controll routine for outside parallel regions
+  ///	@brief
   /// This is a controll routine for reporting the stats outside parallel regions.
   /// For reporting the stats inside of parallel regions, call alternative routine
   /// PerfReport::report defined in SupportReportCPP.cpp
@@ -882,7 +2414,8 @@ namespace pm_lib {
     if (my_rank==0) fprintf(stderr, "\n<PerfMonitor::report> start \n");
 	#endif
 
-	int id, mid, inside;
+	int id, mid;
+	int inside = -1;
 	int nSections;
 
 //	stop the Root section before report
@@ -909,26 +2442,18 @@ namespace pm_lib {
 
 	countSections (nSections);
 
-//	merge thread data into the master thread 
+//	merge thread data of all sections into the master thread 
+	// If some sections are defined inside parallel context and the OpenMP
+	// parallel region is started by a user C++ routine, the merge operation
+	// must be triggered by a user C++ routine, which is outside of PMlib
+	// C++ class parallel context.
+	// In that case, call PerfReport::report() as explained above.
 
-	for (id=0; id<nSections; id++) {
-	SerialParallelRegion (id, mid, inside);
-
-	if (inside==0) {
-		// The section is defined outside of parallel context
-		mergeThreads (id);
+	mergeAllThreads ();
 
-	} else if (inside==1) {
-		// The section is defined inside parallel context
-		// If an OpenMP parallel region is started by a user C++ routine,
-		// the merge operation must be triggered by a user C++ routine,
-		// which is outside of PMlib C++ class parallel context.
-		// In that case, call PerfReport::report() as explained above.
-		mergeThreads (id);
-	} else {
-		;
-	}
-	}	// end of for loop
+//	the trace buffer of this thread. those of the other threads are written at exit
+	struct pmlib_trace_buffer* trace = trace_thread_buffer();
+	if (trace != NULL) trace_flush (trace);
 
 //	now start reporting the PMlib stats
 	selectReport (fp);
@@ -979,6 +2504,7 @@ namespace pm_lib {
   ///   PMLIB_REPORT=DETAIL: MPIランク別に経過時間、頻度、HWPC統計情報の詳細レポートを出力する。
   ///   PMLIB_REPORT=FULL： BASICとDETAILのレポートに加えて、
   ///		各MPIランクが生成した各並列スレッド毎にHWPC統計情報の詳細レポートを出力する。
+  ///   PMLIB_REPORT=TOPK： BASICレポートに加えて、区間毎に最も遅い/速いプロセスを出力する。
   ///
   void PerfMonitor::selectReport(FILE* fp)
   {
@@ -988,6 +2514,42 @@ namespace pm_lib {
     	fprintf(stderr, "<PerfMonitor::selectReport> starts. num_process=%d \n", num_process);
 	#endif
 
+	// All the report drivers (PerfMonitor::report, PerfReport::report,
+	// C_pm_report and f_pm_report) come here after the thread merge.
+	// the last interim record
+	if (m_interval > 0.0) writeInterval (true);
+	// the live statistics segment is removed
+	if (m_shm != NULL) closeShm ();
+	// the final snapshot for the textfile collector
+	if (m_prom_interval > 0.0) writePrometheus (true);
+	// the application's own signal action is restored
+	if (is_signal_dump) restoreSignalDump ();
+	// With PMLIB_DUMP, each process writes its own dump file, and no
+	// collective operation is performed. pmlib-merge creates the report.
+	if (env_str_dump != "") {
+		PerfMonitor::writeDump(env_str_dump);
+		if (my_rank == 0) {
+			fprintf(fp, "\n# PMlib Basic Report --- the values of %d processes are dumped to %s.*.pmd ------\n",
+				num_process, env_str_dump.c_str());
+			fprintf(fp, "\tThe report can be produced by : pmlib-merge %s\n", env_str_dump.c_str());
+		}
+		freeNodeComm();
+		interim_free();
+		return;
+	}
+
+	// the clock drift of the flight recorder and the binary trace
+	if (is_clock_aligned) m_watchArray[0].alignClock(1);
+
+	// With PMLIB_REPORT_FORMAT=JSON|CSV, the same data is written in the
+	// machine readable format instead of the text reports.
+	if (env_str_report_format != "TEXT") {
+		PerfMonitor::printStructured(fp, env_str_report_format);
+		freeNodeComm();
+		interim_free();
+		return;
+	}
+
 	// BASIC report is always generated.
 	PerfMonitor::print(fp, "", "", 0);
 
@@ -996,6 +2558,16 @@ namespace pm_lib {
 	#ifdef DEBUG_PRINT_MONITOR
     	fprintf(stderr, "<PerfMonitor::selectReport> calls printDetail. \n" );
 	#endif
+	// With PMLIB_DETAIL_FILE, the per rank (and per thread) values are
+	// written by all ranks to the file via MPI-IO instead.
+	bool is_detail_file = (env_str_detail_file != "") && is_MPI_enabled;
+	if (is_detail_file && (env_str_report == "DETAIL" || env_str_report == "FULL")) {
+		PerfMonitor::printDetailFile(env_str_detail_file, (env_str_report == "FULL"));
+		if (my_rank == 0) {
+			fprintf(fp, "\n## PMlib Process Report --- written to the file %s via MPI-IO ------\n",
+				env_str_detail_file.c_str());
+		}
+	} else
 	if (env_str_report == "DETAIL" || env_str_report == "FULL") {
 		PerfMonitor::printDetail(fp, 0, 0);
 	}
@@ -1004,16 +2576,25 @@ namespace pm_lib {
 	#ifdef DEBUG_PRINT_MONITOR
     	fprintf(stderr, "<PerfMonitor::selectReport> calls printThreads. \n" );
 	#endif
-	if (env_str_report == "FULL" ) {
+	if (env_str_report == "FULL" && !is_detail_file) {
     	for (int i = 0; i < num_process; i++) {
 		PerfMonitor::printThreads(fp, i, 0);
 		}
 	}
 
+	// TOPK report of the slowest/fastest ranks
+	if (env_str_report == "TOPK" ) {
+		PerfMonitor::printTopK(fp, 0, 0);
+	}
+
 	// print all symbols used in the report, aka Legends.
 	if (env_str_hwpc != "USER" ) {
 		PerfMonitor::printLegend(fp);
 	}
+
+	// the node and the interim communicators are released, as printComm() does for its groups.
+	freeNodeComm();
+	interim_free();
 	#ifdef DEBUG_PRINT_MONITOR
     	fprintf(stderr, "<PerfMonitor::selectReport> ends. \n");
 	#endif
@@ -1098,6 +2679,10 @@ namespace pm_lib {
     PerfMonitor::printBasicTailer (fp, maxLabelLen, tot, sum_flop, sum_comm, sum_other,
                                   sum_time_flop, sum_time_comm, sum_time_other, unit);
 
+    PerfMonitor::printBasicDistribution (fp, maxLabelLen, op_sort);
+
+    PerfMonitor::printBasicNodes (fp, maxLabelLen);
+
     PerfMonitor::printBasicHWPC (fp, maxLabelLen, op_sort);
 
     PerfMonitor::printBasicPower (fp, maxLabelLen, op_sort);
@@ -1143,6 +2728,122 @@ void PerfMonitor::printBasicHWPC (FILE* fp, int maxLabelLen, int op_sort)
 }
 
 
+/// Report the distribution of the section time across the processes
+///
+///   @param[in] fp       	report file pointer
+///   @param[in] maxLabelLen    maximum label string field length
+///   @param[in] op_sort 	sorting option (0:sorted by seconds, 1:listed order)
+///
+///	  @note   the quantiles are estimated by the mergeable sketch with
+///	          about 2% relative error. min, max and the max rank are exact.
+///
+void PerfMonitor::printBasicDistribution (FILE* fp, int maxLabelLen, int op_sort)
+{
+	if (num_process <= 1) return;
+
+	fprintf(fp, "\n");
+	fprintf(fp, "%-*s| distribution of the measured time[sec] across %d processes\n", maxLabelLen, "Section", num_process);
+	fprintf(fp, "%-*s|    min       median      p90        p99        max     max rank\n", maxLabelLen, "Label");
+	for (int i = 0; i < maxLabelLen; i++) fputc('-', fp);
+	fprintf(fp, "+-----------------------------------------------------------------\n");
+
+    for (int j = 0; j < m_nWatch; j++) {
+        int i;
+        if (op_sort == 0) {
+          i = m_order[j];	// sorted by elapsed time
+        } else {
+          i = j;			// listed order
+        }
+        if (i == 0) continue;
+
+        PerfWatch& w = m_watchArray[i];
+        if ( !(w.m_count_sum > 0) ) continue;
+
+        std::string p_label = w.m_label;
+        if (!w.m_exclusive) { p_label = w.m_label + " (*)"; }
+        if (w.m_in_parallel) { p_label = w.m_label + " (+)"; }
+
+        fprintf(fp, "%-*s: %9.3e  %9.3e  %9.3e  %9.3e  %9.3e  %7d\n",
+              maxLabelLen, p_label.c_str(),
+              w.m_stats.time_min,
+              stats_quantile(&w.m_stats, 0.50),
+              stats_quantile(&w.m_stats, 0.90),
+              stats_quantile(&w.m_stats, 0.99),
+              w.m_stats.time_max,
+              w.m_stats.rank_max);
+    }
+
+	for (int i = 0; i < maxLabelLen; i++) fputc('-', fp);
+	fprintf(fp, "+-----------------------------------------------------------------\n");
+}
+
+
+/// Report the per node aggregates of the Root section
+///
+///   @param[in] fp       	report file pointer
+///   @param[in] maxLabelLen    maximum label string field length
+///
+///	  @note   only for PMLIB_GATHER=NODE. The aggregates are computed by the
+///	          node leader processes from the node shared memory.
+///
+void PerfMonitor::printBasicNodes (FILE* fp, int maxLabelLen)
+{
+	if (m_node_stats == NULL || m_node_hosts == NULL) return;
+
+	fprintf(fp, "\n");
+	fprintf(fp, "# Per node aggregates of the Root section over %d processes on %d nodes\n", num_process, num_nodes);
+	fprintf(fp, "%-*s| processes  time av[sec]  time max[sec]  max rank\n", maxLabelLen, "Node (host)");
+	for (int i = 0; i < maxLabelLen; i++) fputc('-', fp);
+	fprintf(fp, "+-----------------------------------------------\n");
+
+	for (int n = 0; n < num_nodes; n++) {
+		const double* v = &m_node_stats[(size_t)n*m_nWatch*4];
+		char p_label[Max_node_hostname+16];
+		snprintf(p_label, sizeof(p_label), "%d (%s)", n, &m_node_hosts[(size_t)n*Max_node_hostname]);
+		fprintf(fp, "%-*s: %8d    %10.3e     %10.3e   %7d\n",
+			maxLabelLen, p_label, (int)v[0], v[1], v[2], (int)v[3]);
+	}
+	for (int i = 0; i < maxLabelLen; i++) fputc('-', fp);
+	fprintf(fp, "+-----------------------------------------------\n");
+}
+
+
+/// Report the per node aggregates of all sections
+///
+///   @param[in] fp       	report file pointer
+///   @param[in] op_sort 	sorting option (0:sorted by seconds, 1:listed order)
+///
+///	  @note   only for PMLIB_GATHER=NODE
+///
+void PerfMonitor::printDetailNodes (FILE* fp, int op_sort)
+{
+	if (m_node_stats == NULL || m_node_hosts == NULL) return;
+
+	fprintf(fp, "\n## PMlib Node Report --- Elapsed time aggregated per node ------\n\n");
+
+	for (int j = 0; j < m_nWatch; j++) {
+		int i;
+		if (op_sort == 0) {
+			i = m_order[j]; //	0:経過時間順
+		} else {
+			i = j; //	1:登録順で表示
+		}
+		if (i == 0) continue;
+		PerfWatch& w = m_watchArray[i];
+		if ( !(w.m_count_sum > 0) ) continue;
+
+		fprintf(fp, "Label  %s\n", w.m_label.c_str());
+		fprintf(fp, "Node  Host                  processes  time av[sec]  time max[sec]  max rank\n");
+		for (int n = 0; n < num_nodes; n++) {
+			const double* v = &m_node_stats[((size_t)n*m_nWatch + i)*4];
+			fprintf(fp, "#%04d %-20.20s  %8d    %10.3e     %10.3e   %7d\n",
+				n, &m_node_hosts[(size_t)n*Max_node_hostname], (int)v[0], v[1], v[2], (int)v[3]);
+		}
+		fprintf(fp, "\n");
+	}
+}
+
+
 /// Report the BASIC power consumption statistics of the master node
 ///
 ///   @param[in] fp       	report file pointer
@@ -1250,6 +2951,8 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
 		np_per_node = atoi(cp_env);;
 	}
 	nnodes=(num_process-1)/np_per_node+1;
+	// the node gather mode knows the exact number of nodes
+	if (is_node_comm_ready) nnodes = num_nodes;
 
 	fprintf(fp, "\t The aggregate power consumption of %d processes on %d nodes =", num_process, nnodes);
 	// m_power_av is the average value of my_power.w_accumu[Max_power_stats-1]; for all processes
@@ -1326,108 +3029,813 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
 			}
 		}
 
-		p_label = w.m_label;
-		if (!w.m_exclusive) { p_label = p_label + " (*)"; }
-		if (w.m_in_parallel) { p_label = p_label + " (+)"; }
+		p_label = w.m_label;
+		if (!w.m_exclusive) { p_label = p_label + " (*)"; }
+		if (w.m_in_parallel) { p_label = p_label + " (+)"; }
+
+		fprintf(fp, "%-*s:", maxLabelLen, p_label.c_str() );
+		for (int i=0; i<n_parts; i++) {
+			fprintf(fp, "%7.1f ",  sorted_joule[i]/w.m_time_av);	// Watt value
+		}
+		fprintf(fp, "  %8.2e",  sorted_joule[0]/3600.0);			// Watt-Hour energy value
+		fprintf(fp, "\n");
+	}
+
+    for (int i=0; i< maxLabelLen; i++) { fputc('-', fp); }	; fprintf(fp, "+--------+");
+    for (int i=0; i<(n_parts-1)*8; i++) { fputc('-', fp); }	 ; fprintf(fp, "+----------\n");
+
+#endif
+}
+
+
+  /// MPIランク別詳細レポート、HWPC詳細レポートを出力。
+  ///
+  ///   @param[in] fp           出力ファイルポインタ
+  ///   @param[in] legend int型 (省略可) HWPC記号説明の表示(0:なし、1:表示する)
+  ///   @param[in] op_sort      (省略可)測定区間の表示順 (0:経過時間順、1:登録順で表示)
+  ///
+  ///   @note 詳細レポートは排他測定区間のみを出力する
+  ///         HWPC値は各プロセス毎に子スレッドの値を合算して表示する
+  ///
+  void PerfMonitor::printDetail(FILE* fp, int legend, int op_sort)
+  {
+
+    if (!is_PMlib_enabled) return;
+    if (!is_MPI_enabled) return;
+
+	#ifdef DEBUG_PRINT_MONITOR
+    fprintf(stderr, "<PerfMonitor::printDetail> starts. \n");
+	#endif
+
+    if (m_nWatch == 0) {
+      if (my_rank == 0) {
+      fprintf(fp, "\n# PMlib printDetail():: No section has been defined via setProperties().\n");
+      }
+      return;
+    }
+
+    gather();
+
+    if (my_rank != 0) return;
+
+    // PMlib Process Report is not generated for serial jobs
+
+    // 	I. MPIランク別詳細レポート: MPIランク別測定結果を出力
+    fprintf(fp, "\n## PMlib Process Report --- Elapsed time for individual MPI ranks ------\n\n");
+
+      // 測定時間の分母
+      // initialize()からgather()までの区間（==Root区間）の測定時間を分母とする
+      double tot = m_watchArray[0].m_time_av;
+
+    // 測定区間の時間と計算量を表示。表示順は引数 op_sort で指定されている。
+      for (int j = 0; j < m_nWatch; j++) {
+        int i;
+        if (op_sort == 0) {
+          i = m_order[j]; //	0:経過時間順
+        } else {
+          i = j; //	1:登録順で表示
+        }
+        if (i == 0) continue;
+		// Policy change
+		// Both of exclusive sections and inclusive sections will be reported.
+        //	if (!m_watchArray[i].m_exclusive) continue;
+        m_watchArray[i].printDetailRanks(fp, tot);
+      }
+
+    //	per node aggregates for PMLIB_GATHER=NODE
+    PerfMonitor::printDetailNodes(fp, op_sort);
+
+
+#ifdef USE_PAPI
+    //	II. HWPC/PAPIレポート：HWPC計測結果を出力
+	if (m_watchArray[0].my_papi.num_events == 0) return;
+	if (env_str_hwpc == "USER" ) return;
+    fprintf(fp, "\n## PMlib hardware performance counter (HWPC) report for individual MPI ranks ---------\n\n");
+    fprintf(fp, "\tThe HWPC stats report for HWPC_CHOOSER=%s is generated.\n\n", env_str_hwpc.c_str());
+
+
+    for (int j = 0; j < m_nWatch; j++) {
+        int i;
+        if (op_sort == 0) {
+          i = m_order[j]; //	0:経過時間順
+        } else {
+          i = j; //	1:登録順で表示
+        }
+        if (i == 0) continue;
+		// Policy change
+		// Both of exclusive sections and inclusive sections will be reported.
+        //	if (!m_watchArray[i].m_exclusive) continue;
+        m_watchArray[i].printDetailHWPCsums(fp, m_watchArray[i].m_label);
+    }
+
+#endif
+
+	#ifdef DEBUG_PRINT_MONITOR
+    fprintf(stderr, "<PerfMonitor::printDetail> ends. \n");
+	#endif
+
+  }
+
+
+  /// 区間毎に最も遅いk個と最も速いk個のプロセスのレポートを出力。
+  ///
+  ///   @param[in] fp           出力ファイルポインタ
+  ///   @param[in] k            表示するプロセスの数 (0の場合はPMLIB_TOPKの値)
+  ///   @param[in] op_sort      測定区間の表示順 (0:経過時間順、1:登録順で表示)
+  ///
+  ///   @note 全プロセスで呼び出す集団操作。区間の並びは reconcile_sections() で
+  ///         全プロセス共通にしてから、区間数 x 2k 個のエントリをリダクションする。
+  ///         時間の分布はBASICレポートの distribution の表を参照する。
+  ///
+  void PerfMonitor::printTopK(FILE* fp, int k, int op_sort)
+  {
+
+    if (!is_PMlib_enabled) return;
+    if (!is_MPI_enabled) return;
+#ifndef DISABLE_MPI
+    if (k <= 0) k = m_topk;
+    if (k > Max_topk) k = Max_topk;
+    if (k > num_process) k = num_process;
+
+    reconcile_sections();
+    int n_sec = m_nGlobal;
+
+    char hn[Max_topk_hostname];
+    memset(hn, 0, sizeof(hn));
+    if (gethostname(hn, sizeof(hn)-1) != 0) {
+      strcpy(hn, "unknown");
+    }
+
+    //	one list of 2*k entries per section in the global order
+    pmlib_topk_entry* t = new pmlib_topk_entry[(size_t)n_sec*2*k];
+    for (int g = 0; g < n_sec; g++) {
+      pmlib_topk_entry* tg = &t[(size_t)g*2*k];
+      topk_init(tg, k);
+      PerfWatch& w = m_watchArray[m_global_order[g]];
+      if (w.m_count > 0) {
+        topk_add(tg, k, w.m_time, my_rank, hn);
+      }
+    }
+
+    if ( topk_reduce(t, n_sec, k, 0, m_comm) != MPI_SUCCESS ) PM_Exit(0);
+
+    if (my_rank == 0) {
+      //	local section id -> global index
+      int* g_index = new int[m_nWatch];
+      for (int g = 0; g < n_sec; g++) g_index[m_global_order[g]] = g;
+
+      fprintf(fp, "\n## PMlib Top-%d Report --- the slowest and the fastest ranks of each section ------\n\n", k);
+      fprintf(fp, "\tThe %d slowest and the %d fastest processes out of %d processes are listed.\n", k, k, num_process);
+      fprintf(fp, "\tSee the distribution table of the BASIC report for min, median, p90, p99 and max.\n\n");
+
+      for (int j = 0; j < m_nWatch; j++) {
+        int i;
+        if (op_sort == 0) {
+          i = m_order[j]; //	0:経過時間順
+        } else {
+          i = j; //	1:登録順で表示
+        }
+        if (i == 0) continue;
+        PerfWatch& w = m_watchArray[i];
+        if ( !(w.m_count_sum > 0) ) continue;
+
+        const pmlib_topk_entry* tg = &t[(size_t)g_index[i]*2*k];
+        fprintf(fp, "Label  %s%s\n", w.m_label.c_str(), w.m_exclusive ? "" : " (*)");
+        fprintf(fp, "        slowest                                  | fastest\n");
+        fprintf(fp, "        time[sec]     rank  host                 | time[sec]     rank  host\n");
+        for (int n = 0; n < k; n++) {
+          const pmlib_topk_entry* s = &tg[n];
+          const pmlib_topk_entry* f = &tg[k+n];
+          if (s->rank < 0 && f->rank < 0) break;
+          fprintf(fp, "  #%-3d  ", n+1);
+          if (s->rank >= 0) {
+            fprintf(fp, "%10.3e  %7d  %-20.20s | ", s->time, s->rank, s->host);
+          } else {
+            fprintf(fp, "%10s  %7s  %-20s | ", "-", "-", "");
+          }
+          if (f->rank >= 0) {
+            fprintf(fp, "%10.3e  %7d  %.20s\n", f->time, f->rank, f->host);
+          } else {
+            fprintf(fp, "%10s  %7s\n", "-", "-");
+          }
+        }
+        fprintf(fp, "\n");
+      }
+      delete[] g_index;
+    }
+    delete[] t;
+#endif
+  }
+
+
+  /// MPIランク別(とスレッド別)の詳細な測定値を MPI-IO で一つのファイルに出力。
+  ///
+  ///   @param[in] filename      出力ファイル名
+  ///   @param[in] with_threads  スレッド別の行も出力する (FULLレポート相当)
+  ///
+  ///   @note 全プロセスで呼び出す集団操作。区間の並びは reconcile_sections() で
+  ///         全プロセス共通にし、全プロセスが同じ行数・同じ行長で書くので、
+  ///         各プロセスの書き込み位置は通信なしに決まる。
+  ///
+  void PerfMonitor::printDetailFile(const std::string filename, bool with_threads)
+  {
+
+    if (!is_PMlib_enabled) return;
+    if (!is_MPI_enabled) return;
+#ifndef DISABLE_MPI
+    reconcile_sections();
+    int n_sec = m_nGlobal;
+
+    //	the row length must be common to all ranks
+    int n_local[2], n_max[2];
+    n_local[0] = 0;
+    for (int i=0; i<m_nWatch; i++) {
+      int n_sorted = m_watchArray[i].calibrateHWPC();
+      if (n_sorted > n_local[0]) n_local[0] = n_sorted;
+    }
+    n_local[1] = with_threads ? num_threads : 0;
+    MPI_Allreduce(n_local, n_max, 2, MPI_INT, MPI_MAX, m_comm);
+    int n_hwpc = n_max[0];
+    int n_thread_rows = n_max[1];
+
+    //	fixed width text row :
+    //	rank thread section count time operations [hwpc ...]
+    const int w_field = 15;
+    int row_bytes = 8+1 + 4+1 + 6+1 + w_field*(3+n_hwpc) + 1;
+    int rows_per_rank = n_sec * (1 + n_thread_rows);
+    int stride = 3 + n_hwpc;
+
+    //	index header written by rank 0. Its length is broadcast to the others.
+    std::string header;
+    long header_bytes = 0;
+    if (my_rank == 0) {
+      char line[256];
+      snprintf(line, sizeof(line), "%8s %4s %6s %*s%*s%*s", "#   rank", "thr", "sec",
+        w_field, "count", w_field, "time[sec]", w_field, "operations");
+      std::string cols = line;
+      int i_hwpc = -1;
+      for (int i=0; i<m_nWatch; i++) {
+        if (n_hwpc > 0 && m_watchArray[i].my_papi.num_sorted == n_hwpc) { i_hwpc = i; break; }
+      }
+      for (int n=0; n<n_hwpc; n++) {
+        std::string s = (i_hwpc < 0) ? "hwpc" : m_watchArray[i_hwpc].my_papi.s_sorted[n];
+        int kp = s.find_last_of(':');
+        if (kp >= 0) s = s.substr(kp+1);
+        snprintf(line, sizeof(line), " %*.*s", w_field-1, w_field-1, s.c_str());
+        cols += line;
+      }
+      cols += "\n";
+
+      std::string body;
+      snprintf(line, sizeof(line), "# processes %d sections %d threads %d hwpc %d\n",
+        num_process, n_sec, n_thread_rows, n_hwpc);
+      body += line;
+      snprintf(line, sizeof(line), "# row_bytes %d rows_per_rank %d\n", row_bytes, rows_per_rank);
+      body += line;
+      body += "# row offset = header_bytes + (rank * rows_per_rank + row) * row_bytes\n";
+      body += "# row = section * (1 + threads) + (thread + 1). thread -1 is the process value\n";
+      body += "# the section index table : index exclusive(1|0) in_parallel(1|0) label\n";
+      for (int g=0; g<n_sec; g++) {
+        PerfWatch& w = m_watchArray[m_global_order[g]];
+        snprintf(line, sizeof(line), "#S %6d %d %d ", g, w.m_exclusive ? 1:0, w.m_in_parallel ? 1:0);
+        body += line;
+        body += w.m_label;
+        body += "\n";
+      }
+      body += cols;
+
+      std::string title = "# PMlib detail file. PMlib version ";
+      title += PM_VERSION;
+      title += "\n";
+      //	"# header_bytes" line has a fixed width, so the total length is known in advance
+      header_bytes = title.size() + 28 + body.size();
+      snprintf(line, sizeof(line), "# header_bytes %012ld\n", header_bytes);
+      header = title + line + body;
+    }
+    MPI_Bcast(&header_bytes, 1, MPI_LONG, 0, m_comm);
+
+    //	format my own rows
+    size_t my_bytes = (size_t)rows_per_rank * row_bytes;
+    size_t h_bytes = (my_rank == 0) ? (size_t)header_bytes : 0;
+    char* wbuf = new char[h_bytes + my_bytes + 1];
+    if (my_rank == 0) memcpy(wbuf, header.c_str(), h_bytes);
+    double* v = new double[stride];
+    char* p = wbuf + h_bytes;
+
+    for (int g=0; g<n_sec; g++) {
+      PerfWatch& w = m_watchArray[m_global_order[g]];
+      for (int t=-1; t<n_thread_rows; t++) {
+        if (t < 0) {
+          w.packGather(v, n_hwpc);
+        } else if (t < num_threads) {
+          w.packThread(v, n_hwpc, t);
+        } else {
+          for (int n=0; n<stride; n++) v[n] = 0.0;
+        }
+        char row[64];
+        int len;
+        snprintf(row, sizeof(row), "%8d %4d %6d %*ld", my_rank, t, g, w_field, (long)v[2]);
+        len = 8+1+4+1+6+1+w_field;
+        memcpy(p, row, len);
+        snprintf(row, sizeof(row), "%*.6e%*.6e", w_field, v[0], w_field, v[1]);
+        memcpy(p+len, row, 2*w_field);
+        len += 2*w_field;
+        for (int n=0; n<n_hwpc; n++) {
+          snprintf(row, sizeof(row), "%*.6e", w_field, v[3+n]);
+          memcpy(p+len, row, w_field);
+          len += w_field;
+        }
+        p[len++] = '\n';
+        p += len;
+      }
+    }
+
+    //	single collective write of all rows
+    MPI_File fh;
+    MPI_Status status;
+    int iret;
+    iret = MPI_File_open(m_comm, (char*)filename.c_str(),
+                         MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+    if (iret != MPI_SUCCESS) {
+      if (my_rank == 0) printDiag("printDetailFile()", "MPI_File_open failed for [%s]. iret=%d\n", filename.c_str(), iret);
+      delete[] wbuf;
+      delete[] v;
+      return;
+    }
+    (void) MPI_File_set_size(fh, 0);
+    MPI_Offset offset = (my_rank == 0) ? 0 :
+      (MPI_Offset)header_bytes + (MPI_Offset)my_rank * (MPI_Offset)my_bytes;
+    iret = MPI_File_write_at_all(fh, offset, wbuf, (int)(h_bytes + my_bytes), MPI_CHAR, &status);
+    if (iret != MPI_SUCCESS) {
+      fprintf(stderr, "*** PMlib error. <printDetailFile> MPI_File_write_at_all failed. iret=%d\n", iret);
+    }
+    MPI_File_close(&fh);
 
-		fprintf(fp, "%-*s:", maxLabelLen, p_label.c_str() );
-		for (int i=0; i<n_parts; i++) {
-			fprintf(fp, "%7.1f ",  sorted_joule[i]/w.m_time_av);	// Watt value
+    delete[] wbuf;
+    delete[] v;
+#endif
+  }
+
+
+  /// printStructured()でランク0がランク別の値を順に受け取る通信のタグ
+  static const int Structured_tag_token = 7412;
+  static const int Structured_tag_values = 7413;
+
+
+  /// 文字列をJSONまたはCSVの文字列として出力
+  ///
+  static void put_string (FILE* fp, const std::string& s, bool is_json)
+  {
+	fputc('"', fp);
+	for (size_t i=0; i<s.size(); i++) {
+		unsigned char c = s[i];
+		if (is_json) {
+			if (c == '"' || c == '\\') {
+				fputc('\\', fp); fputc(c, fp);
+			} else if (c < 0x20) {
+				fprintf(fp, "\\u%04x", c);
+			} else {
+				fputc(c, fp);
+			}
+		} else {
+			if (c == '"') fputc('"', fp);
+			fputc(c, fp);
 		}
-		fprintf(fp, "  %8.2e",  sorted_joule[0]/3600.0);			// Watt-Hour energy value
-		fprintf(fp, "\n");
 	}
+	fputc('"', fp);
+  }
 
-    for (int i=0; i< maxLabelLen; i++) { fputc('-', fp); }	; fprintf(fp, "+--------+");
-    for (int i=0; i<(n_parts-1)*8; i++) { fputc('-', fp); }	 ; fprintf(fp, "+----------\n");
 
-#endif
-}
+  /// 数値をJSONまたはCSVの値として出力。有限でない値はnull(JSON)または空欄(CSV)
+  ///
+  static void put_value (FILE* fp, double v, bool is_json)
+  {
+	if (std::isfinite(v)) {
+		fprintf(fp, "%.17g", v);
+	} else if (is_json) {
+		fprintf(fp, "null");
+	}
+  }
 
 
-  /// MPIランク別詳細レポート、HWPC詳細レポートを出力。
+  /// 測定結果を機械可読な形式(JSON, CSV)で出力。
   ///
-  ///   @param[in] fp           出力ファイルポインタ
-  ///   @param[in] legend int型 (省略可) HWPC記号説明の表示(0:なし、1:表示する)
-  ///   @param[in] op_sort      (省略可)測定区間の表示順 (0:経過時間順、1:登録順で表示)
+  ///   @param[in] fp       出力ファイルポインタ
+  ///   @param[in] format   出力形式 "JSON" または "CSV"
   ///
-  ///   @note 詳細レポートは排他測定区間のみを出力する
-  ///         HWPC値は各プロセス毎に子スレッドの値を合算して表示する
+  ///   @note 全プロセスで呼び出す集団操作。PMLIB_REPORT_FORMAT=json|csv の場合に
+  ///   テキストのレポートの代わりに selectReport() から呼ばれる。
+  ///   PMLIB_REPORTの指定に従い、BASICは区間別の統計量、DETAILはランク別の値、
+  ///   FULLはさらにスレッド別の値を含む。出力は文書全体を保持せずに一回の走査で
+  ///   書き出す。ランク0は各ランクの値をランク順に一つずつ受け取るので、
+  ///   必要なメモリはプロセス数に依存しない。
+  ///   CSVは '#' で始まる行に実行環境の情報を、続く表に1行1レコードを出力する。
+  ///   レコードの種類は kind 列 (section, rank, thread) で区別する。
   ///
-  void PerfMonitor::printDetail(FILE* fp, int legend, int op_sort)
+  void PerfMonitor::printStructured(FILE* fp, const std::string format)
   {
-
     if (!is_PMlib_enabled) return;
-    if (!is_MPI_enabled) return;
+    if (m_nWatch == 0) return;
 
-	#ifdef DEBUG_PRINT_MONITOR
-    fprintf(stderr, "<PerfMonitor::printDetail> starts. \n");
-	#endif
+    bool is_json = (format == "JSON");
+    bool with_ranks = (env_str_report == "DETAIL" || env_str_report == "FULL");
+    bool with_threads = (env_str_report == "FULL");
 
-    if (m_nWatch == 0) {
-      if (my_rank == 0) {
-      fprintf(fp, "\n# PMlib printDetail():: No section has been defined via setProperties().\n");
+    //	the stats of the sections in the global order
+    gather();
+    int n_sec = m_nGlobal;
+
+    //	the row length must be common to all ranks
+    int n_local[2], n_max[2];
+    n_local[0] = 0;
+    for (int i=0; i<m_nWatch; i++) {
+      int n_sorted = m_watchArray[i].calibrateHWPC();
+      if (n_sorted > n_local[0]) n_local[0] = n_sorted;
+    }
+    n_local[1] = (num_threads < Max_nthreads) ? num_threads : Max_nthreads;
+    n_max[0] = n_local[0];
+    n_max[1] = n_local[1];
+#ifndef DISABLE_MPI
+    if (num_process > 1) MPI_Allreduce(n_local, n_max, 2, MPI_INT, MPI_MAX, m_comm);
+#endif
+    int n_hwpc = n_max[0];
+    int n_thread_rows = with_threads ? n_max[1] : 0;
+    int stride = 3 + n_hwpc;
+
+    //	the HWPC values averaged over the processes
+    double* v_sum = new double[(size_t)n_sec*stride + 1];
+    double* v_avg = new double[(size_t)n_sec*stride + 1];
+    for (int g=0; g<n_sec; g++) {
+      m_watchArray[m_global_order[g]].packGather(&v_sum[g*stride], n_hwpc);
+      for (int n=3; n<stride; n++) v_sum[g*stride+n] = fabs(v_sum[g*stride+n]);
+    }
+#ifndef DISABLE_MPI
+    if (num_process > 1) {
+      MPI_Reduce(v_sum, v_avg, n_sec*stride, MPI_DOUBLE, MPI_SUM, 0, m_comm);
+    } else
+#endif
+    {
+      for (int j=0; j<n_sec*stride; j++) v_avg[j] = v_sum[j];
+    }
+    delete[] v_sum;
+
+    //	the values of my own process (and threads) sent to rank 0
+    size_t rank_len = 1 + (size_t)n_sec * (1 + n_thread_rows) * stride;
+    double* rbuf = NULL;
+    if (with_ranks) {
+      rbuf = new double[rank_len];
+      rbuf[0] = (double)n_local[1];
+      double* p = rbuf + 1;
+      for (int g=0; g<n_sec; g++) {
+        PerfWatch& w = m_watchArray[m_global_order[g]];
+        w.packGather(p, n_hwpc);
+        p += stride;
+        for (int t=0; t<n_thread_rows; t++) {
+          if (t < n_local[1]) {
+            w.packThread(p, n_hwpc, t);
+          } else {
+            for (int n=0; n<stride; n++) p[n] = 0.0;
+          }
+          p += stride;
+        }
       }
-      return;
     }
 
-    gather();
-
-    if (my_rank != 0) return;
+    if (my_rank != 0) {
+#ifndef DISABLE_MPI
+      if (with_ranks) {
+        //	wait for the request from rank 0, so that rank 0 receives one rank at a time
+        int token;
+        MPI_Status status;
+        MPI_Recv(&token, 1, MPI_INT, 0, Structured_tag_token, m_comm, &status);
+        MPI_Send(rbuf, (int)rank_len, MPI_DOUBLE, 0, Structured_tag_values, m_comm);
+      }
+#endif
+      if (rbuf != NULL) delete[] rbuf;
+      delete[] v_avg;
+      return;
+    }
 
-    // PMlib Process Report is not generated for serial jobs
+    //	names of the HWPC values and the power parts
+    std::vector<std::string> s_hwpc;
+    for (int i=0; i<m_nWatch; i++) {
+      if (n_hwpc > 0 && m_watchArray[i].my_papi.num_sorted == n_hwpc) {
+        for (int n=0; n<n_hwpc; n++) s_hwpc.push_back(m_watchArray[i].my_papi.s_sorted[n]);
+        break;
+      }
+    }
+    for (int n=(int)s_hwpc.size(); n<n_hwpc; n++) s_hwpc.push_back("hwpc");
+    int n_power = 0;
+    std::vector<std::string> s_power;
+#ifdef USE_POWER
+    if (level_POWER > 0) n_power = (num_power < Max_power_stats) ? num_power : Max_power_stats;
+    for (int n=0; n<n_power; n++) {
+      s_power.push_back((n < Max_power_object) ? p_obj_name[n] : "measured device");
+    }
+#endif
 
-    // 	I. MPIランク別詳細レポート: MPIランク別測定結果を出力
-    fprintf(fp, "\n## PMlib Process Report --- Elapsed time for individual MPI ranks ------\n\n");
+    //	platform and timer information
+    char hn[512];
+    hn[0] = '\0';
+    if (gethostname(hn, sizeof(hn)) != 0) strcpy(hn, "unknown");
+    char date[32];
+    time_t now;
+    time(&now);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+    bool is_precise_timer = false;
+#if defined (USE_PRECISE_TIMER)
+    is_precise_timer = true;
+#endif
+    std::string s_supports;
+#ifdef DISABLE_MPI
+    s_supports += "no-MPI";
+#else
+    s_supports += "MPI";
+#endif
+#ifdef _OPENMP
+    s_supports += ",OpenMP";
+#endif
+#ifdef USE_PAPI
+    s_supports += ",HWPC";
+#endif
+#ifdef USE_POWER
+    s_supports += ",PowerAPI";
+#endif
+#ifdef USE_OTF
+    s_supports += ",OTF";
+#endif
 
-      // 測定時間の分母
-      // initialize()からgather()までの区間（==Root区間）の測定時間を分母とする
-      double tot = m_watchArray[0].m_time_av;
+    const int n_info = 13;
+    const char* key_info[n_info] = { "pmlib_version", "supports", "host", "date",
+      "parallel_mode", "hwpc_chooser", "report", "num_processes", "num_threads",
+      "precise_timer", "cpu_clock_freq", "second_per_cycle", "elapsed_time" };
+    char num_buf[6][32];
+    snprintf(num_buf[0], 32, "%d", num_process);
+    snprintf(num_buf[1], 32, "%d", num_threads);
+    snprintf(num_buf[2], 32, "%s", is_precise_timer ? "true" : "false");
+    snprintf(num_buf[3], 32, "%.17g", hw_context.cpu_clock_freq);
+    snprintf(num_buf[4], 32, "%.17g", hw_context.second_per_cycle);
+    snprintf(num_buf[5], 32, "%.17g", m_watchArray[0].m_time_av);
+    const char* val_info[n_info] = { PM_VERSION, s_supports.c_str(), hn, date,
+      parallel_mode.c_str(), env_str_hwpc.c_str(), env_str_report.c_str(), num_buf[0], num_buf[1],
+      num_buf[2], num_buf[3], num_buf[4], num_buf[5] };
+    const int n_quoted = 7;	// the first n_quoted values are strings
+
+    if (is_json) {
+      fprintf(fp, "{\n");
+      for (int k=0; k<n_info; k++) {
+        fprintf(fp, "\"%s\":", key_info[k]);
+        if (k < n_quoted) put_string(fp, val_info[k], true); else fprintf(fp, "%s", val_info[k]);
+        fprintf(fp, ",\n");
+      }
+      fprintf(fp, "\"hwpc_names\":[");
+      for (int n=0; n<n_hwpc; n++) { if (n) fputc(',', fp); put_string(fp, s_hwpc[n], true); }
+      fprintf(fp, "],\n\"power_names\":[");
+      for (int n=0; n<n_power; n++) { if (n) fputc(',', fp); put_string(fp, s_power[n], true); }
+      fprintf(fp, "],\n\"sections\":[\n");
+    } else {
+      for (int k=0; k<n_info; k++) {
+        fprintf(fp, "# %s,", key_info[k]);
+        put_string(fp, val_info[k], false);
+        fputc('\n', fp);
+      }
+      fprintf(fp, "kind,section,label,type,exclusive,in_parallel,rank,thread,calls,calls_sum,"
+        "time,time_sd,time_min,time_max,rank_min,rank_max,time_p50,time_p90,time_p99,operations,operations_sd");
+      for (int n=0; n<n_hwpc; n++) { fputc(',', fp); put_string(fp, s_hwpc[n], false); }
+      for (int n=0; n<n_power; n++) { fputc(',', fp); put_string(fp, "power:" + s_power[n], false); }
+      fputc('\n', fp);
+    }
 
-    // 測定区間の時間と計算量を表示。表示順は引数 op_sort で指定されている。
-      for (int j = 0; j < m_nWatch; j++) {
-        int i;
-        if (op_sort == 0) {
-          i = m_order[j]; //	0:経過時間順
-        } else {
-          i = j; //	1:登録順で表示
+    //	section stats
+    for (int g=0; g<n_sec; g++) {
+      PerfWatch& w = m_watchArray[m_global_order[g]];
+      double v_sec[13];
+      v_sec[0] = (double)w.m_count_av;
+      v_sec[1] = (double)w.m_count_sum;
+      v_sec[2] = w.m_time_av;
+      v_sec[3] = w.m_time_sd;
+      v_sec[4] = w.m_stats.time_min;
+      v_sec[5] = w.m_stats.time_max;
+      v_sec[6] = (double)w.m_stats.rank_min;
+      v_sec[7] = (double)w.m_stats.rank_max;
+      v_sec[8] = stats_quantile(&w.m_stats, 0.50);
+      v_sec[9] = stats_quantile(&w.m_stats, 0.90);
+      v_sec[10] = stats_quantile(&w.m_stats, 0.99);
+      v_sec[11] = w.m_flop_av;
+      v_sec[12] = w.m_flop_sd;
+      const char* key_sec[13] = { "calls", "calls_sum", "time", "time_sd", "time_min", "time_max",
+        "rank_min", "rank_max", "time_p50", "time_p90", "time_p99", "operations", "operations_sd" };
+      const char* s_type = (w.get_typeCalc() == 0) ? "COMM" : "CALC";
+
+      if (is_json) {
+        fprintf(fp, "%s{\"id\":%d,\"label\":", (g==0)?"":",\n", g);
+        put_string(fp, w.m_label, true);
+        fprintf(fp, ",\"type\":\"%s\",\"exclusive\":%s,\"in_parallel\":%s", s_type,
+          w.m_exclusive ? "true":"false", w.m_in_parallel ? "true":"false");
+        for (int k=0; k<13; k++) { fprintf(fp, ",\"%s\":", key_sec[k]); put_value(fp, v_sec[k], true); }
+        fprintf(fp, ",\"hwpc\":[");
+        for (int n=0; n<n_hwpc; n++) {
+          if (n) fputc(',', fp);
+          put_value(fp, v_avg[g*stride+3+n]/(double)num_process, true);
         }
-        if (i == 0) continue;
-		// Policy change
-		// Both of exclusive sections and inclusive sections will be reported.
-        //	if (!m_watchArray[i].m_exclusive) continue;
-        m_watchArray[i].printDetailRanks(fp, tot);
+        fprintf(fp, "],\"power_joule\":[");
+        for (int n=0; n<n_power; n++) { if (n) fputc(',', fp); put_value(fp, w.my_power.w_accumu[n], true); }
+        fprintf(fp, "]}");
+      } else {
+        fprintf(fp, "section,%d,", g);
+        put_string(fp, w.m_label, false);
+        fprintf(fp, ",%s,%d,%d,,", s_type, w.m_exclusive ? 1:0, w.m_in_parallel ? 1:0);
+        for (int k=0; k<13; k++) { fputc(',', fp); put_value(fp, v_sec[k], false); }
+        for (int n=0; n<n_hwpc; n++) { fputc(',', fp); put_value(fp, v_avg[g*stride+3+n]/(double)num_process, false); }
+        for (int n=0; n<n_power; n++) { fputc(',', fp); put_value(fp, w.my_power.w_accumu[n], false); }
+        fputc('\n', fp);
+      }
+    }
+    delete[] v_avg;
+    if (is_json) fprintf(fp, "\n]");
+
+    //	per rank and per thread values, received one rank at a time
+    if (with_ranks) {
+      if (is_json) fprintf(fp, ",\n\"processes\":[\n");
+      double* buf = rbuf;
+      double* recv = (num_process > 1) ? new double[rank_len] : NULL;
+      for (int r=0; r<num_process; r++) {
+#ifndef DISABLE_MPI
+        if (r > 0) {
+          int token = 1;
+          MPI_Status status;
+          MPI_Send(&token, 1, MPI_INT, r, Structured_tag_token, m_comm);
+          MPI_Recv(recv, (int)rank_len, MPI_DOUBLE, r, Structured_tag_values, m_comm, &status);
+          buf = recv;
+        }
+#endif
+        int n_thr = (int)buf[0];
+        if (n_thr > n_thread_rows) n_thr = n_thread_rows;
+        if (is_json) fprintf(fp, "%s{\"rank\":%d,\"sections\":[\n", (r==0)?"":",\n", r);
+
+        for (int g=0; g<n_sec; g++) {
+          for (int t=-1; t<n_thr; t++) {
+            double* v = buf + 1 + ((size_t)g*(1+n_thread_rows) + (t+1)) * stride;
+            if (is_json) {
+              if (t < 0) {
+                fprintf(fp, "%s{\"id\":%d,\"calls\":", (g==0)?"":",\n", g);
+              } else {
+                fprintf(fp, "%s{\"thread\":%d,\"calls\":", (t==0)?",\"threads\":[":",", t);
+              }
+              put_value(fp, v[2], true);
+              fprintf(fp, ",\"time\":");       put_value(fp, v[0], true);
+              fprintf(fp, ",\"operations\":"); put_value(fp, v[1], true);
+              fprintf(fp, ",\"hwpc\":[");
+              for (int n=0; n<n_hwpc; n++) { if (n) fputc(',', fp); put_value(fp, v[3+n], true); }
+              fprintf(fp, "]");
+              if (t >= 0) fprintf(fp, "}");
+            } else {
+              PerfWatch& w = m_watchArray[m_global_order[g]];
+              fprintf(fp, "%s,%d,", (t<0)?"rank":"thread", g);
+              put_string(fp, w.m_label, false);
+              fprintf(fp, ",,,,%d,", r);
+              if (t >= 0) fprintf(fp, "%d", t);
+              fputc(',', fp); put_value(fp, v[2], false);
+              fputc(',', fp);
+              fputc(',', fp); put_value(fp, v[0], false);
+              fprintf(fp, ",,,,,,,,");
+              fputc(',', fp); put_value(fp, v[1], false);
+              fputc(',', fp);
+              for (int n=0; n<n_hwpc; n++) { fputc(',', fp); put_value(fp, v[3+n], false); }
+              for (int n=0; n<n_power; n++) fputc(',', fp);
+              fputc('\n', fp);
+            }
+          }
+          if (is_json) fprintf(fp, "%s}", (n_thr > 0)?"]":"");
+        }
+        if (is_json) fprintf(fp, "\n]}");
       }
+      if (recv != NULL) delete[] recv;
+      delete[] rbuf;
+      if (is_json) fprintf(fp, "\n]");
+    }
 
+    if (is_json) fprintf(fp, "\n}\n");
+  }
 
-#ifdef USE_PAPI
-    //	II. HWPC/PAPIレポート：HWPC計測結果を出力
-	if (m_watchArray[0].my_papi.num_events == 0) return;
-	if (env_str_hwpc == "USER" ) return;
-    fprintf(fp, "\n## PMlib hardware performance counter (HWPC) report for individual MPI ranks ---------\n\n");
-    fprintf(fp, "\tThe HWPC stats report for HWPC_CHOOSER=%s is generated.\n\n", env_str_hwpc.c_str());
 
+  /// copy the name into the fixed length field of the dump file
+  ///
+  static void dump_name (char* dst, const std::string& src, int len)
+  {
+	strncpy(dst, src.c_str(), len-1);
+	dst[len-1] = '\0';
+  }
 
-    for (int j = 0; j < m_nWatch; j++) {
-        int i;
-        if (op_sort == 0) {
-          i = m_order[j]; //	0:経過時間順
-        } else {
-          i = j; //	1:登録順で表示
-        }
-        if (i == 0) continue;
-		// Policy change
-		// Both of exclusive sections and inclusive sections will be reported.
-        //	if (!m_watchArray[i].m_exclusive) continue;
-        m_watchArray[i].printDetailHWPCsums(fp, m_watchArray[i].m_label);
+
+  /// 自プロセスの全測定区間の測定値をバイナリファイルに出力。
+  ///
+  ///   @param[in] prefix   出力ファイル名の接頭辞。ファイル名は prefix.RRRRRR.pmd
+  ///
+  ///   @note MPI通信を行わない。ファイルの形式は pmlib_dump.h を参照。
+  ///   区間の値はスレッドのマージ後の値、スレッド別の値は printThreads() と
+  ///   同じ値 (packThread) と、HWPCカウンタの生の積算値 (th_accumu) を出力する。
+  ///
+  void PerfMonitor::writeDump(const std::string prefix)
+  {
+    if (!is_PMlib_enabled) return;
+
+    //	the sorted HWPC values and the derived values are prepared
+    //	in the same way as gather_and_stats()
+    int *n_sorted = NULL;
+    if ( !(n_sorted = new int[m_nWatch]) ) PM_Exit(0);
+    int n_sorted_max = 0;
+    int i_hwpc = -1;
+    for (int i=0; i<m_nWatch; i++) {
+      n_sorted[i] = m_watchArray[i].calibrateHWPC();
+      if (n_sorted[i] > Max_dump_events) n_sorted[i] = Max_dump_events;
+      if (n_sorted[i] > n_sorted_max) { n_sorted_max = n_sorted[i]; i_hwpc = i; }
     }
 
+    struct pmlib_dump_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, Dump_magic, sizeof(h.magic));
+    h.version = Dump_version;
+    h.byte_order = Dump_byte_order;
+    h.rank = my_rank;
+    h.num_process = num_process;
+    h.num_threads = (num_threads < Max_nthreads) ? num_threads : Max_nthreads;
+    h.num_sections = m_nWatch;
+    h.num_events = m_watchArray[0].my_papi.num_events;
+    if (h.num_events > Max_dump_events) h.num_events = Max_dump_events;
+    h.num_sorted = n_sorted_max;
+    h.num_power = 0;
+#ifdef USE_POWER
+    if (level_POWER > 0) h.num_power = (num_power < Max_dump_power) ? num_power : Max_dump_power;
 #endif
+    h.is_unit = m_watchArray[0].statsSwitch();
+    dump_name(h.pm_version, PM_VERSION, Max_dump_name);
+    dump_name(h.parallel_mode, parallel_mode, Max_dump_name);
+    dump_name(h.hwpc_chooser, env_str_hwpc, Max_dump_name);
+    if (gethostname(h.hostname, sizeof(h.hostname)-1) != 0) {
+      dump_name(h.hostname, "unknown", sizeof(h.hostname));
+    }
+    for (int n=0; n<h.num_events; n++) {
+      dump_name(h.event_name[n], m_watchArray[0].my_papi.s_name[n], Max_dump_name);
+    }
+    for (int n=0; n<n_sorted_max; n++) {
+      dump_name(h.sorted_name[n], m_watchArray[i_hwpc].my_papi.s_sorted[n], Max_dump_name);
+    }
+    for (int n=0; n<h.num_power; n++) {
+      dump_name(h.power_name[n], (n < Max_power_object) ? p_obj_name[n] : "measured device", Max_dump_name);
+    }
 
-	#ifdef DEBUG_PRINT_MONITOR
-    fprintf(stderr, "<PerfMonitor::printDetail> ends. \n");
-	#endif
+    char filename[512];
+    snprintf(filename, sizeof(filename), "%s.%06d.pmd", prefix.c_str(), my_rank);
+    FILE* fd = fopen(filename, "wb");
+    if (fd == NULL) {
+      printDiag("writeDump()", "can not open the dump file [%s] on my_rank=%d\n", filename, my_rank);
+      delete[] n_sorted;
+      return;
+    }
+
+    fwrite(&h, sizeof(h), 1, fd);
+
+    double v[3+Max_dump_events];
+    for (int i=0; i<m_nWatch; i++) {
+      PerfWatch& w = m_watchArray[i];
+      struct pmlib_dump_section s;
+      memset(&s, 0, sizeof(s));
+      s.id = i;
+      s.type_calc = w.get_typeCalc();
+      s.exclusive = w.m_exclusive ? 1 : 0;
+      s.in_parallel = w.m_in_parallel ? 1 : 0;
+      s.is_unit = w.statsSwitch();
+      s.num_sorted = n_sorted[i];
+      s.label_len = (int)w.m_label.size();
+      s.count = w.m_count;
+      s.time = w.m_time;
+      s.flop = w.m_flop;
+      s.percentage = w.m_percentage;
+      fwrite(&s, sizeof(s), 1, fd);
+      fwrite(w.m_label.data(), 1, s.label_len, fd);
+
+      w.packGather(v, s.num_sorted);
+      fwrite(&v[3], sizeof(double), s.num_sorted, fd);
+      fwrite(w.my_power.w_accumu, sizeof(double), h.num_power, fd);
+
+      for (int t=0; t<h.num_threads; t++) {
+        struct pmlib_dump_thread r;
+        w.packThread(v, s.num_sorted, t);
+        r.count = (long)v[2];
+        r.time = v[0];
+        r.flop = v[1];
+        fwrite(&r, sizeof(r), 1, fd);
+        fwrite(&v[3], sizeof(double), s.num_sorted, fd);
+        fwrite(w.my_papi.th_accumu[t], sizeof(long long), h.num_events, fd);
+      }
+    }
 
+    if (ferror(fd)) {
+      printDiag("writeDump()", "write error in the dump file [%s] on my_rank=%d\n", filename, my_rank);
+    }
+    fclose(fd);
+    delete[] n_sorted;
   }
 
 
@@ -1463,12 +3871,13 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
     }
 
     // 測定区間の時間と計算量を表示。表示順は引数 op_sort で指定されている。
+    // printDetailThreads() is collective. The order must be common to all ranks.
     for (int j = 0; j < m_nWatch; j++) {
       int i;
       if (op_sort == 0) {
           i = m_order[j]; //	0:経過時間順
       } else {
-          i = j; //	1:登録順で表示
+          i = m_global_order[j]; //	1:登録順で表示
       }
       if (i == 0) continue;	// 区間0 : Root区間は出力しない
 		// Policy change
@@ -1582,94 +3991,282 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
   }
 
 
-  /// MPI_Comm_splitで作成するグループ毎にMPIランク詳細レポートを出力
+  /// MPI_Comm_splitで作成するグループ毎に測定区間の統計レポートを出力
   ///
   ///   @param[in] fp 出力ファイルポインタ
-  ///   @param[in] new_comm   MPI_Comm型 対応するcommunicator
+  ///   @param[in] new_comm   MPI_Comm型 対応するcommunicator (互換性のために残されている)
   ///   @param[in] icolor int型 MPI_Comm_split()のカラー変数
   ///   @param[in] key    int型 MPI_Comm_split()のkey変数
   ///   @param[in] legend int型 (省略可) HWPC記号説明の表示(0:なし、1:表示する)
   ///   @param[in] op_sort (省略可)測定区間の表示順 (0:経過時間順、1:登録順)
   ///
+  ///   @note  m_commをicolorで一回だけ分割し、各グループ内で全測定区間の
+  ///   統計量(呼び出し回数、時間の平均・標準偏差・最小・最大とそのランク、
+  ///   演算量、HWPC値の平均)を並列にリダクションする。ランク0には各グループの
+  ///   代表プロセスからグループ毎の集計値のみが集められるので、グループ数や
+  ///   プロセス数が多くてもランク別の表を走査しない。
+  ///   new_commはm_commと異なるcommunicatorから作られている場合があるので
+  ///   グループの構成には用いない。
+  ///
   void PerfMonitor::printComm (FILE* fp, MPI_Comm new_comm, int icolor, int key, int legend, int op_sort)
   {
 
     if (!is_PMlib_enabled) return;
+    if (m_nWatch == 0) return;
+    (void) new_comm;
+#ifndef DISABLE_MPI
 
-	int my_id, num_process;
-	MPI_Group my_group;
-	MPI_Comm_group(MPI_COMM_WORLD, &my_group);
-	MPI_Comm_rank(MPI_COMM_WORLD, &my_id);
-	MPI_Comm_size(MPI_COMM_WORLD, &num_process);
+    //	The sections are reduced in the global order common to all ranks.
+    reconcile_sections();
+    int n_sec = m_nGlobal;
 
-	int ngroups;
-	int *g_icolor;
-	g_icolor = new int[num_process]();
-	MPI_Gather(&icolor,1,MPI_INT, g_icolor,1,MPI_INT, 0, MPI_COMM_WORLD);
+    int n_hwpc = 0;
+    for (int i=0; i<m_nWatch; i++) {
+      int n_sorted = m_watchArray[i].calibrateHWPC();
+      if (n_sorted > n_hwpc) n_hwpc = n_sorted;
+    }
+    (void) MPI_Allreduce(MPI_IN_PLACE, &n_hwpc, 1, MPI_INT, MPI_MAX, m_comm);
+
+    //	the summary of this process and the HWPC values of all sections
+    int stride = 3 + n_hwpc;
+    std::vector<double> buf(stride);
+    std::vector<pmlib_section_stats> st(n_sec);
+    std::vector<double> hw((size_t)n_sec*n_hwpc + 1, 0.0);
+    for (int g = 0; g < n_sec; g++) {
+      m_watchArray[m_global_order[g]].packGather(&buf[0], n_hwpc);
+      stats_init(&st[g]);
+      stats_add(&st[g], buf[0], buf[1], (long)buf[2], my_rank);
+      for (int n = 0; n < n_hwpc; n++) hw[(size_t)g*n_hwpc+n] = buf[3+n];
+    }
 
-	#ifdef DEBUG_PRINT_MPI_GROUP
-	(void) MPI_Barrier(MPI_COMM_WORLD);
-	fprintf(stderr, "<printComm> MPI_Gather finished. my_id=%d, my_group=%d\n",
-		my_id, my_group);
-	#endif
+    //	split m_comm once, and reduce all sections within each group in parallel
+    MPI_Comm g_comm;
+    int g_rank, g_size;
+    if ( MPI_Comm_split(m_comm, icolor, key, &g_comm) != MPI_SUCCESS ) {
+      printDiag("printComm()",  "MPI_Comm_split failed. The group report is not produced.\n");
+      return;
+    }
+    //	the process with icolor=MPI_UNDEFINED does not belong to any group
+    g_rank = -1;
+    g_size = 0;
+    std::vector<pmlib_section_stats> st_g(n_sec);
+    std::vector<double> hw_g(hw.size(), 0.0);
+    if (g_comm != MPI_COMM_NULL) {
+      MPI_Comm_rank(g_comm, &g_rank);
+      MPI_Comm_size(g_comm, &g_size);
+
+      MPI_Datatype stats_type;
+      MPI_Op stats_op;
+      if ( stats_mpi_type(&stats_type, &stats_op) != MPI_SUCCESS ) PM_Exit(0);
+      int iret = MPI_Reduce(&st[0], &st_g[0], n_sec, stats_type, stats_op, 0, g_comm);
+      if (iret == MPI_SUCCESS && n_hwpc > 0) {
+        iret = MPI_Reduce(&hw[0], &hw_g[0], n_sec*n_hwpc, MPI_DOUBLE, MPI_SUM, 0, g_comm);
+      }
+      if ( iret != MPI_SUCCESS ) {
+        fprintf(stderr, "*** PMlib error. <printComm> MPI_Reduce failed. iret=%d\n", iret);
+        PM_Exit(0);
+      }
+      MPI_Comm_free(&g_comm);
+    }
 
-	//	if(my_id != 0) return;
-
-	int *g_myid;
-	int *p_gid;
-	int *p_color;
-	int *p_size;
-	g_myid = new int[num_process]();
-	p_gid  = new int[num_process]();
-	p_color = new int[num_process]();
-	p_size = new int[num_process]();
-
-	std::list<int> c_list;
-	std::list<int>::iterator it;
-	for (int i=0; i<num_process; i++) {
-		c_list.push_back(g_icolor[i]);
-	}
-	c_list.sort();
-	c_list.unique();
-	ngroups = c_list.size();
-
-	int ip = 0;
-	int gid = 0;
-	for (it=c_list.begin(); it!=c_list.end(); it++ ) {
-		int c = *it;
-		p_gid[gid] = ip;
-		p_color[gid] = c;
-
-		for (int i=0; i<num_process; i++) {
-			if( g_icolor[i] == c) { g_myid[ip++] = i; }
-		}
-		p_size[gid] = ip - p_gid[gid];
-		gid++;
-	}
-	#ifdef DEBUG_PRINT_MPI_GROUP
-	fprintf(stderr, "<printComm> The number of produced MPI groups=%d\n", ngroups);
-	for (int i=0; i<ngroups; i++) {
-		fprintf(stderr, "group:%d, color=%d, size=%d, g_myid[%d]:",
-			i, p_color[i], p_size[i], p_gid[i] );
-		for (int j=0; j<p_size[i]; j++) {
-			fprintf(stderr, " %d,", g_myid[p_gid[i]+j]);
-		}
-		fprintf(stderr, "\n");
-	}
-	#endif
+    //	the group leader packs the group summary
+    //	[0]:color, [1]:processes, then for each section
+    //	[0]:calls, [1]:time_av, [2]:time_sd, [3]:time_min, [4]:rank_min,
+    //	[5]:time_max, [6]:rank_max, [7]:operations, [8..]:averaged HWPC values
+    int rec_len = 8 + n_hwpc;
+    int blk_len = 2 + n_sec*rec_len;
+    std::vector<double> blk;
+    if (g_rank == 0) {
+      blk.resize(blk_len);
+      blk[0] = (double)icolor;
+      blk[1] = (double)g_size;
+      for (int g = 0; g < n_sec; g++) {
+        double* r = &blk[2 + (size_t)g*rec_len];
+        const pmlib_section_stats* sg = &st_g[g];
+        r[0] = sg->count_sum;
+        r[1] = sg->time.mean;
+        r[2] = stats_stddev(&sg->time);
+        r[3] = sg->time_min;
+        r[4] = (double)sg->rank_min;
+        r[5] = sg->time_max;
+        r[6] = (double)sg->rank_max;
+        r[7] = sg->flop.mean * sg->flop.n;
+        for (int n = 0; n < n_hwpc; n++) r[8+n] = hw_g[(size_t)g*n_hwpc+n] / (double)g_size;
+      }
+    }
+
+    //	only the group summaries are gathered to rank 0
+    int my_len = (g_rank == 0) ? blk_len : 0;
+    std::vector<int> lens, displs;
+    if (my_rank == 0) { lens.resize(num_process); displs.resize(num_process); }
+    int iret = MPI_Gather(&my_len, 1, MPI_INT, (my_rank == 0) ? &lens[0] : NULL, 1, MPI_INT, 0, m_comm);
+    int n_groups = 0;
+    std::vector<double> all;
+    if (my_rank == 0) {
+      int total = 0;
+      for (int i = 0; i < num_process; i++) {
+        displs[i] = total;
+        total += lens[i];
+        if (lens[i] > 0) n_groups++;
+      }
+      all.resize(total + 1);
+    }
+    if (iret == MPI_SUCCESS) {
+      iret = MPI_Gatherv((my_len > 0) ? &blk[0] : NULL, my_len, MPI_DOUBLE,
+                         (my_rank == 0) ? &all[0] : NULL, (my_rank == 0) ? &lens[0] : NULL,
+                         (my_rank == 0) ? &displs[0] : NULL, MPI_DOUBLE, 0, m_comm);
+    }
+    if ( iret != MPI_SUCCESS ) {
+      fprintf(stderr, "*** PMlib error. <printComm> MPI_Gatherv failed. iret=%d\n", iret);
+      PM_Exit(0);
+    }
+
+    if (my_rank != 0) return;
 
-	MPI_Group new_group;
-	for (int i=0; i<ngroups; i++) {
-		int *p = &g_myid[p_gid[i]];
-		MPI_Group_incl(my_group, p_size[i], p, &new_group);
-		//	printGroup(stdout, new_group, new_comm, p, i);
-		PerfMonitor::printGroup (stdout, new_group, new_comm, p, i, 0, op_sort);
-	}
-	delete[] g_icolor ;
-	delete[] g_myid ;
-	delete[] p_gid  ;
-	delete[] p_color ;
-	delete[] p_size ;
+    //	local section id -> global index
+    std::vector<int> g_index(m_nWatch, 0);
+    for (int g = 0; g < n_sec; g++) g_index[m_global_order[g]] = g;
+
+    //	the groups are listed in ascending order of the color
+    std::vector<const double*> groups;
+    groups.reserve(n_groups);
+    for (int k = 0; k < n_groups; k++) groups.push_back(&all[(size_t)k*blk_len]);
+    std::stable_sort(groups.begin(), groups.end(),
+      [](const double* a, const double* b) { return a[0] < b[0]; });
+
+    int maxLabelLen = 0;
+    for (int i = 0; i < m_nWatch; i++) {
+      int len = m_watchArray[i].m_label.size();
+      if (len > maxLabelLen) maxLabelLen = len;
+    }
+    maxLabelLen++;
+
+    std::vector<std::string> s_hwpc(n_hwpc);
+    for (int i = 0; i < m_nWatch && n_hwpc > 0; i++) {
+      if (m_watchArray[i].my_papi.num_sorted != n_hwpc) continue;
+      for (int n = 0; n < n_hwpc; n++) {
+        std::string s = m_watchArray[i].my_papi.s_sorted[n];
+        size_t kp = s.find_last_of(':');
+        s_hwpc[n] = (kp == std::string::npos) ? s : s.substr(kp+1);
+      }
+      break;
+    }
+
+    fprintf(fp, "\n## PMlib Process Group Report --- the summary of each MPI_Comm_split color group ------\n\n");
+    fprintf(fp, "\t%d processes are split into %d groups by the color.\n", num_process, n_groups);
+    fprintf(fp, "\tThe calls and the operations are the sums of the processes in the group.\n");
+    fprintf(fp, "\tThe time is the average, the standard deviation, the min and the max of the processes.\n");
+
+    for (size_t k = 0; k < groups.size(); k++) {
+      const double* b = groups[k];
+      fprintf(fp, "\n## PMlib Process Group [%5d] color=%d, %d processes --------\n\n",
+              (int)k, (int)b[0], (int)b[1]);
+      fprintf(fp, "%-*s|%9s |%10s %10s %10s %6s %10s %6s |%11s", maxLabelLen, "Label",
+              "calls", "time[sec]", "std.dv", "min[sec]", "rank", "max[sec]", "rank", "operations");
+      for (int n = 0; n < n_hwpc; n++) fprintf(fp, " %10.10s", s_hwpc[n].c_str());
+      fprintf(fp, "\n");
+      for (int i = 0; i < maxLabelLen; i++) fputc('-', fp);
+      fprintf(fp, "+----------+----------------------------------------------------------+-----------");
+      for (int n = 0; n < n_hwpc; n++) fprintf(fp, "-----------");
+      fprintf(fp, "\n");
+
+      for (int j = 0; j < m_nWatch; j++) {
+        int i;
+        if (op_sort == 0) {
+          i = m_order[j]; //	0:経過時間順
+        } else {
+          i = j; //	1:登録順で表示
+        }
+        if (i == 0) continue;
+        PerfWatch& w = m_watchArray[i];
+        if (!w.m_exclusive) continue;
+        const double* r = b + 2 + (size_t)g_index[i]*rec_len;
+        if ( !(r[0] > 0.0) ) continue;
+
+        fprintf(fp, "%-*s:%9ld  %10.3e %10.3e %10.3e %6d %10.3e %6d  %10.3e",
+                maxLabelLen, w.m_label.c_str(), (long)r[0],
+                r[1], r[2], r[3], (int)r[4], r[5], (int)r[6], r[7]);
+        for (int n = 0; n < n_hwpc; n++) fprintf(fp, " %10.3e", r[8+n]);
+        fprintf(fp, "\n");
+      }
+    }
+
+    if (legend == 1) printLegend(fp);
+#else
+    (void) icolor; (void) key; (void) legend; (void) op_sort;
+#endif
+  }
+
+
+
+  /// 測定区間の前回呼び出し以降の時間を全プロセスまたは隣接プロセスと交換する
+  ///
+  ///   @param[in]  label  測定区間のラベル
+  ///   @param[in]  comm   交換するMPI communicator
+  ///   @param[out] out    各プロセスの時間(秒)
+  ///
+  ///   @return  outに格納した値の数
+  ///
+  ///   @note  commがグラフ(MPI_GRAPH, MPI_DIST_GRAPH)または直交(MPI_CART)
+  ///   トポロジを持つ場合は MPI_Neighbor_allgather で隣接プロセスの値のみを、
+  ///   そうでない場合は MPI_Allgather で全プロセスの値を受け取る。
+  ///
+  int PerfMonitor::exchangeSectionCost (const std::string& label, MPI_Comm comm, double* out)
+  {
+    if (!is_PMlib_enabled) return 0;
+
+    //	the time of this process since the last exchange of this section
+    double delta = 0.0;
+    int id = find_section_object(label);
+    if (id >= 0) {
+      PerfWatch& w = m_watchArray[id];
+      delta = w.m_time - w.m_time_exchanged;
+      w.m_time_exchanged = w.m_time;
+    }
+
+#ifdef DISABLE_MPI
+    (void) comm;
+    out[0] = delta;
+    return 1;
+#else
+    int topo = MPI_UNDEFINED;
+    int n_out = 0;
+    int iret = MPI_Topo_test(comm, &topo);
+    if (iret != MPI_SUCCESS) {
+      printDiag("exchangeSectionCost()",  "invalid communicator. [%s] is not exchanged.\n", label.c_str());
+      return 0;
+    }
+
+    if (topo == MPI_DIST_GRAPH) {
+      int outdegree, weighted;
+      MPI_Dist_graph_neighbors_count(comm, &n_out, &outdegree, &weighted);
+    } else if (topo == MPI_GRAPH) {
+      int rank;
+      MPI_Comm_rank(comm, &rank);
+      MPI_Graph_neighbors_count(comm, rank, &n_out);
+    } else if (topo == MPI_CART) {
+      int ndims;
+      MPI_Cartdim_get(comm, &ndims);
+      n_out = 2*ndims;
+    } else {
+      MPI_Comm_size(comm, &n_out);
+    }
+
+    // MPI_Neighbor_allgather does not write the slots of the MPI_PROC_NULL
+    // neighbors at the boundary of a non periodic MPI_CART communicator.
+    for (int i=0; i<n_out; i++) out[i] = 0.0;
+
+    if (topo == MPI_DIST_GRAPH || topo == MPI_GRAPH || topo == MPI_CART) {
+      iret = MPI_Neighbor_allgather(&delta, 1, MPI_DOUBLE, out, 1, MPI_DOUBLE, comm);
+    } else {
+      iret = MPI_Allgather(&delta, 1, MPI_DOUBLE, out, 1, MPI_DOUBLE, comm);
+    }
+    if (iret != MPI_SUCCESS) {
+      fprintf(stderr, "*** PMlib error. <exchangeSectionCost> [%s] exchange failed. iret=%d\n", label.c_str(), iret);
+      return 0;
+    }
+    return n_out;
+#endif
   }
 
 
@@ -1693,17 +4290,29 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
     }
 	#endif
 
+    // the sections of the other threads, if report() has not been called yet
+    int n_shared;
+    countSections(n_shared);
+
     gather_and_stats();
 
 #ifdef USE_OTF
     // OTFファイルの出力と終了処理
+    //	The OTF events hold the shared section IDs of this monitor. They are
+    //	written as the region of the global section ID of reconcile_sections(),
+    //	so that a section has the same region on all ranks and threads.
     if (is_OTF_enabled) {
       std::string label;
-      for (int i=0; i<m_nWatch; i++) {
+      int n_region = m_shared->section_labels.size();	// including the ones of reconcile_sections()
+      std::vector<int> otf_region(n_region, 0);
+      for (int g=0; g<m_nGlobal; g++) {
+        int i = m_global_order[g];
         loop_section_object(i, label);
-        m_watchArray[i].labelOTF (label, i);
+        m_watchArray[i].labelOTF (label, g);
+        std::map<std::string, int>::iterator it = m_shared->map_sections.find(label);
+        if (it != m_shared->map_sections.end() && it->second < n_region) otf_region[it->second] = g;
       }
-      m_watchArray[0].finalizeOTF();
+      m_watchArray[0].finalizeOTF(&otf_region[0], n_region);
     }
 #endif
 
@@ -2178,6 +4787,19 @@ int PerfMonitor::initializePOWER (void)
 	#endif
     if (level_POWER == 0) return(0);
 
+	// The Power API contexts are shared by all PerfMonitor instances
+	// through hw_context, and are initialized only once.
+	if (hw_context.is_power_ready) {
+		pm_pacntxt = hw_context.power.pacntxt;
+		pm_extcntxt = hw_context.power.extcntxt;
+		for (int i=0; i<Max_power_stats; i++) {
+			pm_obj_array[i] = hw_context.power.p_obj_array[i];
+			pm_obj_ext[i] = hw_context.power.p_obj_ext[i];
+		}
+		num_power = hw_context.num_power;
+		return (num_power);
+	}
+
 	#ifdef DEBUG_PRINT_POWER_EXT
     if (my_rank == 0) {
 	fprintf(stderr, "<%s> default objects. &pm_pacntxt=%p, &pm_obj_array=%p\n",
@@ -2221,6 +4843,15 @@ int PerfMonitor::initializePOWER (void)
 
 	num_power = Max_power_object + Max_measure_device;	// =19+1=20
 
+	hw_context.power.pacntxt = pm_pacntxt;
+	hw_context.power.extcntxt = pm_extcntxt;
+	for (int i=0; i<Max_power_stats; i++) {
+		hw_context.power.p_obj_array[i] = pm_obj_array[i];
+		hw_context.power.p_obj_ext[i] = pm_obj_ext[i];
+	}
+	hw_context.num_power = num_power;
+	hw_context.is_power_ready = true;
+
 	#ifdef DEBUG_PRINT_POWER_EXT
     if (my_rank == 0) {
 	fprintf(stderr, "<%s> %d objects were initialized.\n", __func__, num_power);
@@ -2239,6 +4870,8 @@ int PerfMonitor::finalizePOWER ()
 {
 #ifdef USE_POWER
     if (level_POWER == 0) return(0);
+	// the contexts are destroyed when the last PerfMonitor instance detaches
+	if (!hw_context.is_power_ready || hw_context.ref_count > 1) return(0);
 
 	#ifdef DEBUG_PRINT_POWER_EXT
     if (my_rank == 0) { fprintf(stderr, "\t <%s> CntxtDestroy()\n", __func__); }
@@ -2248,6 +4881,7 @@ int PerfMonitor::finalizePOWER ()
 	irc = 0;
 	irc = PWR_CntxtDestroy(pm_pacntxt);
 	irc += PWR_CntxtDestroy(pm_extcntxt);
+	hw_context.is_power_ready = false;
 
 	#ifdef DEBUG_PRINT_POWER_EXT
     if (my_rank == 0) { fprintf(stderr, "\t <%s> returns %d\n", __func__, irc); }
@@ -2493,19 +5127,15 @@ int PerfMonitor::find_section_object(std::string arg_st)
   ///
 void PerfMonitor::loop_section_object(const int mid, std::string& p_label)
 {
-	std::map<std::string, int>::const_iterator it;
-	int p_id;
-
-	for(it = m_map_sections.begin(); it != m_map_sections.end(); ++it) {
-		if (it->second == mid) {
-			p_label = it->first;
-			#ifdef DEBUG_PRINT_LABEL
-			//	if (my_rank==0) {
-			fprintf(stderr, "<loop_section_object> [mid=%d] in my_rank=%d my_thread=%d matched to [%s] \n", mid, my_rank, my_thread, p_label.c_str() );
-			//	}
-			#endif
-			return;
-		}
+	// m_watchArray[mid] holds the label, i.e. it is the reverse index of m_map_sections
+	if (0 <= mid && mid < m_nWatch) {
+		p_label = m_watchArray[mid].m_label;
+		#ifdef DEBUG_PRINT_LABEL
+		//	if (my_rank==0) {
+		fprintf(stderr, "<loop_section_object> [mid=%d] in my_rank=%d my_thread=%d matched to [%s] \n", mid, my_rank, my_thread, p_label.c_str() );
+		//	}
+		#endif
+		return;
 	}
 	// should not reach here
 	fprintf(stderr, "*** PMlib Error. <loop_section_object> section ID %d was not found. my_rank=%d, my_thread=%d \n", mid, my_rank, my_thread);
@@ -2552,9 +5182,10 @@ int PerfMonitor::add_shared_section(std::string arg_st)
 	#pragma omp critical
 	#endif
 	{
-		int n = shared_map_sections.size();
-   		shared_map_sections.insert( make_pair(arg_st, n) );
-   		n_shared_sections = shared_map_sections[arg_st] ;
+		int n = m_shared->map_sections.size();
+   		auto ret = m_shared->map_sections.insert( make_pair(arg_st, n) );
+   		if (ret.second) m_shared->section_labels.push_back(arg_st);
+   		n_shared_sections = ret.first->second ;
 
     	#ifdef DEBUG_PRINT_LABEL
 		fprintf(stderr, "\t<add_shared_section> [%s] updated n_shared_sections=%d  my_rank=%d, my_thread=%d \n", arg_st.c_str(), n_shared_sections, my_rank, my_thread);
@@ -2571,12 +5202,13 @@ void PerfMonitor::check_all_shared_sections(void)
 	std::map<std::string, int>::const_iterator it;
 	std::string p_label;
 	int p_id;
-	int n_shared_sections = shared_map_sections.size();
+	if (m_shared == NULL) return;
+	int n_shared_sections = m_shared->map_sections.size();
 	fprintf(stderr, "\t<check_all_shared_sections> shared map size=%d \n", n_shared_sections);
 	if (n_shared_sections==0) return;
 
 	fprintf(stderr, "\t[map pair] : label, value, &(it->first), &(it->second)\n");
-	for(it = shared_map_sections.begin(); it != shared_map_sections.end(); ++it) {
+	for(it = m_shared->map_sections.begin(); it != m_shared->map_sections.end(); ++it) {
 		p_label = it->first;
 		p_id = it->second;
 		fprintf(stderr, "\t [%s] : %d, %p, %p\n", p_label.c_str(), p_id, &(it->first), &(it->second));
@@ -532,6 +532,42 @@ void f_pm_printcomm_ (char* fc, MPI_Comm new_comm, int& icolor, int& key, int& l
 }
 
 
+/// PMlib Fortran インタフェイス
+/// 測定区間の前回呼び出し以降の時間を全プロセスまたは隣接プロセスと交換する
+///
+///   @param[in] char*	fc	測定区間のラベル(character文字列)
+///   @param[in] int	f_comm	交換するcommunicator
+///   @param[out] double*	out	各プロセスの時間(秒)
+///   @param[out] int	n_out	outに格納した値の数
+///   @param[in] int	fc_size  character文字列ラベルの長さ（文字数）
+///
+///   @note  MPI_Comm型は呼び出すFortran側では integer 型であり、MPI_Comm_f2c()で変換する
+///   @note fc_sizeはFortranコンパイラが自動的に追加してしまう引数。
+///			ユーザがFortranプログラムから呼び出す場合に指定する必要はない。
+///
+void f_pm_exchangecost_ (char* fc, int& f_comm, double* out, int& n_out, int fc_size)
+{
+	std::string s=std::string(fc,fc_size);
+	#ifdef DEBUG_PRINT_MONITOR
+	//	fprintf(stderr, "<f_pm_exchangecost_> fc=%s, fc_size=%d\n", s.c_str(), fc_size);
+	#endif
+
+	n_out = 0;
+	if (fc_size == 0) {
+		fprintf(stderr, "<f_pm_exchangecost_> argument fc_size is 0\n");
+		return;
+	}
+#ifdef DISABLE_MPI
+	(void) f_comm;
+	n_out = PM.exchangeSectionCost (s, MPI_COMM_WORLD, out);
+#else
+	n_out = PM.exchangeSectionCost (s, MPI_Comm_f2c((MPI_Fint)f_comm), out);
+#endif
+
+	return;
+}
+
+
 
 /// PMlib Fortran インタフェイス
 /// ポスト処理用traceファイルの出力
@@ -703,6 +739,20 @@ void f_pm_mergethreads_ (int &id)
 }
 
 
+/// PMlib Fortran interface
+///  全測定区間のスレッド情報を一括してマスタースレッドに集約する。
+///
+///   @note  通常このAPIはPMlib内部で自動的に実行され、利用者が呼び出す必要はない。
+///   @note 並列領域内で測定した区間がある場合は、parallel regionの内側から
+///		全スレッドが一回だけ呼び出す。
+///
+void f_pm_mergeallthreads_ (void)
+{
+	PM.mergeAllThreads();
+	return;
+}
+
+
 /// PMlib Fortran interface
 /// @brief Power knob interface - Read the current value for the given power control knob
 ///
@@ -0,0 +1,567 @@
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+//! @file   PerfStats.cpp
+//! @brief  reduction based statistics among processes
+
+#include <cstdio>
+#include <cmath>
+#include <climits>
+#include <cstring>
+
+#ifdef DISABLE_MPI
+#include "mpi_stubs.h"
+#else
+#include <mpi.h>
+#endif
+
+#include "pmlib_stats.h"
+
+namespace pm_lib {
+
+  /// index of the sketch bin for the positive value v
+  ///	the bin i holds the values in (gamma^(i-1), gamma^i]
+  ///
+  static int sketch_index (double v)
+  {
+	return (int)ceil(log(v) / log(Sketch_gamma));
+  }
+
+
+  /// representative value of the sketch bin i
+  ///
+  static double sketch_value (int i)
+  {
+	return 2.0 * pow(Sketch_gamma, i) / (Sketch_gamma + 1.0);
+  }
+
+
+  /// move the window of the sketch up to the new highest bin index.
+  /// The bins falling below the window are collapsed into bins[0].
+  ///
+  static void sketch_shift (pmlib_sketch* sk, int i_top)
+  {
+	int d = i_top - sk->i_top;
+	if (d <= 0) return;
+
+	if (d >= Max_sketch_bins) {
+		unsigned int n_total = 0;
+		for (int k=0; k<Max_sketch_bins; k++) {
+			n_total += sk->bins[k];
+			sk->bins[k] = 0;
+		}
+		sk->bins[0] = n_total;
+	} else {
+		unsigned int n_low = 0;
+		for (int k=0; k<=d; k++) {
+			n_low += sk->bins[k];
+		}
+		for (int k=1; k<Max_sketch_bins-d; k++) {
+			sk->bins[k] = sk->bins[k+d];
+		}
+		for (int k=Max_sketch_bins-d; k<Max_sketch_bins; k++) {
+			sk->bins[k] = 0;
+		}
+		sk->bins[0] = n_low;
+	}
+	sk->i_top = i_top;
+  }
+
+
+  /// add the positive value v to the sketch
+  ///
+  static void sketch_add (pmlib_sketch* sk, double v)
+  {
+	if (v <= 0.0) {
+		sk->n_zero++;
+		return;
+	}
+	int i = sketch_index(v);
+	if (sk->i_top == INT_MIN) {
+		sk->i_top = i;
+	} else if (i > sk->i_top) {
+		sketch_shift(sk, i);
+	}
+	int k = i - (sk->i_top - Max_sketch_bins + 1);
+	if (k < 0) k = 0;
+	sk->bins[k]++;
+  }
+
+
+  /// initialize the summary as empty
+  ///
+  void stats_init (pmlib_section_stats* s)
+  {
+	s->time.n = 0.0;
+	s->time.mean = 0.0;
+	s->time.m2 = 0.0;
+	s->flop = s->time;
+	s->count_sum = 0.0;
+	s->time_min = 0.0;
+	s->time_max = 0.0;
+	s->rank_min = -1;
+	s->rank_max = -1;
+	s->sketch.i_top = INT_MIN;
+	s->sketch.n_zero = 0;
+	for (int k=0; k<Max_sketch_bins; k++) {
+		s->sketch.bins[k] = 0;
+	}
+  }
+
+
+  /// add one sample to the Welford accumulator (Welford's online update)
+  ///
+  static void welford_add (pmlib_welford* a, double v)
+  {
+	a->n += 1.0;
+	double delta = v - a->mean;
+	a->mean = a->mean + delta / a->n;
+	a->m2 = a->m2 + delta * (v - a->mean);
+  }
+
+
+  /// add the values of one process to the summary
+  ///
+  ///   @param[in] time   measured time of the process
+  ///   @param[in] flop   measured flop (or byte) count of the process
+  ///   @param[in] count  call count of the process
+  ///   @param[in] rank   rank number of the process
+  ///
+  ///   @note the summary is updated in place in O(1) time, so that adding
+  ///         the values of P processes costs O(P). stats_merge() is used only
+  ///         to combine the whole summaries.
+  ///
+  void stats_add (pmlib_section_stats* s, double time, double flop, long count, int rank)
+  {
+	welford_add(&s->time, time);
+	welford_add(&s->flop, flop);
+	s->count_sum += (double)count;
+
+	if ( (s->rank_min < 0) || (time < s->time_min) ||
+		((time == s->time_min) && (rank < s->rank_min)) ) {
+		s->time_min = time;
+		s->rank_min = rank;
+	}
+	if ( (s->rank_max < 0) || (time > s->time_max) ||
+		((time == s->time_max) && (rank < s->rank_max)) ) {
+		s->time_max = time;
+		s->rank_max = rank;
+	}
+
+	sketch_add(&s->sketch, time);
+  }
+
+
+  /// merge two Welford accumulators (Chan et al.)
+  ///
+  static void welford_merge (pmlib_welford* a, const pmlib_welford* b)
+  {
+	if (b->n == 0.0) return;
+	if (a->n == 0.0) { *a = *b; return; }
+	double n = a->n + b->n;
+	double delta = b->mean - a->mean;
+	a->mean = a->mean + delta * b->n / n;
+	a->m2 = a->m2 + b->m2 + delta * delta * a->n * b->n / n;
+	a->n = n;
+  }
+
+
+  /// merge the summary "in" into "inout"
+  ///
+  ///   @note the merge is commutative and associative.
+  ///         When the min/max values tie, the lower rank is kept.
+  ///
+  void stats_merge (pmlib_section_stats* inout, const pmlib_section_stats* in)
+  {
+	if (in->rank_min < 0) return;	// "in" is empty
+	if (inout->rank_min < 0) {		// "inout" is empty
+		*inout = *in;
+		return;
+	}
+
+	welford_merge(&inout->time, &in->time);
+	welford_merge(&inout->flop, &in->flop);
+	inout->count_sum += in->count_sum;
+
+	if ( (in->time_min < inout->time_min) ||
+		((in->time_min == inout->time_min) && (in->rank_min < inout->rank_min)) ) {
+		inout->time_min = in->time_min;
+		inout->rank_min = in->rank_min;
+	}
+	if ( (in->time_max > inout->time_max) ||
+		((in->time_max == inout->time_max) && (in->rank_max < inout->rank_max)) ) {
+		inout->time_max = in->time_max;
+		inout->rank_max = in->rank_max;
+	}
+
+	pmlib_sketch* a = &inout->sketch;
+	a->n_zero += in->sketch.n_zero;
+	if (in->sketch.i_top == INT_MIN) return;
+
+	pmlib_sketch b = in->sketch;
+	if (a->i_top == INT_MIN) {
+		b.n_zero = a->n_zero;
+		*a = b;
+		return;
+	}
+	if (b.i_top > a->i_top) {
+		sketch_shift(a, b.i_top);
+	} else {
+		sketch_shift(&b, a->i_top);
+	}
+	for (int k=0; k<Max_sketch_bins; k++) {
+		a->bins[k] += b.bins[k];
+	}
+  }
+
+
+  /// q-quantile of the time values in the summary
+  ///
+  ///   @param[in] q  0.0 <= q <= 1.0  e.g. 0.5 for the median
+  ///
+  ///   @note the value is accurate within the relative error of the bin
+  ///         width, and is clamped by the exact min/max values.
+  ///
+  double stats_quantile (const pmlib_section_stats* s, double q)
+  {
+	if (s->rank_min < 0) return 0.0;
+
+	const pmlib_sketch* sk = &s->sketch;
+	double n_total = (double)sk->n_zero;
+	for (int k=0; k<Max_sketch_bins; k++) {
+		n_total += (double)sk->bins[k];
+	}
+	if (q <= 0.0) return s->time_min;
+	if (q >= 1.0) return s->time_max;
+
+	double t = floor(q * (n_total - 1.0) + 0.5);
+	double cum = (double)sk->n_zero;
+	double v = 0.0;
+	if (t >= cum) {
+		for (int k=0; k<Max_sketch_bins; k++) {
+			cum += (double)sk->bins[k];
+			if (t < cum) {
+				v = sketch_value(sk->i_top - Max_sketch_bins + 1 + k);
+				break;
+			}
+		}
+	}
+	if (v < s->time_min) v = s->time_min;
+	if (v > s->time_max) v = s->time_max;
+	return v;
+  }
+
+
+  /// standard deviation computed from the Welford accumulator
+  ///
+  double stats_stddev (const pmlib_welford* w)
+  {
+	if (w->n < 2.0) return 0.0;
+	double v = w->m2 / (w->n - 1.0);
+	return (v > 0.0) ? sqrt(v) : 0.0;
+  }
+
+
+#ifndef DISABLE_MPI
+  /// user defined MPI_Op function merging the arrays of the summaries
+  ///
+  static void stats_merge_op (void* in, void* inout, int* len, MPI_Datatype* dtype)
+  {
+	pmlib_section_stats* a = (pmlib_section_stats*) in;
+	pmlib_section_stats* b = (pmlib_section_stats*) inout;
+	for (int i=0; i<*len; i++) {
+		stats_merge(&b[i], &a[i]);
+	}
+  }
+
+
+  // MPI objects created once per process, and freed at MPI_Finalize()
+  static bool is_stats_created = false;
+  static MPI_Datatype stats_type;
+  static MPI_Op stats_op;
+  static bool is_topk_created = false;
+  static MPI_Op topk_op;
+  static int stats_keyval = MPI_KEYVAL_INVALID;
+
+  /// MPI_Finalize() が MPI_COMM_SELF の属性を削除する時に、作成したMPIオブジェクトを解放する
+  ///
+  ///   @note MPI_Finalize() はMPIを使用できる状態で最初に MPI_COMM_SELF の属性を削除する
+  ///
+  static int stats_free_objects (MPI_Comm, int, void*, void*)
+  {
+	if (is_stats_created) {
+		MPI_Op_free(&stats_op);
+		MPI_Type_free(&stats_type);
+		is_stats_created = false;
+	}
+	if (is_topk_created) {
+		MPI_Op_free(&topk_op);
+		is_topk_created = false;
+	}
+	MPI_Comm_free_keyval(&stats_keyval);
+	return MPI_SUCCESS;
+  }
+
+  /// stats_free_objects() を MPI_COMM_SELF の属性の削除関数として1度だけ登録する
+  ///
+  static int stats_register_free (void)
+  {
+	if (stats_keyval != MPI_KEYVAL_INVALID) return MPI_SUCCESS;
+	int iret = MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, stats_free_objects, &stats_keyval, NULL);
+	if (iret == MPI_SUCCESS) iret = MPI_Comm_set_attr(MPI_COMM_SELF, stats_keyval, NULL);
+	return iret;
+  }
+#endif
+
+
+  /// MPI datatype and the custom MPI_Op for the array of the summaries.
+  ///	They are created at the first call, and are shared by all callers.
+  ///	They are freed at MPI_Finalize() (stats_free_objects).
+  ///
+  ///   @param[out] dtype  MPI datatype of one pmlib_section_stats
+  ///   @param[out] op     commutative MPI_Op merging the summaries
+  ///
+  ///   @return  MPI error code. MPI_SUCCESS if successful
+  ///
+  int stats_mpi_type (MPI_Datatype* dtype, MPI_Op* op)
+  {
+#ifdef DISABLE_MPI
+	(void) dtype; (void) op;
+	return MPI_SUCCESS;
+#else
+	int iret = MPI_SUCCESS;
+
+	if (!is_stats_created) {
+		iret = MPI_Type_contiguous((int)sizeof(pmlib_section_stats), MPI_BYTE, &stats_type);
+		if (iret == MPI_SUCCESS) iret = MPI_Type_commit(&stats_type);
+		if (iret == MPI_SUCCESS) iret = MPI_Op_create(stats_merge_op, 1, &stats_op);
+		if (iret == MPI_SUCCESS) iret = stats_register_free();
+		if (iret != MPI_SUCCESS) return iret;
+		is_stats_created = true;
+	}
+	*dtype = stats_type;
+	*op = stats_op;
+	return iret;
+#endif
+  }
+
+
+  /// merge the summaries of n sections across all processes of comm
+  ///	with a single MPI_Allreduce using the custom MPI_Op
+  ///
+  ///   @param[in,out] s  array of n summaries. the merged result on return
+  ///   @param[in] n      number of sections
+  ///   @param[in] comm   MPI communicator
+  ///
+  ///   @return  MPI error code. MPI_SUCCESS if successful
+  ///
+  int stats_allreduce (pmlib_section_stats* s, int n, MPI_Comm comm)
+  {
+#ifdef DISABLE_MPI
+	(void) s; (void) n; (void) comm;
+	return MPI_SUCCESS;
+#else
+	MPI_Datatype stats_type;
+	MPI_Op stats_op;
+	int iret;
+	int np;
+
+	iret = MPI_Comm_size(comm, &np);
+	if (iret != MPI_SUCCESS || np == 1 || n == 0) return iret;
+
+	iret = stats_mpi_type(&stats_type, &stats_op);
+	if (iret != MPI_SUCCESS) return iret;
+
+	pmlib_section_stats* r = new pmlib_section_stats[n];
+	iret = MPI_Allreduce(s, r, n, stats_type, stats_op, comm);
+	if (iret == MPI_SUCCESS) {
+		for (int i=0; i<n; i++) s[i] = r[i];
+	} else {
+		fprintf(stderr, "*** PMlib error. <stats_allreduce> MPI_Allreduce failed. iret=%d\n", iret);
+	}
+	delete[] r;
+	return iret;
+#endif
+  }
+
+
+  /// initialize the top-k list of one section as empty
+  ///
+  ///   @param[out] t  list of 2*k entries. [0,k) the slowest, [k,2k) the fastest
+  ///   @param[in] k   number of the processes kept at each end
+  ///
+  void topk_init (pmlib_topk_entry* t, int k)
+  {
+	for (int i=0; i<2*k; i++) {
+		t[i].time = 0.0;
+		t[i].rank = -1;
+		memset(t[i].host, 0, Max_topk_hostname);
+	}
+  }
+
+
+  /// "a" should be placed before "b" in the list
+  ///	ties are ordered by the lower rank, so that the merge is deterministic
+  ///
+  static bool topk_before (const pmlib_topk_entry* a, const pmlib_topk_entry* b, bool is_slow)
+  {
+	if (a->rank < 0) return false;
+	if (b->rank < 0) return true;
+	if (a->time != b->time) return is_slow ? (a->time > b->time) : (a->time < b->time);
+	return (a->rank < b->rank);
+  }
+
+
+  /// merge two sorted lists of k entries into the first one
+  ///	k is at most Max_topk, so the result is built on the stack
+  ///
+  static void topk_merge_half (pmlib_topk_entry* a, const pmlib_topk_entry* b, int k, bool is_slow)
+  {
+	pmlib_topk_entry r[Max_topk];
+	int ia = 0;
+	int ib = 0;
+	for (int i=0; i<k; i++) {
+		if (ia >= k || (ib < k && topk_before(&b[ib], &a[ia], is_slow))) {
+			r[i] = b[ib++];
+		} else {
+			r[i] = a[ia++];
+		}
+	}
+	for (int i=0; i<k; i++) a[i] = r[i];
+  }
+
+
+  /// insert one entry into a sorted list of k entries
+  ///	the last entry is dropped if the list is full
+  ///
+  static void topk_insert_half (pmlib_topk_entry* a, const pmlib_topk_entry* e, int k, bool is_slow)
+  {
+	int i = k-1;
+	if (!topk_before(e, &a[i], is_slow)) return;
+	for (; i>0 && topk_before(e, &a[i-1], is_slow); i--) {
+		a[i] = a[i-1];
+	}
+	a[i] = *e;
+  }
+
+
+  /// add the value of one process to the top-k list of one section
+  ///
+  ///   @param[in,out] t  list of 2*k entries
+  ///   @param[in] k      number of the processes kept at each end
+  ///   @param[in] time   measured time of the process
+  ///   @param[in] rank   rank number of the process
+  ///   @param[in] host   host name of the process
+  ///
+  void topk_add (pmlib_topk_entry* t, int k, double time, int rank, const char* host)
+  {
+	pmlib_topk_entry e;
+	e.time = time;
+	e.rank = rank;
+	memset(e.host, 0, Max_topk_hostname);
+	strncpy(e.host, host, Max_topk_hostname-1);
+	topk_insert_half(&t[0], &e, k, true);
+	topk_insert_half(&t[k], &e, k, false);
+  }
+
+
+  /// merge the top-k list "in" into "inout"
+  ///
+  ///   @note the merge is commutative and associative.
+  ///
+  void topk_merge (pmlib_topk_entry* inout, const pmlib_topk_entry* in, int k)
+  {
+	topk_merge_half(&inout[0], &in[0], k, true);
+	topk_merge_half(&inout[k], &in[k], k, false);
+  }
+
+
+#ifndef DISABLE_MPI
+  /// user defined MPI_Op function merging the arrays of the top-k lists.
+  ///	the datatype holds the 2*k entries of one section.
+  ///
+  static void topk_merge_op (void* in, void* inout, int* len, MPI_Datatype* dtype)
+  {
+	int size;
+	MPI_Type_size(*dtype, &size);
+	int k = size / (2 * (int)sizeof(pmlib_topk_entry));
+	pmlib_topk_entry* a = (pmlib_topk_entry*) in;
+	pmlib_topk_entry* b = (pmlib_topk_entry*) inout;
+	for (int i=0; i<*len; i++) {
+		topk_merge(&b[(size_t)i*2*k], &a[(size_t)i*2*k], k);
+	}
+  }
+#endif
+
+
+  /// merge the top-k lists of n sections across all processes of comm
+  ///	to the root process with a single MPI_Reduce using the custom MPI_Op
+  ///
+  ///   @param[in,out] t  array of n lists of 2*k entries. the merged result on root
+  ///   @param[in] n      number of sections
+  ///   @param[in] k      number of the processes kept at each end
+  ///   @param[in] root   rank of the root process
+  ///   @param[in] comm   MPI communicator
+  ///
+  ///   @return  MPI error code. MPI_SUCCESS if successful
+  ///
+  ///   @note the message size is n*2*k entries, independent of the number
+  ///         of processes.
+  ///
+  int topk_reduce (pmlib_topk_entry* t, int n, int k, int root, MPI_Comm comm)
+  {
+#ifdef DISABLE_MPI
+	(void) t; (void) n; (void) k; (void) root; (void) comm;
+	return MPI_SUCCESS;
+#else
+	MPI_Datatype topk_type;
+	int iret;
+	int np, my_id;
+
+	iret = MPI_Comm_size(comm, &np);
+	if (iret != MPI_SUCCESS || np == 1 || n == 0) return iret;
+	MPI_Comm_rank(comm, &my_id);
+
+	// the MPI_Op is freed at MPI_Finalize() (stats_free_objects)
+	if (!is_topk_created) {
+		iret = MPI_Op_create(topk_merge_op, 1, &topk_op);
+		if (iret == MPI_SUCCESS) iret = stats_register_free();
+		if (iret != MPI_SUCCESS) return iret;
+		is_topk_created = true;
+	}
+	// the datatype depends on k, and is created at each call
+	iret = MPI_Type_contiguous(2*k*(int)sizeof(pmlib_topk_entry), MPI_BYTE, &topk_type);
+	if (iret == MPI_SUCCESS) iret = MPI_Type_commit(&topk_type);
+	if (iret != MPI_SUCCESS) return iret;
+
+	pmlib_topk_entry* r = NULL;
+	if (my_id == root) r = new pmlib_topk_entry[(size_t)n*2*k];
+	iret = MPI_Reduce(t, r, n, topk_type, topk_op, root, comm);
+	if (iret == MPI_SUCCESS) {
+		if (my_id == root) {
+			for (size_t i=0; i<(size_t)n*2*k; i++) t[i] = r[i];
+		}
+	} else {
+		fprintf(stderr, "*** PMlib error. <topk_reduce> MPI_Reduce failed. iret=%d\n", iret);
+	}
+	delete[] r;
+	MPI_Type_free(&topk_type);
+	return iret;
+#endif
+  }
+
+} /* namespace pm_lib */
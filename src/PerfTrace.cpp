@@ -0,0 +1,226 @@
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+//! @file   PerfTrace.cpp
+//! @brief  per thread binary trace recorder (PMLIB_TRACE)
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "pmlib_papi.h"
+#include "pmlib_trace.h"
+
+namespace pm_lib {
+
+  /// buffers of all threads. written once by the owner thread
+  static struct pmlib_trace_buffer* trace_buffers[Max_nthreads];
+
+  /// size of the buffer of each thread. 0 if the trace is disabled
+  static unsigned int trace_buffer_size = 0;
+
+  /// file descriptor of the trace file
+  static int trace_fd = -1;
+
+  /// end of the file. reserved with an atomic add by the writing thread
+  static long long trace_offset = 0;
+
+
+  /// トレースを初期化し、出力ファイルを作成する (プロセスで1度だけ)
+  ///
+  ///   @param[in] rank    ランク番号
+  ///   @param[in] kbytes  スレッド毎のバッファの大きさ (KB)
+  ///   @param[in] prefix  出力ファイル名の接頭辞
+  ///
+  ///   @return  作成できた場合true
+  ///
+  ///   @note  終了時に残ったバッファが失われないように atexit() でも書き出す
+  ///
+  bool trace_initialize (int rank, int kbytes, const char* prefix)
+  {
+    bool is_ok = true;
+    #ifdef _OPENMP
+    #pragma omp critical (pmlib_trace)
+    #endif
+    {
+    if (trace_buffer_size == 0) {
+      char filename[512];
+      snprintf(filename, sizeof(filename), "%s.%06d.pmt", prefix, rank);
+      trace_fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+      if (trace_fd < 0) {
+        is_ok = false;
+      } else {
+        struct pmlib_trace_file_header h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, Trace_magic, sizeof(h.magic));
+        h.version = Trace_version;
+        h.rank = rank;
+        h.pid = (int)getpid();
+        if (pwrite(trace_fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) is_ok = false;
+        trace_offset = sizeof(h);
+        for (int t=0; t<Max_nthreads; t++) trace_buffers[t] = NULL;
+        if (kbytes < 4) kbytes = 4;
+        if (is_ok) {
+          trace_buffer_size = (unsigned int)kbytes * 1024;
+          atexit(trace_flush_all);
+        } else {
+          close(trace_fd);
+          trace_fd = -1;
+        }
+      }
+    }
+    }
+    return is_ok;
+  }
+
+
+  /// 呼び出したスレッドのバッファを取得する (無ければ作成する)
+  ///
+  ///   @return  バッファ。トレースが無効な場合、またはスレッド番号が
+  ///    Max_nthreads 以上の場合はNULL
+  ///
+  struct pmlib_trace_buffer* trace_thread_buffer (void)
+  {
+    if (trace_buffer_size == 0) return NULL;
+    int t = 0;
+#ifdef _OPENMP
+    t = omp_get_thread_num();
+#endif
+    if (t < 0 || t >= Max_nthreads) return NULL;
+    if (trace_buffers[t] != NULL) return trace_buffers[t];
+
+    struct pmlib_trace_buffer* b = (struct pmlib_trace_buffer*)calloc(1, sizeof(struct pmlib_trace_buffer));
+    if (b == NULL) return NULL;
+    b->data = (unsigned char*)malloc(trace_buffer_size);
+    if (b->data == NULL) {
+      free(b);
+      return NULL;
+    }
+    b->thread = t;
+    b->size = trace_buffer_size;
+    b->used = 0;
+    trace_buffers[t] = b;
+    return b;
+  }
+
+
+  /// バッファをチャンクとしてファイルに書き出し、空にする
+  ///
+  ///   @param[in,out] b  バッファ
+  ///
+  ///   @note  ファイルの領域を atomic add で確保してから書くので、
+  ///    他のスレッドの書き出しを待たない
+  ///
+  void trace_flush (struct pmlib_trace_buffer* b)
+  {
+    if (b->used == 0 || trace_fd < 0) return;
+    struct pmlib_trace_chunk_header c;
+    c.magic = Trace_chunk_magic;
+    c.thread = b->thread;
+    c.bytes = b->used;
+    c.reserved = 0;
+    c.base_time = b->base_time;
+    long long bytes = sizeof(c) + b->used;
+    long long offset = __atomic_fetch_add(&trace_offset, bytes, __ATOMIC_RELAXED);
+
+    bool is_ok = (pwrite(trace_fd, &c, sizeof(c), (off_t)offset) == (ssize_t)sizeof(c));
+    if (is_ok) {
+      is_ok = (pwrite(trace_fd, b->data, b->used, (off_t)(offset + sizeof(c))) == (ssize_t)b->used);
+    }
+    if (!is_ok) {
+      fprintf(stderr, "\n\t *** PMlib warning <trace_flush> thread %d failed to write %u bytes.\n", b->thread, b->used);
+    }
+    b->used = 0;
+  }
+
+
+  /// 全スレッドのバッファを書き出す (並列領域の外から呼ぶ)
+  ///
+  void trace_flush_all (void)
+  {
+    if (trace_buffer_size == 0) return;
+    for (int t=0; t<Max_nthreads; t++) {
+      if (trace_buffers[t] != NULL) trace_flush(trace_buffers[t]);
+    }
+  }
+
+
+  /// 基準ランクの時刻系への変換係数を記録する
+  ///
+  ///   @param[in] offset  ずれ(秒)
+  ///   @param[in] drift   ドリフト(秒/秒)
+  ///   @param[in] t0      ずれを推定した時刻(秒)
+  ///
+  ///   @note  Trace_clock_thread のチャンクとして直接書き出す。
+  ///    変換は pmlib-trace2json が全てのイベントに適用する
+  ///
+  void trace_clock (double offset, double drift, double t0)
+  {
+    if (trace_fd < 0) return;
+    struct pmlib_trace_chunk_header c;
+    unsigned char data[1 + 3*sizeof(double)];
+    double v[3] = {offset, drift, t0};
+    data[0] = Trace_clock;
+    memcpy(data+1, v, sizeof(v));
+    c.magic = Trace_chunk_magic;
+    c.thread = Trace_clock_thread;
+    c.bytes = sizeof(data);
+    c.reserved = 0;
+    c.base_time = t0;
+    long long bytes = sizeof(c) + sizeof(data);
+    long long offs = __atomic_fetch_add(&trace_offset, bytes, __ATOMIC_RELAXED);
+    if (pwrite(trace_fd, &c, sizeof(c), (off_t)offs) != (ssize_t)sizeof(c)
+      || pwrite(trace_fd, data, sizeof(data), (off_t)(offs + sizeof(c))) != (ssize_t)sizeof(data)) {
+      fprintf(stderr, "\n\t *** PMlib warning <trace_clock> failed to write the clock record.\n");
+    }
+  }
+
+
+  /// 区間のラベルを記録する
+  ///
+  ///   @param[in,out] b  バッファ
+  ///   @param[in] id     区間番号
+  ///   @param[in] label  ラベル
+  ///
+  ///   @note  ラベルは区間を定義したスレッドのバッファに1度だけ記録する。
+  ///    時刻を持たないので、チャンクの時刻差には影響しない
+  ///
+  void trace_label (struct pmlib_trace_buffer* b, int id, const char* label)
+  {
+    unsigned int len = (unsigned int)strlen(label);
+    if (len > 255) len = 255;
+    if (b->used + Max_trace_event + len > b->size) trace_flush(b);
+    if (b->used == 0) {
+      // the time of the first event of the chunk is used as the base
+      b->base_time = b->last_time;
+    }
+    unsigned char* p = b->data + b->used;
+    *p++ = Trace_label;
+    p = trace_put_varint(p, (unsigned long long)id);
+    p = trace_put_varint(p, (unsigned long long)len);
+    memcpy(p, label, len);
+    b->used = (unsigned int)(p + len - b->data);
+  }
+
+} /* namespace pm_lib */
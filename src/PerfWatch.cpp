@@ -24,6 +24,7 @@
 #include <cstdio>
 #include <cmath>
 #include <algorithm>
+#include <vector>
 #include <iostream>
 
 #ifdef DISABLE_MPI
@@ -42,11 +43,15 @@ extern void outputPapiCounterLegend (FILE*);
 
 namespace pm_lib {
 
-  struct pmlib_papi_chooser papi;
-  struct hwpc_group_chooser hwpc_group;
-  double cpu_clock_freq;        /// processor clock frequency, i.e. Hz
-  double second_per_cycle;  /// real time to take each cycle
-  struct pmlib_power_chooser power;
+  /// shared hardware context. All PerfMonitor instances attach to it.
+  struct pmlib_hw_context hw_context;
+
+  /// the names used by the HWPC and power routines refer to the shared context
+  struct pmlib_papi_chooser& papi = hw_context.papi;
+  struct hwpc_group_chooser& hwpc_group = hw_context.hwpc_group;
+  double& cpu_clock_freq = hw_context.cpu_clock_freq;
+  double& second_per_cycle = hw_context.second_per_cycle;
+  struct pmlib_power_chooser& power = hw_context.power;
 
   ///
   /// 単位変換.
@@ -148,48 +153,58 @@ namespace pm_lib {
   /// 全プロセスの測定結果の平均値・標準偏差などの基礎的な統計計算
   /// 測定区間の呼び出し回数はプロセス毎に異なる場合がありえる
   ///
+  ///   @note The per process arrays are merged into the summary m_stats in one
+  ///         pass, with the same rule as the reduction of stats_allreduce().
+  ///
   void PerfWatch::statsAverage()
   {
 	//	if (my_rank != 0) return;	// This was a bad idea. All ranks should compute the stats.
 
-	// 平均値
-	m_time_av = 0.0;
-	m_flop_av = 0.0;
+	pmlib_section_stats s;
+	stats_init(&s);
 	for (int i = 0; i < num_process; i++) {
-		m_time_av += m_timeArray[i];
-		m_flop_av += m_flopArray[i];
+		stats_add(&s, m_timeArray[i], m_flopArray[i], m_countArray[i], i);
 	}
-	m_time_av /= num_process;
-	m_flop_av /= num_process;
+	statsReduction(&s);
+  }
+
+
+  /// Pack the process level values of this section into the summary
+  /// which PerfMonitor::gather_and_stats() reduces for all sections at once.
+  ///
+  ///   @param[out] s   この測定区間の自プロセスのサマリ
+  ///
+  void PerfWatch::packStats(pmlib_section_stats* s)
+  {
+	stats_init(s);
+	stats_add(s, m_time, m_flop, m_count, my_rank);
+  }
+
+
+  /// Statistics among processes computed from the merged summary.
+  /// In the root gather mode, the non-root ranks do not keep the
+  /// per process arrays, and all ranks call this routine after the reduction.
+  ///
+  ///   @param[in] s   全プロセスをマージしたサマリ
+  ///
+  void PerfWatch::statsReduction(const pmlib_section_stats* s)
+  {
+	m_stats = *s;
+
+	// 平均値
+	m_count_sum = lround(s->count_sum);
+	m_count_av = lround((double)m_count_sum / (double)num_process);
+	m_time_av = s->time.mean;
+	m_flop_av = s->flop.mean;
 
-	if (m_in_parallel) {
-		m_count_av = lround((double)m_count_sum / (double)num_process);
-	} else {
-		m_count_av = lround((double)m_count_sum / (double)num_process);
-	}
-	
 	// 標準偏差
-	m_time_sd = 0.0;
-	m_flop_sd = 0.0;
-	if (num_process > 1) {
-		for (int i = 0; i < num_process; i++) {
-			double d_time = m_timeArray[i] - m_time_av;
-			double d_flop = m_flopArray[i] - m_flop_av;
-			m_time_sd += d_time*d_time;
-			m_flop_sd += d_flop*d_flop;
-		}
-		m_time_sd = sqrt(m_time_sd / (num_process-1));
-		m_flop_sd = sqrt(m_flop_sd / (num_process-1));
-	}
+	m_time_sd = stats_stddev(&s->time);
+	m_flop_sd = stats_stddev(&s->flop);
 
 	// 通信の場合，各ノードの通信時間の最大値
 	m_time_comm = 0.0;
 	if (m_typeCalc == 0) {
-		double comm_max = 0.0;
-		for (int i = 0; i < num_process; i++) {
-			if (m_timeArray[i] > comm_max) comm_max = m_timeArray[i];
-		}
-		m_time_comm = comm_max;
+		m_time_comm = s->time_max;
 	}
   }
 
@@ -248,22 +263,38 @@ namespace pm_lib {
 
 
 
-  /// Allgather the process level HWPC event values for all processes in MPI_COMM_WORLD
-  /// Calibrate some numbers to represent the process value as the sum of thread values
+  /// HWPCの集約対象となる値の数を返す
   ///
+  ///   @return 集約対象となるHWPC値の数 (ユーザ申告モードやHWPC測定値が無い場合は0)
   ///
-  void PerfWatch::gatherHWPC()
+  int PerfWatch::numSortedHWPC()
   {
 #ifdef USE_PAPI
 	int is_unit = statsSwitch();
 	if ( (is_unit == 0) || (is_unit == 1) ) {
-		return;
+		return 0;
 	}
-	if ( my_papi.num_events == 0) return;
+	if ( my_papi.num_events == 0) return 0;
+	return my_papi.num_sorted;
+#else
+	return 0;
+#endif
+  }
 
-	#ifdef DEBUG_PRINT_WATCH
-	fprintf(stderr, "debug <gatherHWPC> [%s] starts. my_rank=%d \n", m_label.c_str(), my_rank );
-	#endif
+
+  /// Calibrate some numbers to represent the process value as the sum of thread values
+  /// before the process level HWPC event values are gathered.
+  ///
+  ///   @return the number of sorted HWPC values to be gathered. 0 if none.
+  ///
+  int PerfWatch::calibrateHWPC()
+  {
+#ifdef USE_PAPI
+	int is_unit = statsSwitch();
+	if ( (is_unit == 0) || (is_unit == 1) ) {
+		return 0;
+	}
+	if ( my_papi.num_events == 0) return 0;
 
 	sortPapiCounterList ();
 
@@ -315,9 +346,33 @@ namespace pm_lib {
 		}
 		m_percentage = my_papi.v_sorted[my_papi.num_sorted-1] ;	// [Vector %]
 	}
+	return my_papi.num_sorted;
+#else
+	return 0;
+#endif
+  }
+
+
+  /// Allgather the process level HWPC event values for all processes in m_comm
+  /// Calibrate some numbers to represent the process value as the sum of thread values
+  ///
+  ///   @note PerfMonitor::gather_and_stats() exchanges all sections at once
+  ///         using calibrateHWPC(), packGather() and unpackGather() instead.
+  ///
+  void PerfWatch::gatherHWPC()
+  {
+#ifdef USE_PAPI
+	#ifdef DEBUG_PRINT_WATCH
+	fprintf(stderr, "debug <gatherHWPC> [%s] starts. my_rank=%d \n", m_label.c_str(), my_rank );
+	#endif
+
+	if ( calibrateHWPC() == 0 ) return;
+
+	// In the root gather mode (PMLIB_GATHER=ROOT), only rank 0 keeps the array
+	bool is_root_gather = m_gather_root && (num_process > 1);
 
 	// The space is reserved only once as a fixed size array
-	if ( m_sortedArrayHWPC == NULL) {
+	if ( (!is_root_gather || my_rank == 0) && m_sortedArrayHWPC == NULL ) {
 		m_sortedArrayHWPC = new double[num_process*my_papi.num_sorted];
 		if (!(m_sortedArrayHWPC)) {
 			printError("gatherHWPC", "new memory failed. %d x %d x 8\n", num_process, my_papi.num_sorted);
@@ -337,16 +392,25 @@ namespace pm_lib {
 	#ifdef DEBUG_PRINT_WATCH
 	if ( num_process > 1 ) {
 		fprintf(stderr, "debug <gatherHWPC> [%s] calling barrier \n", m_label.c_str() );
-		int iret = MPI_Barrier(MPI_COMM_WORLD);
+		int iret = MPI_Barrier(m_comm);
 		if ( iret != 0 ) { printError("gatherHWPC", " MPI_Barrier failed. iret=%d\n", iret); }
 	}
 	fprintf(stderr, "debug <gatherHWPC> [%s] calling MPI_Allgather \n", m_label.c_str() );
 	#endif
 
+	if ( is_root_gather ) {
+		int iret =
+		MPI_Gather (my_papi.v_sorted, my_papi.num_sorted, MPI_DOUBLE,
+					m_sortedArrayHWPC, my_papi.num_sorted, MPI_DOUBLE, 0, m_comm);
+		if ( iret != 0 ) {
+			printError("gatherHWPC", " MPI_Gather failed. iret=%d\n", iret);
+			PM_Exit(0);
+		}
+	} else
 	if ( num_process > 1 ) {
 		int iret =
 		MPI_Allgather (my_papi.v_sorted, my_papi.num_sorted, MPI_DOUBLE,
-					m_sortedArrayHWPC, my_papi.num_sorted, MPI_DOUBLE, MPI_COMM_WORLD);
+					m_sortedArrayHWPC, my_papi.num_sorted, MPI_DOUBLE, m_comm);
 		if ( iret != 0 ) {
 			printError("gatherHWPC", " MPI_Allather failed.\n");
 			PM_Exit(0);
@@ -366,12 +430,12 @@ namespace pm_lib {
   }
 
 
-  /// Allgather the thread level HWPC event values of all processes in MPI_COMM_WORLD
-  /// Does not calibrate numbers, so they represent the actual thread values
+  /// Sort the HWPC event values of the thread selected by selectPerfSingleThread()
+  /// and set m_flop and m_percentage from them. Local to the process.
   ///
-  /// This API is called by PerfWatch::printDetailThreads() only.
+  /// This API is called by PerfWatch::gatherThreadHWPC() and PerfWatch::packThread()
   ///
-  void PerfWatch::gatherThreadHWPC()
+  void PerfWatch::selectThreadHWPC()
   {
 #ifdef USE_PAPI
 	int is_unit = statsSwitch();
@@ -428,9 +492,31 @@ namespace pm_lib {
 		}
 		m_percentage = my_papi.v_sorted[my_papi.num_sorted-1] ;	// [Vector %]
 	}
+#endif
+  }
+
+
+  /// Allgather the thread level HWPC event values of all processes in m_comm
+  /// Does not calibrate numbers, so they represent the actual thread values
+  ///
+  /// This API is called by PerfWatch::printDetailThreads() only.
+  ///
+  void PerfWatch::gatherThreadHWPC()
+  {
+#ifdef USE_PAPI
+	int is_unit = statsSwitch();
+	if ( (is_unit == 0) || (is_unit == 1) ) {
+		return;
+	}
+	if ( my_papi.num_events == 0) return;
+
+	selectThreadHWPC ();
+
+	// In the root gather mode (PMLIB_GATHER=ROOT), only rank 0 keeps the array
+	bool is_root_gather = m_gather_root && (num_process > 1);
 
 	// The space is reserved only once as a fixed size array
-	if ( m_sortedArrayHWPC == NULL) {
+	if ( (!is_root_gather || my_rank == 0) && m_sortedArrayHWPC == NULL ) {
 		m_sortedArrayHWPC = new double[num_process*my_papi.num_sorted];
 		if (!(m_sortedArrayHWPC)) {
 			printError("gatherThreadHWPC", "new memory failed. %d x %d x 8\n", num_process, my_papi.num_sorted);
@@ -442,10 +528,19 @@ namespace pm_lib {
 		#endif
 	}
 
+	if ( is_root_gather ) {
+		int iret =
+		MPI_Gather (my_papi.v_sorted, my_papi.num_sorted, MPI_DOUBLE,
+					m_sortedArrayHWPC, my_papi.num_sorted, MPI_DOUBLE, 0, m_comm);
+		if ( iret != 0 ) {
+			printError("gatherThreadHWPC", " MPI_Gather failed. iret=%d\n", iret);
+			PM_Exit(0);
+		}
+	} else
 	if ( num_process > 1 ) {
 		int iret =
 		MPI_Allgather (my_papi.v_sorted, my_papi.num_sorted, MPI_DOUBLE,
-					m_sortedArrayHWPC, my_papi.num_sorted, MPI_DOUBLE, MPI_COMM_WORLD);
+					m_sortedArrayHWPC, my_papi.num_sorted, MPI_DOUBLE, m_comm);
 		if ( iret != 0 ) {
 			printError("gatherThreadHWPC", " MPI_Allather failed. iret=%d\n", iret);
 			PM_Exit(0);
@@ -470,8 +565,12 @@ namespace pm_lib {
     int m_np;
     m_np = num_process;
 
+	// In the root gather mode (PMLIB_GATHER=ROOT), only rank 0 keeps the arrays
+	bool is_root_gather = m_gather_root && (m_np > 1);
+
 	// The space should be reserved only once as fixed size arrays
-	if (( m_timeArray == NULL) && ( m_flopArray == NULL) && ( m_countArray == NULL)) {
+	if ( (!is_root_gather || my_rank == 0) &&
+		( m_timeArray == NULL) && ( m_flopArray == NULL) && ( m_countArray == NULL)) {
 		m_timeArray  = new double[m_np];
 		m_flopArray  = new double[m_np];
 		m_countArray  = new long[m_np];
@@ -500,20 +599,27 @@ namespace pm_lib {
       m_flopArray[0] = m_flop;
       m_countArray[0]= m_count;
       m_count_sum = m_count;
+    } else if ( is_root_gather ) {
+      if (MPI_Gather(&m_time,  1, MPI_DOUBLE, m_timeArray, 1, MPI_DOUBLE, 0, m_comm) != MPI_SUCCESS) PM_Exit(0);
+      if (MPI_Gather(&m_flop,  1, MPI_DOUBLE, m_flopArray, 1, MPI_DOUBLE, 0, m_comm) != MPI_SUCCESS) PM_Exit(0);
+      if (MPI_Gather(&m_count, 1, MPI_LONG, m_countArray, 1, MPI_LONG, 0, m_comm) != MPI_SUCCESS) PM_Exit(0);
+      if (MPI_Allreduce(&m_count, &m_count_sum, 1, MPI_LONG, MPI_SUM, m_comm) != MPI_SUCCESS) PM_Exit(0);
     } else {
-      if (MPI_Allgather(&m_time,  1, MPI_DOUBLE, m_timeArray, 1, MPI_DOUBLE, MPI_COMM_WORLD) != MPI_SUCCESS) PM_Exit(0);
-      if (MPI_Allgather(&m_flop,  1, MPI_DOUBLE, m_flopArray, 1, MPI_DOUBLE, MPI_COMM_WORLD) != MPI_SUCCESS) PM_Exit(0);
-      if (MPI_Allgather(&m_count, 1, MPI_LONG, m_countArray, 1, MPI_LONG, MPI_COMM_WORLD) != MPI_SUCCESS) PM_Exit(0);
-      if (MPI_Allreduce(&m_count, &m_count_sum, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD) != MPI_SUCCESS) PM_Exit(0);
+      if (MPI_Allgather(&m_time,  1, MPI_DOUBLE, m_timeArray, 1, MPI_DOUBLE, m_comm) != MPI_SUCCESS) PM_Exit(0);
+      if (MPI_Allgather(&m_flop,  1, MPI_DOUBLE, m_flopArray, 1, MPI_DOUBLE, m_comm) != MPI_SUCCESS) PM_Exit(0);
+      if (MPI_Allgather(&m_count, 1, MPI_LONG, m_countArray, 1, MPI_LONG, m_comm) != MPI_SUCCESS) PM_Exit(0);
+      if (MPI_Allreduce(&m_count, &m_count_sum, 1, MPI_LONG, MPI_SUM, m_comm) != MPI_SUCCESS) PM_Exit(0);
     }
 	// Above arrays will be used by the subsequent routines, and should not be deleted here
 	// i.e. m_timeArray, m_flopArray, m_countArray
 
 	#ifdef DEBUG_PRINT_WATCH
+	if (m_countArray != NULL) {
 	fprintf(stderr, "\t<PerfWatch::gather> [%15s] my_rank=%d, m_countArray[0:*]:", m_label.c_str(), my_rank);
 	for (int i=0; i<num_process; i++) { fprintf(stderr, " %ld",  m_countArray[i]); } fprintf(stderr, "\n");
+	}
 	int iret;
-	iret = MPI_Barrier(MPI_COMM_WORLD);
+	iret = MPI_Barrier(m_comm);
 	if ( iret != 0 ) {
 		printError("gather", " MPI_Barrier failed. my_rank=%d, iret=%d\n", my_rank, iret);
 	} else {
@@ -525,80 +631,203 @@ namespace pm_lib {
 
 
 
-  ///  Merging the thread parallel data into the master thread in three steps.
-  ///  These three step routines are called by <PerfMonitor::mergeThreads>
-  ///  which is called by <PerfMonitor::report> in a serial region.
-  ///  After these steps, the master thread will retain the aggregated values
-  ///  in its "my_papi" struct.
-  ///  Shared struct "papi" is used as a scratch space during these steps.
+  ///	Pack the process level values of this section into the send buffer
+  ///	which PerfMonitor::gather_and_stats() exchanges for all sections at once.
+  ///
+  ///   @param[out] buf     この測定区間の書き込み先 (3+n_hwpc 個のdouble)
+  ///   @param[in]  n_hwpc  1区間あたりに確保されたHWPC値の数
   ///
-  ///  The 1st step : Process the data generated in the serial hybrid region.
-  ///  			Copy "my_papi" data of the master thread into shared "papi" space.
+  ///   @note calibrateHWPC() should be called before packing the HWPC values
   ///
-  ///	@note The 1st step master thread copy in should be done by the master thread
+  void PerfWatch::packGather(double* buf, int n_hwpc)
+  {
+	buf[0] = m_time;
+	buf[1] = m_flop;
+	buf[2] = (double)m_count;	// exact up to 2^53 calls
+
+	int n_sorted = numSortedHWPC();
+	for (int n = 0; n < n_hwpc; n++) {
+		buf[3+n] = (n < n_sorted) ? my_papi.v_sorted[n] : 0.0;
+	}
+  }
+
+
+  ///	Pack the current values without stopping the section
   ///
+  ///   @param[in]  now   現在の時刻 (getTime()の値)
+  ///   @param[out] buf   time, flop, count の3個のdouble
   ///
-  void PerfWatch::mergeMasterThread(void)
+  void PerfWatch::packSnapshot(double now, double* buf)
   {
-  #ifdef _OPENMP
-	if (m_threads_merged) return;
-	if (my_thread != 0) return;
-	if (m_started) return; // still in the middle of active start/stop pair
-		// The thread stats should be merged after the thread has stopped.
+	buf[0] = m_time;
+	if (m_started) buf[0] += now - m_startTime;
+	buf[1] = m_flop;
+	buf[2] = (double)m_count;
+  }
 
-	#ifdef DEBUG_PRINT_WATCH
-	if (my_rank == 0) {
-		fprintf(stderr, "<mergeMasterThread> [%s] merge step 1. m_in_parallel=%s, &my_papi=%p \n",
-					m_label.c_str(), m_in_parallel?"true":"false", &my_papi);
+
+  ///	Time since the start of a running section
+  ///
+  ///   @param[in]  now   現在の時刻 (getTime()の値)
+  ///
+  ///   @return  経過時間(秒)。start済みでない場合は -1.0
+  ///
+  double PerfWatch::runningTime(double now)
+  {
+	if (!m_started) return -1.0;
+	return now - m_startTime;
+  }
+
+
+  ///	Write the current values into the record of the live statistics segment
+  ///
+  ///   @param[in,out] rec  この区間のレコード (PMLIB_SHM)
+  ///
+  void PerfWatch::publishShm(struct pmlib_shm_section* rec)
+  {
+	shm_write_begin(rec);
+	rec->count = m_count;
+	rec->time = m_time;
+	rec->last = m_stopTime - m_startTime;
+	rec->flop = m_flop;
+	sumEvents(rec->events, Max_shm_events);
+	shm_write_end(rec);
+  }
+
+
+  ///	Raw HWPC counts of the section summed over the threads
+  ///
+  ///   @param[out] events  イベント毎の積算値 (max_events個のdouble)
+  ///   @param[in]  max_events  取得するイベント数の上限
+  ///
+  ///   @return  取得したイベント数。HWPCを使わない場合は0
+  ///
+  int PerfWatch::sumEvents(double* events, int max_events)
+  {
+	int n_events = 0;
+#ifdef USE_PAPI
+	n_events = (my_papi.num_events < max_events) ? my_papi.num_events : max_events;
+	int n_threads = (num_threads < Max_nthreads) ? num_threads : Max_nthreads;
+	for (int i=0; i<n_events; i++) {
+		long long c = 0;
+		for (int j=0; j<n_threads; j++) c += my_papi.th_accumu[j][i];
+		events[i] = (double)c;
 	}
-	#endif
+#else
+	(void) events; (void) max_events;
+#endif
+	return n_events;
+  }
 
-    int is_unit = statsSwitch();
 
-	// In the following steps, "papi" shared structureis used as a scratch space.
-	// First, copy the master thread local "my_papi" to shared "papi"
-	if ( is_unit >= 2) { // PMlib HWPC counter mode
-		for (int j=0; j<num_threads; j++) {
-			for (int i=0; i<my_papi.num_events; i++) {
-				papi.th_accumu[j][i] = my_papi.th_accumu[j][i];
-				papi.th_v_sorted[j][i] = my_papi.th_v_sorted[j][i];
-			}
-		}
+  ///	Pack the values of the thread i_thread in the same order as packGather()
+  ///	The process values of this section are restored before return.
+  ///
+  ///   @param[out] buf     この測定区間の書き込み先 (3+n_hwpc 個のdouble)
+  ///   @param[in]  n_hwpc  1区間あたりに確保されたHWPC値の数
+  ///   @param[in]  i_thread スレッド番号
+  ///
+  ///   @note As in printDetailThreads(), the user mode values of a section
+  ///         outside of parallel region are represented by thread 0, and
+  ///         the other threads are packed as zero.
+  ///
+  void PerfWatch::packThread(double* buf, int n_hwpc, int i_thread)
+  {
+	int is_unit = statsSwitch();
+	if ( !m_in_parallel && is_unit < 2 && i_thread >= 1 ) {
+		for (int n = 0; n < 3+n_hwpc; n++) buf[n] = 0.0;
+		return;
+	}
 
-	} else {	// PMlib user counter mode
-		for (int j=0; j<num_threads; j++) {
-			for (int i=0; i<3; i++) {
-				papi.th_accumu[j][i] = my_papi.th_accumu[j][i];	// This is not necessary. Just keeping symmetry.
-				papi.th_v_sorted[j][i] = my_papi.th_v_sorted[j][i];
-			}
+	long save_m_count = m_count;
+	double save_m_time = m_time;
+	double save_m_flop = m_flop;
+	double save_m_percentage = m_percentage;
+	struct pmlib_papi_chooser save_papi = my_papi;
+
+	PerfWatch::selectPerfSingleThread(i_thread);
+	PerfWatch::selectThreadHWPC();
+	PerfWatch::packGather(buf, n_hwpc);
+
+	m_count = save_m_count;
+	m_time  = save_m_time;
+	m_flop  = save_m_flop;
+	m_percentage = save_m_percentage;
+	my_papi = save_papi;
+  }
+
+
+  ///	Unpack the values of all processes from the receive buffer, and
+  ///	create the same arrays as gather() and gatherHWPC() do.
+  ///
+  ///   @param[in] recvbuf  全プロセス分の受信バッファ
+  ///   @param[in] offset   1プロセス分のバッファ内でのこの区間の開始位置
+  ///   @param[in] row_len  1プロセス分のバッファ長
+  ///
+  void PerfWatch::unpackGather(const double* recvbuf, int offset, int row_len)
+  {
+    int m_np;
+    m_np = num_process;
+
+	// The space should be reserved only once as fixed size arrays
+	if (( m_timeArray == NULL) && ( m_flopArray == NULL) && ( m_countArray == NULL)) {
+		m_timeArray  = new double[m_np];
+		m_flopArray  = new double[m_np];
+		m_countArray  = new long[m_np];
+		if (!(m_timeArray) || !(m_flopArray) || !(m_countArray)) {
+			printError("PerfWatch::unpackGather", "new memory failed. %d(process) x 3 x 8 \n", num_process);
+			PM_Exit(0);
 		}
 	}
-	//  Note on the use of my_papi.th_v_sorted[][] array.
-	//  PerfWatch::stop() should have saved following variables (both for HWPC mode and USER mode)
-	//	my_papi.th_v_sorted[my_thread][0] = (double)m_count;	// call
-	//	my_papi.th_v_sorted[my_thread][1] = m_time;				// time[s]
-	//	my_papi.th_v_sorted[my_thread][2] = m_flop;				// operations
-	//	So the copy volume in the above if block is somewhat overdone
 
-  #endif
+	m_count_sum = 0;
+	for (int i = 0; i < m_np; i++) {
+		const double* p = recvbuf + (size_t)i*row_len + offset;
+		m_timeArray[i]  = p[0];
+		m_flopArray[i]  = p[1];
+		m_countArray[i] = lround(p[2]);
+		m_count_sum += m_countArray[i];
+	}
+
+	int n_sorted = numSortedHWPC();
+	if (n_sorted == 0) return;
+
+	if ( m_sortedArrayHWPC == NULL) {
+		m_sortedArrayHWPC = new double[m_np*n_sorted];
+		if (!(m_sortedArrayHWPC)) {
+			printError("PerfWatch::unpackGather", "new memory failed. %d x %d x 8\n", m_np, n_sorted);
+			PM_Exit(0);
+		}
+	}
+	for (int i = 0; i < m_np; i++) {
+		const double* p = recvbuf + (size_t)i*row_len + offset + 3;
+		for (int n = 0; n < n_sorted; n++) {
+			m_sortedArrayHWPC[i*n_sorted + n] = p[n];
+		}
+	}
   }
 
 
-  ///  Merging the thread parallel data into the master thread in three steps.
-  ///  These three step routines are called by <PerfMonitor::gather>
-  ///  which is called by <PerfMonitor::report/print> in a serial region.
+
+  ///  Merging the thread parallel data into the master thread in two steps.
+  ///  These two step routines are called by <PerfMonitor::mergeAllThreads>
+  ///  for all the sections at once, with a single barrier between the steps.
   ///  After these steps, the master thread will retain the aggregated values
   ///  in its "my_papi" struct.
-  ///  Shared struct "papi" is used as a scratch space during these steps.
+  ///  The shared reduction buffer "slot" of the section is used to pass the
+  ///  values of the parallel threads to the master thread. Each thread writes
+  ///  its own row of the buffer, so the threads do not conflict with each other.
   ///
-  ///  The 2nd step : Process the data generated from parallel region.
-  ///  			Aggregate the class private "my_papi" data into shared "papi" space.
+  ///  The 1st step : Process the data generated from parallel region.
+  ///  			Write the class private "my_papi" data of this thread into the slot.
   ///
-  ///	@note This 2nd step aggregation must be called by all the threads inside parallel construct
-  ///	@note  Only the sections executed inside of parallel construct are merged.
+  ///	@param[in] slot  reduction buffer of the section shared by all threads
+  ///
+  ///	@note This 1st step must be called by all the threads inside parallel construct
+  ///	@note  Only the sections executed inside of parallel construct are written.
   ///		In Worksharing parallel structure, everything is in place and nothing is done here.
   ///
-  void PerfWatch::mergeParallelThread(void)
+  void PerfWatch::writeThreadSlot(struct pmlib_thread_slots& slot)
   {
   #ifdef _OPENMP
 	if (m_threads_merged) return;
@@ -612,29 +841,30 @@ namespace pm_lib {
 	i_thread = omp_get_thread_num();
 	if (i_thread != my_thread) {
 		// collection of thread values must be done by each thread instances
-		fprintf(stderr, "\n\t*** PMlib internal error <mergeParallelThread> [%s] my_thread:%d does not match OpenMP thread:%d\n ",
+		fprintf(stderr, "\n\t*** PMlib internal error <writeThreadSlot> [%s] my_thread:%d does not match OpenMP thread:%d\n ",
 				m_label.c_str(), my_thread, i_thread);
 	}
+	if (my_thread >= Max_nthreads) return;
 
     int is_unit = statsSwitch();
 
 	if ( is_unit >= 2) { // PMlib HWPC counter mode
 		for (int i=0; i<my_papi.num_events; i++) {
-			papi.th_accumu[my_thread][i] = my_papi.th_accumu[my_thread][i];
-			papi.th_v_sorted[my_thread][i] = my_papi.th_v_sorted[my_thread][i];
+			slot.th_accumu[my_thread][i] = my_papi.th_accumu[my_thread][i];
+			slot.th_v_sorted[my_thread][i] = my_papi.th_v_sorted[my_thread][i];
 		}
 
 	} else {	// PMlib user counter mode
 		for (int i=0; i<3; i++) {
-			papi.th_v_sorted[my_thread][i] = my_papi.th_v_sorted[my_thread][i];
+			slot.th_v_sorted[my_thread][i] = my_papi.th_v_sorted[my_thread][i];
 		}
 	}
+	slot.written[my_thread] = true;
 
 	#ifdef DEBUG_PRINT_WATCH
-	//	if (my_rank == 0) {
 		#pragma omp critical
 		{
-		fprintf(stderr, "<mergeParallelThread> [%s] merge step 2. my_thread=%d, &my_papi=%p \n",
+		fprintf(stderr, "<writeThreadSlot> [%s] merge step 1. my_thread=%d, &my_papi=%p \n",
 					m_label.c_str(), my_thread, &my_papi);
 
 		#ifdef DEBUG_PRINT_PAPI_THREADS
@@ -646,53 +876,70 @@ namespace pm_lib {
 			}
 		} else {	// ( is_unit == 0 | is_unit == 1) : PMlib user counter mode
     		fprintf(stderr, "\t [%s] user mode: my_thread=%d, m_flop=%e\n", m_label.c_str(), my_thread, m_flop);
-			for (int j=my_thread; j<my_thread+1; j++) {
-				fprintf (stderr, "\t\t my_papi.th_v_sorted[%d][0:2]: %e, %e, %e \n",
-					j, my_papi.th_v_sorted[j][0], my_papi.th_v_sorted[j][1], my_papi.th_v_sorted[j][2]);
-			}
+			fprintf (stderr, "\t\t my_papi.th_v_sorted[%d][0:2]: %e, %e, %e \n",
+				my_thread, my_papi.th_v_sorted[my_thread][0], my_papi.th_v_sorted[my_thread][1], my_papi.th_v_sorted[my_thread][2]);
 		}
 		fprintf (stderr, "\t m_count=%ld, m_time=%e, m_flop=%e\n", m_count, m_time, m_flop);
 		#endif
 		}
-	//	}
 	#endif
 
+  #else
+	(void) slot;
   #endif
   }
 
 
 
-  ///  Merging the thread parallel data into the master thread in three steps.
-  ///  These three routines are called by <PerfMonitor::gather> which is
-  ///  called by <PerfMonitor::report> in a serial region.
-  ///  After these steps, the master thread will retain the aggregated values
-  ///  in its "my_papi" struct.
-  ///  Shared struct "papi" is used as a scratch space during these steps.
+  ///  Merging the thread parallel data into the master thread in two steps.
   ///
-  ///  The 3rd step : Finally update some of the "isolated" stats.
+  ///  The 2nd step : Copy the rows written by the parallel threads from the slot
+  ///  			into the master thread "my_papi", and update the "isolated" stats.
+  ///  			The rows of the master thread and of the threads which did not
+  ///  			write the slot keep the values of the master thread.
   ///
-  ///	@note The 3rd step should be done by the master thread only
+  ///	@param[in] slot  reduction buffer of the section shared by all threads.
+  ///		NULL if the section has no buffer, i.e. it is outside of parallel region.
   ///
+  ///	@note The 2nd step should be done by the master thread only,
+  ///		after all the threads have finished the 1st step.
   ///
-  void PerfWatch::updateMergedThread(void)
+  void PerfWatch::mergeThreadSlots(struct pmlib_thread_slots* slot)
   {
   #ifdef _OPENMP
-	if (m_threads_merged) return;
 	if (my_thread != 0) return;
-	if (m_started) return; // still in the middle of active start/stop pair
+
+	int n_slots = (slot == NULL) ? 0 : std::min(num_threads, Max_nthreads);
+	if (m_threads_merged || m_started) {
 		// The thread stats should be merged after the thread has stopped.
+		// Discard the rows so that they are not taken by the next merge.
+		for (int j=0; j<n_slots; j++) { slot->written[j] = false; }
+		return;
+	}
 
     int is_unit = statsSwitch();
 
-	if ( is_unit >= 2) { // PMlib HWPC counter mode
-
-		for (int j=0; j<num_threads; j++) {
+	for (int j=1; j<n_slots; j++) {
+		if (!slot->written[j]) continue;
+		if ( is_unit >= 2) { // PMlib HWPC counter mode
 			for (int i=0; i<my_papi.num_events; i++) {
-				my_papi.th_accumu[j][i] = papi.th_accumu[j][i] ;
-				my_papi.th_v_sorted[j][i] = papi.th_v_sorted[j][i] ;
+				my_papi.th_accumu[j][i] = slot->th_accumu[j][i] ;
+				my_papi.th_v_sorted[j][i] = slot->th_v_sorted[j][i] ;
+			}
+		} else {	// PMlib user counter mode
+			for (int i=0; i<3; i++) {
+				my_papi.th_v_sorted[j][i] = slot->th_v_sorted[j][i] ;
 			}
 		}
+		slot->written[j] = false;
+	}
+	//  Note on the use of my_papi.th_v_sorted[][] array.
+	//  PerfWatch::stop() should have saved following variables (both for HWPC mode and USER mode)
+	//	my_papi.th_v_sorted[my_thread][0] = (double)m_count;	// call
+	//	my_papi.th_v_sorted[my_thread][1] = m_time;				// time[s]
+	//	my_papi.th_v_sorted[my_thread][2] = m_flop;				// operations
 
+	if ( is_unit >= 2) { // PMlib HWPC counter mode
 		//
 		// Normal HWPC events are isolated inside the compute core, and their values should be accumulated.
 		// The below formula is valid for the most cases. Just accmulate the values.
@@ -776,7 +1023,7 @@ namespace pm_lib {
 					}
 				}
 				#ifdef DEBUG_PRINT_PAPI_THREADS
-    			fprintf(stderr, "<updateMergedThread> A64FX BANDWIDTH case: [%s] np_node=%d, my_rank_on_node=%d \n", m_label.c_str(), np_node, my_rank_on_node);
+    			fprintf(stderr, "<mergeThreadSlots> A64FX BANDWIDTH case: [%s] np_node=%d, my_rank_on_node=%d \n", m_label.c_str(), np_node, my_rank_on_node);
 				#endif
 
 			} else if (np_node >= 5) {
@@ -791,7 +1038,7 @@ namespace pm_lib {
 					my_papi.accumu[i] = my_papi.th_accumu[0][i] * share_ratio;
 				}
 				#ifdef DEBUG_PRINT_PAPI_THREADS
-    			fprintf(stderr, "<updateMergedThread> A64FX BANDWIDTH case: [%s] np_node=%d, my_rank_on_node=%d \n", m_label.c_str(), np_node, my_rank_on_node);
+    			fprintf(stderr, "<mergeThreadSlots> A64FX BANDWIDTH case: [%s] np_node=%d, my_rank_on_node=%d \n", m_label.c_str(), np_node, my_rank_on_node);
     			fprintf(stderr, "\t\t np_share=%d, share_ratio=%f \n", np_share, share_ratio);
 				#endif
 			}
@@ -799,12 +1046,6 @@ namespace pm_lib {
 
 
 
-	} else {	// PMlib user counter mode
-		for (int j=0; j<num_threads; j++) {
-			for (int i=0; i<3; i++) {
-				my_papi.th_v_sorted[j][i] = papi.th_v_sorted[j][i] ;
-			}
-		}
 	}
 
 	m_threads_merged = true;
@@ -832,7 +1073,7 @@ namespace pm_lib {
     //	if (my_rank == 0) {
 		#pragma omp critical
 		{
-    	fprintf(stderr, "<updateMergedThread> [%s] merge step 3. master thread:\n", m_label.c_str());
+    	fprintf(stderr, "<mergeThreadSlots> [%s] merge step 2. master thread:\n", m_label.c_str());
 		if ( is_unit >= 2) { // PMlib HWPC counter mode
 			for (int i=0; i<my_papi.num_events; i++) {
 				fprintf(stderr, "\t [%s] : [%8s] my_papi.accumu[%d]=%llu \n",
@@ -853,24 +1094,8 @@ namespace pm_lib {
     //	}
 	#endif
 
-// we should clean up "papi" after these steps.
-
-	if ( is_unit >= 2) { // PMlib HWPC counter mode
-		for (int j=0; j<num_threads; j++) {
-			for (int i=0; i<my_papi.num_events; i++) {
-				papi.th_accumu[j][i] = 0;
-				papi.th_v_sorted[j][i] = 0.0;
-			}
-		}
-	} else {	// PMlib user counter mode
-		for (int j=0; j<num_threads; j++) {
-			for (int i=0; i<3; i++) {
-				papi.th_accumu[j][i] = 0;
-				papi.th_v_sorted[j][i] = 0.0;
-			}
-		}
-	}
-
+  #else
+	(void) slot;
   #endif
   }
 
@@ -913,6 +1138,14 @@ namespace pm_lib {
 		m_is_set = true;
 	}
 
+	// the ring of the monitor in the thread which defines the section (PMLIB_FLIGHT_RECORDER)
+	m_flight = flight_thread_ring(m_flight_slot);
+	if (m_flight != NULL) flight_set_label(m_flight, id, label.c_str());
+
+	// the buffer of the thread which defines the section (PMLIB_TRACE)
+	m_trace = trace_thread_buffer();
+	if (m_trace != NULL) trace_label(m_trace, id, label.c_str());
+
 	if (m_in_parallel) {
 #if defined (__INTEL_COMPILER)	|| \
     defined (__GXX_ABI_VERSION)	|| \
@@ -1021,7 +1254,7 @@ namespace pm_lib {
 #ifdef USE_POWER
     if (level_POWER == 0) return;
 	#ifdef DEBUG_PRINT_POWER_EXT
-	(void) MPI_Barrier(MPI_COMM_WORLD);
+	(void) MPI_Barrier(m_comm);
    	fprintf(stderr, "<PerfWatch::gatherPOWER> [%s] my_rank:%d, thread:%d, w_accumu[0]=%e \n",
 		m_label.c_str(), my_rank, my_thread, my_power.w_accumu[0]);
 	#endif
@@ -1030,7 +1263,7 @@ namespace pm_lib {
 	int iret;
 	//	Sum up (MPI_Reduce) the estimated total power consumption my_power.w_accumu[0] into t_joule
 	if ( num_process > 1 ) {
-		iret = MPI_Reduce (&my_power.w_accumu[0], &t_joule, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+		iret = MPI_Reduce (&my_power.w_accumu[0], &t_joule, 1, MPI_DOUBLE, MPI_SUM, 0, m_comm);
 		if ( iret != 0 ) {
 			fprintf(stderr, "*** error. <%s> MPI_Reduce failed. iret=%d\n", __func__, iret);
 			t_joule = 0.0;
@@ -1044,6 +1277,126 @@ namespace pm_lib {
   }
 
 
+  /// gather the estimated power consumption of all nodes.
+  /// Each node is counted once, through its node leader process.
+  ///
+  ///   @param[in] comm_leader  communicator of the node leader processes
+  ///   @param[in] is_leader    true if this process is the node leader
+  ///   @param[in] n_nodes      number of nodes
+  ///
+  ///   @note m_power_av is the average value per node in this case
+  ///
+  void PerfWatch::gatherPOWER(MPI_Comm comm_leader, bool is_leader, int n_nodes)
+  {
+#ifdef USE_POWER
+    if (level_POWER == 0) return;
+	if (!is_leader) return;
+
+	double t_joule = 0.0;	// the result of MPI_Reduce is defined on the root only
+	int iret;
+	if ( n_nodes > 1 ) {
+		iret = MPI_Reduce (&my_power.w_accumu[0], &t_joule, 1, MPI_DOUBLE, MPI_SUM, 0, comm_leader);
+		if ( iret != 0 ) {
+			fprintf(stderr, "*** error. <%s> MPI_Reduce failed. iret=%d\n", __func__, iret);
+			t_joule = 0.0;
+		}
+	} else {
+		t_joule = my_power.w_accumu[0];
+	}
+	m_power_av = t_joule/n_nodes;
+#else
+	(void) comm_leader; (void) is_leader; (void) n_nodes;
+#endif
+  }
+
+
+
+#ifdef USE_OTF
+  // OTF出力イベントのスレッド別バッファ
+  //	start()/stop() は生のイベントを自スレッドのバッファに追加するだけで、
+  //	時刻の変換、ユーザ申告値の速度の計算、OTFへの書き出しはフラッシュ時に行う。
+  //	バッファが Otf_buffer_events 個に達すると、自スレッドが生のイベントのまま
+  //	一時ファイルに退避する。finalizeOTF() でドリフトを求めた後に、マスタースレッドが
+  //	退避分と残りを同じ時刻系に変換してOTFに書き出す。
+  //	一時ファイルを作成できない場合は、メモリ上のバッファを拡張して保持する。
+  enum { Otf_enter, Otf_leave, Otf_counter, Otf_counter_ops };
+  struct otf_raw_event {
+    double time;      // getTime()の時刻値
+    double value;     // カウンター値、または Otf_counter_ops の場合は計算量
+    double duration;  // Otf_counter_ops の場合の区間の時間
+    int kind;         // Otf_enter | Otf_leave | Otf_counter | Otf_counter_ops
+    int ref;          // 共有区間番号m_otf_id、またはカウンターの場合は is_unit
+  };
+  static const size_t Otf_buffer_events = 65536;
+  static std::vector<struct otf_raw_event> otf_buffer[Max_nthreads];
+  static FILE* otf_spill[Max_nthreads];
+  static unsigned long otf_sample_seq[Max_nthreads];
+  static int otf_counter_interval = 1;
+  static std::vector<int> otf_global_region;	// global section ID of each shared section ID (finalizeOTF)
+
+  /// communicatorのFortranハンドル。OTFのCインタフェイスに渡す
+  static int otf_comm_handle(MPI_Comm comm)
+  {
+#ifdef DISABLE_MPI
+    return 0;
+#else
+    return (int)MPI_Comm_c2f(comm);
+#endif
+  }
+
+  static inline void bufferOTF(int thread, int kind, double time, int ref,
+      double value=0.0, double duration=0.0)
+  {
+    struct otf_raw_event e;
+    e.time = time;
+    e.value = value;
+    e.duration = duration;
+    e.kind = kind;
+    e.ref = ref;
+    otf_buffer[thread].push_back(e);
+  }
+
+  /// スレッドのバッファの生のイベントを一時ファイルに退避する
+  static void spillOTF(int thread)
+  {
+    std::vector<struct otf_raw_event>& buf = otf_buffer[thread];
+    if (otf_spill[thread] == NULL) {
+      otf_spill[thread] = tmpfile();
+      if (otf_spill[thread] == NULL) return;	// keep growing the buffer
+    }
+    if (fwrite(&buf[0], sizeof(struct otf_raw_event), buf.size(), otf_spill[thread]) != buf.size()) {
+      fprintf(stderr, "*** PMlib warning. can not spill the OTF events of thread %d. they are kept in memory.\n", thread);
+      fclose(otf_spill[thread]);
+      otf_spill[thread] = NULL;
+      return;
+    }
+    buf.clear();
+  }
+
+  /// イベントをOTFのスレッドストリームに書き出す
+  static void flushOTF(int my_rank, int thread, std::vector<struct otf_raw_event>& buf)
+  {
+    for (size_t i=0; i<buf.size(); i++) {
+      const struct otf_raw_event& e = buf[i];
+      double t = PerfWatch::alignedTime(e.time);
+      if (e.kind == Otf_enter || e.kind == Otf_leave) {
+        int region = (e.ref < (int)otf_global_region.size()) ? otf_global_region[e.ref] : 0;
+        if (e.kind == Otf_enter) {
+          my_otf_event_start(my_rank, thread, t, region);
+        } else {
+          my_otf_event_stop(my_rank, thread, t, region);
+        }
+      } else if (e.kind == Otf_counter) {
+        my_otf_event_counter(my_rank, thread, t, e.ref, e.value);
+      } else {
+        double w = (e.duration > 0.0) ? e.value / e.duration : 0.0;
+        my_otf_event_counter(my_rank, thread, t, e.ref, w);
+      }
+    }
+    buf.clear();
+  }
+#endif
+
 
   /// ポスト処理用traceファイル出力用の初期化
   ///
@@ -1061,12 +1414,179 @@ namespace pm_lib {
     } else {
       otf_filename = "pmlib_otf_files";
     }
-    double baseT = PerfWatch::getTime();
-    my_otf_initialize(num_process, my_rank, otf_filename.c_str(), baseT);
+	// 環境変数 OTF_COUNTER_INTERVAL=N が指定された場合、OTF_TRACING=full の
+	// カウンター値は各スレッドの N 回目毎の区間の測定についてのみ出力する
+    otf_counter_interval = 1;
+    cp_env = std::getenv("OTF_COUNTER_INTERVAL");
+    if (cp_env != NULL) {
+      int n = atoi(cp_env);
+      if (n > 0) {
+        otf_counter_interval = n;
+      } else if (my_rank == 0) {
+        fprintf(stderr, "*** PMlib warning. OTF_COUNTER_INTERVAL=%s is ignored. A positive integer is expected.\n", cp_env);
+      }
+    }
+    for (int i=0; i<Max_nthreads; i++) {
+      otf_buffer[i].clear();
+      otf_spill[i] = NULL;
+      otf_sample_seq[i] = 0;
+    }
+    // 全ランクのトレースを基準ランクの時刻系で出力する
+    alignClock(0);
+    double baseT = alignedTime(PerfWatch::getTime());
+#ifndef DISABLE_MPI
+    (void) MPI_Bcast(&baseT, 1, MPI_DOUBLE, 0, m_comm);
+#endif
+    my_otf_initialize(num_process, my_rank, num_threads, otf_filename.c_str(), baseT,
+      otf_comm_handle(m_comm));
+#endif
+  }
+
+
+  // 基準ランクの時刻系への変換係数 (alignClock)
+  //	基準ランクの時刻 = t + clock_offset + clock_drift * (t - clock_t0)
+  static double clock_offset = 0.0;
+  static double clock_drift = 0.0;
+  static double clock_t0 = 0.0;
+  static double clock_error = 0.0;
+  static bool clock_is_set = false;
+  static bool clock_is_final = false;
+  static const int Max_clock_sync_rounds = 10;
+  static const int Clock_sync_tag = 7411;
+
+
+  /// 基準ランク(ランク0)の時刻とのずれをMPI ping-pongで推定する
+  ///
+  ///   @param[out] offset  ずれ(秒)。基準ランクの時刻 = 自ランクの時刻 + offset
+  ///
+  ///   @return 推定誤差の上限(秒)。最小往復時間の1/2
+  ///
+  ///   @note Cristian's algorithm. 基準ランクは各ランクと順に
+  ///   Max_clock_sync_rounds回のping-pongを行い、往復時間が最小となった
+  ///   応答の時刻と往復の中間時刻の差をずれとする。m_commの集団操作。
+  ///   アプリケーションの通信と混ざらないように、m_commを複製したcommunicator
+  ///   で通信し、終了後に解放する。
+  ///
+  double PerfWatch::estimateClockOffset(double& offset)
+  {
+    offset = 0.0;
+#ifdef DISABLE_MPI
+    return 0.0;
+#else
+    int rank, nprocs;
+    double ta, tb, tr, rtt;
+    double best_rtt = 0.0;
+    MPI_Status status;
+    MPI_Comm comm;
+
+    MPI_Comm_rank(m_comm, &rank);
+    MPI_Comm_size(m_comm, &nprocs);
+    if (nprocs == 1) return 0.0;
+
+    if (MPI_Comm_dup(m_comm, &comm) != MPI_SUCCESS) {
+      fprintf(stderr, "*** PMlib error. <estimateClockOffset> MPI_Comm_dup failed.\n");
+      return 0.0;
+    }
+
+    if (rank == 0) {
+      for (int i=1; i<nprocs; i++) {
+        for (int k=0; k<Max_clock_sync_rounds; k++) {
+          MPI_Recv(&ta, 1, MPI_DOUBLE, i, Clock_sync_tag, comm, &status);
+          tr = getTime();
+          MPI_Send(&tr, 1, MPI_DOUBLE, i, Clock_sync_tag, comm);
+        }
+      }
+    } else {
+      for (int k=0; k<Max_clock_sync_rounds; k++) {
+        ta = getTime();
+        MPI_Send(&ta, 1, MPI_DOUBLE, 0, Clock_sync_tag, comm);
+        MPI_Recv(&tr, 1, MPI_DOUBLE, 0, Clock_sync_tag, comm, &status);
+        tb = getTime();
+        rtt = tb - ta;
+        if (k == 0 || rtt < best_rtt) {
+          best_rtt = rtt;
+          offset = tr - 0.5*(ta + tb);
+        }
+      }
+    }
+    MPI_Comm_free(&comm);
+    return 0.5*best_rtt;
 #endif
   }
 
 
+  /// トレースの時刻を全ランク共通の時刻系にそろえる
+  ///
+  ///   @param[in] phase  0: 初期化時にずれを推定する。
+  ///                     1: 終了時に再推定し、2点間のドリフトを求めて残差を出力する
+  ///
+  ///   @note 終了時には各ランクのずれ、ドリフト、推定誤差の最大値をランク0が出力する。
+  ///   OTFのイベントは終了時まで生の時刻値で保持され、全てのイベントが
+  ///   ずれとドリフトの両方で補正される。フライトレコーダとバイナリトレースは
+  ///   生の時刻値を記録し、推定の度に係数を受け取って出力時に全てのイベントを変換する。
+  ///   初期化時と終了時の推定はそれぞれプロセスで1度だけ行う。
+  ///   OTFの終了処理とレポートの両方から呼ばれた場合、2度目は1度目の結果を使う。
+  ///
+  void PerfWatch::alignClock(int phase)
+  {
+    if (phase == 0) {
+      if (clock_is_set) return;
+      double offset;
+      clock_error = estimateClockOffset(offset);
+      clock_t0 = getTime();
+      clock_offset = offset;
+      clock_drift = 0.0;
+      clock_is_set = true;
+      flight_set_clock(clock_offset, clock_drift, clock_t0);
+      trace_clock(clock_offset, clock_drift, clock_t0);
+      return;
+    }
+
+    if (clock_is_final) return;
+    clock_is_final = true;
+
+    double offset;
+    double error = estimateClockOffset(offset);
+
+    double t1 = getTime();
+    double d_offset = offset - clock_offset;
+    if (t1 > clock_t0) {
+      clock_drift = d_offset / (t1 - clock_t0);
+    }
+    flight_set_clock(clock_offset, clock_drift, clock_t0);
+    trace_clock(clock_offset, clock_drift, clock_t0);
+
+    double v[4], v_max[4];
+    v[0] = fabs(clock_offset);
+    v[1] = fabs(clock_drift);
+    v[2] = std::max(clock_error, error);
+    v[3] = fabs(d_offset);
+#ifdef DISABLE_MPI
+    for (int i=0; i<4; i++) v_max[i] = v[i];
+#else
+    MPI_Reduce(v, v_max, 4, MPI_DOUBLE, MPI_MAX, 0, m_comm);
+#endif
+    if (my_rank == 0) {
+      fprintf(stderr, "\tPMlib clock alignment to rank 0: max offset=%9.3e [sec], max drift=%9.3e [sec/sec]\n",
+        v_max[0], v_max[1]);
+      fprintf(stderr, "\t\tresidual error: sync=%9.3e [sec], drift over the run=%9.3e [sec]\n",
+        v_max[2], v_max[3]);
+    }
+  }
+
+
+  /// 自ランクの時刻を基準ランクの時刻系に変換する
+  ///
+  ///   @param[in] t  getTime()の時刻値(秒)
+  ///
+  ///   @return 基準ランクの時刻系での時刻値(秒)
+  ///
+  double PerfWatch::alignedTime(double t)
+  {
+    return t + clock_offset + clock_drift * (t - clock_t0);
+  }
+
+
   /// 測定区間のラベル情報をOTF に出力
   ///
   ///   @param[in] label     ラベル
@@ -1095,8 +1615,12 @@ namespace pm_lib {
 
   /// OTF 出力処理を終了する
   ///
-  void PerfWatch::finalizeOTF(void)
+  ///   @param[in] otf_region  共有区間番号に対応する全プロセス共通の区間番号
+  ///   @param[in] n_region    otf_region[] の要素数
+  ///
+  void PerfWatch::finalizeOTF(const int* otf_region, int n_region)
   {
+	(void) otf_region; (void) n_region;
 #ifdef USE_OTF
     if (level_OTF == 0) return;
 
@@ -1119,10 +1643,28 @@ namespace pm_lib {
 		s_unit =  my_papi.s_sorted[my_papi.num_sorted-1] ;
 	}
 
-	(void) MPI_Barrier(MPI_COMM_WORLD);
+	otf_global_region.assign(otf_region, otf_region + n_region);
+	(void) MPI_Barrier(m_comm);
+	alignClock(1);
+	// 退避したイベントと残りのイベントをドリフト補正後の時刻系で書き出す
+	for (int i=0; i<Max_nthreads; i++) {
+		if (otf_spill[i] != NULL) {
+			std::vector<struct otf_raw_event> chunk(Otf_buffer_events);
+			rewind(otf_spill[i]);
+			size_t n;
+			while ((n = fread(&chunk[0], sizeof(struct otf_raw_event), Otf_buffer_events, otf_spill[i])) > 0) {
+				chunk.resize(n);
+				flushOTF(my_rank, i, chunk);
+				chunk.resize(Otf_buffer_events);
+			}
+			fclose(otf_spill[i]);	// the file of tmpfile() is removed at close
+			otf_spill[i] = NULL;
+		}
+		if (!otf_buffer[i].empty()) flushOTF(my_rank, i, otf_buffer[i]);
+	}
 	my_otf_finalize (num_process, my_rank, is_unit,
 		otf_filename.c_str(), s_group.c_str(),
-		s_counter.c_str(), s_unit.c_str());
+		s_counter.c_str(), s_unit.c_str(), otf_comm_handle(m_comm));
 
     level_OTF = 0;
 
@@ -1160,8 +1702,12 @@ namespace pm_lib {
 		//	return;
 	}
     m_started = true;
+	// a full trace buffer is written before the start time is taken
+	if (m_trace != NULL) trace_reserve(m_trace, Max_trace_event);
     m_startTime = getTime();
 	m_threads_merged = false;
+	if (m_flight != NULL) flight_start(m_flight, m_id, m_startTime);
+	if (m_trace != NULL) trace_enter(m_trace, m_id, m_startTime);
 
 	if ( m_in_parallel ) {
 		// The threads are active and running in parallel region
@@ -1172,9 +1718,12 @@ namespace pm_lib {
 	}
 
 #ifdef USE_OTF
-    if (level_OTF != 0) {
-      int is_unit = statsSwitch();
-      my_otf_event_start(my_rank, m_startTime, m_id, is_unit);
+    // Max_nthreads 以上のスレッド番号はバッファを持たない
+    if (level_OTF != 0 && my_thread < Max_nthreads) {
+      // OTF_TRACING=full のカウンター値は OTF_COUNTER_INTERVAL 回毎の測定で出力する
+      m_otf_sampled = (level_OTF == 2) && (otf_sample_seq[my_thread]++ % otf_counter_interval == 0);
+      bufferOTF(my_thread, Otf_enter, m_startTime, m_otf_id);
+      if (m_otf_sampled) bufferOTF(my_thread, Otf_counter, m_startTime, statsSwitch(), 0.0);
 	}
 #endif
   }
@@ -1341,6 +1890,15 @@ namespace pm_lib {
     m_time += m_stopTime - m_startTime;
     m_count++;
     m_started = false;
+	if (m_flight != NULL) flight_stop(m_flight, m_id, m_stopTime, m_stopTime - m_startTime);
+	if (m_trace != NULL) {
+		trace_leave(m_trace, m_id, m_stopTime);
+		// the counter sample is the speed of this call, as the OTF_TRACING=full
+		double ops = flopPerTask * (double)iterationCount;
+		if (ops != 0.0 && m_stopTime > m_startTime) {
+			trace_counter(m_trace, m_id, m_stopTime, ops / (m_stopTime - m_startTime));
+		}
+	}
 
 	if ( m_in_parallel ) {
 		// The threads are active and running in parallel region
@@ -1360,34 +1918,31 @@ namespace pm_lib {
 	fprintf (stderr, "\t\t m_startTime=%f, m_stopTime=%f\n", m_startTime, m_stopTime);
 	#endif
 #ifdef USE_OTF
-    int is_unit = statsSwitch();
-	double w=0.0;
-	if (level_OTF == 0) {
-		// OTFファイル出力なし
-		;
-	} else if (level_OTF == 1) {
-		// OTFファイルには時間情報だけを出力し、カウンター値は0.0とする
-		w = 0.0;
-		my_otf_event_stop(my_rank, m_stopTime, m_id, is_unit, w);
-
-	} else if (level_OTF == 2) {
-		if ( (is_unit == 0) || (is_unit == 1) ) {
-			// ユーザが引数で指定した計算量/time(計算speed)
-    		w = (flopPerTask * (double)iterationCount) / (m_stopTime-m_startTime);
-		} else if ( (2 <= is_unit) && (is_unit <= Max_hwpc_output_group) ) {
-			// 自動計測されたHWPCイベントを分析した計算speed
-			sortPapiCounterList ();
-
-			// is_unitが2,3の時、v_sorted[]配列の最後の要素は速度の次元を持つ
-			// is_unitが4,5の時は...
-			w = my_papi.v_sorted[my_papi.num_sorted-1] ;
+	if (level_OTF != 0 && my_thread < Max_nthreads) {
+		// OTF_TRACING=on の場合は時間情報だけを出力する
+		if (m_otf_sampled) {
+			int is_unit = statsSwitch();
+			if ( (is_unit == 0) || (is_unit == 1) ) {
+				// ユーザが引数で指定した計算量/time(計算speed) はフラッシュ時に計算する
+				bufferOTF(my_thread, Otf_counter_ops, m_stopTime, is_unit,
+					flopPerTask * (double)iterationCount, m_stopTime-m_startTime);
+			} else if ( (2 <= is_unit) && (is_unit <= Max_hwpc_output_group) ) {
+				// 自動計測されたHWPCイベントを分析した計算speed
+				sortPapiCounterList ();
+
+				// is_unitが2,3の時、v_sorted[]配列の最後の要素は速度の次元を持つ
+				// is_unitが4,5の時は...
+				double w = my_papi.v_sorted[my_papi.num_sorted-1] ;
+				bufferOTF(my_thread, Otf_counter, m_stopTime, is_unit, w);
+			}
 		}
-		my_otf_event_stop(my_rank, m_stopTime, m_id, is_unit, w);
+		bufferOTF(my_thread, Otf_leave, m_stopTime, m_otf_id);
+		if (otf_buffer[my_thread].size() >= Otf_buffer_events) spillOTF(my_thread);
 	}
 	#ifdef DEBUG_PRINT_OTF
     if (my_rank == 0) {
-		fprintf (stderr, "\t <PerfWatch::stop> OTF [%s] w=%e, m_time=%f, m_flop=%e \n"
-				, m_label.c_str(), w, m_time, m_flop );
+		fprintf (stderr, "\t <PerfWatch::stop> OTF [%s] sampled=%d, m_time=%f, m_flop=%e \n"
+				, m_label.c_str(), m_otf_sampled, m_time, m_flop );
     }
 	#endif
 #endif	// end of #ifdef USE_OTF
@@ -1568,6 +2123,7 @@ namespace pm_lib {
     m_time = 0.0;
     m_count = 0;
 	m_flop = 0.0;
+	m_time_exchanged = 0.0;
 
 #ifdef USE_PAPI
 	if (my_papi.num_events > 0) {
@@ -1949,6 +2505,16 @@ namespace pm_lib {
     if (cp_env != NULL) {
 	  fprintf(fp, "\t\tOTF_TRACING=%s \n", cp_env);
     }
+    cp_env = std::getenv("OTF_COUNTER_INTERVAL");
+    if (cp_env != NULL) {
+	  fprintf(fp, "\t\tOTF_COUNTER_INTERVAL=%s \n", cp_env);
+    }
+#endif
+#ifdef USE_OTF2
+    cp_env = std::getenv("OTF2_CHUNK_SIZE");
+    if (cp_env != NULL) {
+	  fprintf(fp, "\t\tOTF2_CHUNK_SIZE=%s \n", cp_env);
+    }
 #endif
 
 	cp_env = std::getenv("PMLIB_REPORT");
@@ -1958,13 +2524,74 @@ namespace pm_lib {
 		s_chooser = cp_env;
 		if (s_chooser == "BASIC" ||
 			s_chooser == "DETAIL" ||
-			s_chooser == "FULL" ) {
+			s_chooser == "FULL" ||
+			s_chooser == "TOPK" ) {
 			fprintf(fp, "\t\tPMLIB_REPORT=%s \n", s_chooser.c_str());
 		} else {
 			; // ignore other values
 		}
 	}
 
+	cp_env = std::getenv("PMLIB_REPORT_FORMAT");
+	if (cp_env != NULL) {
+		fprintf(fp, "\t\tPMLIB_REPORT_FORMAT=%s \n", cp_env);
+	}
+
+	cp_env = std::getenv("PMLIB_INTERVAL");
+	if (cp_env != NULL) {
+		fprintf(fp, "\t\tPMLIB_INTERVAL=%s \n", cp_env);
+	}
+
+	cp_env = std::getenv("PMLIB_SHM");
+	if (cp_env != NULL) {
+		fprintf(fp, "\t\tPMLIB_SHM=%s \n", cp_env);
+	}
+
+	cp_env = std::getenv("PMLIB_PROMETHEUS_DIR");
+	if (cp_env != NULL) {
+		fprintf(fp, "\t\tPMLIB_PROMETHEUS_DIR=%s \n", cp_env);
+	}
+
+	cp_env = std::getenv("PMLIB_FLIGHT_RECORDER");
+	if (cp_env != NULL) {
+		fprintf(fp, "\t\tPMLIB_FLIGHT_RECORDER=%s \n", cp_env);
+	}
+
+	cp_env = std::getenv("PMLIB_TRACE");
+	if (cp_env != NULL) {
+		fprintf(fp, "\t\tPMLIB_TRACE=%s \n", cp_env);
+	}
+
+	cp_env = std::getenv("PMLIB_SIGNAL_DUMP");
+	if (cp_env != NULL) {
+		fprintf(fp, "\t\tPMLIB_SIGNAL_DUMP=%s \n", cp_env);
+	}
+
+	cp_env = std::getenv("PMLIB_GATHER");
+	if (cp_env != NULL) {
+		s_chooser = cp_env;
+		if (s_chooser == "ALL" ||
+			s_chooser == "ROOT" ||
+			s_chooser == "NODE" ) {
+			fprintf(fp, "\t\tPMLIB_GATHER=%s \n", s_chooser.c_str());
+		}
+	}
+
+	cp_env = std::getenv("PMLIB_DETAIL_FILE");
+	if (cp_env != NULL) {
+		fprintf(fp, "\t\tPMLIB_DETAIL_FILE=%s \n", cp_env);
+	}
+
+	cp_env = std::getenv("PMLIB_TOPK");
+	if (cp_env != NULL) {
+		fprintf(fp, "\t\tPMLIB_TOPK=%s \n", cp_env);
+	}
+
+	cp_env = std::getenv("PMLIB_DUMP");
+	if (cp_env != NULL) {
+		fprintf(fp, "\t\tPMLIB_DUMP=%s \n", cp_env);
+	}
+
   }
 
 
@@ -2100,7 +2727,9 @@ namespace pm_lib {
 				(void) fflush(fp);
 			}
 		}	// end of if (my_rank == 0) 
+		#ifdef _OPENMP
 		#pragma omp barrier
+		#endif
 	}	// end of for (int j=0; j<num_threads; j++)
 	m_count = save_m_count;
 	m_time  = save_m_time;
@@ -17,6 +17,7 @@ extern void C_pm_serial_parallel (int id, int *mid, int *inside);
 extern void C_pm_stop_Root (void);
 extern void C_pm_sections (int *nSections);
 extern void C_pm_mergethreads (int id);
+extern void C_pm_mergeallthreads (void);
 extern void C_pm_select_report (char *filename);
 
 void C_pm_report (char *filename)
@@ -44,28 +45,29 @@ void C_pm_report (char *filename)
 
 	C_pm_sections (&nSections);
 
-//	merge thread data into the master thread 
+//	merge thread data of all sections into the master thread 
 
+	int n_inside = 0;
 	for (id=0; id<nSections; id++) {
-	C_pm_serial_parallel (id, &mid, &inside);
+		C_pm_serial_parallel (id, &mid, &inside);
+		if (inside==1) { n_inside++; break; }
+	}
 
-	if (inside==0) {
-		// The section is defined outside of parallel context
-		C_pm_mergethreads (id);
+	if (n_inside==0) {
+		// All the sections are defined outside of parallel context
+		C_pm_mergeallthreads ();
 
-	} else if (inside==1) {
-		// The section is defined inside parallel context
+	} else {
+		// Some sections are defined inside parallel context
 		// If an OpenMP parallel region is started by a C routine,
 		// the merge operation must be triggered by a C routine,
 		// which is outside of PMlib C++ class parallel context
 		// The followng OpenMP parallel block profives such merging support.
+		// All the sections are merged in this single parallel region.
 		#pragma omp parallel
-		C_pm_mergethreads (id);
-		;
-	} else {
+		C_pm_mergeallthreads ();
 		;
 	}
-	}	// end of for loop
 
 //	now start reporting the PMlib stats
 	C_pm_select_report (filename);
@@ -65,32 +65,33 @@ namespace pm_lib {
 
 	PM.countSections (nSections);
 
-//	merge thread data into the master thread 
+//	merge thread data of all sections into the master thread 
 
+	int n_inside = 0;
 	for (id=0; id<nSections; id++) {
-	PM.SerialParallelRegion (id, mid, inside);
+		PM.SerialParallelRegion (id, mid, inside);
 		#ifdef DEBUG_PRINT_MONITOR
 		printf("section %d is %s \n", id, (inside==0)?"outside":"inside");
 		#endif
+		if (inside==1) { n_inside++; break; }
+	}
 
-	if (inside==0) {
-		// The section is defined outside of parallel context
-		PM.mergeThreads (id);
+	if (n_inside==0) {
+		// All the sections are defined outside of parallel context
+		PM.mergeAllThreads ();
 
-	} else if (inside==1) {
-		// The section is defined inside parallel context
+	} else {
+		// Some sections are defined inside parallel context
 		// If an OpenMP parallel region is started by a Fortran routine,
 		// the merge operation must be triggered by a Fortran routine,
 		// i.e. C or C++ parallel context does not match that of Fortran.
 		// The followng OpenMP parallel block profives such merging support.
+		// All the sections are merged in this single parallel region.
 		#ifdef _OPENMP
 		#pragma omp parallel
 		#endif
-		PM.mergeThreads (id);
-	} else {
-		;
+		PM.mergeAllThreads ();
 	}
-	}	// end of for loop
 
 //	now start reporting the PMlib stats
 	PM.selectReport (fp);
@@ -0,0 +1,429 @@
+/* ##################################################################
+ *
+ * PMlib - Performance Monitor library
+ *
+ * Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+ * All rights reserved.
+ *
+ * Copyright (c) 2012-2015 Advanced Institute for Computational Science, RIKEN.
+ * All rights reserved.
+ *
+ * Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+ * All rights reserved.
+ *
+ * ###################################################################
+ */
+
+//	OTF2 backend of the my_otf_* interface (pmlib_otf.h)
+//	This file replaces src_otf_ext/otf_ext.c when PMlib is built with -D with_OTF2=
+//
+//	- The events of each thread are written to its own OTF2 location (rank x thread)
+//	  through its own event writer, so no lock is taken at each event.
+//	  PerfWatch passes the thread number when it flushes the event buffer of the thread.
+//	- The event writers are buffered by OTF2 in chunks of OTF2_CHUNK_SIZE bytes.
+//	- The value w of my_otf_event_counter() is written as the metric record
+//	  of the metric class numbered by m_shift (see statsSwitch()).
+//	- All global definitions are written by rank 0 at my_otf_finalize(),
+//	  once the number of the threads and the events of every rank are known.
+
+#ifdef USE_OTF2
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <otf2/otf2.h>
+
+#ifndef DISABLE_MPI
+#include <mpi.h>
+#include <otf2/OTF2_MPI_Collectives.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#include <otf2/OTF2_OpenMP_Locks.h>
+#endif
+
+#define OTF2_EXT_MAX_THREADS 256	//	maximum number of the thread locations per process
+#define OTF2_EXT_MAX_METRICS 8		//	m_shift is 0,1,..,Max_hwpc_output_group
+#define OTF2_EXT_DEFAULT_CHUNK (1024*1024)
+
+	static OTF2_Archive* archive = NULL;
+	static OTF2_EvtWriter* evt_writers[OTF2_EXT_MAX_THREADS];
+	static uint64_t last_ts[OTF2_EXT_MAX_THREADS];
+	static int n_local_threads = 0;
+	static double otf2_base_time;
+
+	static int n_regions = 0;		//	section labels received by my_otf_event_label() on rank 0
+	static int max_regions = 0;
+	static char** region_names = NULL;
+
+
+// location reference of the thread of the rank
+static OTF2_LocationRef otf2_location (int my_rank, int thread)
+{
+	return (OTF2_LocationRef)my_rank * OTF2_EXT_MAX_THREADS + (OTF2_LocationRef)thread;
+}
+
+
+// the signatures are fixed by OTF2_PreFlushCallback and OTF2_PostFlushCallback.
+// the arguments not used here are marked as unused.
+static OTF2_FlushType otf2_pre_flush (void* userData, OTF2_FileType fileType,
+		OTF2_LocationRef location, void* callerData, bool final)
+{
+	(void)userData; (void)fileType; (void)location; (void)callerData; (void)final;
+	return OTF2_FLUSH;
+}
+
+static OTF2_TimeStamp otf2_post_flush (void* userData, OTF2_FileType fileType,
+		OTF2_LocationRef location)
+{
+	(void)userData; (void)fileType;
+	int thread = (int)(location % OTF2_EXT_MAX_THREADS);
+	return last_ts[thread];
+}
+
+static OTF2_FlushCallbacks otf2_flush_callbacks = { otf2_pre_flush, otf2_post_flush };
+
+
+// event writer of the thread. created at the first event of the thread
+//
+// return NULL if the thread number exceeds OTF2_EXT_MAX_THREADS
+static OTF2_EvtWriter* otf2_thread_writer (int my_rank, int t)
+{
+	if (archive == NULL || t < 0 || t >= OTF2_EXT_MAX_THREADS) return NULL;
+	if (evt_writers[t] != NULL) return evt_writers[t];
+
+	#pragma omp critical (pmlib_otf2_ext)
+	{
+	evt_writers[t] = OTF2_Archive_GetEvtWriter(archive, otf2_location(my_rank, t));
+	if (t+1 > n_local_threads) n_local_threads = t+1;
+	}
+	return evt_writers[t];
+}
+
+
+// time stamp in nano seconds from the base time. kept non-decreasing per thread
+static OTF2_TimeStamp otf2_time_stamp (double time, int thread)
+{
+	double dt = (time - otf2_base_time) * 1.0e9;
+	uint64_t ts = (dt > 0.0) ? (uint64_t)dt : 0;
+	if (ts < last_ts[thread]) ts = last_ts[thread];
+	last_ts[thread] = ts;
+	return ts;
+}
+
+
+static void otf2_write_metric (OTF2_EvtWriter* w, OTF2_TimeStamp ts, int m_shift, double value)
+{
+	OTF2_Type type = OTF2_TYPE_DOUBLE;
+	OTF2_MetricValue v;
+	v.floating_point = value;
+	OTF2_EvtWriter_Metric(w, NULL, ts, (OTF2_MetricRef)m_shift, 1, &type, &v);
+}
+
+
+// Open the OTF2 archive and the event files
+//
+// num_process	並列プロセス数
+// my_rank	自ランク番号
+// num_threads	スレッド数 (the locations are created for the threads with events)
+// otf_filename	OTF2 archive directory 文字列
+// baseT	base time to start recording from.
+// f_comm	Fortran handle of the communicator (MPI_Comm_c2f)
+
+void my_otf_initialize(int num_process, int my_rank, int num_threads, char* otf_filename, double baseT, int f_comm)
+{
+	// this function is called by PerfWatch::initializeOTF() of all ranks (collective)
+	uint64_t chunk = OTF2_EXT_DEFAULT_CHUNK;
+	char* cp_env = getenv("OTF2_CHUNK_SIZE");
+	if (cp_env != NULL && atol(cp_env) > 0) chunk = (uint64_t)atol(cp_env);
+	if (chunk < OTF2_CHUNK_SIZE_MIN) chunk = OTF2_CHUNK_SIZE_MIN;
+	if (chunk > OTF2_CHUNK_SIZE_MAX) chunk = OTF2_CHUNK_SIZE_MAX;
+
+	#ifdef DEBUG_PRINT_OTF
+	if (my_rank == 0) {
+	fprintf(stderr, "\t<my_otf_initialize> OTF2 num_process=%d, archive=%s/traces, chunk=%lu, baseT=%f \n",
+		num_process, otf_filename, (unsigned long)chunk, baseT);
+	}
+	#endif
+
+	archive = OTF2_Archive_Open(otf_filename, "traces", OTF2_FILEMODE_WRITE,
+				chunk, OTF2_UNDEFINED_UINT64, OTF2_SUBSTRATE_POSIX, OTF2_COMPRESSION_NONE);
+	if (archive == NULL) {
+		fprintf(stderr, "\t*** internal error. <my_otf_initialize> OTF2_Archive_Open() failed. \n");
+		return;
+	}
+	OTF2_Archive_SetFlushCallbacks(archive, &otf2_flush_callbacks, NULL);
+	#ifdef DISABLE_MPI
+	OTF2_Archive_SetSerialCollectiveCallbacks(archive);
+	#else
+	OTF2_MPI_Archive_SetCollectiveCallbacks(archive, MPI_Comm_f2c((MPI_Fint)f_comm), MPI_COMM_NULL);
+	#endif
+	#ifdef _OPENMP
+	OTF2_OpenMP_Archive_SetLockingCallbacks(archive);
+	#endif
+	OTF2_Archive_SetCreator(archive, "PMlib");
+	OTF2_Archive_OpenEvtFiles(archive);
+
+	for (int i=0; i<OTF2_EXT_MAX_THREADS; i++) {
+		evt_writers[i] = NULL;
+		last_ts[i] = 0;
+	}
+	n_local_threads = 0;
+	otf2_base_time = baseT;
+}
+
+
+// write the enter record
+//
+// my_rank	自ランク番号
+// thread	スレッド番号
+// time		the event start time
+// m_id		the global section ID (0,1,..,m_nGlobal-1)
+void my_otf_event_start(int my_rank, int thread, double time, int m_id)
+{
+	OTF2_EvtWriter* w = otf2_thread_writer(my_rank, thread);
+	if (w == NULL) return;
+	OTF2_TimeStamp ts = otf2_time_stamp(time, thread);
+	OTF2_EvtWriter_Enter(w, NULL, ts, (OTF2_RegionRef)(m_id+1));
+}
+
+
+// write the leave record
+//
+// my_rank	自ランク番号
+// thread	スレッド番号
+// time		the event stop time
+// m_id		the global section ID (0,1,..,m_nGlobal-1)
+void my_otf_event_stop(int my_rank, int thread, double time, int m_id)
+{
+	OTF2_EvtWriter* w = otf2_thread_writer(my_rank, thread);
+	if (w == NULL) return;
+	OTF2_TimeStamp ts = otf2_time_stamp(time, thread);
+	OTF2_EvtWriter_Leave(w, NULL, ts, (OTF2_RegionRef)(m_id+1));
+}
+
+
+// write the counter value as the metric record
+//
+// my_rank	自ランク番号
+// thread	スレッド番号
+// time		the time stamp of the value
+// m_shift	the metric class number
+// w		測定値 (ユーザ指定値 or HWPC自動測定値)
+void my_otf_event_counter(int my_rank, int thread, double time, int m_shift, double w)
+{
+	OTF2_EvtWriter* writer = otf2_thread_writer(my_rank, thread);
+	if (writer == NULL) return;
+	OTF2_TimeStamp ts = otf2_time_stamp(time, thread);
+	otf2_write_metric(writer, ts, m_shift, w);
+}
+
+
+// keep the section label for the region definition
+//
+// num_process	並列プロセス数
+// my_rank		自ランク番号
+// id			全プロセス共通の区間番号+1 (1,2,..,m_nGlobal)
+// c_label		測定区間のラベル文字列
+// i_exclusive	排他測定のフラグ (0:false, 1:true)
+// i_switch		計算量の選択 (0,1,..,5)
+//
+void my_otf_event_label(int num_process, int my_rank, int id, char* c_label, int i_exclusive, int i_switch)
+{
+	if (my_rank != 0) return;
+	if (id > max_regions) {
+		int n = (id > 2*max_regions) ? id : 2*max_regions;
+		char** p = (char**)realloc(region_names, n * sizeof(char*));
+		if (p == NULL) return;
+		for (int i=max_regions; i<n; i++) p[i] = NULL;
+		region_names = p;
+		max_regions = n;
+	}
+	size_t len = strlen(c_label);
+	char* label = (char*)malloc(len+1);
+	if (label == NULL) return;
+	memcpy(label, c_label, len+1);
+	free(region_names[id-1]);
+	region_names[id-1] = label;
+	if (id > n_regions) n_regions = id;
+}
+
+
+// global definitions written by rank 0
+//
+// n_threads[r]	number of the thread locations of rank r
+// n_events[]	number of the events of each location, in the order of rank and thread
+static void otf2_write_definitions(int num_process, const int* n_threads, const uint64_t* n_events,
+			uint64_t trace_length, int is_unit, char* c_group, char* c_counter, char* c_unit)
+{
+	OTF2_GlobalDefWriter* gdw = OTF2_Archive_GetGlobalDefWriter(archive);
+	if (gdw == NULL) {
+		fprintf(stderr, "\t*** internal error. <my_otf_finalize> OTF2_Archive_GetGlobalDefWriter() failed. \n");
+		return;
+	}
+	OTF2_StringRef s = 0;
+	char name[64];
+
+#if OTF2_VERSION_MAJOR >= 3
+	OTF2_GlobalDefWriter_WriteClockProperties(gdw, 1000000000, 0, trace_length+1, OTF2_UNDEFINED_TIMESTAMP);
+#else
+	OTF2_GlobalDefWriter_WriteClockProperties(gdw, 1000000000, 0, trace_length+1);
+#endif
+
+	OTF2_StringRef s_empty = s++;
+	OTF2_GlobalDefWriter_WriteString(gdw, s_empty, "");
+	OTF2_StringRef s_node = s++;
+	OTF2_GlobalDefWriter_WriteString(gdw, s_node, "machine");
+	OTF2_StringRef s_class = s++;
+	OTF2_GlobalDefWriter_WriteString(gdw, s_class, "PMlib");
+	OTF2_GlobalDefWriter_WriteSystemTreeNode(gdw, 0, s_node, s_class, OTF2_UNDEFINED_SYSTEM_TREE_NODE);
+
+	size_t k = 0;
+	for (int r=0; r<num_process; r++) {
+		snprintf(name, sizeof(name), "Process %d", r);
+		OTF2_GlobalDefWriter_WriteString(gdw, s, name);
+#if OTF2_VERSION_MAJOR >= 3
+		OTF2_GlobalDefWriter_WriteLocationGroup(gdw, (OTF2_LocationGroupRef)r, s++,
+			OTF2_LOCATION_GROUP_TYPE_PROCESS, 0, OTF2_UNDEFINED_LOCATION_GROUP);
+#else
+		OTF2_GlobalDefWriter_WriteLocationGroup(gdw, (OTF2_LocationGroupRef)r, s++,
+			OTF2_LOCATION_GROUP_TYPE_PROCESS, 0);
+#endif
+		for (int t=0; t<n_threads[r]; t++) {
+			snprintf(name, sizeof(name), "Process %d thread %d", r, t);
+			OTF2_GlobalDefWriter_WriteString(gdw, s, name);
+			OTF2_GlobalDefWriter_WriteLocation(gdw, otf2_location(r, t), s++,
+				OTF2_LOCATION_TYPE_CPU_THREAD, n_events[k++], (OTF2_LocationGroupRef)r);
+		}
+	}
+
+	for (int i=0; i<n_regions; i++) {
+		const char* label = (region_names[i] != NULL) ? region_names[i] : "(undefined)";
+		OTF2_GlobalDefWriter_WriteString(gdw, s, label);
+		OTF2_GlobalDefWriter_WriteRegion(gdw, (OTF2_RegionRef)(i+1), s, s, s_empty,
+			OTF2_REGION_ROLE_FUNCTION, OTF2_PARADIGM_USER, OTF2_REGION_FLAG_NONE, s_empty, 0, 0);
+		s++;
+	}
+
+	//	metric classes numbered by m_shift. 0:COMM and 1:CALC sections, or the HWPC group
+	const char* m_name[OTF2_EXT_MAX_METRICS];
+	const char* m_unit[OTF2_EXT_MAX_METRICS];
+	for (int i=0; i<OTF2_EXT_MAX_METRICS; i++) m_name[i] = NULL;
+	if (is_unit >= 2 && is_unit < OTF2_EXT_MAX_METRICS) {
+		m_name[is_unit] = c_counter;
+		m_unit[is_unit] = c_unit;
+	} else {
+		m_name[0] = "User Defined COMM sections";
+		m_unit[0] = "Bytes/s";
+		m_name[1] = "User Defined CALC sections";
+		m_unit[1] = "Flops";
+	}
+	OTF2_StringRef s_group = s++;
+	OTF2_GlobalDefWriter_WriteString(gdw, s_group, c_group);
+	for (int i=0; i<OTF2_EXT_MAX_METRICS; i++) {
+		if (m_name[i] == NULL) continue;
+		OTF2_StringRef s_name = s++;
+		OTF2_StringRef s_unit = s++;
+		OTF2_GlobalDefWriter_WriteString(gdw, s_name, m_name[i]);
+		OTF2_GlobalDefWriter_WriteString(gdw, s_unit, m_unit[i]);
+		OTF2_MetricMemberRef member = (OTF2_MetricMemberRef)i;
+		OTF2_GlobalDefWriter_WriteMetricMember(gdw, member, s_name, s_group,
+			OTF2_METRIC_TYPE_USER, OTF2_METRIC_ABSOLUTE_LAST, OTF2_TYPE_DOUBLE,
+			OTF2_BASE_DECIMAL, 0, s_unit);
+		OTF2_GlobalDefWriter_WriteMetricClass(gdw, (OTF2_MetricRef)i, 1, &member,
+			OTF2_METRIC_ASYNCHRONOUS, OTF2_RECORDER_KIND_ABSTRACT);
+	}
+}
+
+
+// Close the event writers, write the definitions and close the archive
+//
+// num_process	並列プロセス数
+// my_rank	自ランク番号
+// is_unit	the metric class number of the HWPC group, or 0/1 for the user values
+// otf_filename	OTF2 archive directory 文字列
+// c_group		counter group name 文字列
+// c_counter	測定counter name 文字列
+// c_unit		測定unit name 文字列
+// f_comm		Fortran handle of the communicator (MPI_Comm_c2f)
+
+void my_otf_finalize(int num_process, int my_rank, int is_unit,
+			char* otf_filename, char* c_group,
+			char* c_counter, char* c_unit, int f_comm)
+{
+	// this function is called by PerfWatch::finalizeOTF() of all ranks (collective),
+	// from the master thread outside of the parallel region.
+	if (archive == NULL) return;
+
+	//	a thread without events still has its (empty) location
+	int n_local = (n_local_threads > 0) ? n_local_threads : 1;
+	uint64_t counts[OTF2_EXT_MAX_THREADS];
+	uint64_t local_length = 0;
+	for (int t=0; t<n_local; t++) {
+		if (evt_writers[t] == NULL) {
+			evt_writers[t] = OTF2_Archive_GetEvtWriter(archive, otf2_location(my_rank, t));
+		}
+		counts[t] = 0;
+		OTF2_EvtWriter_GetNumberOfEvents(evt_writers[t], &counts[t]);
+		OTF2_Archive_CloseEvtWriter(archive, evt_writers[t]);
+		evt_writers[t] = NULL;
+		if (last_ts[t] > local_length) local_length = last_ts[t];
+	}
+	OTF2_Archive_CloseEvtFiles(archive);
+
+	OTF2_Archive_OpenDefFiles(archive);
+	for (int t=0; t<n_local; t++) {
+		OTF2_DefWriter* dw = OTF2_Archive_GetDefWriter(archive, otf2_location(my_rank, t));
+		OTF2_Archive_CloseDefWriter(archive, dw);
+	}
+	OTF2_Archive_CloseDefFiles(archive);
+
+	int* n_threads = NULL;
+	uint64_t* n_events = NULL;
+	uint64_t trace_length = local_length;
+	#ifdef DISABLE_MPI
+	n_threads = &n_local;
+	n_events = counts;
+	#else
+	MPI_Comm comm = MPI_Comm_f2c((MPI_Fint)f_comm);
+	int* displs = NULL;
+	if (my_rank == 0) {
+		n_threads = (int*)malloc(num_process * sizeof(int));
+		displs = (int*)malloc(num_process * sizeof(int));
+	}
+	MPI_Gather(&n_local, 1, MPI_INT, n_threads, 1, MPI_INT, 0, comm);
+	if (my_rank == 0) {
+		int n = 0;
+		for (int r=0; r<num_process; r++) {
+			displs[r] = n;
+			n += n_threads[r];
+		}
+		n_events = (uint64_t*)malloc(n * sizeof(uint64_t));
+	}
+	MPI_Gatherv(counts, n_local, MPI_UINT64_T, n_events, n_threads, displs, MPI_UINT64_T, 0, comm);
+	MPI_Reduce(&local_length, &trace_length, 1, MPI_UINT64_T, MPI_MAX, 0, comm);
+	#endif
+
+	if (my_rank == 0) {
+		otf2_write_definitions(num_process, n_threads, n_events, trace_length,
+			is_unit, c_group, c_counter, c_unit);
+	}
+
+	#ifndef DISABLE_MPI
+	if (my_rank == 0) {
+		free(n_threads);
+		free(displs);
+		free(n_events);
+	}
+	#endif
+	OTF2_Archive_Close(archive);
+	archive = NULL;
+
+	for (int i=0; i<max_regions; i++) free(region_names[i]);
+	free(region_names);
+	region_names = NULL;
+	n_regions = max_regions = 0;
+}
+#endif
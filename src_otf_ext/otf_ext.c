@@ -18,11 +18,15 @@
 
 #include "stdio.h"
 #include <string.h>
+#include <stdlib.h>
 #include "otf.h"
 #define OTF_STREAM_0 0
 
 	static OTF_FileManager* manager;
-	static OTF_WStream* wstream;
+	static OTF_WStream** wstreams;	//	stream of each thread
+	static uint64_t* last_sec;		//	last time stamp of each stream
+	static int otf_num_process;
+	static int otf_num_threads;
 	static OTF_Writer* writer;
 	static OTF_MasterControl* master;
 	static double otf_base_time;
@@ -37,22 +41,33 @@
 	static OTF_KeyValueList* key_list;
 
 
-// Initialize the OTF manager, and open the stream files
+// OTF process id of the thread of the rank.
+// thread 0 keeps the process id my_rank+1 of the former single stream output,
+// and the other threads follow as the child processes of it.
+static uint32_t otf_process_id (int my_rank, int thread)
+{
+	return (uint32_t)(my_rank + 1 + thread * otf_num_process);
+}
+
+
+// Initialize the OTF manager, and open the stream file of each thread
 //
 // num_process	並列プロセス数
 // my_rank	自ランク番号
+// num_threads	スレッド数
 // otf_filename	OTF filename header 文字列
 // baseT	base time to start recording from.
+// f_comm	Fortran handle of the communicator. not used, since OTF writes the files of each rank without communication
 
-void my_otf_initialize(int num_process, int my_rank, char* otf_filename, double baseT)
+void my_otf_initialize(int num_process, int my_rank, int num_threads, char* otf_filename, double baseT, int f_comm)
 {
 	// Initialize OTF output files
 	// this function is called by PerfMonitor::initialize (int init_nWatch)
-	// remark OTF process id is numbered as 1,2,..,num_process, not from 0.
+	// remark OTF process id is numbered as 1,2,..,num_process*num_threads, not from 0.
 
 	#ifdef DEBUG_PRINT_OTF
 	if (my_rank == 0) {
-	fprintf(stderr, "\t<my_otf_initialize> num_process=%d, my_rank=%d, filename=%s, baseT=%f \n", num_process, my_rank, otf_filename, baseT);
+	fprintf(stderr, "\t<my_otf_initialize> num_process=%d, my_rank=%d, num_threads=%d, filename=%s, baseT=%f \n", num_process, my_rank, num_threads, otf_filename, baseT);
 	}
 	#endif
 
@@ -75,66 +90,110 @@ void my_otf_initialize(int num_process, int my_rank, char* otf_filename, double
 	}
 	//	}
 
-	wstream = OTF_WStream_open(otf_filename, my_rank+1, manager);
-	if (!wstream) {
-		fprintf(stderr, "\t*** internal error. <my_otf_initialize> OTF_WStream_open() failed. \n");
-		return;
+	otf_num_process = num_process;
+	otf_num_threads = (num_threads > 0) ? num_threads : 1;
+	wstreams = (OTF_WStream**)calloc(otf_num_threads, sizeof(OTF_WStream*));
+	last_sec = (uint64_t*)calloc(otf_num_threads, sizeof(uint64_t));
+	for (int t=0; t<otf_num_threads; t++) {
+		uint32_t proc = otf_process_id(my_rank, t);
+		wstreams[t] = OTF_WStream_open(otf_filename, proc, manager);
+		if (!wstreams[t]) {
+			fprintf(stderr, "\t*** internal error. <my_otf_initialize> OTF_WStream_open() failed. \n");
+			return;
+		}
+		//	every stream of the master control has at least one record
+		OTF_WStream_writeBeginProcess(wstreams[t], 0, proc);
 	}
 
 	otf_base_time = baseT;
 }
 
 
-// write the event start time stamp with 0 counter value
+// the stream of the thread. NULL if the thread is out of range
+static OTF_WStream* otf_thread_stream (int thread)
+{
+	if (wstreams == NULL || thread < 0 || thread >= otf_num_threads) return NULL;
+	return wstreams[thread];
+}
+
+
+// time stamp in micro seconds from the base time. kept non-decreasing per stream
+static uint64_t otf_time_stamp (double time, int thread)
+{
+	double dt = (time - otf_base_time) * 1.0e6;
+	uint64_t m_sec = (dt > 0.0) ? (uint64_t)dt : 0;
+	if (m_sec < last_sec[thread]) m_sec = last_sec[thread];
+	last_sec[thread] = m_sec;
+	return m_sec;
+}
+
+
+// write the event start time stamp
 //
 // my_rank	自ランク番号
+// thread	スレッド番号
 // time		the event start time
-// m_id		the number mapped to the section label (1,2,..,m_nWatch)
-// m_shift	optional shift value for the counter id (0,1,2,3,4,5)
-//			see statsSwitch() document for the meaning of each value 
-void my_otf_event_start(int my_rank, double time, int m_id, int m_shift)
+// m_id		the global section ID (0,1,..,m_nGlobal-1)
+void my_otf_event_start(int my_rank, int thread, double time, int m_id)
 {
-	// Write the counter zero value and leave with starting time stamp
-	// this function is called by PerfWatch::start()
-	// m_id is the sequential number mapped with the section label
+	// this function is called when PerfWatch flushes the event buffer of the thread.
+	// the file manager is shared by the streams, so the records are written exclusively.
 	// remark OTF identifier is numbered as 1,2,..,num_process. 0 is reserved.
 	// so the numbers given from PMlib are +1 biased.
-
-	uint64_t m_sec = (uint64_t)((time-otf_base_time)*1.0e6);
-	uint32_t u_cid = otf_counterid + (uint32_t)m_shift;
-	uint64_t u_w = (uint64_t)0;
-	OTF_WStream_writeEnter(wstream, m_sec, m_id+1, my_rank+1, 0);
-	OTF_WStream_writeCounter (wstream, m_sec, my_rank+1, u_cid, u_w);
+	OTF_WStream* wstream = otf_thread_stream(thread);
+	if (wstream == NULL) return;
+	uint64_t m_sec = otf_time_stamp(time, thread);
+	#pragma omp critical (pmlib_otf_ext)
+	OTF_WStream_writeEnter(wstream, m_sec, m_id+1, otf_process_id(my_rank, thread), 0);
 
 	#ifdef DEBUG_PRINT_OTF
-	fprintf(stderr, "\t<my_otf_event_start> my_rank=%d, time=%f, m_sec=%lu, m_id=%d, m_shift=%d\n", my_rank, time, m_sec, m_id, m_shift);
+	fprintf(stderr, "\t<my_otf_event_start> my_rank=%d, thread=%d, time=%f, m_sec=%lu, m_id=%d\n", my_rank, thread, time, m_sec, m_id);
 	#endif
 }
 
 
-
-// write the event ending time stamp with the measured performance values
+// write the event ending time stamp
 //
 // my_rank	自ランク番号
+// thread	スレッド番号
 // time		the event stop time
-// m_id		the number mapped to the section label (1,2,..,m_nWatch)
-// m_shift	optional shift value for the counter id
+// m_id		the global section ID (0,1,..,m_nGlobal-1)
+void my_otf_event_stop(int my_rank, int thread, double time, int m_id)
+{
+	OTF_WStream* wstream = otf_thread_stream(thread);
+	if (wstream == NULL) return;
+	uint64_t m_sec = otf_time_stamp(time, thread);
+	#pragma omp critical (pmlib_otf_ext)
+	OTF_WStream_writeLeave(wstream, m_sec, m_id+1, otf_process_id(my_rank, thread), 0);
+
+	#ifdef DEBUG_PRINT_OTF
+	fprintf(stderr, "\t<my_otf_event_stop> my_rank=%d, thread=%d, time=%f, m_sec=%lu, m_id=%d\n", my_rank, thread, time, m_sec, m_id);
+	#endif
+}
+
+
+// write the measured performance value
+//
+// my_rank	自ランク番号
+// thread	スレッド番号
+// time		the time stamp of the value
+// m_shift	optional shift value for the counter id (0,1,2,3,4,5)
+//			see statsSwitch() document for the meaning of each value
 // w		測定値 (ユーザ指定値 or HWPC自動測定値)
 //* Remark that w often contains the rate(speed) such as Flops or Bytes/sec,
 
-void my_otf_event_stop(int my_rank, double time, int m_id, int m_shift, double w)
+void my_otf_event_counter(int my_rank, int thread, double time, int m_shift, double w)
 {
-	// Write the counter value and leave with ending time stamp
-	// this function is called by PerfWatch::stop()
-	uint64_t m_sec = (uint64_t)((time-otf_base_time)*1.0e6);
+	OTF_WStream* wstream = otf_thread_stream(thread);
+	if (wstream == NULL) return;
+	uint64_t m_sec = otf_time_stamp(time, thread);
 	uint32_t u_cid = otf_counterid + (uint32_t)m_shift;
 	uint64_t u_w = (uint64_t)w;
-
-	OTF_WStream_writeCounter (wstream, m_sec, my_rank+1, u_cid, u_w);
-	OTF_WStream_writeLeave(wstream, m_sec, m_id+1, my_rank+1, 0);
+	#pragma omp critical (pmlib_otf_ext)
+	OTF_WStream_writeCounter (wstream, m_sec, otf_process_id(my_rank, thread), u_cid, u_w);
 
 	#ifdef DEBUG_PRINT_OTF
-	fprintf(stderr, "\t<my_otf_event_stop> my_rank=%d, time=%f, m_id=%d, u_cid=%u, m_sec=%lu, w=%e, u_w=%lu \n", my_rank, time, m_id, u_cid, m_sec, w, u_w);
+	fprintf(stderr, "\t<my_otf_event_counter> my_rank=%d, thread=%d, time=%f, u_cid=%u, m_sec=%lu, w=%e, u_w=%lu \n", my_rank, thread, time, u_cid, m_sec, w, u_w);
 	#endif
 }
 
@@ -143,7 +202,7 @@ void my_otf_event_stop(int my_rank, double time, int m_id, int m_shift, double w
 //
 // num_process	並列プロセス数
 // my_rank		自ランク番号
-// id			測定区間のラベルに対応する番号 (1,2,..,m_nWatch)
+// id			全プロセス共通の区間番号+1 (1,2,..,m_nGlobal)
 // c_label		測定区間のラベル文字列
 // i_exclusive	排他測定のフラグ (0:false, 1:true)
 // i_switch		計算量の選択 (0,1,..,5)
@@ -161,16 +220,23 @@ void my_otf_event_label(int num_process, int my_rank, int id, char* c_label, int
 	OTF_KeyValueList_appendUint32(key_list, property_2nd, i_switch);
 
 	if (id == 1) {
-		char c_defp[21];
 		OTF_Writer_writeDefCreator( writer, OTF_STREAM_0, "PMlib created OTF");
 
 		OTF_Writer_writeDefTimerResolution(writer, OTF_STREAM_0, (uint64_t)1.0e6);
 		//	The default timer resolution is 1 micro second (1e6 ticksPerSecond)
 		//	writes "TR" record
 
-		for( int i= 1; i <= num_process; i++ ) {
-			snprintf( c_defp, 20, "Process %u", i );
-			OTF_Writer_writeDefProcess (writer, OTF_STREAM_0, i, c_defp, 0);
+		char c_defp[41];
+		for( int t= 0; t < otf_num_threads; t++ ) {
+		for( int i= 0; i < num_process; i++ ) {
+			if (t == 0) {
+				snprintf( c_defp, 40, "Process %u", i+1 );
+			} else {
+				snprintf( c_defp, 40, "Process %u thread %d", i+1, t );
+			}
+			OTF_Writer_writeDefProcess (writer, OTF_STREAM_0, otf_process_id(i, t), c_defp,
+				(t == 0) ? 0 : otf_process_id(i, 0));
+		}
 		}
 		OTF_Writer_writeDefFunctionGroup
 			( writer, OTF_STREAM_0, u_root_sec, "Root Section");
@@ -201,10 +267,11 @@ void my_otf_event_label(int num_process, int my_rank, int id, char* c_label, int
 // c_group		counter group name 文字列
 // c_counter	測定counter name 文字列
 // c_unit		測定unit name 文字列
+// f_comm		Fortran handle of the communicator. not used
 
 void my_otf_finalize(int num_process, int my_rank, int is_unit,
 			char* otf_filename, char* c_group,
-			char* c_counter, char* c_unit)
+			char* c_counter, char* c_unit, int f_comm)
 {
 	#ifdef DEBUG_PRINT_OTF
 	if (my_rank == 0) {
@@ -246,7 +313,17 @@ void my_otf_finalize(int num_process, int my_rank, int is_unit,
 		}
 	}
 
-	OTF_WStream_close(wstream);
+	if (wstreams != NULL) {
+		for (int t=0; t<otf_num_threads; t++) {
+			if (wstreams[t] == NULL) continue;
+			OTF_WStream_writeEndProcess(wstreams[t], last_sec[t], otf_process_id(my_rank, t));
+			OTF_WStream_close(wstreams[t]);
+		}
+		free(wstreams);
+		free(last_sec);
+		wstreams = NULL;
+		last_sec = NULL;
+	}
 	//	if (my_rank == 0) {
 	OTF_Writer_close(writer);
 	OTF_KeyValueList_close(key_list);
@@ -259,7 +336,8 @@ void my_otf_finalize(int num_process, int my_rank, int is_unit,
 			return;
 		}
 
-		for (int i=1; i <= num_process; i++) {
+		//	the stream id is the same as the process id of the thread
+		for (int i=1; i <= num_process*otf_num_threads; i++) {
 			OTF_MasterControl_append(master, i, i);
 		}
 		OTF_MasterControl_write(master, otf_filename);
@@ -0,0 +1,764 @@
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+///@file   pmlib_merge.cpp
+///@brief  pmlib-merge : offline report generator for the PMLIB_DUMP files
+///
+///	usage : pmlib-merge [-r BASIC|DETAIL|FULL] [-o output] [-n threads] prefix
+///
+///	The dump files prefix.RRRRRR.pmd written by the processes at report()
+///	are read in parallel by the threads, one file at a time, and merged into
+///	the per section summaries with the same reduction rule as the report of
+///	PMlib (pmlib_stats.h). The per rank rows are kept only for DETAIL/FULL.
+///	The missing files are reported and skipped, so that the profile of the
+///	remaining processes is still produced.
+///
+
+#include "mpi_stubs.h"
+#include "pmlib_stats.h"
+#include "pmlib_dump.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace pm_lib;
+
+namespace {
+
+/// merged values of one section
+struct Section {
+	std::string label;
+	int first_id;		// the smallest section ID among the processes (listed order)
+	int type_calc;
+	int exclusive;
+	int in_parallel;
+	int is_unit;
+	int num_sorted;
+	pmlib_section_stats stats;
+	double sorted_sum[Max_dump_events];	// sum of |HWPC value| of the processes
+	double percentage_sum;
+	double power_sum[Max_dump_power];
+	std::vector<bool> seen;				// the processes which have this section
+	std::vector<double> ranks;			// DETAIL : rank, count, time, flop, hwpc...
+	std::vector<double> threads;		// FULL : rank, thread, count, time, flop, hwpc...
+};
+
+/// merged table of the sections read by one thread
+struct Table {
+	std::map<std::string, int> index;
+	std::vector<Section> sec;
+};
+
+/// report options and the common values of the files
+struct Context {
+	std::string prefix;
+	std::string report;		// BASIC, DETAIL, FULL
+	int num_process;
+	int n_files;
+	std::vector<bool> present;
+	pmlib_dump_header h0;	// header of the first file read
+};
+
+
+Section& find_section (Table& tab, const std::string& label, const pmlib_dump_section& s, int num_process)
+{
+	std::map<std::string, int>::iterator it = tab.index.find(label);
+	if (it != tab.index.end()) {
+		Section& w = tab.sec[it->second];
+		if (s.id < w.first_id) w.first_id = s.id;
+		if (s.num_sorted > w.num_sorted) w.num_sorted = s.num_sorted;
+		return w;
+	}
+	tab.index.insert( std::make_pair(label, (int)tab.sec.size()) );
+	tab.sec.push_back(Section());
+	Section& w = tab.sec.back();
+	w.label = label;
+	w.first_id = s.id;
+	w.type_calc = s.type_calc;
+	w.exclusive = s.exclusive;
+	w.in_parallel = s.in_parallel;
+	w.is_unit = s.is_unit;
+	w.num_sorted = s.num_sorted;
+	stats_init(&w.stats);
+	for (int n=0; n<Max_dump_events; n++) w.sorted_sum[n] = 0.0;
+	w.percentage_sum = 0.0;
+	for (int n=0; n<Max_dump_power; n++) w.power_sum[n] = 0.0;
+	w.seen.assign(num_process, false);
+	return w;
+}
+
+
+/// merge the table "in" into "inout"
+///
+void merge_table (Table& inout, Table& in, int num_process)
+{
+	for (size_t k=0; k<in.sec.size(); k++) {
+		Section& b = in.sec[k];
+		pmlib_dump_section s;
+		s.id = b.first_id;
+		s.type_calc = b.type_calc;
+		s.exclusive = b.exclusive;
+		s.in_parallel = b.in_parallel;
+		s.is_unit = b.is_unit;
+		s.num_sorted = b.num_sorted;
+		Section& a = find_section(inout, b.label, s, num_process);
+		stats_merge(&a.stats, &b.stats);
+		for (int n=0; n<Max_dump_events; n++) a.sorted_sum[n] += b.sorted_sum[n];
+		a.percentage_sum += b.percentage_sum;
+		for (int n=0; n<Max_dump_power; n++) a.power_sum[n] += b.power_sum[n];
+		for (int r=0; r<num_process; r++) {
+			if (b.seen[r]) a.seen[r] = true;
+		}
+		a.ranks.insert(a.ranks.end(), b.ranks.begin(), b.ranks.end());
+		a.threads.insert(a.threads.end(), b.threads.begin(), b.threads.end());
+	}
+}
+
+
+/// read one dump file and add its values to the table
+///
+///   @return  0 if OK, -1 if the file does not exist or is not a dump file,
+///            -2 if the file is truncated. The values read so far are added.
+///
+int read_dump (const Context& c, int rank, Table& tab, pmlib_dump_header& h)
+{
+	char filename[512];
+	snprintf(filename, sizeof(filename), "%s.%06d.pmd", c.prefix.c_str(), rank);
+	FILE* fd = fopen(filename, "rb");
+	if (fd == NULL) return -1;
+
+	static const size_t Buffer_size = 1<<20;
+	char* buffer = new char[Buffer_size];
+	setvbuf(fd, buffer, _IOFBF, Buffer_size);
+
+	int iret = 0;
+	bool with_ranks = (c.report == "DETAIL" || c.report == "FULL");
+	bool with_threads = (c.report == "FULL");
+
+	if ( fread(&h, sizeof(h), 1, fd) != 1
+		|| memcmp(h.magic, Dump_magic, sizeof(h.magic)) != 0
+		|| h.version != Dump_version
+		|| h.byte_order != Dump_byte_order
+		|| h.rank != rank
+		|| h.num_sorted > Max_dump_events
+		|| h.num_events > Max_dump_events
+		|| h.num_power > Max_dump_power ) {
+		fprintf(stderr, "*** pmlib-merge error. [%s] is not a valid dump file of rank %d\n", filename, rank);
+		fclose(fd);
+		delete[] buffer;
+		return -1;
+	}
+
+	std::vector<char> label;
+	double v[Max_dump_events];
+	double p[Max_dump_power];
+	long long raw[Max_dump_events];
+
+	for (int i=0; i<h.num_sections && iret == 0; i++) {
+		pmlib_dump_section s;
+		if ( fread(&s, sizeof(s), 1, fd) != 1 || s.label_len < 0 || s.num_sorted < 0 || s.num_sorted > Max_dump_events ) {
+			iret = -2;
+			break;
+		}
+		label.resize(s.label_len + 1);
+		if ( fread(&label[0], 1, s.label_len, fd) != (size_t)s.label_len
+			|| fread(v, sizeof(double), s.num_sorted, fd) != (size_t)s.num_sorted
+			|| fread(p, sizeof(double), h.num_power, fd) != (size_t)h.num_power ) {
+			iret = -2;
+			break;
+		}
+		label[s.label_len] = '\0';
+
+		Section& w = find_section(tab, std::string(&label[0]), s, c.num_process);
+		stats_add(&w.stats, s.time, s.flop, s.count, rank);
+		w.seen[rank] = true;
+		for (int n=0; n<s.num_sorted; n++) w.sorted_sum[n] += fabs(v[n]);
+		w.percentage_sum += s.percentage;
+		for (int n=0; n<h.num_power; n++) w.power_sum[n] += p[n];
+		if (with_ranks) {
+			w.ranks.push_back((double)rank);
+			w.ranks.push_back((double)s.count);
+			w.ranks.push_back(s.time);
+			w.ranks.push_back(s.flop);
+			for (int n=0; n<Max_dump_events; n++) w.ranks.push_back( (n < s.num_sorted) ? v[n] : 0.0 );
+		}
+
+		for (int t=0; t<h.num_threads; t++) {
+			pmlib_dump_thread r;
+			if ( fread(&r, sizeof(r), 1, fd) != 1
+				|| fread(v, sizeof(double), s.num_sorted, fd) != (size_t)s.num_sorted
+				|| fread(raw, sizeof(long long), h.num_events, fd) != (size_t)h.num_events ) {
+				iret = -2;
+				break;
+			}
+			if (with_threads) {
+				w.threads.push_back((double)rank);
+				w.threads.push_back((double)t);
+				w.threads.push_back((double)r.count);
+				w.threads.push_back(r.time);
+				w.threads.push_back(r.flop);
+				for (int n=0; n<Max_dump_events; n++) w.threads.push_back( (n < s.num_sorted) ? v[n] : 0.0 );
+			}
+		}
+	}
+	if (iret == -2) {
+		fprintf(stderr, "*** pmlib-merge error. [%s] is truncated or broken. The values read so far are used.\n", filename);
+	}
+
+	fclose(fd);
+	delete[] buffer;
+	return iret;
+}
+
+
+/// unit conversion. the same rule as PerfWatch::unitFlop()
+///
+double unit_flop (double fops, std::string& unit, int is_unit)
+{
+	const char* s_byte[] = { "MB/sec", "GB/sec", "TB/sec", "PB/sec" };
+	const char* s_flop[] = { "Mflops", "Gflops", "Tflops", "Pflops" };
+	const char* s_inst[] = { "M.ips", "G.ips", "T.ips", "P.ips" };
+	const char** s_unit;
+
+	if ( (is_unit == 4) || (is_unit == 5) || (is_unit == 7) ) {
+		unit = "(%)";
+		return fops;
+	}
+	if ( (is_unit == 0) || (is_unit == 2) ) {
+		s_unit = s_byte;
+	} else if ( (is_unit == 1) || (is_unit == 3) ) {
+		s_unit = s_flop;
+	} else if ( is_unit == 6 ) {
+		s_unit = s_inst;
+	} else {
+		unit = "";
+		return 0.0;
+	}
+	double scale = 1.0e6;
+	int k = 0;
+	while (k < 3 && fops > scale*1000.0) { scale *= 1000.0; k++; }
+	unit = s_unit[k];
+	return fops / scale;
+}
+
+
+/// label with the symbols (*) for inclusive and (+) for parallel region sections
+///
+std::string label_symbol (const Section& w)
+{
+	std::string s = w.label;
+	if (!w.exclusive) { s = w.label + " (*)"; }
+	if (w.in_parallel) { s = w.label + " (+)"; }
+	return s;
+}
+
+
+/// short name of the HWPC event. The prefix before ':' is removed
+///
+std::string short_name (const char* name)
+{
+	std::string s = name;
+	int kp = s.find_last_of(':');
+	if (kp >= 0) s = s.substr(kp+1);
+	return s;
+}
+
+
+bool by_time (const Section* a, const Section* b)
+{
+	return a->stats.time.mean > b->stats.time.mean;
+}
+
+
+void print_basic (FILE* fp, const Context& c, const Section& root, std::vector<const Section*>& order)
+{
+	const pmlib_dump_header& h = c.h0;
+	int np = c.n_files;
+	double tot = root.stats.time.mean;
+
+	int maxLabelLen = (int)label_symbol(root).size();
+	for (size_t j=0; j<order.size(); j++) {
+		int len = (int)label_symbol(*order[j]).size();
+		if (len > maxLabelLen) maxLabelLen = len;
+	}
+	maxLabelLen++;
+
+	time_t now = time(NULL);
+	struct tm* date = localtime(&now);
+	fprintf(fp, "\n# PMlib Basic Report ------------------------------------------------------------- #\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "\tPerformance Statistics Report from PMlib version %s\n", h.pm_version);
+	fprintf(fp, "\tMerged by pmlib-merge from %d dump files %s.*.pmd\n", np, c.prefix.c_str());
+	fprintf(fp, "\tHost name : %s\n", h.hostname);
+	fprintf(fp, "\tDate      : %04d/%02d/%02d : %02d:%02d:%02d\n", date->tm_year+1900, date->tm_mon+1,
+		date->tm_mday, date->tm_hour, date->tm_min, date->tm_sec);
+	fprintf(fp, "\tParallel Mode:   %s ", h.parallel_mode);
+	if (std::string(h.parallel_mode) == "Serial") {
+		fprintf(fp, "\n");
+	} else if (std::string(h.parallel_mode) == "FlatMPI") {
+		fprintf(fp, "(%d processes)\n", np);
+	} else if (std::string(h.parallel_mode) == "OpenMP") {
+		fprintf(fp, "(%d threads)\n", h.num_threads);
+	} else {
+		fprintf(fp, "(%d processes x %d threads)\n", np, h.num_threads);
+	}
+	if (np < c.num_process) {
+		fprintf(fp, "\t*** The dump files of %d processes out of %d are missing. They are excluded.\n",
+			c.num_process - np, c.num_process);
+	}
+	fprintf(fp, "\tHWPC_CHOOSER=%s\n", h.hwpc_chooser);
+	fprintf(fp, "\tActive PMlib elapsed time (from initialize to report/print) = %9.3e [sec]\n", tot);
+	fprintf(fp, "\tBasic process stats as the average of all the processes are reported below.\n");
+	fprintf(fp, "\tSee Legend page if the section name is annotated with special symbols such as (*),(+).\n");
+	fprintf(fp, "\n");
+
+	int is_unit = h.is_unit;
+	const char* s_head1[] = { "| user defined numerical performance", "| user defined numerical performance",
+		"| hardware counted data access ", "| hardware counted floating point ops.",
+		"| hardware counted floating point ops.", "| hardware counted cache utilization",
+		"| hardware counted total instructions", "| memory load and store instruction type" };
+	const char* s_head2[] = { "| operations  std.dv  performance", "| operations  std.dv  performance",
+		"|   Bytes    std.dv  Mem+LLC bandwidth", "|  f.p.ops    std.dv  performance",
+		"|  f.p.ops    std.dv  vectorized%", "| load+store  std.dv  L1+L2 hit%",
+		"| instructions std.dv performance", "| load+store  std.dv  vectorized%" };
+	if (is_unit < 0 || is_unit > 7) is_unit = 1;
+
+	fprintf(fp, "%-*s| number of| measured | weight| time per| std.dv of ", maxLabelLen, "Section");
+	fprintf(fp, "%s\n", s_head1[is_unit]);
+	fprintf(fp, "%-*s|   calls  | time[sec]   [%%]   call[sec]    time    ", maxLabelLen, "Label");
+	fprintf(fp, "%s\n", s_head2[is_unit]);
+	for (int i = 0; i < maxLabelLen; i++) fputc('-', fp);
+	fprintf(fp, "+----------+----------------------------------------+--------------------------------\n");
+
+	double sum_time_comm = 0.0, sum_time_flop = 0.0;
+	double sum_comm = 0.0, sum_flop = 0.0, sum_other = 0.0;
+	std::string unit;
+
+	for (size_t j=0; j<order.size(); j++) {
+		const Section& w = *order[j];
+		long count_sum = lround(w.stats.count_sum);
+		if ( !(count_sum > 0) ) continue;
+		long count_av = lround((double)count_sum / (double)np);
+		double time_av = w.stats.time.mean;
+		double flop_av = w.stats.flop.mean;
+		double tav = (count_av != 0) ? time_av/(double)count_av : (double)np*time_av/(double)count_sum;
+
+		fprintf(fp, "%-*s: %8ld   %9.3e %6.2f  %9.3e  %8.2e",
+			maxLabelLen, label_symbol(w).c_str(), count_av, time_av, 100*time_av/tot, tav,
+			stats_stddev(&w.stats.time));
+
+		double fops = 0.0;
+		if (time_av != 0.0 && count_av != 0) {
+			if ( (w.is_unit == 4) || (w.is_unit == 5) || (w.is_unit == 7) ) {
+				fops = w.percentage_sum / (double)np;
+			} else {
+				fops = flop_av/time_av;
+			}
+		}
+		double uF = unit_flop(fops, unit, w.is_unit);
+		std::string p_label = unit;
+		if (!w.exclusive)  { p_label = p_label + "(*)"; }
+		if (w.in_parallel) { p_label = p_label + "(+)"; }
+		fprintf(fp, "    %8.3e  %8.2e %6.2f %s\n", flop_av, stats_stddev(&w.stats.flop), uF, p_label.c_str());
+
+		if (w.exclusive) {
+			if ( w.is_unit == 0 ) {
+				sum_time_comm += time_av;
+				sum_comm += flop_av;
+			} else {
+				sum_time_flop += time_av;
+				sum_flop += flop_av;
+				if ( (w.is_unit == 4) || (w.is_unit == 5) || (w.is_unit == 7) ) sum_other += flop_av * uF;
+			}
+		}
+	}
+
+	for (int i = 0; i < maxLabelLen; i++) fputc('-', fp);
+	fprintf(fp, "+----------+----------------------------------------+--------------------------------\n");
+	if ( sum_time_comm > 0.0 ) {
+		double u = unit_flop(sum_comm/sum_time_comm, unit, 0);
+		fprintf(fp, "%-*s   %9.3e %6.2f ", maxLabelLen+10, "Sum of exclusive sections", sum_time_comm, 100*sum_time_comm/tot);
+		fprintf(fp, "%22s  %8.3e          %7.2f %s\n", " ", sum_comm, u, unit.c_str());
+		u = unit_flop((double)np*sum_comm/sum_time_comm, unit, 0);
+		fprintf(fp, "%-*s %16s", maxLabelLen+10, "[sum of all processes]", " " );
+		fprintf(fp, "%22s     %8.3e          %7.2f %s\n", "", (double)np*sum_comm, u, unit.c_str());
+	}
+	if ( sum_time_flop > 0.0 ) {
+		int k_unit = (is_unit == 0) ? 1 : is_unit;
+		bool is_ratio = (k_unit == 4) || (k_unit == 5) || (k_unit == 7);
+		double u = is_ratio ? unit_flop(sum_other/sum_flop, unit, k_unit)
+		                    : unit_flop(sum_flop/sum_time_flop, unit, k_unit);
+		fprintf(fp, "%-*s   %9.3e %6.2f ", maxLabelLen+10, "Sum of exclusive sections", sum_time_flop, 100*sum_time_flop/tot);
+		fprintf(fp, "%22s  %8.3e          %7.2f %s\n", " ", sum_flop, u, unit.c_str());
+		if (!is_ratio) u = unit_flop((double)np*sum_flop/sum_time_flop, unit, k_unit);
+		fprintf(fp, "%-*s %16s", maxLabelLen+10, "[sum of all processes]", " " );
+		fprintf(fp, "%22s     %8.3e          %7.2f %s\n", "", (double)np*sum_flop, u, unit.c_str());
+	}
+	for (int i = 0; i < maxLabelLen; i++) fputc('-', fp);
+	fprintf(fp, "+----------+----------------------------------------+--------------------------------\n");
+	fprintf(fp, "%-*s   %9.3e %6.2f \n", maxLabelLen+10, "[active PMlib elapsed time]", tot, 100.0);
+
+	//	distribution of the time across the processes
+	if (np > 1) {
+		fprintf(fp, "\n");
+		fprintf(fp, "%-*s| distribution of the measured time[sec] across %d processes\n", maxLabelLen, "Section", np);
+		fprintf(fp, "%-*s|    min       median      p90        p99        max     max rank\n", maxLabelLen, "Label");
+		for (int i = 0; i < maxLabelLen; i++) fputc('-', fp);
+		fprintf(fp, "+-----------------------------------------------------------------\n");
+		for (size_t j=0; j<order.size(); j++) {
+			const Section& w = *order[j];
+			if ( !(w.stats.count_sum > 0.0) ) continue;
+			fprintf(fp, "%-*s: %9.3e  %9.3e  %9.3e  %9.3e  %9.3e  %7d\n",
+				maxLabelLen, label_symbol(w).c_str(),
+				w.stats.time_min,
+				stats_quantile(&w.stats, 0.50),
+				stats_quantile(&w.stats, 0.90),
+				stats_quantile(&w.stats, 0.99),
+				w.stats.time_max,
+				w.stats.rank_max);
+		}
+		for (int i = 0; i < maxLabelLen; i++) fputc('-', fp);
+		fprintf(fp, "+-----------------------------------------------------------------\n");
+	}
+
+	//	HWPC averaged over the processes
+	if (h.num_sorted > 0 && std::string(h.hwpc_chooser) != "USER") {
+		fprintf(fp, "\n");
+		fprintf(fp, "\n# PMlib hardware performance counter (HWPC) report of the averaged process ------- #\n");
+		fprintf(fp, "\n");
+		fprintf(fp, "\tReport for option HWPC_CHOOSER=%s is generated.\n\n", h.hwpc_chooser);
+		fprintf(fp, "Section"); for (int i=7; i< maxLabelLen; i++) { fputc(' ', fp); } fputc('|', fp);
+		for (int n=0; n<h.num_sorted; n++) {
+			fprintf(fp, " %10.10s", short_name(h.sorted_name[n]).c_str());
+		}
+		fprintf(fp, "\n");
+		for (int i=0; i< maxLabelLen; i++) { fputc('-', fp); }  fputc('+', fp);
+		for (int i=0; i<(h.num_sorted*11); i++) { fputc('-', fp); } fprintf(fp, "\n");
+		for (size_t j=0; j<order.size(); j++) {
+			const Section& w = *order[j];
+			if ( !(w.stats.count_sum > 0.0) ) continue;
+			fprintf(fp, "%-*s:", maxLabelLen, label_symbol(w).c_str());
+			for (int n=0; n<w.num_sorted; n++) {
+				fprintf(fp, "  %9.3e", w.sorted_sum[n] / (double)np);
+			}
+			fprintf(fp, "%s\n", !w.exclusive ? " (*)" : (w.in_parallel ? " (+)" : ""));
+		}
+		for (int i=0; i< maxLabelLen; i++) { fputc('-', fp); }  fputc('+', fp);
+		for (int i=0; i<(h.num_sorted*11); i++) { fputc('-', fp); } fprintf(fp, "\n");
+	}
+
+	//	power consumption averaged over the processes
+	if (h.num_power > 0) {
+		fprintf(fp, "\n# PMlib Power Consumption report of the averaged process [Joule] ---------------- #\n\n");
+		fprintf(fp, "%-*s|", maxLabelLen, "Section");
+		for (int n=0; n<h.num_power; n++) {
+			fprintf(fp, " %10.10s", short_name(h.power_name[n]).c_str());
+		}
+		fprintf(fp, "\n");
+		for (size_t j=0; j<order.size(); j++) {
+			const Section& w = *order[j];
+			if ( !(w.stats.count_sum > 0.0) ) continue;
+			fprintf(fp, "%-*s:", maxLabelLen, label_symbol(w).c_str());
+			for (int n=0; n<h.num_power; n++) {
+				fprintf(fp, "  %9.3e", w.power_sum[n] / (double)np);
+			}
+			fprintf(fp, "\n");
+		}
+	}
+}
+
+
+void print_detail (FILE* fp, const Context& c, const Section& root, std::vector<const Section*>& order)
+{
+	const pmlib_dump_header& h = c.h0;
+	double tot = root.stats.time.mean;
+	const int stride = 4 + Max_dump_events;
+	std::vector<double> row;
+
+	fprintf(fp, "\n## PMlib Process Report --- Elapsed time for individual MPI ranks ------\n\n");
+	for (size_t j=0; j<order.size(); j++) {
+		const Section& w = *order[j];
+		if ( !(w.stats.count_sum > 0.0) ) continue;
+
+		//	the rows in the rank order. The ranks without the section are zero.
+		row.assign((size_t)c.num_process*stride, 0.0);
+		for (size_t k=0; k<w.ranks.size(); k+=stride) {
+			int r = (int)w.ranks[k];
+			std::copy(&w.ranks[k], &w.ranks[k]+stride, &row[(size_t)r*stride]);
+		}
+		double tMax = w.stats.time_max;
+		const char* unit = (w.is_unit == 0) ? "B/sec" : ((w.is_unit == 1) ? "Flops" : "");
+
+		fprintf(fp, "Section : %s%s%s\n", w.label.c_str(), w.exclusive? "":" (*)" , w.in_parallel? " (+)":"" );
+		if (w.is_unit <= 1) {
+			fprintf(fp, "MPI rankID :     call   time[s] time[%%]  t_wait[s]  t[s]/call   counter     speed              \n");
+		} else {
+			fprintf(fp, "MPI rankID :     call   time[s] time[%%]  t_wait[s]  t[s]/call   \n");
+		}
+		for (int r=0; r<c.num_process; r++) {
+			if (!c.present[r]) continue;
+			const double* v = &row[(size_t)r*stride];
+			long count = (long)v[1];
+			double t_per_call = (count == 0) ? 0.0 : v[2]/count;
+			if (w.is_unit <= 1) {
+				double perf_rate = (count == 0) ? 0.0 : v[3]/v[2];
+				fprintf(fp, "Rank %5d : %8ld  %9.3e  %5.1f  %9.3e  %9.3e  %9.3e  %9.3e %s\n",
+					r, count, v[2], 100*v[2]/tot, tMax-v[2], t_per_call, v[3], perf_rate, unit);
+			} else {
+				fprintf(fp, "Rank %5d : %8ld  %9.3e  %5.1f  %9.3e  %9.3e  \n",
+					r, count, v[2], 100*v[2]/tot, tMax-v[2], t_per_call);
+			}
+		}
+	}
+
+	if (h.num_sorted == 0 || std::string(h.hwpc_chooser) == "USER") return;
+
+	fprintf(fp, "\n## PMlib hardware performance counter (HWPC) report for individual MPI ranks ---------\n\n");
+	fprintf(fp, "\tThe HWPC stats report for HWPC_CHOOSER=%s is generated.\n\n", h.hwpc_chooser);
+	for (size_t j=0; j<order.size(); j++) {
+		const Section& w = *order[j];
+		if ( !(w.stats.count_sum > 0.0) || w.num_sorted == 0 ) continue;
+		fprintf(fp, "Section : %s%s%s\n", w.label.c_str(), w.exclusive? "":" (*)" , w.in_parallel? " (+)":"" );
+		fprintf(fp, "MPI rankID :");
+		for (int n=0; n<w.num_sorted; n++) {
+			fprintf(fp, " %10.10s", short_name(h.sorted_name[n]).c_str());
+		}
+		fprintf(fp, "\n");
+		row.assign((size_t)c.num_process*stride, 0.0);
+		for (size_t k=0; k<w.ranks.size(); k+=stride) {
+			int r = (int)w.ranks[k];
+			std::copy(&w.ranks[k], &w.ranks[k]+stride, &row[(size_t)r*stride]);
+		}
+		for (int r=0; r<c.num_process; r++) {
+			if (!c.present[r]) continue;
+			fprintf(fp, "Rank %5d :", r);
+			for (int n=0; n<w.num_sorted; n++) {
+				fprintf(fp, "  %9.3e", fabs(row[(size_t)r*stride + 4 + n]));
+			}
+			fprintf(fp, "\n");
+		}
+	}
+}
+
+
+void print_threads (FILE* fp, const Context& c, std::vector<const Section*>& order)
+{
+	const pmlib_dump_header& h = c.h0;
+	const int stride = 5 + Max_dump_events;
+	int nt = h.num_threads;
+	std::vector<double> row;
+
+	for (int r=0; r<c.num_process; r++) {
+		if (!c.present[r]) continue;
+		if (std::string(h.parallel_mode) == "Serial" || std::string(h.parallel_mode) == "OpenMP") {
+			fprintf(fp, "\n## PMlib Thread Report for the single process run ---------------------\n\n");
+		} else {
+			fprintf(fp, "\n## PMlib Thread Report for MPI rank %d  ----------------------\n\n", r);
+		}
+		for (size_t j=0; j<order.size(); j++) {
+			const Section& w = *order[j];
+			if ( !(w.stats.count_sum > 0.0) ) continue;
+			double time_av = w.stats.time.mean;
+
+			row.assign((size_t)nt*stride, 0.0);
+			for (size_t k=0; k<w.threads.size(); k+=stride) {
+				if ((int)w.threads[k] != r) continue;
+				int t = (int)w.threads[k+1];
+				if (t >= nt) continue;
+				std::copy(&w.threads[k], &w.threads[k]+stride, &row[(size_t)t*stride]);
+			}
+
+			fprintf(fp, "Section : %s%s%s\n", w.label.c_str(), w.exclusive? "":" (*)" , w.in_parallel? " (+)":"" );
+			if (w.is_unit < 2) {
+				fprintf(fp, "Thread  call  time[s]  t/tav[%%]  operations  performance\n");
+			} else {
+				fprintf(fp, "Thread  call  time[s]  t/tav[%%]");
+				for (int n=0; n<w.num_sorted; n++) {
+					fprintf(fp, " %10.10s", short_name(h.sorted_name[n]).c_str());
+				}
+				fprintf(fp, "\n");
+			}
+			for (int t=0; t<nt; t++) {
+				if ( !w.in_parallel && w.is_unit < 2 && t >= 1 ) {
+					if (t == 1) {
+						fprintf(fp, " %3d\t\t user mode worksharing threads are represented by thread 0\n", t);
+					} else {
+						fprintf(fp, " %3d\t\t ditto\n", t);
+					}
+					continue;
+				}
+				const double* v = &row[(size_t)t*stride];
+				long count = (long)v[2];
+				if (w.is_unit < 2) {
+					double perf_rate = (count == 0) ? 0.0 : v[4]/v[3];
+					fprintf(fp, " %3d%8ld  %9.3e  %5.1f   %9.3e  %9.3e %s\n",
+						t, count, v[3], 100*v[3]/time_av, v[4], perf_rate,
+						(w.is_unit == 0) ? "B/sec" : "Flops");
+				} else {
+					fprintf(fp, " %3d%8ld  %9.3e  %5.1f ", t, count, v[3], 100*v[3]/time_av);
+					for (int n=0; n<w.num_sorted; n++) {
+						fprintf(fp, "  %9.3e", fabs(v[5+n]));
+					}
+					fprintf(fp, "\n");
+				}
+			}
+		}
+	}
+}
+
+
+void usage (void)
+{
+	fprintf(stderr, "usage : pmlib-merge [-r BASIC|DETAIL|FULL] [-o output] [-n threads] prefix\n");
+	fprintf(stderr, "\tmerges the dump files prefix.RRRRRR.pmd written with PMLIB_DUMP=prefix\n");
+	fprintf(stderr, "\tand produces the PMlib report. The default report is BASIC to stdout.\n");
+}
+
+} // end of anonymous namespace
+
+
+int main (int argc, char *argv[])
+{
+	Context c;
+	c.report = "BASIC";
+	std::string output = "";
+	int n_threads = 0;
+
+	int k = 1;
+	for ( ; k < argc && argv[k][0] == '-'; k++) {
+		std::string opt = argv[k];
+		if (opt == "-r" && k+1 < argc) {
+			c.report = argv[++k];
+		} else if (opt == "-o" && k+1 < argc) {
+			output = argv[++k];
+		} else if (opt == "-n" && k+1 < argc) {
+			n_threads = atoi(argv[++k]);
+		} else {
+			usage();
+			return 1;
+		}
+	}
+	if (k != argc-1 || (c.report != "BASIC" && c.report != "DETAIL" && c.report != "FULL")) {
+		usage();
+		return 1;
+	}
+	c.prefix = argv[k];
+
+	//	the number of processes and the common values are taken from the file of rank 0
+	char filename[512];
+	snprintf(filename, sizeof(filename), "%s.%06d.pmd", c.prefix.c_str(), 0);
+	FILE* fd = fopen(filename, "rb");
+	if (fd == NULL || fread(&c.h0, sizeof(c.h0), 1, fd) != 1
+		|| memcmp(c.h0.magic, Dump_magic, sizeof(c.h0.magic)) != 0 || c.h0.num_process < 1) {
+		fprintf(stderr, "*** pmlib-merge error. can not read the dump file %s\n", filename);
+		return 1;
+	}
+	fclose(fd);
+	c.num_process = c.h0.num_process;
+	c.present.assign(c.num_process, false);
+
+#ifdef _OPENMP
+	if (n_threads > 0) omp_set_num_threads(n_threads);
+	int n_tables = omp_get_max_threads();
+#else
+	int n_tables = 1;
+	(void) n_threads;
+#endif
+	std::vector<Table> tables(n_tables);
+	std::vector<char> status(c.num_process, 0);
+
+	//	each thread streams the files one by one into its own table
+#ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int r=0; r<c.num_process; r++) {
+#ifdef _OPENMP
+		Table& my_tab = tables[omp_get_thread_num()];
+#else
+		Table& my_tab = tables[0];
+#endif
+		pmlib_dump_header hr;
+		status[r] = (char)read_dump(c, r, my_tab, hr);
+	}
+
+	c.n_files = 0;
+	for (int r=0; r<c.num_process; r++) {
+		if (status[r] == -1) {
+			fprintf(stderr, "*** pmlib-merge warning. the dump file of rank %d is missing. It is excluded.\n", r);
+		} else {
+			c.present[r] = true;
+			c.n_files++;
+		}
+	}
+
+	//	merge the tables of the threads
+	for (int t=1; t<n_tables; t++) {
+		merge_table(tables[0], tables[t], c.num_process);
+	}
+	Table& all = tables[0];
+
+	//	the processes without the section are counted as zero values,
+	//	as reconcile_sections() does in the report of PMlib
+	int i_root = -1;
+	std::vector<const Section*> order;
+	for (size_t i=0; i<all.sec.size(); i++) {
+		Section& w = all.sec[i];
+		for (int r=0; r<c.num_process; r++) {
+			if (c.present[r] && !w.seen[r]) stats_add(&w.stats, 0.0, 0.0, 0, r);
+		}
+		if (w.first_id == 0) {
+			i_root = (int)i;
+		} else {
+			order.push_back(&w);
+		}
+	}
+	if (i_root < 0) {
+		fprintf(stderr, "*** pmlib-merge error. the Root section is not found.\n");
+		return 1;
+	}
+	std::stable_sort(order.begin(), order.end(), by_time);
+
+	FILE* fp = stdout;
+	if (output != "") {
+		fp = fopen(output.c_str(), "w");
+		if (fp == NULL) {
+			fprintf(stderr, "*** pmlib-merge error. can not open the output file %s\n", output.c_str());
+			return 1;
+		}
+	}
+
+	print_basic(fp, c, all.sec[i_root], order);
+	if (c.report == "DETAIL" || c.report == "FULL") {
+		print_detail(fp, c, all.sec[i_root], order);
+	}
+	if (c.report == "FULL") {
+		print_threads(fp, c, order);
+	}
+
+	if (fp != stdout) fclose(fp);
+	return 0;
+}
@@ -0,0 +1,249 @@
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+///@file   pmlib_top.cpp
+///@brief  pmlib-top : live viewer of the PMLIB_SHM segments on the node
+///
+///	usage : pmlib-top [-n rows] [-d delay] [-i iterations]
+///
+///	The segments /dev/shm/pmlib.* written by the running PMlib processes
+///	are read at each refresh. The rates are computed from the difference
+///	of the values between two refreshes, divided by the wall clock time
+///	of the viewer. The sections with the same label are summed over the
+///	processes on the node, and sorted by their busy ratio, i.e. the sum of
+///	the measured time divided by the refresh interval.
+///	The segments of the terminated processes are skipped.
+///
+
+#include "pmlib_shm.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+using namespace pm_lib;
+
+/// 区間レコードのコピーと直前の値
+struct top_entry {
+	struct pmlib_shm_section now;
+	struct pmlib_shm_section prev;
+	bool has_prev;
+};
+
+/// ラベル毎の集計値
+struct top_row {
+	std::string label;
+	int ranks;
+	double calls;	// calls per second
+	double busy;	// sum of time per second
+	double last;	// maximum time of the last call
+	double rate;	// first event per second
+};
+
+static double wall_time (void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return (double)tv.tv_sec + (double)tv.tv_usec * 1.0e-6;
+}
+
+static bool compare_busy (const top_row& a, const top_row& b)
+{
+	return a.busy > b.busy;
+}
+
+static void usage (void)
+{
+	fprintf(stderr, "usage : pmlib-top [-n rows] [-d delay] [-i iterations]\n");
+	fprintf(stderr, "    -n rows       : number of the listed sections (default 20)\n");
+	fprintf(stderr, "    -d delay      : refresh interval in seconds (default 1.0)\n");
+	fprintf(stderr, "    -i iterations : number of refreshes. 0 runs until interrupted (default 0)\n");
+}
+
+
+/// 1つのセグメントを読み出し、区間レコードを entries に記録する
+///
+///   @param[in] path     セグメントのファイル名
+///   @param[out] hdr     ヘッダのコピー
+///   @param[in,out] entries  key=(path,id) の区間レコード
+///
+///   @return  読み出せた場合true
+///
+static bool read_segment (const std::string& path, struct pmlib_shm_header& hdr,
+	std::map<std::string, top_entry>& entries)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct pmlib_shm_header)) {
+		close(fd);
+		return false;
+	}
+	size_t bytes = (size_t)st.st_size;
+	void* p = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return false;
+
+	const struct pmlib_shm_header* h = (const struct pmlib_shm_header*)p;
+	bool is_valid = (memcmp(h->magic, Shm_magic, sizeof(h->magic)) == 0)
+		&& (h->version == Shm_version)
+		&& (bytes >= sizeof(struct pmlib_shm_header) + sizeof(struct pmlib_shm_section) * h->max_sections);
+	if (is_valid && kill(h->pid, 0) != 0 && errno == ESRCH) is_valid = false;
+
+	if (is_valid) {
+		memcpy(&hdr, h, sizeof(hdr));
+		const struct pmlib_shm_section* rec = (const struct pmlib_shm_section*)(h + 1);
+		int n = __atomic_load_n(&h->num_sections, __ATOMIC_ACQUIRE);
+		if (n > h->max_sections) n = h->max_sections;
+		for (int i=0; i<n; i++) {
+			char key[300];
+			snprintf(key, sizeof(key), "%s:%d", path.c_str(), i);
+			top_entry& e = entries[key];
+			struct pmlib_shm_section copy;
+			if (!shm_read(&rec[i], &copy)) continue;
+			copy.label[Max_shm_label-1] = '\0';
+			e.now = copy;
+		}
+	}
+	munmap(p, bytes);
+	return is_valid;
+}
+
+
+int main (int argc, char *argv[])
+{
+	int n_rows = 20;
+	double delay = 1.0;
+	int n_iterations = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:d:i:h")) != -1) {
+		switch (c) {
+		case 'n': n_rows = atoi(optarg); break;
+		case 'd': delay = atof(optarg); break;
+		case 'i': n_iterations = atoi(optarg); break;
+		default: usage(); return 1;
+		}
+	}
+	if (n_rows <= 0 || delay <= 0.0 || n_iterations < 0) {
+		usage();
+		return 1;
+	}
+	bool is_tty = isatty(fileno(stdout));
+
+	std::map<std::string, top_entry> entries;
+	double t_prev = wall_time();
+
+	for (int iter=0; n_iterations==0 || iter<=n_iterations; iter++) {
+		// scan the segments
+		std::vector<std::string> paths;
+		DIR* dir = opendir("/dev/shm");
+		if (dir == NULL) {
+			fprintf(stderr, "pmlib-top: can not open /dev/shm\n");
+			return 1;
+		}
+		struct dirent* d;
+		while ((d = readdir(dir)) != NULL) {
+			if (strncmp(d->d_name, "pmlib.", 6) == 0) paths.push_back(std::string("/dev/shm/") + d->d_name);
+		}
+		closedir(dir);
+		std::sort(paths.begin(), paths.end());
+
+		double t_now = wall_time();
+		double dwall = t_now - t_prev;
+		t_prev = t_now;
+
+		std::map<std::string, top_entry> current;
+		std::string event_name;
+		int n_segments = 0;
+		for (size_t i=0; i<paths.size(); i++) {
+			struct pmlib_shm_header hdr;
+			std::map<std::string, top_entry> seg;
+			if (!read_segment(paths[i], hdr, seg)) continue;
+			n_segments++;
+			if (event_name.empty() && hdr.num_events > 0) {
+				hdr.event_name[0][Max_shm_name-1] = '\0';
+				event_name = hdr.event_name[0];
+			}
+			for (std::map<std::string, top_entry>::iterator it=seg.begin(); it!=seg.end(); ++it) {
+				top_entry e = it->second;
+				std::map<std::string, top_entry>::iterator old = entries.find(it->first);
+				e.has_prev = (old != entries.end());
+				if (e.has_prev) e.prev = old->second.now;
+				current[it->first] = e;
+			}
+		}
+		entries.swap(current);
+
+		// the first scan only records the values
+		if (iter == 0) {
+			usleep((useconds_t)(delay * 1.0e6));
+			continue;
+		}
+
+		// sum up the sections with the same label
+		std::map<std::string, top_row> rows;
+		for (std::map<std::string, top_entry>::iterator it=entries.begin(); it!=entries.end(); ++it) {
+			const top_entry& e = it->second;
+			top_row& r = rows[e.now.label];
+			if (r.label.empty()) {
+				r.label = e.now.label;
+				r.ranks = 0;
+				r.calls = r.busy = r.last = r.rate = 0.0;
+			}
+			r.ranks++;
+			if (e.has_prev && dwall > 0.0) {
+				r.calls += (double)(e.now.count - e.prev.count) / dwall;
+				r.busy += (e.now.time - e.prev.time) / dwall;
+				r.rate += (e.now.events[0] - e.prev.events[0]) / dwall;
+			}
+			r.last = std::max(r.last, e.now.last);
+		}
+		std::vector<top_row> sorted;
+		for (std::map<std::string, top_row>::iterator it=rows.begin(); it!=rows.end(); ++it) {
+			sorted.push_back(it->second);
+		}
+		std::stable_sort(sorted.begin(), sorted.end(), compare_busy);
+
+		if (is_tty) printf("\033[H\033[2J");
+		printf("pmlib-top  segments=%d  sections=%d  interval=%.2f [sec]\n\n",
+			n_segments, (int)sorted.size(), dwall);
+		printf("%-32s %6s %12s %8s %12s %14s\n", "Label", "ranks", "calls/s", "busy", "last[s]",
+			event_name.empty() ? "-" : (event_name + "/s").c_str());
+		for (size_t i=0; i<sorted.size() && (int)i<n_rows; i++) {
+			const top_row& r = sorted[i];
+			printf("%-32.32s %6d %12.3e %8.3f %12.3e %14.3e\n",
+				r.label.c_str(), r.ranks, r.calls, r.busy, r.last, r.rate);
+		}
+		fflush(stdout);
+
+		if (n_iterations == 0 || iter < n_iterations) usleep((useconds_t)(delay * 1.0e6));
+	}
+	return 0;
+}
@@ -0,0 +1,296 @@
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+///@file   pmlib_trace2json.cpp
+///@brief  pmlib-trace2json : converter of the PMLIB_TRACE files to the Chrome trace JSON
+///
+///	usage : pmlib-trace2json [-o output] file.pmt [file.pmt ...]
+///
+///	The binary trace files prefix.RRRRRR.pmt written by the processes are
+///	converted to one JSON file of the Chrome trace event format, which is
+///	shown by chrome://tracing and by the Perfetto UI (ui.perfetto.dev).
+///	The rank is shown as the process and the thread as the thread of the
+///	timeline. The sections are the duration events, and the counter samples
+///	are the counter tracks. The time stamps are converted to the clock of
+///	rank 0 with the last clock record of each file, and are relative to the
+///	earliest event of all the files. A truncated file, e.g. of a killed process,
+///	is converted up to its last complete chunk.
+///
+
+#include "pmlib_trace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <unistd.h>
+
+using namespace pm_lib;
+
+/// 読み込んだトレースファイル
+struct trace_file {
+	std::string name;
+	int rank;
+	std::vector<unsigned char> data;
+};
+
+/// 復号したイベント
+struct trace_event {
+	int rank;
+	int thread;
+	int kind;
+	int id;
+	double time;
+	double value;
+	std::string label;
+};
+
+static void usage (void)
+{
+	fprintf(stderr, "usage : pmlib-trace2json [-o output] file.pmt [file.pmt ...]\n");
+	fprintf(stderr, "    -o output : output JSON file (default stdout)\n");
+}
+
+/// JSON文字列のエスケープ
+static std::string json_escape (const std::string& s)
+{
+	std::string r;
+	for (size_t i=0; i<s.size(); i++) {
+		unsigned char c = (unsigned char)s[i];
+		if (c == '"' || c == '\\') {
+			r += '\\';
+			r += (char)c;
+		} else if (c < 0x20) {
+			char u[8];
+			snprintf(u, sizeof(u), "\\u%04x", c);
+			r += u;
+		} else {
+			r += (char)c;
+		}
+	}
+	return r;
+}
+
+static bool read_file (const char* path, trace_file& f)
+{
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "pmlib-trace2json: can not open %s\n", path);
+		return false;
+	}
+	f.name = path;
+	f.data.clear();
+	unsigned char buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) f.data.insert(f.data.end(), buf, buf+n);
+	fclose(fp);
+
+	struct pmlib_trace_file_header h;
+	if (f.data.size() < sizeof(h)) {
+		fprintf(stderr, "pmlib-trace2json: %s is too short\n", path);
+		return false;
+	}
+	memcpy(&h, &f.data[0], sizeof(h));
+	// version 1 has no clock record
+	if (memcmp(h.magic, Trace_magic, sizeof(h.magic)) != 0 || h.version < 1 || h.version > Trace_version) {
+		fprintf(stderr, "pmlib-trace2json: %s is not a PMlib trace file of version 1 to %d\n", path, Trace_version);
+		return false;
+	}
+	f.rank = h.rank;
+	return true;
+}
+
+/// チャンクを順に取り出す
+///
+///   @return  次のチャンクのヘッダを c に、その位置を offset に設定した場合true
+///
+static bool next_chunk (const trace_file& f, size_t& offset, struct pmlib_trace_chunk_header& c)
+{
+	if (offset + sizeof(c) > f.data.size()) return false;
+	memcpy(&c, &f.data[offset], sizeof(c));
+	if (c.magic != Trace_chunk_magic || offset + sizeof(c) + c.bytes > f.data.size()) {
+		fprintf(stderr, "pmlib-trace2json: %s is truncated at offset %ld\n", f.name.c_str(), (long)offset);
+		return false;
+	}
+	return true;
+}
+
+
+/// ファイルの全チャンクを復号して events に追加する
+///
+static void decode_file (const trace_file& f, std::vector<trace_event>& events)
+{
+	size_t offset = sizeof(struct pmlib_trace_file_header);
+	size_t first = events.size();
+	double clock[3] = {0.0, 0.0, 0.0};	// offset, drift, t0
+	struct pmlib_trace_chunk_header ch;
+	while (next_chunk(f, offset, ch)) {
+		const unsigned char* p = &f.data[offset + sizeof(ch)];
+		const unsigned char* end = p + ch.bytes;
+		offset += sizeof(ch) + ch.bytes;
+
+		if (ch.thread == Trace_clock_thread) {
+			if (ch.bytes >= 1 + sizeof(clock) && *p == Trace_clock) memcpy(clock, p+1, sizeof(clock));
+			continue;
+		}
+
+		trace_event e;
+		e.rank = f.rank;
+		e.thread = ch.thread;
+		e.time = ch.base_time;
+		e.value = 0.0;
+		while (p < end) {
+			unsigned long long v, id;
+			e.kind = *p++;
+			e.label.clear();
+			if (e.kind == Trace_label) {
+				unsigned long long len;
+				p = trace_get_varint(p, end, id);
+				if (p != NULL) p = trace_get_varint(p, end, len);
+				if (p == NULL || p + len > end) break;
+				e.id = (int)id;
+				e.label = std::string((const char*)p, (size_t)len);
+				p += len;
+				events.push_back(e);
+				continue;
+			}
+			if (e.kind != Trace_enter && e.kind != Trace_leave && e.kind != Trace_counter) {
+				fprintf(stderr, "pmlib-trace2json: %s has an unknown event kind %d\n", f.name.c_str(), e.kind);
+				break;
+			}
+			p = trace_get_varint(p, end, v);
+			if (p != NULL) p = trace_get_varint(p, end, id);
+			if (p == NULL) break;
+			e.id = (int)id;
+			e.time += (double)v * 1.0e-9;
+			if (e.kind == Trace_counter) {
+				if (p + sizeof(double) > end) break;
+				memcpy(&e.value, p, sizeof(double));
+				p += sizeof(double);
+			}
+			events.push_back(e);
+		}
+	}
+
+	// every event of the file is converted with the same coefficients
+	for (size_t k=first; k<events.size(); k++) {
+		double t = events[k].time;
+		events[k].time = t + clock[0] + clock[1] * (t - clock[2]);
+	}
+}
+
+
+int main (int argc, char *argv[])
+{
+	const char* output = NULL;
+	int c;
+	while ((c = getopt(argc, argv, "o:h")) != -1) {
+		switch (c) {
+		case 'o': output = optarg; break;
+		default: usage(); return 1;
+		}
+	}
+	if (optind >= argc) {
+		usage();
+		return 1;
+	}
+
+	std::vector<trace_file> files;
+	for (int i=optind; i<argc; i++) {
+		trace_file f;
+		if (read_file(argv[i], f)) files.push_back(f);
+	}
+	if (files.empty()) return 1;
+
+	// decode all the events, to find the origin of the time stamps
+	std::vector<trace_event> events;
+	for (size_t i=0; i<files.size(); i++) decode_file(files[i], events);
+
+	double t_origin = 0.0;
+	bool has_origin = false;
+	for (size_t k=0; k<events.size(); k++) {
+		if (events[k].kind == Trace_label || events[k].time <= 0.0) continue;
+		if (!has_origin || events[k].time < t_origin) t_origin = events[k].time;
+		has_origin = true;
+	}
+
+	FILE* fp = stdout;
+	if (output != NULL) {
+		fp = fopen(output, "w");
+		if (fp == NULL) {
+			fprintf(stderr, "pmlib-trace2json: can not open %s\n", output);
+			return 1;
+		}
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	for (size_t i=0; i<files.size(); i++) {
+		fprintf(fp, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"rank %d\"}}",
+			(i == 0) ? "" : ",\n", files[i].rank, files[i].rank);
+	}
+
+	std::map<std::pair<int,int>, std::map<int, std::string> > labels;	// (rank, thread) -> id -> label
+	long n_events = 0;
+	long n_clamped = 0;
+	for (size_t k=0; k<events.size(); k++) {
+		const trace_event& e = events[k];
+		std::pair<int,int> key(e.rank, e.thread);
+		if (labels.find(key) == labels.end()) {
+			fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+				e.rank, e.thread, e.thread);
+		}
+		std::map<int, std::string>& table = labels[key];
+		if (e.kind == Trace_label) {
+			table[e.id] = json_escape(e.label);
+			continue;
+		}
+
+		std::string label;
+		std::map<int, std::string>::iterator it = table.find(e.id);
+		if (it != table.end()) {
+			label = it->second;
+		} else {
+			char s[32];
+			snprintf(s, sizeof(s), "section %d", e.id);
+			label = s;
+		}
+		// a time stamp taken before the clock of the process was ready is put at the origin
+		double ts = (e.time - t_origin) * 1.0e6;
+		if (ts < 0.0) {
+			ts = 0.0;
+			n_clamped++;
+		}
+
+		if (e.kind == Trace_enter || e.kind == Trace_leave) {
+			fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"pmlib\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+				label.c_str(), (e.kind == Trace_enter) ? "B" : "E", ts, e.rank, e.thread);
+		} else {
+			fprintf(fp, ",\n{\"name\":\"%s [ops/s]\",\"cat\":\"pmlib\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"value\":%.6e}}",
+				label.c_str(), ts, e.rank, e.thread, e.value);
+		}
+		n_events++;
+	}
+	fprintf(fp, "\n]}\n");
+	if (fp != stdout) fclose(fp);
+	fprintf(stderr, "pmlib-trace2json: %ld events of %d files\n", n_events, (int)files.size());
+	if (n_clamped > 0) {
+		fprintf(stderr, "pmlib-trace2json: %ld events before the origin are put at the origin\n", n_clamped);
+	}
+	return 0;
+}